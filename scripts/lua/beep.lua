@@ -2,31 +2,15 @@
 -- 
 -- This module provides system beep functionality with support for:
 -- - Console thread beeping (simple MessageBeep)
--- - Main process thread beeping (via CreateRemoteThread)
+-- - Main thread beeping (via the native main thread dispatcher)
 -- - Basic thread information display
 
 local ffi = require('ffi')
 
--- Windows API definitions for beep functionality
-ffi.cdef[[
-    // Sound functions
-    int MessageBeep(unsigned int uType);
-    
-    // Process and thread management
-    void* GetCurrentProcess();
-    unsigned long GetCurrentProcessId();
-    void* GetCurrentThread();
-    unsigned long GetCurrentThreadId();
-    void* CreateRemoteThread(void* hProcess, void* lpThreadAttributes, unsigned long dwStackSize,
-                           void* lpStartAddress, void* lpParameter, unsigned long dwCreationFlags,
-                           unsigned long* lpThreadId);
-    unsigned long WaitForSingleObject(void* hHandle, unsigned long dwMilliseconds);
-    int CloseHandle(void* hObject);
-]]
-
--- Load Windows DLLs
-local user32 = ffi.load('user32')
-local kernel32 = ffi.load('kernel32')
+-- Shared Windows bindings
+local win32 = require('lua/win32')
+local user32 = win32.user32
+local kernel32 = win32.kernel32
 
 --============================================================================
 -- CONSTANTS
@@ -41,8 +25,8 @@ local BEEP_TYPES = {
     INFORMATION = 0x00000040   -- Information sound
 }
 
--- Timeout for remote thread operations (milliseconds)
-local REMOTE_THREAD_TIMEOUT = 1000
+-- Timeout for main thread operations (milliseconds)
+local MAIN_THREAD_TIMEOUT = 1000
 
 --============================================================================
 -- BEEP FUNCTIONS
@@ -54,43 +38,31 @@ local function beep_console(beepType)
     return user32.MessageBeep(beepType)
 end
 
--- Advanced: Execute MessageBeep in the main game process/thread
+-- Advanced: Execute MessageBeep on the game's main thread
 local function beep_main_process(beepType)
     beepType = beepType or BEEP_TYPES.OK
     
-    -- Get current process handle (the game process)
-    local hProcess = kernel32.GetCurrentProcess()
-    local processId = kernel32.GetCurrentProcessId()
     local currentThreadId = kernel32.GetCurrentThreadId()
-    
     print(string.format("Console thread ID: %d", currentThreadId))
-    print(string.format("Process ID: %d", processId))
     
     -- Get address of MessageBeep function
-    local messageBeepAddr = ffi.cast("void*", user32.MessageBeep)
+    local messageBeepAddr = tonumber(ffi.cast("uintptr_t", ffi.cast("void*", user32.MessageBeep)))
+    print(string.format("MessageBeep address: 0x%08X", messageBeepAddr))
     
-    print(string.format("MessageBeep address: 0x%08X", tonumber(ffi.cast("uintptr_t", messageBeepAddr))))
+    if not dispatch.attached() then
+        print("Main thread dispatcher is not attached")
+        return false
+    end
     
-    -- Create a simple thread that calls MessageBeep
-    -- This will run in the main process but in a separate thread
-    local hThread = kernel32.CreateRemoteThread(
-        hProcess,           -- Target process (same process)
-        nil,               -- Default security
-        0,                 -- Default stack size
-        messageBeepAddr,   -- Start address (MessageBeep function)
-        ffi.cast("void*", beepType), -- Parameter (beep type)
-        0,                 -- Run immediately
-        nil                -- Don't need thread ID
-    )
+    -- Queue the call; it runs on the next pass of the game's message pump
+    local future = dispatch.call(messageBeepAddr, "stdcall", "u", "i", beepType)
+    local completed, result = future:wait(MAIN_THREAD_TIMEOUT)
     
-    if hThread ~= nil then
-        print("Successfully created thread in main process")
-        -- Wait for the thread to complete (max 1 second)
-        kernel32.WaitForSingleObject(hThread, 1000)
-        kernel32.CloseHandle(hThread)
-        return true
+    if completed then
+        print(string.format("MessageBeep ran on main thread %d", dispatch.stats().main_thread_id))
+        return result ~= 0
     else
-        print("Failed to create thread in main process")
+        print("Timed out waiting for the main thread")
         return false
     end
 end
@@ -0,0 +1,365 @@
+-- Europa 1400 - Microbenchmark Harness
+--
+-- This module times small pieces of Lua and native code:
+-- - bench.run(name, fn, opts): warmup, automatic iteration count, ns/op
+--   with spread across samples, optionally bytes/s
+-- - bench.suite(): the standard set (game.call overhead, memory reads,
+--   scanner and logger throughput) for comparing DLL builds
+-- - bench.save / bench.compare: keep a baseline and flag regressions
+--
+-- Runs pin the console thread to one core at raised priority, so results
+-- are comparable between runs on the same machine. Timing uses
+-- latency.now() (QueryPerformanceCounter).
+
+local ffi = require('ffi')
+
+local win32 = require('lua/win32')
+local kernel32 = win32.kernel32
+
+--============================================================================
+-- CONSTANTS
+--============================================================================
+
+local THREAD_PRIORITY_HIGHEST = 2
+
+local DEFAULT_SAMPLES = 10      -- Timed batches per benchmark
+local DEFAULT_SAMPLE_MS = 20    -- Target length of one batch
+local DEFAULT_WARMUP_MS = 100   -- Warmup when no iteration count is given
+local MAX_ITERATIONS = 2^30
+local DEFAULT_BASELINE = "lua/bench_baseline.lua"
+local DEFAULT_THRESHOLD = 10    -- Percent slower that counts as a regression
+
+-- Registered for the game.call benchmarks, removed again afterwards
+local BENCH_FUNCTION = "__bench_GetTickCount"
+
+--============================================================================
+-- THREAD PINNING
+--============================================================================
+
+-- Pin the calling thread to the highest core it may run on (core 0 takes
+-- most interrupts) and raise its priority; returns what unpin restores
+local function pin(core)
+    local thread = kernel32.GetCurrentThread()
+    local process_mask = ffi.new("uintptr_t[1]")
+    local system_mask = ffi.new("uintptr_t[1]")
+
+    local mask = 0
+    if kernel32.GetProcessAffinityMask(kernel32.GetCurrentProcess(), process_mask, system_mask) ~= 0 then
+        local allowed = tonumber(process_mask[0])
+        if core then
+            mask = 2^core
+        else
+            mask = 1
+            while mask * 2 <= allowed do
+                mask = mask * 2
+            end
+        end
+    end
+
+    local saved = {
+        affinity = mask > 0 and kernel32.SetThreadAffinityMask(thread, mask) or 0,
+        priority = kernel32.GetThreadPriority(thread),
+        core = mask > 0 and math.floor(math.log(mask) / math.log(2) + 0.5) or nil
+    }
+    kernel32.SetThreadPriority(thread, THREAD_PRIORITY_HIGHEST)
+    return saved
+end
+
+local function unpin(saved)
+    local thread = kernel32.GetCurrentThread()
+    if saved.affinity ~= 0 then
+        kernel32.SetThreadAffinityMask(thread, saved.affinity)
+    end
+    kernel32.SetThreadPriority(thread, saved.priority)
+end
+
+--============================================================================
+-- MEASUREMENT
+--============================================================================
+
+-- Milliseconds for n operations. Batched functions loop themselves and get
+-- the count; others are called once per operation with the index.
+local function time_batch(fn, n, batched)
+    local start = latency.now()
+    if batched then
+        fn(n)
+    else
+        for i = 1, n do
+            fn(i)
+        end
+    end
+    return latency.now() - start
+end
+
+-- Smallest n whose batch takes about sample_ms
+local function calibrate(fn, batched, sample_ms)
+    local n = 1
+    local elapsed = time_batch(fn, n, batched)
+    while elapsed < sample_ms / 8 and n < MAX_ITERATIONS do
+        n = n * 8
+        elapsed = time_batch(fn, n, batched)
+    end
+    if elapsed > 0 then
+        n = math.ceil(n * sample_ms / elapsed)
+    end
+    return math.max(1, math.min(n, MAX_ITERATIONS))
+end
+
+local function summarize(values)
+    local sorted = {}
+    local sum = 0
+    for i, v in ipairs(values) do
+        sorted[i] = v
+        sum = sum + v
+    end
+    table.sort(sorted)
+
+    local count = #sorted
+    local mean = sum / count
+    local squares = 0
+    for _, v in ipairs(sorted) do
+        squares = squares + (v - mean)^2
+    end
+    local stddev = count > 1 and math.sqrt(squares / (count - 1)) or 0
+    local median = count % 2 == 1 and sorted[(count + 1) / 2] or (sorted[count / 2] + sorted[count / 2 + 1]) / 2
+
+    return {
+        mean_ns = mean,
+        median_ns = median,
+        min_ns = sorted[1],
+        max_ns = sorted[count],
+        stddev_ns = stddev,
+        cv_pct = mean > 0 and stddev / mean * 100 or 0
+    }
+end
+
+local function report(result)
+    local line = string.format("  %-28s %12.1f ns/op  +-%5.1f%%  (min %.1f, %d x %d", result.name,
+                               result.median_ns, result.cv_pct, result.min_ns, result.samples, result.iters)
+    if result.gb_per_s then
+        line = line .. string.format(", %.2f GB/s", result.gb_per_s)
+    end
+    print(line .. ")")
+end
+
+-- Benchmark fn and print one line with its median ns/op
+-- @param name: Label for the result
+-- @param fn: Called with the iteration index, or with the count if opts.batch
+-- @param opts: Optional {iters = n per sample, warmup = n, samples = n,
+--              sample_ms = ms, batch = bool, bytes = per op, core = n, quiet = bool}
+-- @return {name, iters, samples, mean_ns, median_ns, min_ns, max_ns,
+--          stddev_ns, cv_pct, ops_per_s, gb_per_s}
+local function run(name, fn, opts)
+    opts = opts or {}
+    local samples = opts.samples or DEFAULT_SAMPLES
+    local sample_ms = opts.sample_ms or DEFAULT_SAMPLE_MS
+
+    local pinned = pin(opts.core)
+    local ok, result = pcall(function()
+        -- Warmup also lets LuaJIT compile the loop before it is timed
+        if opts.warmup then
+            time_batch(fn, opts.warmup, opts.batch)
+        else
+            local deadline = latency.now() + DEFAULT_WARMUP_MS
+            repeat
+                time_batch(fn, opts.iters or 64, opts.batch)
+            until latency.now() >= deadline
+        end
+
+        local iters = opts.iters or calibrate(fn, opts.batch, sample_ms)
+        local per_op = {}
+        for i = 1, samples do
+            per_op[i] = time_batch(fn, iters, opts.batch) * 1e6 / iters
+        end
+
+        local result = summarize(per_op)
+        result.name = name
+        result.iters = iters
+        result.samples = samples
+        result.core = pinned.core
+        result.ops_per_s = result.median_ns > 0 and 1e9 / result.median_ns or 0
+        if opts.bytes then
+            result.gb_per_s = result.median_ns > 0 and opts.bytes / result.median_ns or 0
+        end
+        return result
+    end)
+    unpin(pinned)
+
+    if not ok then
+        error(string.format("bench '%s' failed: %s", name, tostring(result)), 2)
+    end
+    if not opts.quiet then
+        report(result)
+    end
+    return result
+end
+
+--============================================================================
+-- STANDARD SUITE
+--============================================================================
+
+local function address_of(cdata)
+    return tonumber(ffi.cast("uintptr_t", cdata))
+end
+
+-- Benchmarks as {name, fn, opts}, built fresh for each suite run
+local function standard_benchmarks(with_calls)
+    local list = {}
+    local function add(name, fn, opts)
+        table.insert(list, {name = name, fn = fn, opts = opts})
+    end
+
+    -- Loop overhead, to read the others against
+    add("lua.empty", function() end)
+
+    -- Calling a trivial native function: bound FFI pointer, game.call
+    -- without and with latency stats, and through the main thread
+    if with_calls then
+        local direct = game.bind(BENCH_FUNCTION)
+        add("game.bind", function() direct() end)
+        add("game.call", function() game.call(BENCH_FUNCTION) end, {settings = {collect_stats = false}})
+        add("game.call (stats)", function() game.call(BENCH_FUNCTION) end, {settings = {collect_stats = true}})
+        if dispatch.attached() then
+            add("game.call_main", function() game.call_main(BENCH_FUNCTION) end,
+                {settings = {collect_stats = false}, sample_ms = 100, samples = 5})
+        end
+    end
+
+    -- Reading memory: checked copy versus a typed view
+    local buffer = ffi.new("int32_t[1024]")
+    local address = address_of(buffer)
+    local sum = 0
+    add("game.read_mem int32", function(i) sum = sum + game.read_mem(address, 4, "int32_t")[0] end)
+    add("mem.view create+read", function(i) sum = sum + game.view(address, "int32_t")[0] end)
+    local view = game.view(address, "int32_t", 1024)
+    add("mem.view read", function(i) sum = sum + view[i % 1024] end)
+
+    -- Scanner throughput over the game executable with a pattern that
+    -- does not occur, so every byte is examined
+    local exe = mem.module_of(address_of(kernel32.GetModuleHandleA(nil)))
+    if exe then
+        local pattern = "DE AD ?? EF 13 37 C0 DE"
+        local _, info = mem.scan(pattern, {module = exe.name})
+        add("mem.scan " .. exe.name, function() mem.scan(pattern, {module = exe.name}) end,
+            {bytes = info.bytes, sample_ms = 100, samples = 5})
+    end
+
+    -- Logger throughput: binary ring records, and hook_log.txt lines
+    -- through the staging rings (these do land in the log)
+    local ring = ringlog.new(4096)
+    add("ringlog push", function(i) ring:push(ringlog.CALL, 1, 0x401000, 0, ringlog.OK, 0.1, i) end)
+    add("hooklog.write", function() hooklog.write("bench: hook log throughput line") end,
+        {iters = 2000, warmup = 2000, samples = 5})
+
+    return list
+end
+
+-- Run the standard benchmarks
+-- @param filter: Optional Lua pattern; only names matching it run
+-- @return {[name] = result}
+local function suite(filter)
+    local saved = game.debug_config(nil, true)
+    local tick = win32.proc("kernel32.dll", "GetTickCount")
+    if tick then
+        game.register(BENCH_FUNCTION, tick, "unsigned int __stdcall()", "bench.suite call target")
+    end
+    game.debug_config({enabled = false}, true)
+
+    print("Benchmark suite:")
+    local results = {}
+    local ok, err = pcall(function()
+        for _, entry in ipairs(standard_benchmarks(tick ~= nil)) do
+            if not filter or entry.name:find(filter) then
+                local opts = entry.opts or {}
+                if opts.settings then
+                    game.debug_config(opts.settings, true)
+                end
+                results[entry.name] = run(entry.name, entry.fn, opts)
+            end
+        end
+    end)
+
+    game.debug_config({enabled = saved.enabled, collect_stats = saved.collect_stats}, true)
+    if tick ~= nil then
+        game.unregister(BENCH_FUNCTION)
+    end
+    if not ok then
+        error(err, 0)
+    end
+    return results
+end
+
+--============================================================================
+-- BASELINES
+--============================================================================
+
+-- Write results as a Lua file that bench.compare can read back
+local function save(results, path)
+    path = path or DEFAULT_BASELINE
+    local file = io.open(path, "w")
+    if not file then
+        error("Could not open file for writing: " .. path)
+    end
+
+    local names = {}
+    for name in pairs(results) do
+        table.insert(names, name)
+    end
+    table.sort(names)
+
+    file:write("-- Benchmark baseline, " .. os.date("%Y-%m-%d %H:%M:%S") .. "\n")
+    file:write("return {\n")
+    for _, name in ipairs(names) do
+        local r = results[name]
+        file:write(string.format("    [%q] = {median_ns = %.3f, cv_pct = %.2f, gb_per_s = %s},\n", name,
+                                 r.median_ns, r.cv_pct, r.gb_per_s and string.format("%.3f", r.gb_per_s) or "nil"))
+    end
+    file:write("}\n")
+    file:close()
+    print(string.format("Saved %d results to %s", #names, path))
+end
+
+-- Compare results against a saved baseline; a benchmark regressed when its
+-- median is more than threshold percent slower and outside both runs' spread
+-- @return list of regressed names
+local function compare(results, path, threshold)
+    path = path or DEFAULT_BASELINE
+    threshold = threshold or DEFAULT_THRESHOLD
+    local chunk, err = loadfile(path)
+    if not chunk then
+        error("Could not load baseline: " .. tostring(err))
+    end
+    local baseline = chunk()
+
+    local names = {}
+    for name in pairs(results) do
+        table.insert(names, name)
+    end
+    table.sort(names)
+
+    local regressed = {}
+    print(string.format("  %-28s %12s %12s %8s", "Benchmark", "baseline ns", "now ns", "change"))
+    for _, name in ipairs(names) do
+        local now, before = results[name], baseline[name]
+        if before then
+            local change = (now.median_ns - before.median_ns) / before.median_ns * 100
+            local noise = math.max(threshold, now.cv_pct + before.cv_pct)
+            local flag = change > noise and "  REGRESSED" or ""
+            if flag ~= "" then
+                table.insert(regressed, name)
+            end
+            print(string.format("  %-28s %12.1f %12.1f %+7.1f%%%s", name, before.median_ns, now.median_ns, change, flag))
+        else
+            print(string.format("  %-28s %12s %12.1f", name, "-", now.median_ns))
+        end
+    end
+    return regressed
+end
+
+-- Export functions
+return {
+    run = run,
+    suite = suite,
+    save = save,
+    compare = compare
+}
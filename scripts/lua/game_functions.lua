@@ -44,6 +44,11 @@ game.register("CreateConnection", 0x00402000, "void*(char*, int)",
               "Create network connection - host, port")
 game.register("SendPacket", 0x00402100, "int(void*, void*, int)", 
               "Send network packet - connection, data, size")
+
+-- Signature-based registrations survive game patches: the address is
+-- found by byte pattern once per game build and cached in lua/sigcache.txt
+game.register_sig("GetPlayerGold", "A1 ?? ?? ?? ?? 8B 80 ?? ?? ?? ?? C3", "int()",
+                  "Get current player gold amount")
 --]]
 
 --============================================================================
@@ -6,40 +6,18 @@
 -- Features:
 -- - Function registration with FFI signatures
 -- - Direct function calling in console thread  
--- - Remote thread execution in main game process
+-- - Batched execution on the game's main thread (native dispatcher)
 -- - Memory read/write operations
 -- - Debug logging and call tracking
--- - Persistent save/load of function registrations
+-- - Persistent save/load of function registrations (binary registry files,
+--   mapped at load and registered lazily on first use)
+-- - Bulk import of Ghidra symbol exports
+-- - Native walks over game object graphs (game.walker)
 
 local ffi = require('ffi')
 
--- Windows API definitions for process manipulation and memory operations
-ffi.cdef[[
-    // Process and thread management
-    void* GetCurrentProcess();
-    unsigned long GetCurrentProcessId();
-    unsigned long GetCurrentThreadId();
-    void* CreateRemoteThread(void* hProcess, void* lpThreadAttributes, unsigned long dwStackSize,
-                           void* lpStartAddress, void* lpParameter, unsigned long dwCreationFlags,
-                           unsigned long* lpThreadId);
-    unsigned long WaitForSingleObject(void* hHandle, unsigned long dwMilliseconds);
-    int CloseHandle(void* hObject);
-    
-    // Memory management
-    void* VirtualAllocEx(void* hProcess, void* lpAddress, unsigned long dwSize, 
-                        unsigned long flAllocationType, unsigned long flProtect);
-    int VirtualFreeEx(void* hProcess, void* lpAddress, unsigned long dwSize, unsigned long dwFreeType);
-    int WriteProcessMemory(void* hProcess, void* lpBaseAddress, const void* lpBuffer,
-                          unsigned long nSize, unsigned long* lpNumberOfBytesWritten);
-    int ReadProcessMemory(void* hProcess, const void* lpBaseAddress, void* lpBuffer,
-                         unsigned long nSize, unsigned long* lpNumberOfBytesRead);
-    
-    // Module management
-    void* GetModuleHandleA(const char* lpModuleName);
-    void* GetProcAddress(void* hModule, const char* lpProcName);
-]]
-
-local kernel32 = ffi.load('kernel32')
+-- Shared Windows bindings
+local kernel32 = require('lua/win32').kernel32
 
 --============================================================================
 -- CONFIGURATION AND STATE
@@ -55,12 +33,15 @@ local debug_settings = {
     log_parameters = true, 
     log_return_values = true,
     log_memory_ops = true,
+    collect_stats = true, -- Per-function latency histograms (game.stats)
     max_log_entries = 1000
 }
 
--- Logging storage
-local call_log = {}
-local memory_log = {}
+-- Logging storage: native fixed-capacity rings of binary records,
+-- formatted only when read back
+local call_log = ringlog.new(debug_settings.max_log_entries)
+local memory_log = ringlog.new(debug_settings.max_log_entries)
+local DEFAULT_LOG_DUMP = "lua/calllog"
 
 -- Windows memory constants
 local MEM_COMMIT = 0x1000
@@ -69,20 +50,27 @@ local MEM_RELEASE = 0x8000
 local PAGE_EXECUTE_READWRITE = 0x40
 
 -- Default timeouts (milliseconds)
-local DEFAULT_THREAD_TIMEOUT = 5000
-local DEFAULT_SAVE_FILE = "lua/functions_save.lua"
+local DEFAULT_CALL_TIMEOUT = 5000
+
+-- Calling conventions understood by the main thread dispatcher
+local CALLING_CONVENTIONS = {"stdcall", "fastcall", "thiscall", "cdecl"}
+local DEFAULT_SAVE_FILE = "lua/functions_save.reg"
+local LEGACY_SAVE_FILE = "lua/functions_save.lua"
+
+-- Registry files mapped by game.load, newest first, as {reg, path}. Their
+-- entries join function_registry the first time they are looked up.
+local mapped_files = {}
+
+-- Names unregistered (or unresolvable) while still in a mapped file
+local unregistered = {}
+
+-- Set while game.load runs a registrations script
+local quiet_registration = false
 
 --============================================================================
 -- UTILITY FUNCTIONS
 --============================================================================
 
--- Count entries in a table
-local function table_count(t)
-    local count = 0
-    for _ in pairs(t) do count = count + 1 end
-    return count
-end
-
 -- Validate function signature format
 local function validate_signature(signature)
     if not signature or type(signature) ~= "string" then
@@ -97,6 +85,89 @@ local function validate_signature(signature)
     return true
 end
 
+-- Map a C type to the dispatcher's kind character
+-- (p = pointer, d = double, f = float, q = int64, u = unsigned, i = int, v = void,
+-- b = bool, c/C = signed/unsigned char, s/S = signed/unsigned short)
+local function type_kind(ctype)
+    ctype = ctype:gsub("^%s+", ""):gsub("%s+$", "")
+    if ctype:find("*", 1, true) then return "p" end
+    if ctype:find("double") then return "d" end
+    if ctype:find("float") then return "f" end
+    if ctype:find("long%s+long") or ctype:find("int64") then return "q" end
+    if ctype == "void" then return "v" end
+    local unsigned = ctype:find("unsigned") or ctype:find("uint")
+    if ctype:find("bool") then return "b" end
+    if ctype:find("char") or ctype:find("int8") then return unsigned and "C" or "c" end
+    if ctype:find("short") or ctype:find("int16") then return unsigned and "S" or "s" end
+    if unsigned then return "u" end
+    return "i"
+end
+
+-- Split an FFI signature into calling convention, return kind and argument kinds
+-- e.g. "int __stdcall(int, char*)" -> {conv = "stdcall", ret = "i", args = "ip"}
+local function parse_signature(signature)
+    local ret, params = signature:match("^%s*(.-)%s*%((.*)%)%s*$")
+    if not ret then
+        return nil, "Malformed signature"
+    end
+    
+    local conv = "cdecl"
+    for _, name in ipairs(CALLING_CONVENTIONS) do
+        if ret:find("__" .. name, 1, true) then
+            conv = name
+            ret = ret:gsub("__" .. name, "")
+            break
+        end
+    end
+    
+    local kinds = {}
+    params = params:gsub("^%s+", ""):gsub("%s+$", "")
+    if params ~= "" and params ~= "void" then
+        for param in (params .. ","):gmatch("([^,]*),") do
+            if param:find("...", 1, true) then
+                return nil, "Variadic functions cannot be dispatched"
+            end
+            table.insert(kinds, type_kind(param))
+        end
+    end
+    
+    return {conv = conv, ret = type_kind(ret), args = table.concat(kinds)}
+end
+
+-- Parsed pointer ctypes and dispatcher specs, keyed by declaration, so
+-- repeated registrations and views never re-run the C parser
+local pointer_types = {}
+local call_specs = {}
+
+-- Pointer ctype for a C declaration ("int __stdcall(int)", "struct City")
+-- or an existing ctype
+local function pointer_type(decl)
+    local ct = pointer_types[decl]
+    if not ct then
+        ct = type(decl) == "string" and ffi.typeof(decl .. "*") or ffi.typeof("$ *", decl)
+        pointer_types[decl] = ct
+    end
+    return ct
+end
+
+-- Dispatcher spec for a signature; nil if the dispatcher cannot call it
+local function call_spec(signature)
+    local spec = call_specs[signature]
+    if spec == nil then
+        spec = parse_signature(signature) or false
+        call_specs[signature] = spec
+    end
+    return spec or nil
+end
+
+-- Convert an argument to something the native dispatcher can pass by value
+local function to_native_arg(arg)
+    if type(arg) == "cdata" then
+        return tonumber(ffi.cast("uintptr_t", arg))
+    end
+    return arg
+end
+
 -- Format function parameters for display
 local function format_parameters(...)
     local args = {...}
@@ -127,58 +198,183 @@ end
 --============================================================================
 -- LOGGING SYSTEM  
 --============================================================================
-local function log_entry(entry_type, data)
-    if not debug_settings.enabled then return end
-    
-    local timestamp = os.date("%H:%M:%S")
-    local entry = {
-        timestamp = timestamp,
-        type = entry_type,
-        data = data
-    }
+-- True while game.trace_start() is streaming calls to a binary trace file
+local trace_on = false
+
+-- Record a finished call: kind is ringlog.CALL or ringlog.CALL_MAIN
+local function log_call(kind, func_info, success, result, elapsed_ms, ...)
+    if trace_on then
+        local flags = (success and trace.OK or 0) + (kind == ringlog.CALL_MAIN and trace.MAIN or 0)
+        trace.call(func_info.log_id, elapsed_ms, flags, to_native_arg(result), ...)
+    end
+    if debug_settings.enabled and debug_settings.log_calls then
+        call_log:push(kind, func_info.log_id, func_info.address, 0, success and ringlog.OK or 0,
+                      elapsed_ms, to_native_arg(result), ...)
+    end
+end
+
+-- Record a memory operation: kind is ringlog.READ or ringlog.WRITE
+local function log_memory(kind, address, size, success)
+    if trace_on then
+        trace.memory(kind == ringlog.WRITE, address, size, success)
+    end
+    if debug_settings.enabled and debug_settings.log_memory_ops then
+        memory_log:push(kind, 0, address, size, success and ringlog.OK or 0)
+    end
+end
+
+-- True when calls are logged or traced
+local function tracing_calls()
+    return trace_on or (debug_settings.enabled and (debug_settings.log_calls or debug_settings.log_return_values))
+end
+
+-- True when calls are timed: logged, traced or counted into game.stats.
+-- Checked once per call, so with all of these off a call is a plain FFI
+-- call with no formatting or clock reads.
+local function timing_calls()
+    return debug_settings.collect_stats or tracing_calls()
+end
+
+-- Record a finished call's wall time into the function's histogram
+local function record_latency(func_info, elapsed_ms, success)
+    if debug_settings.collect_stats then
+        func_info.stats:record(elapsed_ms, success)
+    end
+end
+
+-- True when results should be printed as calls return
+local function printing_results()
+    return debug_settings.enabled and debug_settings.log_return_values
+end
+
+--============================================================================
+-- REGISTRY FILES
+--============================================================================
+
+-- Registry record for a function: its FFI pointer, dispatcher spec and stats
+local function new_entry(name, address, signature, description)
+    local success, func_ptr = pcall(function()
+        return ffi.cast(pointer_type(signature), address)
+    end)
     
-    if entry_type == "call" and debug_settings.log_calls then
-        table.insert(call_log, entry)
-        if #call_log > debug_settings.max_log_entries then
-            table.remove(call_log, 1)
-        end
-        
-        if debug_settings.log_calls then
-            print(string.format("[%s] CALL: %s", timestamp, data.summary))
+    if not success then
+        error("Failed to create function pointer: " .. tostring(func_ptr))
+    end
+    
+    return {
+        address = address,
+        signature = signature,
+        func_ptr = func_ptr,
+        call_spec = call_spec(signature),
+        log_id = ringlog.intern(name),
+        stats = latency.new(),
+        description = description or "No description",
+        registered_time = os.time()
+    }
+end
+
+-- Mapped file and entry index holding name, newest file first
+local function find_mapped(name)
+    for _, mapped in ipairs(mapped_files) do
+        local index = mapped.reg:find(name)
+        if index then
+            return mapped.reg, index
         end
-    elseif entry_type == "memory" and debug_settings.log_memory_ops then
-        table.insert(memory_log, entry)
-        if #memory_log > debug_settings.max_log_entries then
-            table.remove(memory_log, 1)
+    end
+end
+
+-- Register a mapped entry. Entries saved from game.register_sig are
+-- resolved again, as running the registration would.
+local function materialize(name, reg, index)
+    local _, address, signature, pattern, offset, size = reg:entry(index)
+    local err
+    if pattern then
+        address, err = mem.resolve(pattern, {offset = offset})
+    end
+    
+    local ok, info = false, err
+    if address then
+        ok, info = pcall(new_entry, name, address, signature, reg:description(index))
+    end
+    if not ok then
+        print(string.format("Warning: cannot register '%s' from registry file: %s", name, tostring(info)))
+        unregistered[name] = true
+        symbols.remove(name)
+        return nil
+    end
+    
+    info.pattern = pattern
+    info.offset = pattern and offset or nil
+    info.size = size > 0 and size or nil
+    rawset(function_registry, name, info)
+    symbols.add(name, address, size)
+    return info
+end
+
+setmetatable(function_registry, {
+    __index = function(registry, name)
+        if type(name) ~= "string" or unregistered[name] then
+            return nil
         end
-        
-        if debug_settings.log_memory_ops then
-            print(string.format("[%s] MEMORY: %s", timestamp, data.summary))
+        local reg, index = find_mapped(name)
+        if reg then
+            return materialize(name, reg, index)
         end
     end
-end
+})
 
-local function format_parameters(...)
-    local args = {...}
-    local formatted = {}
+-- Visit every function once, including mapped ones not used yet; those
+-- are passed as plain tables of their saved fields
+local function each_function(visit)
+    local seen = {}
+    for name, info in pairs(function_registry) do
+        seen[name] = true
+        visit(name, info)
+    end
     
-    for i, arg in ipairs(args) do
-        local arg_str
-        if type(arg) == "number" then
-            if arg > 65535 then
-                arg_str = string.format("0x%08X (%d)", arg, arg)
-            else
-                arg_str = tostring(arg)
+    for _, mapped in ipairs(mapped_files) do
+        local reg = mapped.reg
+        for index = 1, reg:count() do
+            local name, address, signature, pattern, offset, size = reg:entry(index)
+            if not seen[name] and not unregistered[name] then
+                seen[name] = true
+                visit(name, {
+                    address = address,
+                    signature = signature,
+                    pattern = pattern,
+                    offset = pattern and offset or nil,
+                    size = size > 0 and size or nil,
+                    description = reg:description(index) or "No description"
+                })
             end
-        elseif type(arg) == "string" then
-            arg_str = '"' .. arg .. '"'
-        else
-            arg_str = tostring(arg)
         end
-        table.insert(formatted, arg_str)
     end
-    
-    return table.concat(formatted, ", ")
+end
+
+local function function_count()
+    local count = 0
+    each_function(function() count = count + 1 end)
+    return count
+end
+
+-- Windows cannot replace a mapped file, so saving unmaps first
+local function close_mapped()
+    local paths = {}
+    for _, mapped in ipairs(mapped_files) do
+        mapped.reg:close()
+        table.insert(paths, mapped.path)
+    end
+    mapped_files = {}
+    return paths
+end
+
+local function map_file(path)
+    local reg, err = regfile.open(path)
+    if not reg then
+        return nil, err
+    end
+    table.insert(mapped_files, {reg = reg, path = path})
+    return reg
 end
 
 --============================================================================
@@ -222,29 +418,21 @@ function register_function(name, address, signature, description)
         error(string.format("Address out of valid range: 0x%08X", addr_num))
     end
     
-    -- Check if function already exists
-    if function_registry[name] then
+    -- Check if function already exists (without registering a mapped one)
+    local exists = rawget(function_registry, name) or (not unregistered[name] and find_mapped(name))
+    if exists and not quiet_registration then
         print(string.format("Warning: Overwriting existing function '%s'", name))
     end
     
-    -- Create FFI function pointer with error handling
-    local success, func_ptr = pcall(function()
-        return ffi.cast(signature .. "*", addr_num)
-    end)
+    -- Store function information
+    function_registry[name] = new_entry(name, addr_num, signature, description)
+    unregistered[name] = nil
+    symbols.add(name, addr_num)
     
-    if not success then
-        error("Failed to create function pointer: " .. tostring(func_ptr))
+    if quiet_registration then
+        return
     end
     
-    -- Store function information
-    function_registry[name] = {
-        address = addr_num,
-        signature = signature,
-        func_ptr = func_ptr,
-        description = description or "No description",
-        registered_time = os.time()
-    }
-    
     -- Success message
     print(string.format("✓ Registered function: %s", name))
     print(string.format("  Address: 0x%08X", addr_num))
@@ -254,6 +442,40 @@ function register_function(name, address, signature, description)
     end
 end
 
+-- Register a game function located by byte signature instead of address
+-- Resolved addresses are cached per game build in lua/sigcache.txt, so only
+-- new signatures, or ones that moved in a patch, are scanned for
+-- @param name: Function name
+-- @param pattern: Byte signature, e.g. "55 8B EC 83 EC ?? A1 ?? ?? ?? ??"
+-- @param signature: FFI function signature, e.g. "int(int, int)"
+-- @param description: Optional description
+-- @param offset: Optional distance from the match to the function start
+function register_signature(name, pattern, signature, description, offset)
+    local address, err = mem.resolve(pattern, {offset = offset})
+    if not address then
+        error(string.format("Cannot resolve '%s': %s", name, err))
+    end
+    
+    register_function(name, address, signature, description)
+    function_registry[name].pattern = pattern
+    function_registry[name].offset = offset
+end
+
+-- Forget a registered function; hooks on it stay in place
+-- @param name: Function name
+function unregister_function(name)
+    local mapped = not unregistered[name] and find_mapped(name)
+    if not rawget(function_registry, name) and not mapped then
+        return false
+    end
+    function_registry[name] = nil
+    if mapped then
+        unregistered[name] = true
+    end
+    symbols.remove(name)
+    return true
+end
+
 -- Call a registered function directly (in console thread)
 -- @param name: Function name
 -- @param ...: Function arguments
@@ -263,32 +485,19 @@ function call_function(name, ...)
         error("Function '" .. name .. "' not registered")
     end
     
-    local params = format_parameters(...)
-    local call_info = {
-        function_name = name,
-        address = func_info.address,
-        thread_type = "console",
-        parameters = params,
-        signature = func_info.signature
-    }
-    
-    if debug_settings.log_calls then
-        call_info.summary = string.format("%s(%s) [console thread] @ 0x%08X", 
-                                        name, params, func_info.address)
-        log_entry("call", call_info)
+    if not timing_calls() then
+        return func_info.func_ptr(...)
     end
     
-    local start_time = os.clock()
+    local start_time = latency.now()
     local success, result = pcall(func_info.func_ptr, ...)
-    local end_time = os.clock()
+    local elapsed = latency.now() - start_time -- ms
     
-    call_info.execution_time = (end_time - start_time) * 1000 -- ms
-    call_info.success = success
-    call_info.result = result
+    record_latency(func_info, elapsed, success)
+    log_call(ringlog.CALL, func_info, success, result, elapsed, ...)
     
-    if debug_settings.log_return_values then
-        print(string.format("  -> Result: %s (%.2fms)", 
-                          tostring(result), call_info.execution_time))
+    if printing_results() then
+        print(string.format("  -> Result: %s (%.2fms)", tostring(result), elapsed))
     end
     
     if not success then
@@ -299,72 +508,207 @@ function call_function(name, ...)
     return result
 end
 
--- Call a registered function in the main game process (new thread)
--- Note: This works best with simple functions that take basic parameters
+-- Queue a registered function on the game's main thread
+-- Returns a future immediately; use future:wait([ms]) -> completed, result
+-- Queue many calls before waiting to have them all run in one pump iteration
 -- @param name: Function name
--- @param param: Single parameter to pass (limitations of CreateRemoteThread)
-function call_function_main(name, param)
+-- @param ...: Function arguments (numbers, booleans, strings, pointers)
+function call_function_async(name, ...)
     local func_info = function_registry[name]
     if not func_info then
         error("Function '" .. name .. "' not registered")
     end
     
-    local call_info = {
-        function_name = name,
-        address = func_info.address,
-        thread_type = "main_process",
-        parameters = tostring(param or "none"),
-        signature = func_info.signature
-    }
+    local spec = func_info.call_spec
+    if not spec then
+        error("Function '" .. name .. "' has a signature the dispatcher cannot call")
+    end
     
-    if debug_settings.log_calls then
-        call_info.summary = string.format("%s(%s) [main process] @ 0x%08X", 
-                                        name, tostring(param or "none"), func_info.address)
-        log_entry("call", call_info)
-    end
-    
-    local hProcess = kernel32.GetCurrentProcess()
-    local start_time = os.clock()
-    
-    -- Create remote thread to execute the function
-    local hThread = kernel32.CreateRemoteThread(
-        hProcess,
-        nil,
-        0,
-        ffi.cast("void*", func_info.address),
-        ffi.cast("void*", param or 0),
-        0,
-        nil
-    )
-    
-    local success = false
-    local result = nil
-    
-    if hThread ~= nil then
-        -- Wait for completion (max 5 seconds)
-        result = kernel32.WaitForSingleObject(hThread, 5000)
-        kernel32.CloseHandle(hThread)
-        success = (result == 0) -- 0 = success
-        
-        local end_time = os.clock()
-        call_info.execution_time = (end_time - start_time) * 1000
-        call_info.success = success
-        call_info.wait_result = result
-        
-        if debug_settings.log_return_values then
-            print(string.format("  -> Thread result: %s (%.2fms)", 
-                              success and "SUCCESS" or "TIMEOUT/ERROR", call_info.execution_time))
+    -- cdata goes through as is, so the dispatcher keeps it alive until the call
+    -- ran; only the float and int64 kinds need plain numbers
+    local count = select("#", ...)
+    local args = {...}
+    for i = 1, count do
+        if type(args[i]) == "cdata" and spec.args:sub(i, i):find("[dfq]") then
+            args[i] = tonumber(args[i])
         end
-    else
-        call_info.success = false
-        call_info.error = "Failed to create remote thread"
-        
-        if debug_settings.log_return_values then
-            print("  -> ERROR: Failed to create remote thread")
+    end
+    
+    return dispatch.call(func_info.address, spec.conv, spec.args, spec.ret, unpack(args, 1, count))
+end
+
+-- Call a registered function on the game's main thread and wait for the result
+-- @param name: Function name
+-- @param ...: Function arguments
+function call_function_main(name, ...)
+    local func_info = function_registry[name]
+    if not func_info then
+        error("Function '" .. name .. "' not registered")
+    end
+    
+    if not timing_calls() then
+        local completed, result = call_function_async(name, ...):wait(DEFAULT_CALL_TIMEOUT)
+        if not completed then
+            error(string.format("Main thread call '%s' timed out", name))
         end
+        return result
+    end
+    
+    local start_time = latency.now()
+    local completed, result = call_function_async(name, ...):wait(DEFAULT_CALL_TIMEOUT)
+    local elapsed = latency.now() - start_time
+    
+    record_latency(func_info, elapsed, completed)
+    log_call(ringlog.CALL_MAIN, func_info, completed, result, elapsed, ...)
+    
+    if printing_results() then
+        if completed then
+            print(string.format("  -> Result: %s (%.2fms)", tostring(result), elapsed))
+        else
+            print(string.format("  -> ERROR: main thread did not run the call within %dms", DEFAULT_CALL_TIMEOUT))
+        end
+    end
+    
+    if not completed then
+        error(string.format("Main thread call '%s' timed out", name))
+    end
+    
+    return result
+end
+
+-- Bare callable for a registered function: the FFI function pointer
+-- itself, which LuaJIT compiles into a direct call inside hot loops.
+-- Bound callables skip logging; pass traced = true for one that goes
+-- through game.call instead. Re-bind after re-registering the name.
+-- @param name: Function name
+-- @param traced: Optional, log and time calls while debug logging is on
+function bind_function(name, traced)
+    local func_info = function_registry[name]
+    if not func_info then
+        error("Function '" .. name .. "' not registered")
+    end
+    
+    if traced then
+        return function(...)
+            return call_function(name, ...)
+        end
+    end
+    return func_info.func_ptr
+end
+
+-- Resolve a registered function name or address string to an address
+local function resolve_target(target, what)
+    local address = target
+    if type(target) == "string" then
+        local func_info = function_registry[target]
+        address = func_info and func_info.address or tonumber(target)
+    end
+    if not address then
+        error("Unknown " .. what .. " function: " .. tostring(target))
+    end
+    return address
+end
+
+-- Hook the game's per-frame function so on_frame/on_tick callbacks run once
+-- per rendered frame instead of from the message pump fallback
+-- @param target: Registered function name or address
+function hook_frame_function(target)
+    local address = resolve_target(target, "frame")
+    frame.attach(address)
+    print(string.format("Frame callbacks now run from 0x%08X", address))
+end
+
+-- Hook the game's present/flip call so frame times are measured from one
+-- displayed frame to the next. Without it, system.frame_stats() measures
+-- between calls of the function given to game.frame_hook.
+-- @param target: Registered function name or address
+function hook_present_function(target)
+    local address = resolve_target(target, "present")
+    frametime.attach(address)
+    print(string.format("Frame times now measured at 0x%08X", address))
+end
+
+-- Hook a registered function so every call the game makes is counted
+-- natively. Callbacks run on the calling thread when the Lua state is free,
+-- and receive raw 32-bit argument slots (a double or int64 takes two):
+--   pre(args...)               before the function runs
+--   post(result, elapsed_ms)   after it returns; result is EAX
+-- Without callbacks the hook only counts; pass {timed = true} to also
+-- measure each call. Timed calls show up in game.trace_start() traces.
+-- @param name: Function name
+-- @param callbacks: Optional {pre = fn, post = fn, timed = bool}
+function hook_function(name, callbacks)
+    local func_info = function_registry[name]
+    if not func_info then
+        error("Function '" .. name .. "' not registered")
     end
     
-    return success
+    local spec = func_info.call_spec
+    if not spec then
+        error("Function '" .. name .. "' has a signature hooks cannot decode")
+    end
+    
+    callbacks = callbacks or {}
+    local _, wide = spec.args:gsub("[dq]", "")
+    hook.attach(func_info.address, {
+        pre = callbacks.pre,
+        post = callbacks.post,
+        timed = callbacks.timed,
+        argc = #spec.args + wide,
+        conv = spec.conv,
+        name = name
+    })
+    print(string.format("Hooked %s at 0x%08X", name, func_info.address))
+end
+
+function unhook_function(name)
+    local func_info = function_registry[name]
+    if not func_info then
+        error("Function '" .. name .. "' not registered")
+    end
+    return hook.detach(func_info.address)
+end
+
+-- Counters for a hooked function: calls, total_ms, avg_us, max_us,
+-- lua_calls, skipped, errors. Pass reset = true to zero them afterwards.
+function hook_stats(name, reset)
+    local func_info = function_registry[name]
+    if not func_info then
+        error("Function '" .. name .. "' not registered")
+    end
+    local stats = hook.stats(func_info.address)
+    if stats and reset then
+        hook.reset(func_info.address)
+    end
+    return stats
+end
+
+-- Registered addresses and names, {[address] = name}, for symbolizing
+-- profiler samples and other raw addresses
+function function_symbols()
+    local symbols = {}
+    each_function(function(name, info)
+        symbols[info.address] = name
+    end)
+    return symbols
+end
+
+-- Registered function containing an address, from the native address
+-- index (see src/symbols.c) kept up to date by register and unregister
+-- @param address: Number or cdata pointer
+-- @return name, offset into the function; nil if no function covers it
+function symbolize(address)
+    if type(address) == "cdata" then
+        address = tonumber(ffi.cast("uintptr_t", address))
+    end
+    return symbols.lookup(address)
+end
+
+-- Symbolize an array of addresses in one call
+-- @param addresses: Array of numbers
+-- @return names, offsets: arrays matching addresses, false where no function covers one
+function symbolize_many(addresses)
+    return symbols.lookup_many(addresses)
 end
 
 -- List all registered functions
@@ -372,20 +716,26 @@ function list_functions()
     print("Registered game functions:")
     print("=" .. string.rep("=", 50))
     
-    if next(function_registry) == nil then
-        print("  No functions registered")
-        return
-    end
-    
-    for name, info in pairs(function_registry) do
+    local count = 0
+    each_function(function(name, info)
+        count = count + 1
         print(string.format("  %s", name))
         print(string.format("    Address: 0x%08X", info.address))
         print(string.format("    Signature: %s", info.signature))
         print(string.format("    Description: %s", info.description))
         print("")
+    end)
+    
+    if count == 0 then
+        print("  No functions registered")
     end
 end
 
+-- Numeric address of a cdata pointer or array
+local function address_of(cdata)
+    return tonumber(ffi.cast("uintptr_t", ffi.cast("const void*", cdata)))
+end
+
 -- Read memory at a specific address
 -- @param address: Memory address
 -- @param size: Number of bytes to read
@@ -393,76 +743,64 @@ end
 function read_memory(address, size, ffi_type)
     local addr_num = type(address) == "string" and tonumber(address, 16) or address
     local buffer = ffi.new(ffi_type .. "[?]", size / ffi.sizeof(ffi_type))
-    local hProcess = kernel32.GetCurrentProcess()
-    
-    local mem_info = {
-        operation = "READ",
-        address = addr_num,
-        size = size,
-        type = ffi_type
-    }
     
-    local bytes_read = ffi.new("unsigned long[1]")
-    local success = kernel32.ReadProcessMemory(
-        hProcess,
-        ffi.cast("void*", addr_num),
-        buffer,
-        size,
-        bytes_read
-    )
+    -- Same address space: a checked memcpy instead of a ReadProcessMemory call
+    local success = mem.readable(addr_num, size) and pcall(mem.copy, address_of(buffer), addr_num, size)
     
-    mem_info.success = (success ~= 0)
-    mem_info.bytes_processed = bytes_read[0]
+    log_memory(ringlog.READ, addr_num, size, success)
     
-    if debug_settings.log_memory_ops then
-        mem_info.summary = string.format("READ 0x%08X (%d bytes, %s) -> %s", 
-                                       addr_num, size, ffi_type, 
-                                       success ~= 0 and "SUCCESS" or "FAILED")
-        log_entry("memory", mem_info)
-    end
-    
-    if success ~= 0 then
-        return buffer, bytes_read[0]
+    if success then
+        return buffer, size
     else
         return nil, 0
     end
 end
 
+-- Typed pointer straight into game memory, no copy
+-- @param address: Memory address
+-- @param ctype: FFI type the memory holds (e.g., "struct Building")
+-- @param count: Number of consecutive elements to validate (default 1)
+function view_memory(address, ctype, count)
+    local addr_num = type(address) == "string" and tonumber(address, 16) or address
+    local ptr_type = pointer_type(ctype)
+    
+    local size = ffi.sizeof(ctype) * (count or 1)
+    if not mem.readable(addr_num, size) then
+        error(string.format("mem.view: 0x%08X (%d bytes of %s) is not readable memory", 
+                            addr_num, size, tostring(ctype)), 2)
+    end
+    return ffi.cast(ptr_type, addr_num)
+end
+
+mem.view = view_memory
+
 -- Write memory at a specific address
 -- @param address: Memory address
 -- @param data: Data to write (FFI array or single value)
 -- @param size: Number of bytes to write
 function write_memory(address, data, size)
     local addr_num = type(address) == "string" and tonumber(address, 16) or address
-    local hProcess = kernel32.GetCurrentProcess()
+    local success, bytes_written
     
-    local mem_info = {
-        operation = "WRITE",
-        address = addr_num,
-        size = size,
-        data = tostring(data)
-    }
-    
-    local bytes_written = ffi.new("unsigned long[1]")
-    local success = kernel32.WriteProcessMemory(
-        hProcess,
-        ffi.cast("void*", addr_num),
-        data,
-        size,
-        bytes_written
-    )
-    
-    mem_info.success = (success ~= 0)
-    mem_info.bytes_processed = bytes_written[0]
-    
-    if debug_settings.log_memory_ops then
-        mem_info.summary = string.format("WRITE 0x%08X (%d bytes) -> %s", 
-                                       addr_num, size, 
-                                       success ~= 0 and "SUCCESS" or "FAILED")
-        log_entry("memory", mem_info)
+    if mem.writable(addr_num, size) then
+        success = pcall(mem.copy, addr_num, address_of(data), size)
+        bytes_written = success and size or 0
+    else
+        -- Read-only pages (code patches): WriteProcessMemory handles the protection
+        local written = ffi.new("unsigned long[1]")
+        success = kernel32.WriteProcessMemory(
+            kernel32.GetCurrentProcess(),
+            ffi.cast("void*", addr_num),
+            data,
+            size,
+            written
+        ) ~= 0
+        bytes_written = written[0]
     end
     
-    return success ~= 0, bytes_written[0]
+    log_memory(ringlog.WRITE, addr_num, bytes_written, success)
+    
+    return success, bytes_written
 end
 
 -- Helper function to get module base address
@@ -474,11 +812,161 @@ function get_module_base(module_name)
     return nil
 end
 
--- Save function registrations to file
--- @param filename: File to save to (default: "functions.lua")
-function save_functions(filename)
-    filename = filename or "lua/functions_save.lua"
+--============================================================================
+-- OBJECT GRAPHS
+--============================================================================
+
+-- Start of every walker output (walker_header in src/walker.h)
+local WALKER_HEADER = "uint32_t count, truncated, faults, unreadable;"
+local WALKER_RESERVED = {count = true, truncated = true, faults = true, unreadable = true,
+                         address = true, parent = true}
+local DEFAULT_WALKER_CAPACITY = 65536
+
+-- Offset, column type and size of a struct field. Scalar types are found
+-- by writing probe values into a scratch node, since the FFI does not say
+-- what a field's type is; pointers become uint32_t addresses and nested
+-- structs or arrays are copied as raw bytes ("raw").
+local function field_column(ct, field)
+    local offset, bitpos = ffi.offsetof(ct, field)
+    if not offset then
+        error(string.format("%s has no field '%s'", tostring(ct), field), 3)
+    end
+    if bitpos then
+        error("Bit fields cannot be copied by the walker: " .. field, 3)
+    end
+    
+    local probe = ffi.new(ct)
+    local value = probe[field]
+    if type(value) == "boolean" then
+        return offset, "bool", 1
+    elseif type(value) == "cdata" then
+        if ffi.istype("int64_t", value) then
+            return offset, "int64_t", 8
+        elseif ffi.istype("uint64_t", value) then
+            return offset, "uint64_t", 8
+        elseif tostring(ffi.typeof(value)):find("*", 1, true) then
+            return offset, "uint32_t", 4
+        end
+        return offset, "raw", ffi.sizeof(value)
+    end
+    
+    probe[field] = 0.5
+    if probe[field] == 0.5 then
+        probe[field] = 0.1
+        return offset, probe[field] == 0.1 and "double" or "float", probe[field] == 0.1 and 8 or 4
+    end
+    
+    -- Integers: -1 sets every byte of the field and reads back negative if signed
+    probe[field] = -1
+    local bytes = ffi.cast("uint8_t *", probe)
+    local width = 0
+    while width < 8 and offset + width < ffi.sizeof(ct) and bytes[offset + width] == 0xFF do
+        width = width + 1
+    end
+    return offset, string.format("%sint%d_t", probe[field] < 0 and "" or "u", width * 8), width
+end
+
+-- Walker link for a "next" or children entry
+local function walker_link(ct, link)
+    if type(link) == "string" then
+        return {kind = "pointer", offset = (field_column(ct, link))}
+    end
+    
+    local native = {kind = link.structs and "structs" or "pointers", offset = (field_column(ct, link[1]))}
+    if type(link.count) == "number" then
+        native.count = link.count
+    elseif type(link.count) == "string" then
+        local offset, _, size = field_column(ct, link.count)
+        native.count_offset = offset
+        native.count_size = size
+        native.count = link.max
+    else
+        error("Array link '" .. tostring(link[1]) .. "' needs a count (number or field name)", 3)
+    end
+    return native
+end
+
+-- Native walker over a graph of one struct type, for refreshing large
+-- entity lists without a read_mem per node. Every refresh fills the same
+-- preallocated struct-of-arrays buffer and returns it:
+--   snap.count, snap.address[i], snap.parent[i] (-1 for roots), snap.<field>[i]
+-- for i = 0 .. snap.count - 1; raw fields are byte arrays.
+-- @param spec: node     - struct type of the nodes (name or ctype)
+--              next     - pointer field to the next node in a list
+--              children - further links: a pointer field name, or
+--                         {field, count = n | "count_field" [, max = n] [, structs = true]}
+--                         for an array of node pointers (an array of nodes with structs)
+--              fields   - fields to copy
+--              capacity - most nodes per refresh (default 65536)
+-- @return walker with :refresh(roots) -> snapshot and :stats(); roots is a
+--         node address, {kind = "pointers"|"structs", address, count}, or an
+--         array of those
+function create_walker(spec)
+    local ct = ffi.typeof(spec.node)
+    local capacity = spec.capacity or DEFAULT_WALKER_CAPACITY
+    
+    local links = {}
+    if spec.next then
+        table.insert(links, walker_link(ct, spec.next))
+    end
+    for _, child in ipairs(spec.children or {}) do
+        table.insert(links, walker_link(ct, child))
+    end
+    
+    local decls = {WALKER_HEADER, string.format("uint32_t address[%d]; int32_t parent[%d];", capacity, capacity)}
+    local columns = {}
+    for _, field in ipairs(spec.fields or {}) do
+        if WALKER_RESERVED[field] then
+            error("Field name is used by the snapshot itself: " .. field, 2)
+        end
+        local offset, ctype, size = field_column(ct, field)
+        if ctype == "raw" then
+            table.insert(decls, string.format("uint8_t %s[%d][%d];", field, capacity, size))
+        else
+            table.insert(decls, string.format("%s %s[%d];", ctype, field, capacity))
+        end
+        table.insert(columns, {field = field, source = offset, size = size})
+    end
+    
+    local out_type = ffi.typeof("struct { " .. table.concat(decls, " ") .. " }")
+    local out = ffi.new(out_type)
+    for _, column in ipairs(columns) do
+        column.dest = ffi.offsetof(out_type, column.field)
+    end
     
+    local native = mem.walker({
+        size = ffi.sizeof(ct),
+        capacity = capacity,
+        bytes = ffi.sizeof(out_type),
+        address = ffi.offsetof(out_type, "address"),
+        parent = ffi.offsetof(out_type, "parent"),
+        links = links,
+        columns = columns
+    })
+    local out_address = tonumber(ffi.cast("uintptr_t", out))
+    
+    return {
+        snapshot = out,
+        refresh = function(self, roots)
+            if type(roots) == "cdata" then
+                roots = tonumber(ffi.cast("uintptr_t", roots))
+            end
+            native:walk(out_address, roots)
+            return out
+        end,
+        stats = function(self)
+            local stats = native:stats()
+            stats.count = out.count
+            stats.truncated = out.truncated ~= 0
+            stats.faults = out.faults
+            stats.unreadable = out.unreadable
+            return stats
+        end
+    }
+end
+
+-- Write registrations as a script of game.register calls
+local function save_script(filename)
     local file = io.open(filename, "w")
     if not file then
         error("Could not open file for writing: " .. filename)
@@ -488,56 +976,207 @@ function save_functions(filename)
     file:write("-- Generated: " .. os.date("%Y-%m-%d %H:%M:%S") .. "\n\n")
     file:write("local game = require('lua/gamecalls')\n\n")
     
-    for name, info in pairs(function_registry) do
-        file:write(string.format('game.register("%s", 0x%08X, "%s", "%s")\n',
-                                name, info.address, info.signature, info.description))
-    end
+    each_function(function(name, info)
+        if info.pattern then
+            file:write(string.format('game.register_sig("%s", "%s", "%s", "%s", %d)\n',
+                                    name, info.pattern, info.signature, info.description, info.offset or 0))
+        else
+            file:write(string.format('game.register("%s", 0x%08X, "%s", "%s")\n',
+                                    name, info.address, info.signature, info.description))
+        end
+    end)
     
     file:write("\nreturn game\n")
     file:close()
+    return function_count()
+end
+
+-- Write registrations as a binary registry file (see src/regformat.h),
+-- which then replaces any mapped files as the source of unused entries
+local function save_registry(filename)
+    local entries = {}
+    each_function(function(name, info)
+        table.insert(entries, {
+            name = name,
+            address = info.address,
+            signature = info.signature,
+            description = info.description,
+            pattern = info.pattern,
+            offset = info.offset,
+            size = info.size
+        })
+    end)
+    
+    local paths = close_mapped()
+    local count, err = regfile.write(filename, entries)
+    if not count then
+        for _, path in ipairs(paths) do
+            map_file(path)
+        end
+        error(err)
+    end
     
-    print(string.format("Saved %d function registrations to: %s", 
-                       table_count(function_registry), filename))
+    unregistered = {}
+    assert(map_file(filename))
+    return count
+end
+
+-- Save function registrations to file
+-- A name ending in .lua writes a registrations script, anything else a
+-- binary registry file that game.load maps instead of running
+-- @param filename: File to save to (default: "lua/functions_save.reg")
+function save_functions(filename)
+    filename = filename or DEFAULT_SAVE_FILE
+    
+    local count
+    if filename:lower():match("%.lua$") then
+        count = save_script(filename)
+    else
+        count = save_registry(filename)
+    end
+    
+    print(string.format("Saved %d function registrations to: %s", count, filename))
 end
 
 -- Load function registrations from file
--- @param filename: File to load from
+-- Registry files are mapped, and each function is registered the first
+-- time it is used; scripts are run with per-function output suppressed.
+-- Functions in the file replace registered ones of the same name.
+-- @param filename: File to load from (default: "lua/functions_save.reg",
+--                  or the older "lua/functions_save.lua" if that is missing)
 function load_functions(filename)
-    filename = filename or "lua/functions_save.lua"
-    
-    local chunk, err = loadfile(filename)
-    if not chunk then
-        error("Could not load functions file: " .. (err or "unknown error"))
+    if not filename then
+        local file = io.open(DEFAULT_SAVE_FILE, "rb")
+        filename = file and DEFAULT_SAVE_FILE or LEGACY_SAVE_FILE
+        if file then
+            file:close()
+        end
     end
     
-    local old_count = table_count(function_registry)
-    chunk() -- Execute the file
-    local new_count = table_count(function_registry)
+    local old_count = function_count()
+    if filename:lower():match("%.lua$") then
+        local chunk, err = loadfile(filename)
+        if not chunk then
+            error("Could not load functions file: " .. (err or "unknown error"))
+        end
+        
+        local previous = quiet_registration
+        quiet_registration = true
+        local ok, run_err = pcall(chunk)
+        quiet_registration = previous
+        if not ok then
+            error(run_err, 0)
+        end
+    else
+        local reg, err = regfile.open(filename)
+        if not reg then
+            error("Could not load functions file: " .. err)
+        end
+        
+        for name in pairs(function_registry) do
+            if reg:find(name) then
+                function_registry[name] = nil
+            end
+        end
+        for name in pairs(unregistered) do
+            if reg:find(name) then
+                unregistered[name] = nil
+            end
+        end
+        table.insert(mapped_files, 1, {reg = reg, path = filename})
+        
+        -- Unused entries are symbolized at their saved address; one found
+        -- by byte signature moves when it is first used and resolved again
+        for index = 1, reg:count() do
+            local name, address, _, _, _, size = reg:entry(index)
+            symbols.add(name, address, size)
+        end
+    end
+    local new_count = function_count()
     
     print(string.format("Loaded function registrations from: %s", filename))
     print(string.format("Functions loaded: %d (total: %d)", new_count - old_count, new_count))
 end
 
+-- Import functions from a Ghidra export
+-- Takes a CSV export of the Functions or Symbol Table window (Name and
+-- Location columns, optionally Function Signature and Function Size) or
+-- a JSON list of {name, address, signature, size} objects, writes it to
+-- a registry file in one pass and loads that. Prototypes are rewritten
+-- as FFI signatures; ones that cannot be read register as "int()".
+-- @param path: Export file
+-- @param options: Optional table:
+--                 output - registry file to write (default: path with a .reg extension)
+--                 types  - C header from Ghidra's "Export C" to pass to ffi.cdef
+function import_ghidra(path, options)
+    options = options or {}
+    local output = options.output or (path:gsub("%.[^./\\]*$", "") .. ".reg")
+    if output == path then
+        error("Output would overwrite the export: " .. path)
+    end
+    
+    local result, err = ghidra.import(path, output)
+    if not result then
+        error("Could not import Ghidra export: " .. err)
+    end
+    print(string.format("Imported %d functions from %s (%s) in %.1f ms, %d rows skipped, %d duplicate names",
+                        result.functions, path, result.format, result.ms, result.skipped, result.duplicates))
+    
+    if options.types then
+        local file = io.open(options.types, "r")
+        if not file then
+            error("Could not open type header: " .. options.types)
+        end
+        local header = file:read("*a")
+        file:close()
+        
+        local ok, cdef_err = pcall(ffi.cdef, header)
+        if not ok then
+            print("Warning: type header not fully declared: " .. tostring(cdef_err))
+        end
+    end
+    
+    load_functions(output)
+    return result
+end
+
 -- Debug and logging management functions
 function debug_enable(enabled)
     debug_settings.enabled = enabled ~= false
     print("Debug logging: " .. (debug_settings.enabled and "ENABLED" or "DISABLED"))
 end
 
-function debug_config(config)
+-- Change debug settings, or print them when called without a table
+-- @param config: Optional {setting = value}
+-- @param quiet: Optional, change settings without printing
+-- @return a copy of the current settings
+function debug_config(config, quiet)
     if config then
         for key, value in pairs(config) do
             if debug_settings[key] ~= nil then
                 debug_settings[key] = value
-                print(string.format("Debug setting %s: %s", key, tostring(value)))
+                if key == "max_log_entries" then
+                    -- Rings have a fixed capacity; resizing starts them empty
+                    call_log = ringlog.new(value)
+                    memory_log = ringlog.new(value)
+                end
+                if not quiet then
+                    print(string.format("Debug setting %s: %s", key, tostring(value)))
+                end
             end
         end
-    else
+    elseif not quiet then
         print("Current debug settings:")
         for key, value in pairs(debug_settings) do
             print(string.format("  %s: %s", key, tostring(value)))
         end
     end
+    
+    local copy = {}
+    for key, value in pairs(debug_settings) do
+        copy[key] = value
+    end
+    return copy
 end
 
 function show_call_log(count)
@@ -545,18 +1184,20 @@ function show_call_log(count)
     print(string.format("Recent function calls (last %d):", count))
     print(string.rep("-", 60))
     
-    local start_idx = math.max(1, #call_log - count + 1)
-    for i = start_idx, #call_log do
-        local entry = call_log[i]
-        print(string.format("[%s] %s", entry.timestamp, entry.data.summary))
-        
-        if entry.data.execution_time then
-            print(string.format("    Time: %.2fms, Success: %s", 
-                              entry.data.execution_time, tostring(entry.data.success)))
+    local records = call_log:records(count)
+    for _, r in ipairs(records) do
+        local params = format_parameters(unpack(r.args))
+        if r.argc > #r.args then
+            params = params .. ", ..."
         end
+        print(string.format("[%s] %s(%s) [%s] @ 0x%08X", os.date("%H:%M:%S", math.floor(r.time)),
+                            r.name or "?", params, r.kind == "main" and "main thread" or "console thread",
+                            r.address))
+        print(string.format("    Time: %.2fms, Success: %s, Result: %s", 
+                          r.duration_ms, tostring(r.ok), tostring(r.result)))
     end
     
-    if #call_log == 0 then
+    if #records == 0 then
         print("  No function calls logged")
     end
 end
@@ -566,54 +1207,154 @@ function show_memory_log(count)
     print(string.format("Recent memory operations (last %d):", count))
     print(string.rep("-", 60))
     
-    local start_idx = math.max(1, #memory_log - count + 1)
-    for i = start_idx, #memory_log do
-        local entry = memory_log[i]
-        print(string.format("[%s] %s", entry.timestamp, entry.data.summary))
-        
-        if entry.data.bytes_processed then
-            print(string.format("    Bytes: %d, Success: %s", 
-                              entry.data.bytes_processed, tostring(entry.data.success)))
-        end
+    local records = memory_log:records(count)
+    for _, r in ipairs(records) do
+        print(string.format("[%s] %s 0x%08X (%d bytes) -> %s", os.date("%H:%M:%S", math.floor(r.time)),
+                            r.kind:upper(), r.address, r.size, r.ok and "SUCCESS" or "FAILED"))
     end
     
-    if #memory_log == 0 then
+    if #records == 0 then
         print("  No memory operations logged")
     end
 end
 
 function clear_logs()
-    call_log = {}
-    memory_log = {}
+    call_log:clear()
+    memory_log:clear()
     print("All logs cleared")
 end
 
--- Helper function to count table entries
-function table_count(t)
-    local count = 0
-    for _ in pairs(t) do count = count + 1 end
-    return count
+-- Write both logs to disk as binary records (see src/ringlog.c for the layout)
+-- @param basename: Optional path prefix, default "lua/calllog"
+function dump_logs(basename)
+    basename = basename or DEFAULT_LOG_DUMP
+    local calls, err = call_log:dump(basename .. "_calls.bin")
+    if not calls then
+        error(err)
+    end
+    local memory, err2 = memory_log:dump(basename .. "_memory.bin")
+    if not memory then
+        error(err2)
+    end
+    print(string.format("Dumped %d calls and %d memory operations to %s_*.bin", calls, memory, basename))
+end
+
+-- Stream every call and memory operation, plus hook_log.txt lines, to a
+-- binary trace file until trace_stop(); independent of debug logging.
+-- Convert with tools/traceconv (text or Chrome trace JSON)
+-- @param path: Optional trace file, default "lua/trace.bin"
+function trace_start(path)
+    local ok, err = trace.start(path)
+    if not ok then
+        error(err)
+    end
+    trace_on = true
+    print(string.format("Tracing to %s", trace.stats().path))
+end
+
+function trace_stop()
+    trace_on = false
+    local events = trace.stop()
+    print(string.format("Trace stopped, %d events written", events))
+    return events
+end
+
+-- Latency of calls made through game.call / game.call_main, measured on
+-- the performance counter: count, errors, min/mean/p50/p90/p99/p99.9/max
+-- in milliseconds. Without a name, prints every function that was called.
+-- @param name: Optional function name
+function function_stats(name)
+    if name then
+        local func_info = function_registry[name]
+        if not func_info then
+            error("Function '" .. name .. "' not registered")
+        end
+        return func_info.stats:stats()
+    end
+    
+    local names = {}
+    for registered, info in pairs(function_registry) do
+        if #info.stats > 0 then
+            table.insert(names, registered)
+        end
+    end
+    table.sort(names)
+    
+    print(string.format("%-28s %8s %6s %9s %9s %9s %9s", "Function", "Calls", "Errors", "p50 ms", "p99 ms",
+                        "max ms", "total ms"))
+    local all = {}
+    for _, registered in ipairs(names) do
+        local stats = function_registry[registered].stats:stats()
+        all[registered] = stats
+        print(string.format("%-28s %8d %6d %9.3f %9.3f %9.3f %9.1f", registered, stats.count, stats.errors,
+                            stats.p50_ms, stats.p99_ms, stats.max_ms, stats.total_ms))
+    end
+    if #names == 0 then
+        print("  No calls recorded")
+    end
+    return all
+end
+
+-- Clear latency stats for one function, or all of them
+-- @param name: Optional function name
+function function_stats_reset(name)
+    for registered, info in pairs(function_registry) do
+        if not name or registered == name then
+            info.stats:reset()
+        end
+    end
 end
 
 -- Export the API
 return {
     -- Core functions
     register = register_function,
+    register_sig = register_signature,
+    unregister = unregister_function,
     call = call_function,
+    bind = bind_function,
     call_main = call_function_main,
+    call_async = call_function_async,
     list = list_functions,
+    symbols = function_symbols,
+    symbolize = symbolize,
+    symbolize_many = symbolize_many,
     read_mem = read_memory,
+    view = view_memory,
     write_mem = write_memory,
     get_module_base = get_module_base,
+    walker = create_walker,
+    
+    -- Per-frame callbacks (run on the main thread)
+    on_frame = frame.on_frame,
+    on_tick = frame.on_tick,
+    cancel_tick = frame.cancel,
+    frame_budget = frame.budget,
+    frame_stats = frame.stats,
+    frame_hook = hook_frame_function,
+    frame_unhook = frame.detach,
+    present_hook = hook_present_function,
+    present_unhook = frametime.detach,
+    
+    -- Inline hooks on registered functions
+    hook = hook_function,
+    unhook = unhook_function,
+    hook_stats = hook_stats,
     
     -- Save/Load functions
     save = save_functions,
     load = load_functions,
+    import_ghidra = import_ghidra,
     
     -- Debug functions
     debug_on = debug_enable,
     debug_config = debug_config,
     show_calls = show_call_log,
     show_memory = show_memory_log,
-    clear_logs = clear_logs
+    clear_logs = clear_logs,
+    dump_logs = dump_logs,
+    stats = function_stats,
+    stats_reset = function_stats_reset,
+    trace_start = trace_start,
+    trace_stop = trace_stop
 }
\ No newline at end of file
@@ -1,24 +1,48 @@
 -- Europa 1400 Lua Console - Initialization Script
 -- Loads all required modules and sets up the console environment
 
-local ffi = require('ffi')
+-- Shared Windows bindings, declared once for every script; k32 is kept for
+-- older scripts
+win32 = require('lua/win32')
+k32 = win32.kernel32
 
--- Load basic Windows API for compatibility
-ffi.cdef[[
-    void __stdcall Sleep(unsigned long dwMilliseconds);
-]]
-k32 = ffi.load('kernel32')
+-- Table that loads a module on first access, so compiling it stays off the
+-- startup path. A module that fails to load is retried next time.
+local function lazy_module(path)
+    return setmetatable({}, {
+        __index = function(proxy, key)
+            local module = dofile(path)
+            setmetatable(proxy, nil)
+            for name, value in pairs(module) do
+                rawset(proxy, name, value)
+            end
+            return rawget(proxy, key)
+        end
+    })
+end
+
+-- Function that forwards to a lazily loaded module's field
+local function lazy_function(module, name)
+    return function(...)
+        return module[name](...)
+    end
+end
 
 -- Load core modules
 game = dofile('lua/game_functions.lua')    -- Game function registration system
-system = dofile('lua/sysinfo.lua')        -- System diagnostic functions
+system = lazy_module('lua/sysinfo.lua')   -- System diagnostic functions
+bench = lazy_module('lua/bench.lua')      -- Microbenchmark harness
 
--- Load utility modules  
-local beep_module = dofile('lua/beep.lua')
-beep = beep_module.beep                    -- System beep (console thread)
-beep_main = beep_module.beep_main          -- System beep (main process)
-thread_info = beep_module.info             -- Thread information
-beep_types = beep_module.types             -- Beep type constants
+-- Load utility modules on first use
+local beep_module = lazy_module('lua/beep.lua')
+beep = lazy_function(beep_module, "beep")              -- System beep (console thread)
+beep_main = lazy_function(beep_module, "beep_main")    -- System beep (main process)
+thread_info = lazy_function(beep_module, "info")       -- Thread information
+beep_types = setmetatable({}, {                        -- Beep type constants
+    __index = function(_, key)
+        return beep_module.types[key]
+    end
+})
 
 -- Console help function
 function help()
@@ -32,9 +56,28 @@ function help()
     print("GAME FUNCTIONS (game.*)")
     print("  game.register(name, addr, sig, desc)  Register game function from Ghidra")
     print("  game.call(name, ...)                  Call registered function")
+    print("  game.bind(name)                       Fast callable for hot loops (no logging)")
     print("  game.list()                           List all registered functions")
+    print("  game.symbolize(addr)                  Registered function and offset at an address")
     print("  game.save([filename])                 Save functions to file")
     print("  game.load([filename])                 Load functions from file")
+    print("  game.import_ghidra(path [, opts])     Import a Ghidra CSV/JSON function export")
+    print("  mem.scan(pattern [, opts])            Find byte signature (\"8B 0D ?? ?? 85 C9\")")
+    print("  mem.view(addr, ctype [, count])       Typed pointer into game memory")
+    print("  mem.region_of(addr)                   Region, protection and module of an address")
+    print("  mem.snapshot([opts])                  Snapshot memory, then s:filter_changed() etc.")
+    print("  mem.watch(addr, size, mode [, fn])    Report writes/accesses as they happen (mem.watch_poll)")
+    print("  game.walker(spec)                     Native walk over linked game objects, w:refresh(roots)")
+    print()
+    
+    -- Per-frame callbacks
+    print("FRAME CALLBACKS (frame.*)")
+    print("  frame.on_frame(fn)                    Run fn(dt) every frame on the main thread")
+    print("  frame.on_tick(ms, fn)                 Run fn(dt) every ms milliseconds")
+    print("  frame.cancel(id)                      Remove a callback")
+    print("  frame.budget([ms])                    Get/set per-frame Lua budget")
+    print("  game.frame_hook(name_or_addr)         Drive callbacks from the game's frame function")
+    print("  game.present_hook(name_or_addr)       Measure frame times at the present/flip call")
     print()
     
     -- System diagnostic functions  
@@ -45,6 +88,18 @@ function help()
     print("  system.window_info()    Window information") 
     print("  system.memory_layout()  Memory layout overview")
     print("  system.thread_info()    Thread information")
+    print("  system.profile([s])     Sample the main thread, show hot functions")
+    print("  system.frame_stats()    Frame times, hitches and our share of each frame")
+    print("  system.frame_overlay([mode])  Live stats on the console (\"status\", \"title\", \"off\")")
+    print("  startup_times           Attach-to-prompt timing of this session")
+    print()
+    
+    -- Benchmarks
+    print("BENCHMARKS (bench.*)")
+    print("  bench.run(name, fn [, opts])  Time fn: median ns/op and spread")
+    print("  bench.suite([filter])         Standard call/memory/scan/log benchmarks")
+    print("  bench.save(results [, path])  Keep results as a baseline")
+    print("  bench.compare(results [, path])  Flag regressions against a baseline")
     print()
     
     -- Utility functions
@@ -53,6 +108,20 @@ function help()
     print("  list()                  Alias for game.list()")
     print("  beep()                  System beep (console thread)")
     print("  thread_info()           Basic thread info")
+    print("  output.quiet(path|false)  Send all output to a file, or back")
+    print("  output.pager(lines)     Spill a command's output past lines to a file")
+    print()
+    
+    -- Background jobs
+    print("JOBS")
+    print("  sleep(ms)               Suspend the current job")
+    print("  await(future [, ms])    Wait for game.call_async() without blocking")
+    print("  yield()                 Let other jobs and input run")
+    print("  sched.spawn(fn)         Start a background job")
+    print("  jobs / kill <id>        List or stop background jobs")
+    print("  run <path>              Run a script file as a job")
+    print("  workers.spawn(script)   Run a script in its own Lua state on another core")
+    print("  remote.start([opts])    Serve eval/call/read/scan to external tools")
     print()
     
     -- Usage examples
@@ -87,6 +156,10 @@ local function show_welcome()
     print()
 end
 
--- Initialize console
-beep()
-show_welcome()
\ No newline at end of file
+-- Initialize console; the startup chime calls user32 directly so beep.lua
+-- stays unloaded until it is used. Worker states (workers.spawn) run this
+-- script too, for the bindings only.
+if workers.id == 0 then
+    win32.user32.MessageBeep(0)
+    show_welcome()
+end
\ No newline at end of file
@@ -10,65 +10,10 @@
 
 local ffi = require('ffi')
 
--- Windows API definitions for system diagnostics
-ffi.cdef[[
-    // Process and thread information
-    void* GetCurrentProcess();
-    unsigned long GetCurrentProcessId();
-    void* GetCurrentThread();
-    unsigned long GetCurrentThreadId();
-    
-    // Module management
-    void* GetModuleHandleA(const char* lpModuleName);
-    unsigned long GetModuleFileNameA(void* hModule, char* lpFilename, unsigned long nSize);
-    void* GetProcAddress(void* hModule, const char* lpProcName);
-    
-    // System information
-    int GetSystemInfo(void* lpSystemInfo);
-    int GlobalMemoryStatusEx(void* lpBuffer);
-    
-    // Window management
-    void* GetConsoleWindow();
-    unsigned long GetWindowThreadProcessId(void* hWnd, unsigned long* lpdwProcessId);
-    int GetWindowTextA(void* hWnd, char* lpString, int nMaxCount);
-    void* FindWindowA(const char* lpClassName, const char* lpWindowName);
-    int EnumWindows(void* lpEnumFunc, uintptr_t lParam);
-    int IsWindowVisible(void* hWnd);
-    int GetClassNameA(void* hWnd, char* lpClassName, int nMaxCount);
-    void* GetWindow(void* hWnd, unsigned int uCmd);
-    void* GetParent(void* hWnd);
-    
-    // System information structures
-    typedef struct {
-        unsigned short wProcessorArchitecture;
-        unsigned short wReserved;
-        unsigned long dwPageSize;
-        void* lpMinimumApplicationAddress;
-        void* lpMaximumApplicationAddress;
-        uintptr_t dwActiveProcessorMask;
-        unsigned long dwNumberOfProcessors;
-        unsigned long dwProcessorType;
-        unsigned long dwAllocationGranularity;
-        unsigned short wProcessorLevel;
-        unsigned short wProcessorRevision;
-    } SYSTEM_INFO;
-    
-    typedef struct {
-        unsigned long dwLength;
-        unsigned long dwMemoryLoad;
-        uint64_t ullTotalPhys;
-        uint64_t ullAvailPhys;
-        uint64_t ullTotalPageFile;
-        uint64_t ullAvailPageFile;
-        uint64_t ullTotalVirtual;
-        uint64_t ullAvailVirtual;
-        uint64_t ullAvailExtendedVirtual;
-    } MEMORYSTATUSEX;
-]]
-
--- Load Windows system DLLs
-local user32 = ffi.load('user32')
-local kernel32 = ffi.load('kernel32')
+-- Shared Windows bindings
+local win32 = require('lua/win32')
+local user32 = win32.user32
+local kernel32 = win32.kernel32
 
 --============================================================================
 -- CONSTANTS
@@ -82,6 +27,9 @@ local GW_HWNDPREV = 3
 local GW_OWNER = 4
 local GW_CHILD = 5
 
+-- Collapsed-stack output of system.profile(), for flamegraph.pl or speedscope
+local DEFAULT_PROFILE_OUTPUT = "lua/profile.folded"
+
 --============================================================================
 -- UTILITY FUNCTIONS
 --============================================================================
@@ -182,27 +130,13 @@ local function list_modules()
     print("=" .. string.rep("=", 30))
     
     local modules = {}
-    local common_modules = {
-        "kernel32.dll", "user32.dll", "ntdll.dll", "advapi32.dll",
-        "gdi32.dll", "comctl32.dll", "ole32.dll", "shell32.dll",
-        "msvcrt.dll", "d3d8.dll", "d3d9.dll", "opengl32.dll",
-        "winmm.dll", "dsound.dll", "dinput8.dll"
-    }
-    
-    for _, module_name in ipairs(common_modules) do
-        local hModule = kernel32.GetModuleHandleA(module_name)
-        if hModule ~= nil then
-            local filename = ffi.new("char[?]", 260)
-            local length = kernel32.GetModuleFileNameA(hModule, filename, 260)
-            if length > 0 then
-                local base_addr = tonumber(ffi.cast("uintptr_t", hModule))
-                print(string.format("  %-15s: 0x%08X - %s", module_name, base_addr, ffi.string(filename)))
-                modules[module_name] = {
-                    base_address = base_addr,
-                    path = ffi.string(filename)
-                }
-            end
-        end
+    for _, module in ipairs(mem.modules()) do
+        print(string.format("  %-20s: 0x%08X - %s", module.name, module.base, module.path))
+        modules[module.name:lower()] = {
+            base_address = module.base,
+            size = module.size,
+            path = module.path
+        }
     end
     
     return modules
@@ -338,27 +272,133 @@ local function show_memory_layout()
     print("=" .. string.rep("=", 30))
     
     local modules = {}
-    local common_modules = {"kernel32.dll", "user32.dll", "ntdll.dll"}
-    
-    for _, module_name in ipairs(common_modules) do
-        local hModule = kernel32.GetModuleHandleA(module_name)
-        if hModule ~= nil then
-            local base_addr = tonumber(ffi.cast("uintptr_t", hModule))
-            print(string.format("  %-12s: 0x%08X", module_name, base_addr))
-            modules[module_name] = base_addr
-        end
+    for _, module in ipairs(mem.modules()) do
+        print(string.format("  0x%08X - 0x%08X  %s", module.base, module.base + module.size, module.name))
+        modules[module.name:lower()] = module.base
     end
     
-    -- Show some key addresses
-    local currentProcess = kernel32.GetCurrentProcess()
-    local currentThread = kernel32.GetCurrentThread()
+    -- Committed memory by kind and access, from the shared region index
+    local totals = {image = 0, mapped = 0, private = 0}
+    local access = {}
+    local regions = mem.regions()
+    for _, region in ipairs(regions) do
+        totals[region.type] = totals[region.type] + region.size
+        access[region.protect] = (access[region.protect] or 0) + region.size
+    end
     
-    print(string.format("  Current Process: 0x%08X", tonumber(ffi.cast("uintptr_t", currentProcess))))
-    print(string.format("  Current Thread:  0x%08X", tonumber(ffi.cast("uintptr_t", currentThread))))
+    print()
+    print(string.format("  %d committed regions", #regions))
+    for _, kind in ipairs({"image", "mapped", "private"}) do
+        print(string.format("  %-8s %s", kind, format_bytes(totals[kind])))
+    end
+    for protect, bytes in pairs(access) do
+        print(string.format("  %-8s %s", protect, format_bytes(bytes)))
+    end
     
     return modules
 end
 
+-- Sample the game's main thread for a while and show where it spends its
+-- time, attributed to registered game functions where possible
+-- @param seconds: How long to sample, default 5
+-- @param opts: Optional {interval = ms, depth = frames, top = n, output = path}
+local function profile(seconds, opts)
+    opts = opts or {}
+    seconds = seconds or 5
+    -- The profiler reads 0 as "until stopped", and wait() would never return
+    if type(seconds) ~= "number" or seconds <= 0 then
+        error("profile: seconds must be a positive number")
+    end
+    
+    local ok, err = profiler.start({
+        seconds = seconds,
+        interval = opts.interval,
+        depth = opts.depth,
+        thread = opts.thread
+    })
+    if not ok then
+        error(err)
+    end
+    
+    print(string.format("Profiling for %.1f s...", seconds))
+    profiler.wait()
+    profiler.stop()
+    
+    -- Samples are named from the registered functions' address index
+    local report = profiler.report({
+        top = opts.top or 20,
+        collapsed = opts.output or DEFAULT_PROFILE_OUTPUT
+    })
+    
+    print(string.format("%d samples of thread %d over %.0f ms (%d missed)",
+          report.samples, report.thread, report.duration_ms, report.missed))
+    print(string.format("  %6s %6s  %s", "self%", "total%", "function"))
+    for _, entry in ipairs(report.top) do
+        print(string.format("  %6.2f %6.2f  %s", entry.self_pct, entry.total_pct, entry.name))
+    end
+    if report.collapsed then
+        print(string.format("Collapsed stacks written to %s", report.collapsed))
+    elseif report.collapsed_error then
+        print(string.format("Could not write %s", report.collapsed_error))
+    end
+    
+    return report
+end
+
+-- Show the frame-time distribution, hitches and how much of each frame
+-- went to our own Lua and hook work
+-- @param opts: Optional {hitches = n} to list the n most recent hitches (default 5)
+local function show_frame_stats(opts)
+    opts = opts or {}
+    local stats = frametime.stats()
+    
+    print("Frame Timing")
+    print(separator(30))
+    
+    if stats.frames == 0 then
+        print("No frames measured yet; hook the game loop with game.present_hook()")
+        print("or game.frame_hook() first")
+        return stats
+    end
+    
+    local f = stats.frame
+    print(string.format("Source: %s, %d frames, %.1f fps average", stats.source, stats.frames, stats.fps))
+    print(string.format("Frame time: mean %.2f ms, p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f",
+          f.mean_ms, f.p50_ms, f.p90_ms, f.p99_ms, f.p999_ms, f.max_ms))
+    print(string.format("Hitches over %.0f ms: %d (%d where our work took half the frame or more)",
+          stats.hitch_ms, stats.hitches, stats.mod_hitches))
+    print(string.format("Our work: mean %.3f ms/frame, p99 %.3f, max %.3f, %.2f%% of frame time",
+          stats.mod.mean_ms, stats.mod.p99_ms, stats.mod.max_ms, stats.mod_pct))
+    
+    local recent = stats.recent
+    print(string.format("Last %d frames: %.1f fps, max %.2f ms, %d hitches, our share %.2f%%",
+          recent.frames, recent.fps, recent.max_ms, recent.hitches, recent.mod_pct))
+    
+    local count = opts.hitches or 5
+    local hitches = frametime.hitches()
+    if count > 0 and #hitches > 0 then
+        print("Recent hitches:")
+        for i = 1, math.min(count, #hitches) do
+            local hitch = hitches[i]
+            print(string.format("  %8.1f s ago  %8.2f ms  (ours %.2f ms)",
+                  hitch.ago_ms / 1000, hitch.frame_ms, hitch.mod_ms))
+        end
+    end
+    
+    return stats
+end
+
+-- Keep a live frame-time summary on screen
+-- @param mode: "status" (top console row), "title" (console title) or "off"
+local function frame_overlay(mode)
+    if mode == nil then
+        mode = frametime.overlay() == "off" and "status" or "off"
+    end
+    local current = frametime.overlay(mode)
+    print("Frame overlay: " .. current)
+    return current
+end
+
 -- Export functions
 return {
     thread_info = show_thread_info,
@@ -366,5 +406,8 @@ return {
     memory_info = show_memory_info,
     list_modules = list_modules,
     window_info = show_window_info,
-    memory_layout = show_memory_layout
+    memory_layout = show_memory_layout,
+    profile = profile,
+    frame_stats = show_frame_stats,
+    frame_overlay = frame_overlay
 }
\ No newline at end of file
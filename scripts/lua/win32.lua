@@ -0,0 +1,128 @@
+-- Europa 1400 - Shared Win32 Bindings
+--
+-- Every script gets its Windows API from here, through
+-- require('lua/win32'), so:
+-- - The declarations are parsed once per session, and reloading a script
+--   with dofile can't hit "attempt to redefine" on a struct
+-- - The kernel32/user32 handles are shared; LuaJIT caches each resolved
+--   symbol on the handle, so a function is looked up once in total
+-- - win32.proc(dll, name) caches raw export addresses for code that
+--   registers or hooks Win32 functions by address
+
+local ffi = require('ffi')
+
+ffi.cdef[[
+    // Process and thread management
+    void* GetCurrentProcess();
+    unsigned long GetCurrentProcessId();
+    void* GetCurrentThread();
+    unsigned long GetCurrentThreadId();
+    int CloseHandle(void* hObject);
+    void __stdcall Sleep(unsigned long dwMilliseconds);
+    int GetProcessAffinityMask(void* hProcess, uintptr_t* lpProcessAffinityMask, uintptr_t* lpSystemAffinityMask);
+    uintptr_t SetThreadAffinityMask(void* hThread, uintptr_t dwThreadAffinityMask);
+    int GetThreadPriority(void* hThread);
+    int SetThreadPriority(void* hThread, int nPriority);
+
+    // Memory management
+    void* VirtualAllocEx(void* hProcess, void* lpAddress, unsigned long dwSize,
+                        unsigned long flAllocationType, unsigned long flProtect);
+    int VirtualFreeEx(void* hProcess, void* lpAddress, unsigned long dwSize, unsigned long dwFreeType);
+    int WriteProcessMemory(void* hProcess, void* lpBaseAddress, const void* lpBuffer,
+                          unsigned long nSize, unsigned long* lpNumberOfBytesWritten);
+    int ReadProcessMemory(void* hProcess, const void* lpBaseAddress, void* lpBuffer,
+                         unsigned long nSize, unsigned long* lpNumberOfBytesRead);
+
+    // Module management
+    void* GetModuleHandleA(const char* lpModuleName);
+    unsigned long GetModuleFileNameA(void* hModule, char* lpFilename, unsigned long nSize);
+    void* GetProcAddress(void* hModule, const char* lpProcName);
+
+    // System information
+    int GetSystemInfo(void* lpSystemInfo);
+    int GlobalMemoryStatusEx(void* lpBuffer);
+
+    // Window management
+    void* GetConsoleWindow();
+    unsigned long GetWindowThreadProcessId(void* hWnd, unsigned long* lpdwProcessId);
+    int GetWindowTextA(void* hWnd, char* lpString, int nMaxCount);
+    void* FindWindowA(const char* lpClassName, const char* lpWindowName);
+    int EnumWindows(void* lpEnumFunc, uintptr_t lParam);
+    int IsWindowVisible(void* hWnd);
+    int GetClassNameA(void* hWnd, char* lpClassName, int nMaxCount);
+    void* GetWindow(void* hWnd, unsigned int uCmd);
+    void* GetParent(void* hWnd);
+
+    // Sound functions
+    int MessageBeep(unsigned int uType);
+
+    // System information structures
+    typedef struct {
+        unsigned short wProcessorArchitecture;
+        unsigned short wReserved;
+        unsigned long dwPageSize;
+        void* lpMinimumApplicationAddress;
+        void* lpMaximumApplicationAddress;
+        uintptr_t dwActiveProcessorMask;
+        unsigned long dwNumberOfProcessors;
+        unsigned long dwProcessorType;
+        unsigned long dwAllocationGranularity;
+        unsigned short wProcessorLevel;
+        unsigned short wProcessorRevision;
+    } SYSTEM_INFO;
+
+    typedef struct {
+        unsigned long dwLength;
+        unsigned long dwMemoryLoad;
+        uint64_t ullTotalPhys;
+        uint64_t ullAvailPhys;
+        uint64_t ullTotalPageFile;
+        uint64_t ullAvailPageFile;
+        uint64_t ullTotalVirtual;
+        uint64_t ullAvailVirtual;
+        uint64_t ullAvailExtendedVirtual;
+    } MEMORYSTATUSEX;
+]]
+
+-- Load Windows system DLLs
+local kernel32 = ffi.load('kernel32')
+local user32 = ffi.load('user32')
+
+--============================================================================
+-- EXPORT LOOKUP
+--============================================================================
+
+-- Resolved addresses by "dll!name"; failed lookups are not cached, so a
+-- DLL loaded later is still found
+local proc_cache = {}
+
+-- Address of an exported function as a number, or nil
+-- @param dll: Module name, e.g. "kernel32.dll"
+-- @param name: Export name
+local function proc_address(dll, name)
+    local key = dll:lower() .. "!" .. name
+    local address = proc_cache[key]
+    if address then
+        return address
+    end
+
+    local module = kernel32.GetModuleHandleA(dll)
+    if module == nil then
+        return nil
+    end
+    local proc = kernel32.GetProcAddress(module, name)
+    if proc == nil then
+        return nil
+    end
+
+    address = tonumber(ffi.cast("uintptr_t", proc))
+    proc_cache[key] = address
+    return address
+end
+
+-- Export bindings
+return {
+    kernel32 = kernel32,
+    user32 = user32,
+    proc = proc_address
+}
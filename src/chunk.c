@@ -0,0 +1,521 @@
+/*
+ * chunk.c: Multi-line console input and the compiled chunk cache.
+ *
+ * Console lines accumulate here until they form a complete chunk. A small
+ * scanner follows each line as it arrives, tracking open blocks, brackets,
+ * strings and comments, so a statement that is obviously unfinished waits
+ * for the next line without being compiled. Once the scanner sees the
+ * chunk closed it is compiled; a syntax error at '<eof>' (as lua.c treats
+ * it) still means more input is needed. Each line is scanned once, so a
+ * pasted script costs a compile per complete chunk, not per line.
+ *
+ * Pending input is kept in blocks and handed to lua_load through a reader,
+ * so a large paste is never copied into one buffer. Compiled chunks are
+ * cached by a 64-bit FNV-1a hash and length of their source; running the
+ * same command again reuses the function without parsing it.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "chunk.h"
+#include "lauxlib.h"
+
+#define CHUNK_EOF_MARK "'<eof>'"
+
+typedef struct chunk_block
+{
+    struct chunk_block *next;
+    size_t              length;
+    size_t              capacity;
+    char                text[];
+} chunk_block;
+
+typedef enum
+{
+    SCAN_CODE = 0,
+    SCAN_STRING,
+    SCAN_LONG_STRING,
+    SCAN_LONG_COMMENT
+} scan_mode;
+
+typedef struct
+{
+    scan_mode mode;
+    char      quote; /* Delimiter of a short string */
+    int       level; /* Number of '=' in a long bracket */
+    int       blocks;
+    int       brackets;
+} scan_state;
+
+typedef struct
+{
+    uint64_t hash;
+    size_t   length;
+    int      ref; /* LUA_NOREF for an empty slot */
+    uint32_t used;
+} chunk_entry;
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t incomplete; /* Compiles that ended at '<eof>' */
+    uint32_t evicted;
+} chunk_stats;
+
+static chunk_block *g_first = NULL;
+static chunk_block *g_last = NULL;
+static size_t       g_length = 0;
+static uint64_t     g_hash = 14695981039346656037ull;
+static scan_state   g_scan = {0};
+static char         g_name[CHUNK_NAME_SIZE] = "";
+
+static chunk_entry  g_cache[CHUNK_CACHE_SIZE];
+static bool         g_cacheReady = false;
+static uint32_t     g_clock = 0;
+static chunk_stats  g_stats = {0};
+
+//============================================================================
+// SCANNER
+//============================================================================
+
+// Level of a long bracket opening at text ("[[" is 0, "[==[" is 2), or -1
+static int long_open(const char *text, size_t length)
+{
+    size_t i = 1;
+    while (i < length && text[i] == '=')
+    {
+        i++;
+    }
+    return i < length && text[i] == '[' ? (int)(i - 1) : -1;
+}
+
+static bool long_close(const char *text, size_t length, int level)
+{
+    if ((size_t)level + 2 > length)
+    {
+        return false;
+    }
+    for (int i = 1; i <= level; i++)
+    {
+        if (text[i] != '=')
+        {
+            return false;
+        }
+    }
+    return text[level + 1] == ']';
+}
+
+static bool is_word_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static void scan_word(const char *word, size_t length)
+{
+#define WORD_IS(literal) (length == sizeof(literal) - 1 && memcmp(word, literal, length) == 0)
+    if (WORD_IS("function") || WORD_IS("if") || WORD_IS("do") || WORD_IS("repeat"))
+    {
+        g_scan.blocks++;
+    }
+    else if (WORD_IS("end") || WORD_IS("until"))
+    {
+        g_scan.blocks--;
+    }
+#undef WORD_IS
+}
+
+// Follows one line. `while` and `for` need no case: their `do` opens the block.
+static void scan_line(const char *text, size_t length)
+{
+    size_t i = 0;
+    while (i < length)
+    {
+        char c = text[i];
+        switch (g_scan.mode)
+        {
+        case SCAN_STRING:
+            if (c == '\\')
+            {
+                i += 2;
+                continue;
+            }
+            if (c == g_scan.quote || c == '\n')
+            {
+                g_scan.mode = SCAN_CODE; /* An unfinished string is the compiler's to report */
+            }
+            i++;
+            continue;
+
+        case SCAN_LONG_STRING:
+        case SCAN_LONG_COMMENT:
+            if (c == ']' && long_close(text + i, length - i, g_scan.level))
+            {
+                g_scan.mode = SCAN_CODE;
+                i += (size_t)g_scan.level + 2;
+                continue;
+            }
+            i++;
+            continue;
+
+        case SCAN_CODE:
+            break;
+        }
+
+        if (c == '-' && i + 1 < length && text[i + 1] == '-')
+        {
+            i += 2;
+            int level = i < length && text[i] == '[' ? long_open(text + i, length - i) : -1;
+            if (level >= 0)
+            {
+                g_scan.mode = SCAN_LONG_COMMENT;
+                g_scan.level = level;
+                i += (size_t)level + 2;
+            }
+            else
+            {
+                const char *newline = memchr(text + i, '\n', length - i);
+                i = newline ? (size_t)(newline - text) : length;
+            }
+            continue;
+        }
+
+        if (c == '[')
+        {
+            int level = long_open(text + i, length - i);
+            if (level >= 0)
+            {
+                g_scan.mode = SCAN_LONG_STRING;
+                g_scan.level = level;
+                i += (size_t)level + 2;
+                continue;
+            }
+        }
+
+        if (c == '"' || c == '\'')
+        {
+            g_scan.mode = SCAN_STRING;
+            g_scan.quote = c;
+        }
+        else if (c == '(' || c == '{' || c == '[')
+        {
+            g_scan.brackets++;
+        }
+        else if (c == ')' || c == '}' || c == ']')
+        {
+            g_scan.brackets--;
+        }
+        else if (is_word_char(c))
+        {
+            // Numbers are skipped the same way; none of them is a keyword
+            size_t start = i;
+            while (i < length && is_word_char(text[i]))
+            {
+                i++;
+            }
+            scan_word(text + start, i - start);
+            continue;
+        }
+        i++;
+    }
+}
+
+//============================================================================
+// PENDING INPUT
+//============================================================================
+
+static void hash_bytes(const char *text, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        g_hash = (g_hash ^ (uint8_t)text[i]) * 1099511628211ull;
+    }
+}
+
+static bool store(const char *text, size_t length)
+{
+    if (!g_last || g_last->capacity - g_last->length < length)
+    {
+        size_t       capacity = length > CHUNK_BLOCK_SIZE ? length : CHUNK_BLOCK_SIZE;
+        chunk_block *block = malloc(sizeof(chunk_block) + capacity);
+        if (!block)
+        {
+            return false;
+        }
+        block->next = NULL;
+        block->length = 0;
+        block->capacity = capacity;
+        if (g_last)
+        {
+            g_last->next = block;
+        }
+        else
+        {
+            g_first = block;
+        }
+        g_last = block;
+    }
+
+    memcpy(g_last->text + g_last->length, text, length);
+    g_last->length += length;
+    g_length += length;
+    hash_bytes(text, length);
+    return true;
+}
+
+// Adds a line; a newline is appended. On failure the chunk is incomplete
+// and must be reset.
+bool chunk_append(const char *line, size_t length)
+{
+    if (g_length == 0)
+    {
+        snprintf(g_name, sizeof(g_name), "%.*s", (int)length, line);
+    }
+
+    if (!store(line, length) || !store("\n", 1))
+    {
+        return false;
+    }
+    scan_line(line, length);
+    scan_line("\n", 1);
+    return true;
+}
+
+// Lines are waiting for the rest of their chunk
+bool chunk_pending(void)
+{
+    return g_length > 0;
+}
+
+// The scanner has the chunk unfinished; compiling it would end at '<eof>'
+bool chunk_open(void)
+{
+    return g_scan.mode != SCAN_CODE || g_scan.blocks > 0 || g_scan.brackets > 0;
+}
+
+size_t chunk_length(void)
+{
+    return g_length;
+}
+
+// Copies the pending source without its last newline, as far as it fits.
+// Returns the full length.
+size_t chunk_copy(char *out, size_t size)
+{
+    size_t total = g_length > 0 ? g_length - 1 : 0;
+    size_t copied = 0;
+    for (chunk_block *block = g_first; block && copied + 1 < size; block = block->next)
+    {
+        size_t part = block->length < size - 1 - copied ? block->length : size - 1 - copied;
+        memcpy(out + copied, block->text, part);
+        copied += part;
+    }
+    if (size > 0)
+    {
+        out[copied < total ? copied : total] = '\0';
+    }
+    return total;
+}
+
+// First line of the pending chunk
+const char *chunk_name(void)
+{
+    return g_name;
+}
+
+void chunk_reset(void)
+{
+    while (g_first)
+    {
+        chunk_block *next = g_first->next;
+        free(g_first);
+        g_first = next;
+    }
+    g_last = NULL;
+    g_length = 0;
+    g_hash = 14695981039346656037ull;
+    memset(&g_scan, 0, sizeof(g_scan));
+    g_name[0] = '\0';
+}
+
+//============================================================================
+// COMPILED CHUNK CACHE
+//============================================================================
+
+static void cache_init(void)
+{
+    for (int i = 0; i < CHUNK_CACHE_SIZE; i++)
+    {
+        g_cache[i].ref = LUA_NOREF;
+    }
+    g_cacheReady = true;
+}
+
+static chunk_entry *cache_find(uint64_t hash, size_t length)
+{
+    for (int i = 0; i < CHUNK_CACHE_SIZE; i++)
+    {
+        chunk_entry *entry = &g_cache[i];
+        if (entry->ref != LUA_NOREF && entry->hash == hash && entry->length == length)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Keeps the function on top of the stack, replacing the least recently
+// used entry when the cache is full
+static void cache_store(lua_State *L, uint64_t hash, size_t length)
+{
+    chunk_entry *slot = &g_cache[0];
+    for (int i = 0; i < CHUNK_CACHE_SIZE; i++)
+    {
+        chunk_entry *entry = &g_cache[i];
+        if (entry->ref == LUA_NOREF)
+        {
+            slot = entry;
+            break;
+        }
+        if (entry->used < slot->used)
+        {
+            slot = entry;
+        }
+    }
+
+    if (slot->ref != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, slot->ref);
+        g_stats.evicted++;
+    }
+    lua_pushvalue(L, -1);
+    slot->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    slot->hash = hash;
+    slot->length = length;
+    slot->used = ++g_clock;
+}
+
+static const char *read_block(lua_State *L, void *data, size_t *size)
+{
+    (void)L;
+    chunk_block **cursor = data;
+    chunk_block  *block = *cursor;
+    if (!block)
+    {
+        *size = 0;
+        return NULL;
+    }
+    *cursor = block->next;
+    *size = block->length;
+    return block->text;
+}
+
+// Pushes the compiled pending chunk, from the cache if it was seen before,
+// or the error message. Returns the lua_load status.
+int chunk_load(lua_State *L)
+{
+    if (!g_cacheReady)
+    {
+        cache_init();
+    }
+
+    chunk_entry *entry = cache_find(g_hash, g_length);
+    if (entry)
+    {
+        g_stats.hits++;
+        entry->used = ++g_clock;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, entry->ref);
+        return 0;
+    }
+
+    chunk_block *cursor = g_first;
+    int          status = lua_load(L, read_block, &cursor, g_name);
+    if (status == 0)
+    {
+        g_stats.misses++;
+        cache_store(L, g_hash, g_length);
+    }
+    else if (chunk_incomplete(L, status))
+    {
+        g_stats.incomplete++;
+    }
+    return status;
+}
+
+// The error on top of the stack says the chunk ended too early
+bool chunk_incomplete(lua_State *L, int status)
+{
+    if (status != LUA_ERRSYNTAX)
+    {
+        return false;
+    }
+    size_t      length;
+    const char *message = lua_tolstring(L, -1, &length);
+    size_t      mark = sizeof(CHUNK_EOF_MARK) - 1;
+    return message && length >= mark && strcmp(message + length - mark, CHUNK_EOF_MARK) == 0;
+}
+
+// The cache's references die with the Lua state
+void chunk_shutdown(void)
+{
+    chunk_reset();
+    g_cacheReady = false;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static int l_chunk_stats(lua_State *L)
+{
+    int entries = 0;
+    for (int i = 0; g_cacheReady && i < CHUNK_CACHE_SIZE; i++)
+    {
+        entries += g_cache[i].ref != LUA_NOREF;
+    }
+
+    lua_createtable(L, 0, 7);
+    lua_pushinteger(L, entries);
+    lua_setfield(L, -2, "entries");
+    lua_pushinteger(L, CHUNK_CACHE_SIZE);
+    lua_setfield(L, -2, "capacity");
+    lua_pushnumber(L, g_stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, g_stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, g_stats.incomplete);
+    lua_setfield(L, -2, "incomplete");
+    lua_pushnumber(L, g_stats.evicted);
+    lua_setfield(L, -2, "evicted");
+    lua_pushnumber(L, (lua_Number)g_length);
+    lua_setfield(L, -2, "pending_bytes");
+    return 1;
+}
+
+static int l_chunk_clear(lua_State *L)
+{
+    for (int i = 0; g_cacheReady && i < CHUNK_CACHE_SIZE; i++)
+    {
+        if (g_cache[i].ref != LUA_NOREF)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, g_cache[i].ref);
+            g_cache[i].ref = LUA_NOREF;
+        }
+    }
+    memset(&g_stats, 0, sizeof(g_stats));
+    return 0;
+}
+
+static const luaL_Reg chunk_funcs[] = {{"stats", l_chunk_stats}, {"clear", l_chunk_clear}, {NULL, NULL}};
+
+int luaopen_chunk(lua_State *L)
+{
+    luaL_register(L, "chunk", chunk_funcs);
+    return 1;
+}
@@ -0,0 +1,25 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lua.h"
+
+#define CHUNK_CACHE_SIZE 128   /* Compiled chunks kept, least recently used dropped */
+#define CHUNK_NAME_SIZE 96     /* Chunk names and job labels use the first line */
+#define CHUNK_BLOCK_SIZE 65536 /* Pending input is stored in blocks of at least this size */
+
+bool        chunk_append(const char *line, size_t length);
+bool        chunk_pending(void);
+bool        chunk_open(void);
+size_t      chunk_length(void);
+size_t      chunk_copy(char *out, size_t size);
+const char *chunk_name(void);
+int         chunk_load(lua_State *L);
+bool        chunk_incomplete(lua_State *L, int status);
+void        chunk_reset(void);
+void        chunk_shutdown(void);
+int         luaopen_chunk(lua_State *L);
+
+#endif // CHUNK_H
@@ -0,0 +1,49 @@
+/*
+ * cpu.c: Runtime CPU feature detection for the SIMD kernels.
+ */
+
+#include <cpuid.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cpu.h"
+
+static uint32_t g_features = 0;
+static bool     g_detected = false;
+
+static uint32_t read_xcr0(void)
+{
+    uint32_t eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return eax;
+}
+
+// AVX2 needs both the CPU bit and the OS saving YMM state
+uint32_t cpu_features(void)
+{
+    if (g_detected)
+    {
+        return g_features;
+    }
+
+    unsigned eax, ebx, ecx, edx;
+    uint32_t features = 0;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        if (edx & bit_SSE2)
+        {
+            features |= CPU_SSE2;
+        }
+
+        bool os_avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX) && (read_xcr0() & 0x6) == 0x6;
+        if (os_avx && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2))
+        {
+            features |= CPU_AVX2;
+        }
+    }
+
+    g_features = features;
+    g_detected = true;
+    return features;
+}
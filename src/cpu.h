@@ -0,0 +1,12 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CPU_SSE2 0x1u
+#define CPU_AVX2 0x2u /* Only set when the OS also saves YMM state */
+
+uint32_t cpu_features(void);
+
+#endif // CPU_H
@@ -0,0 +1,453 @@
+/*
+ * detour.c: Minimal x86 inline hooking.
+ *
+ * Overwrites the first instructions of a function with a jmp rel32 to a
+ * hook and builds a trampoline holding the relocated prologue plus a jump
+ * back. Patching suspends every other thread and moves any that are
+ * parked inside the rewritten bytes, so hooks can be placed on functions
+ * the game is actively running.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tlhelp32.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "logging.h"
+
+#define CODE_POOL_SIZE 0x10000u
+
+static SRWLOCK  g_codeLock = SRWLOCK_INIT;
+static uint8_t *g_codePool = NULL;
+static size_t   g_codeUsed = 0;
+
+typedef struct
+{
+    HANDLE *threads;
+    int     count;
+} thread_set;
+
+//============================================================================
+// INSTRUCTION LENGTH DECODER
+//============================================================================
+
+// Length of a ModRM byte plus its SIB and displacement
+static int modrm_length(const uint8_t *p)
+{
+    uint8_t mod = p[0] >> 6;
+    uint8_t rm = p[0] & 7;
+    int     len = 1;
+
+    if (mod == 3)
+    {
+        return 1;
+    }
+
+    if (rm == 4)
+    {
+        len++;
+        if (mod == 0 && (p[1] & 7) == 5)
+        {
+            len += 4;
+        }
+    }
+    else if (mod == 0 && rm == 5)
+    {
+        len += 4;
+    }
+
+    if (mod == 1)
+        len += 1;
+    else if (mod == 2)
+        len += 4;
+
+    return len;
+}
+
+// Decodes one 32-bit instruction. Returns its length, or 0 for anything the
+// relocator can't move safely (short branches, far jumps, unknown opcodes).
+// rel_offset/rel_size describe a rel32 operand that must be re-based.
+int detour_insn_length(const uint8_t *code, int *rel_offset, int *rel_size)
+{
+    const uint8_t *p = code;
+    bool           opsize = false;
+
+    *rel_offset = -1;
+    *rel_size = 0;
+
+    // Prefixes
+    for (;;)
+    {
+        uint8_t b = *p;
+        if (b == 0x66)
+            opsize = true;
+        else if (b == 0x67)
+            return 0;
+        else if (!(b == 0xF0 || b == 0xF2 || b == 0xF3 || b == 0x26 || b == 0x2E || b == 0x36 || b == 0x3E ||
+                   b == 0x64 || b == 0x65))
+            break;
+        p++;
+    }
+
+    int     imm32 = opsize ? 2 : 4;
+    uint8_t op = *p++;
+
+    if (op == 0x0F)
+    {
+        uint8_t op2 = *p++;
+        if (op2 >= 0x80 && op2 <= 0x8F)
+        {
+            // jcc rel32
+            *rel_offset = (int)(p - code);
+            *rel_size = 4;
+            return (int)(p - code) + 4;
+        }
+        if (op2 == 0x38 || op2 == 0x3A)
+            return 0;
+        if (op2 == 0x05 || op2 == 0x0B || op2 == 0x31 || op2 == 0xA0 || op2 == 0xA1 || op2 == 0xA2 || op2 == 0xA8 ||
+            op2 == 0xA9 || (op2 >= 0xC8 && op2 <= 0xCF))
+            return (int)(p - code);
+
+        int len = modrm_length(p);
+        if ((op2 >= 0x70 && op2 <= 0x73) || op2 == 0xA4 || op2 == 0xAC || op2 == 0xBA || op2 == 0xC2 ||
+            (op2 >= 0xC4 && op2 <= 0xC6))
+            len += 1;
+        return (int)(p - code) + len;
+    }
+
+    if (op < 0x40)
+    {
+        switch (op & 7)
+        {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+            return (int)(p - code) + modrm_length(p);
+        case 4:
+            return (int)(p - code) + 1;
+        case 5:
+            return (int)(p - code) + imm32;
+        default:
+            return (int)(p - code);
+        }
+    }
+
+    if (op <= 0x61 || (op >= 0x6C && op <= 0x6F) || (op >= 0x90 && op <= 0x99) || (op >= 0x9B && op <= 0x9F) ||
+        (op >= 0xA4 && op <= 0xA7) || (op >= 0xAA && op <= 0xAF) || op == 0xC3 || op == 0xC9 || op == 0xCB ||
+        op == 0xCC || op == 0xCE || op == 0xCF || op == 0xD6 || op == 0xD7 || (op >= 0xEC && op <= 0xEF) ||
+        op == 0xF1 || op == 0xF4 || op == 0xF5 || (op >= 0xF8 && op <= 0xFD))
+        return (int)(p - code);
+
+    if (op == 0x62 || op == 0x63 || (op >= 0x84 && op <= 0x8F) || op == 0xC4 || op == 0xC5 ||
+        (op >= 0xD0 && op <= 0xD3) || (op >= 0xD8 && op <= 0xDF) || op == 0xFE || op == 0xFF)
+        return (int)(p - code) + modrm_length(p);
+
+    if (op == 0x6A || (op >= 0xB0 && op <= 0xB7) || op == 0xA8 || op == 0xCD || op == 0xD4 || op == 0xD5 ||
+        (op >= 0xE4 && op <= 0xE7))
+        return (int)(p - code) + 1;
+
+    if (op == 0x68 || (op >= 0xB8 && op <= 0xBF) || op == 0xA9)
+        return (int)(p - code) + imm32;
+
+    if (op >= 0xA0 && op <= 0xA3)
+        return (int)(p - code) + 4;
+
+    if (op == 0x69 || op == 0x81 || op == 0xC7)
+        return (int)(p - code) + modrm_length(p) + imm32;
+
+    if (op == 0x6B || op == 0x80 || op == 0x82 || op == 0x83 || op == 0xC0 || op == 0xC1 || op == 0xC6)
+        return (int)(p - code) + modrm_length(p) + 1;
+
+    if (op == 0xC2 || op == 0xCA)
+        return (int)(p - code) + 2;
+
+    if (op == 0xC8)
+        return (int)(p - code) + 3;
+
+    if (op == 0xE8 || op == 0xE9)
+    {
+        // call/jmp rel32
+        *rel_offset = (int)(p - code);
+        *rel_size = 4;
+        return (int)(p - code) + 4;
+    }
+
+    if (op == 0xF6 || op == 0xF7)
+    {
+        // test r/m, imm only for /0 and /1
+        uint8_t reg = (p[0] >> 3) & 7;
+        int     len = modrm_length(p);
+        if (reg < 2)
+            len += op == 0xF6 ? 1 : imm32;
+        return (int)(p - code) + len;
+    }
+
+    // 0x70-0x7F, 0xE0-0xE3, 0xEB short branches; 0x9A/0xEA far transfers
+    return 0;
+}
+
+//============================================================================
+// EXECUTABLE MEMORY
+//============================================================================
+
+// Carves 16-byte aligned chunks out of RWX pages. Chunks are never freed:
+// a thread may still be running a trampoline after its hook is removed.
+void *detour_alloc_code(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > CODE_POOL_SIZE)
+    {
+        return NULL;
+    }
+
+    AcquireSRWLockExclusive(&g_codeLock);
+
+    if (!g_codePool || g_codeUsed + size > CODE_POOL_SIZE)
+    {
+        g_codePool = VirtualAlloc(NULL, CODE_POOL_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+        g_codeUsed = 0;
+    }
+
+    void *chunk = NULL;
+    if (g_codePool)
+    {
+        chunk = g_codePool + g_codeUsed;
+        g_codeUsed += size;
+    }
+
+    ReleaseSRWLockExclusive(&g_codeLock);
+    return chunk;
+}
+
+//============================================================================
+// THREAD SUSPENSION
+//============================================================================
+
+// Thread IDs are collected before anything is suspended: a suspended
+// thread may hold the heap lock, so nothing here allocates afterwards.
+static void suspend_other_threads(thread_set *set)
+{
+    set->threads = NULL;
+    set->count = 0;
+
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD         pid = GetCurrentProcessId();
+    DWORD         self = GetCurrentThreadId();
+    DWORD        *ids = NULL;
+    int           count = 0;
+    int           capacity = 0;
+    THREADENTRY32 te;
+    te.dwSize = sizeof(te);
+
+    for (BOOL ok = Thread32First(snapshot, &te); ok; ok = Thread32Next(snapshot, &te))
+    {
+        if (te.th32OwnerProcessID != pid || te.th32ThreadID == self)
+        {
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            DWORD *grown = realloc(ids, capacity * sizeof(DWORD));
+            if (!grown)
+            {
+                break;
+            }
+            ids = grown;
+        }
+        ids[count++] = te.th32ThreadID;
+    }
+    CloseHandle(snapshot);
+
+    set->threads = count ? malloc(count * sizeof(HANDLE)) : NULL;
+    if (!set->threads)
+    {
+        free(ids);
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, ids[i]);
+        if (!thread)
+        {
+            continue;
+        }
+
+        if (SuspendThread(thread) == (DWORD)-1)
+        {
+            CloseHandle(thread);
+            continue;
+        }
+        set->threads[set->count++] = thread;
+    }
+
+    free(ids);
+}
+
+// Moves threads whose EIP lies within [from, from + length) to the same
+// offset within 'to'. Relocated instructions keep their lengths, so the
+// offsets line up between a prologue and its trampoline copy.
+static void relocate_threads(const thread_set *set, uintptr_t from, size_t length, uintptr_t to)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        CONTEXT ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.ContextFlags = CONTEXT_CONTROL;
+        if (!GetThreadContext(set->threads[i], &ctx))
+        {
+            continue;
+        }
+
+        if (ctx.Eip > from && ctx.Eip < from + length)
+        {
+            ctx.Eip = (DWORD)(to + (ctx.Eip - from));
+            SetThreadContext(set->threads[i], &ctx);
+        }
+    }
+}
+
+static void resume_threads(thread_set *set)
+{
+    for (int i = 0; i < set->count; i++)
+    {
+        ResumeThread(set->threads[i]);
+        CloseHandle(set->threads[i]);
+    }
+    free(set->threads);
+    set->threads = NULL;
+    set->count = 0;
+}
+
+static bool write_code(uint8_t *dst, const uint8_t *bytes, size_t length, uintptr_t move_from, uintptr_t move_to)
+{
+    DWORD old_protect;
+    if (!VirtualProtect(dst, length, PAGE_EXECUTE_READWRITE, &old_protect))
+    {
+        return false;
+    }
+
+    thread_set set;
+    suspend_other_threads(&set);
+    memcpy(dst, bytes, length);
+    relocate_threads(&set, move_from, length, move_to);
+    resume_threads(&set);
+
+    VirtualProtect(dst, length, old_protect, &old_protect);
+    FlushInstructionCache(GetCurrentProcess(), dst, length);
+    return true;
+}
+
+//============================================================================
+// ATTACH / DETACH
+//============================================================================
+
+// Builds the trampoline without touching the target. Callers that jump to
+// the trampoline from their hook can publish it before detour_enable().
+bool detour_create(detour *d, void *target, void *hook)
+{
+    uint8_t *code = (uint8_t *)target;
+    int      length = 0;
+
+    memset(d, 0, sizeof(*d));
+
+    // Whole instructions covering the 5-byte jump
+    while (length < DETOUR_PATCH_SIZE)
+    {
+        int rel_offset, rel_size;
+        int insn = detour_insn_length(code + length, &rel_offset, &rel_size);
+        if (insn == 0 || length + insn > DETOUR_MAX_PROLOGUE)
+        {
+            logf("[DETOUR] Cannot relocate instruction at %p (byte %02X)", code + length, code[length]);
+            return false;
+        }
+        length += insn;
+    }
+
+    uint8_t *trampoline = detour_alloc_code(length + DETOUR_PATCH_SIZE);
+    if (!trampoline)
+    {
+        return false;
+    }
+
+    // Copy the prologue, re-basing rel32 operands for the new location
+    memcpy(trampoline, code, length);
+    for (int offset = 0; offset < length;)
+    {
+        int rel_offset, rel_size;
+        int insn = detour_insn_length(code + offset, &rel_offset, &rel_size);
+        if (rel_size == 4)
+        {
+            int32_t rel;
+            memcpy(&rel, code + offset + rel_offset, 4);
+            rel += (int32_t)(code - trampoline);
+            memcpy(trampoline + offset + rel_offset, &rel, 4);
+        }
+        offset += insn;
+    }
+
+    trampoline[length] = 0xE9;
+    int32_t back = (int32_t)((code + length) - (trampoline + length + DETOUR_PATCH_SIZE));
+    memcpy(trampoline + length + 1, &back, 4);
+
+    memcpy(d->saved, code, length);
+    d->target = code;
+    d->hook = (uint8_t *)hook;
+    d->trampoline = trampoline;
+    d->length = (uint8_t)length;
+    return true;
+}
+
+bool detour_enable(detour *d)
+{
+    if (d->attached || !d->trampoline)
+    {
+        return false;
+    }
+
+    uint8_t patch[DETOUR_MAX_PROLOGUE];
+    memset(patch, 0x90, sizeof(patch));
+    patch[0] = 0xE9;
+    int32_t jump = (int32_t)(d->hook - (d->target + DETOUR_PATCH_SIZE));
+    memcpy(patch + 1, &jump, 4);
+
+    if (!write_code(d->target, patch, d->length, (uintptr_t)d->target, (uintptr_t)d->trampoline))
+    {
+        return false;
+    }
+
+    d->attached = true;
+    logf("[DETOUR] Hooked %p -> %p (%d byte prologue, trampoline %p)", d->target, d->hook, d->length, d->trampoline);
+    return true;
+}
+
+// Restores the original bytes. The trampoline stays allocated for threads
+// that may still be executing it.
+bool detour_disable(detour *d)
+{
+    if (!d->attached)
+    {
+        return false;
+    }
+
+    if (!write_code(d->target, d->saved, d->length, (uintptr_t)d->trampoline, (uintptr_t)d->target))
+    {
+        return false;
+    }
+
+    d->attached = false;
+    logf("[DETOUR] Unhooked %p", d->target);
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef DETOUR_H
+#define DETOUR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#define DETOUR_PATCH_SIZE 5  /* jmp rel32 */
+#define DETOUR_MAX_PROLOGUE 16
+
+typedef struct
+{
+    uint8_t *target;
+    uint8_t *hook;
+    uint8_t *trampoline; /* Relocated prologue followed by a jump back */
+    uint8_t  saved[DETOUR_MAX_PROLOGUE];
+    uint8_t  length; /* Prologue bytes replaced at target */
+    bool     attached;
+} detour;
+
+bool  detour_create(detour *d, void *target, void *hook);
+bool  detour_enable(detour *d);
+bool  detour_disable(detour *d);
+void *detour_alloc_code(size_t size);
+int   detour_insn_length(const uint8_t *code, int *rel_offset, int *rel_size);
+
+#endif // DETOUR_H
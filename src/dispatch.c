@@ -0,0 +1,867 @@
+/*
+ * dispatch.c: Runs queued work on the game's main thread.
+ *
+ * Producers (console thread, future subsystems) push jobs onto a lock-free
+ * intrusive MPSC queue. The queue is drained on every message the game's
+ * main thread retrieves, through a WH_GETMESSAGE hook installed once on its
+ * message pump; an idle pump is woken with a single WM_NULL per batch, so a
+ * burst of calls costs one pump iteration instead of one thread per call.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "dispatch.h"
+#include "lauxlib.h"
+#include "logging.h"
+
+#define DISPATCH_MAX_BATCH 4096u /* Jobs drained per pump before yielding back to the game */
+#define FUTURE_MT "luaapi.future"
+#define ANCHORS_KEY "luaapi.dispatch_anchors" /* Job -> its string/userdata arguments, until it has run */
+#define RET_KINDS "viupqfdbcCsS"
+#define LUA_TCDATA 10 /* LuaJIT's type tag for FFI cdata */
+
+// Marks a job whose completion has already been signalled to waiters
+#define EVENT_DONE ((HANDLE)(intptr_t)-2)
+
+typedef struct
+{
+    volatile LONG submitted;
+    LONG          completed;
+    LONG          pumps;
+    LONG          max_batch;
+} dispatch_stats;
+
+typedef struct
+{
+    dispatch_job *job;
+} future_ud;
+
+static DWORD                  g_mainThreadId = 0;
+static HHOOK                  g_hook = NULL;
+static volatile LONG          g_wakePending = 0;
+static volatile LONG          g_pumping = 0;
+static volatile LONG          g_closed = 0;     /* Set by dispatch_shutdown; submits fail from then on */
+static volatile LONG          g_submitting = 0; /* Submits past the g_closed check, not yet queued */
+static dispatch_fn_void       g_pumpHandler = NULL;
+static HANDLE volatile        g_notifyEvent = NULL;
+static dispatch_stats         g_stats = {0};
+
+// Vyukov intrusive MPSC queue: producers swap g_head, the main thread owns g_tail
+static dispatch_job           g_stub = {0};
+static dispatch_job *volatile g_head = &g_stub;
+static dispatch_job          *g_tail = &g_stub;
+
+//============================================================================
+// QUEUE
+//============================================================================
+
+static void queue_push(dispatch_job *job)
+{
+    job->next = NULL;
+    dispatch_job *prev = (dispatch_job *)InterlockedExchangePointer((void *volatile *)&g_head, job);
+    prev->next = job;
+}
+
+// Single consumer only. Returns NULL when empty or when a producer is
+// between its exchange and link; the job is picked up on the next pump.
+static dispatch_job *queue_pop(void)
+{
+    dispatch_job *tail = g_tail;
+    dispatch_job *next = tail->next;
+
+    if (tail == &g_stub)
+    {
+        if (!next)
+        {
+            return NULL;
+        }
+        g_tail = next;
+        tail = next;
+        next = next->next;
+    }
+
+    if (next)
+    {
+        g_tail = next;
+        return tail;
+    }
+
+    if (tail != g_head)
+    {
+        return NULL;
+    }
+
+    queue_push(&g_stub);
+    next = tail->next;
+    if (next)
+    {
+        g_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+//============================================================================
+// NATIVE CALLS
+//============================================================================
+
+// Calls fn with nwords stack words and the given ECX/EDX, then restores ESP
+// from EBP so cdecl and callee-cleanup conventions both leave it balanced.
+// Integer results come back in EDX:EAX, floating-point results stay in ST0.
+__attribute__((naked)) static uint64_t __cdecl dispatch_thunk(void *fn, const uint32_t *words, uint32_t nwords,
+                                                              uint32_t ecx, uint32_t edx)
+{
+    __asm__ volatile("pushl %ebp\n\t"
+                     "movl %esp, %ebp\n\t"
+                     "pushl %esi\n\t"
+                     "pushl %edi\n\t"
+                     "movl 16(%ebp), %ecx\n\t"
+                     "leal 0(,%ecx,4), %eax\n\t"
+                     "subl %eax, %esp\n\t"
+                     "andl $-16, %esp\n\t"
+                     "movl %esp, %edi\n\t"
+                     "movl 12(%ebp), %esi\n\t"
+                     "cld\n\t"
+                     "rep movsl\n\t"
+                     "movl 20(%ebp), %ecx\n\t"
+                     "movl 24(%ebp), %edx\n\t"
+                     "call *8(%ebp)\n\t"
+                     "leal -8(%ebp), %esp\n\t"
+                     "popl %edi\n\t"
+                     "popl %esi\n\t"
+                     "popl %ebp\n\t"
+                     "ret\n\t");
+}
+
+typedef double(__cdecl *dispatch_thunk_fp)(void *, const uint32_t *, uint32_t, uint32_t, uint32_t);
+
+static void dispatch_run_call(dispatch_job *job)
+{
+    if (job->ret_kind == 'f' || job->ret_kind == 'd')
+    {
+        dispatch_thunk_fp thunk = (dispatch_thunk_fp)(void *)dispatch_thunk;
+        job->result.d = thunk(job->target, job->words, job->nwords, job->ecx, job->edx);
+    }
+    else
+    {
+        job->result.i = dispatch_thunk(job->target, job->words, job->nwords, job->ecx, job->edx);
+    }
+}
+
+//============================================================================
+// JOB LIFECYCLE
+//============================================================================
+
+dispatch_job *dispatch_job_new(dispatch_fn run, void *user)
+{
+    dispatch_job *job = calloc(1, sizeof(*job));
+    if (job)
+    {
+        job->refs = 1;
+        job->state = DISPATCH_PENDING;
+        job->run = run ? run : dispatch_run_call;
+        job->user = user;
+    }
+    return job;
+}
+
+void dispatch_job_release(dispatch_job *job)
+{
+    if (job && InterlockedDecrement(&job->refs) == 0)
+    {
+        free(job);
+    }
+}
+
+// One signal per batch for consumers that track many jobs at once
+static void notify_completed(void)
+{
+    HANDLE event = g_notifyEvent;
+    if (event)
+    {
+        SetEvent(event);
+    }
+}
+
+static void dispatch_complete(dispatch_job *job)
+{
+    InterlockedExchange(&job->state, DISPATCH_DONE);
+
+    HANDLE event = InterlockedExchangePointer((void *volatile *)&job->event, EVENT_DONE);
+    if (event && event != EVENT_DONE)
+    {
+        SetEvent(event);
+    }
+
+    dispatch_job_release(job);
+}
+
+bool dispatch_is_main_thread(void)
+{
+    return g_mainThreadId != 0 && GetCurrentThreadId() == g_mainThreadId;
+}
+
+// Id of the game's main thread, 0 before dispatch_init
+DWORD dispatch_main_thread(void)
+{
+    return g_mainThreadId;
+}
+
+// Queues a job for the main thread. The queue takes its own reference,
+// so callers keep theirs and release it when done with the result.
+// Jobs submitted from the main thread itself run inline.
+bool dispatch_submit(dispatch_job *job)
+{
+    // Counted before the check, so dispatch_shutdown can wait for every
+    // push that got past it before draining the queue
+    InterlockedIncrement(&g_submitting);
+    if (g_closed || !g_hook)
+    {
+        InterlockedDecrement(&g_submitting);
+        return false;
+    }
+
+    InterlockedIncrement(&job->refs);
+    InterlockedIncrement(&g_stats.submitted);
+
+    if (dispatch_is_main_thread())
+    {
+        InterlockedDecrement(&g_submitting);
+        job->run(job);
+        g_stats.completed++;
+        dispatch_complete(job);
+        notify_completed();
+        return true;
+    }
+
+    queue_push(job);
+    InterlockedDecrement(&g_submitting);
+    if (InterlockedExchange(&g_wakePending, 1) == 0)
+    {
+        PostThreadMessage(g_mainThreadId, WM_NULL, 0, 0);
+    }
+    return true;
+}
+
+static bool poll_done(dispatch_job *job, DWORD timeout_ms)
+{
+    DWORD start = GetTickCount();
+    while (job->state != DISPATCH_DONE)
+    {
+        if (timeout_ms != INFINITE && GetTickCount() - start >= timeout_ms)
+        {
+            return false;
+        }
+        Sleep(1);
+    }
+    return true;
+}
+
+// Blocks until the job completes or the timeout expires.
+// Supports one blocking waiter per job; the event is only created when
+// the job is still pending, so waiting on an already finished batch is free.
+bool dispatch_wait(dispatch_job *job, DWORD timeout_ms)
+{
+    if (job->state == DISPATCH_DONE)
+    {
+        return true;
+    }
+
+    if (dispatch_is_main_thread())
+    {
+        dispatch_pump();
+        return job->state == DISPATCH_DONE;
+    }
+
+    HANDLE event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!event)
+    {
+        return poll_done(job, timeout_ms);
+    }
+
+    HANDLE previous = InterlockedCompareExchangePointer((void *volatile *)&job->event, event, NULL);
+    if (previous != NULL)
+    {
+        CloseHandle(event);
+        if (previous == EVENT_DONE)
+        {
+            return true;
+        }
+
+        // Another thread is already blocked on this job; poll instead
+        return poll_done(job, timeout_ms);
+    }
+
+    if (WaitForSingleObject(event, timeout_ms) != WAIT_OBJECT_0)
+    {
+        // Take the event back unless the pump already claimed it for signalling
+        if (InterlockedCompareExchangePointer((void *volatile *)&job->event, NULL, event) == event)
+        {
+            CloseHandle(event);
+            return false;
+        }
+        WaitForSingleObject(event, INFINITE);
+    }
+
+    CloseHandle(event);
+    return true;
+}
+
+//============================================================================
+// MAIN THREAD PUMP
+//============================================================================
+
+// Drains pending jobs. Only has an effect on the main thread and is not
+// reentrant, so a job that runs a modal message loop doesn't recurse.
+void dispatch_pump(void)
+{
+    if (!dispatch_is_main_thread() || g_pumping)
+    {
+        return;
+    }
+
+    g_pumping = 1;
+    InterlockedExchange(&g_wakePending, 0);
+
+    LONG          batch = 0;
+    dispatch_job *job;
+    while (batch < (LONG)DISPATCH_MAX_BATCH && (job = queue_pop()) != NULL)
+    {
+        job->run(job);
+        dispatch_complete(job);
+        batch++;
+    }
+
+    if (batch > 0)
+    {
+        notify_completed();
+        g_stats.pumps++;
+        g_stats.completed += batch;
+        if (batch > g_stats.max_batch)
+        {
+            g_stats.max_batch = batch;
+        }
+
+        // Batch limit hit: make sure the rest runs on the next iteration
+        if (batch == (LONG)DISPATCH_MAX_BATCH && InterlockedExchange(&g_wakePending, 1) == 0)
+        {
+            PostThreadMessage(g_mainThreadId, WM_NULL, 0, 0);
+        }
+    }
+
+    g_pumping = 0;
+}
+
+// Replaces the work done on each pump message. The handler is expected to
+// call dispatch_pump() itself; the frame scheduler uses this to piggyback.
+void dispatch_set_pump_handler(dispatch_fn_void handler)
+{
+    g_pumpHandler = handler;
+}
+
+// Sets an event signalled after every batch of completed jobs, so a
+// consumer polling many futures can sleep until there is news.
+void dispatch_set_notify_event(HANDLE event)
+{
+    g_notifyEvent = event;
+}
+
+static LRESULT CALLBACK dispatch_msg_hook(int code, WPARAM wParam, LPARAM lParam)
+{
+    if (code == HC_ACTION)
+    {
+        dispatch_fn_void handler = g_pumpHandler;
+        if (handler)
+            handler();
+        else
+            dispatch_pump();
+    }
+    return CallNextHookEx(g_hook, code, wParam, lParam);
+}
+
+bool dispatch_init(DWORD main_thread_id)
+{
+    g_mainThreadId = main_thread_id;
+    InterlockedExchange(&g_closed, 0);
+
+    g_hook = SetWindowsHookEx(WH_GETMESSAGE, dispatch_msg_hook, NULL, main_thread_id);
+    if (!g_hook)
+    {
+        logf("[DISPATCH] Failed to hook message pump of thread %lu (error %lu)", main_thread_id, GetLastError());
+        return false;
+    }
+
+    logf("[DISPATCH] Message pump hook installed on main thread %lu", main_thread_id);
+    return true;
+}
+
+void dispatch_shutdown(void)
+{
+    InterlockedExchange(&g_closed, 1);
+    if (g_hook)
+    {
+        UnhookWindowsHookEx(g_hook);
+        g_hook = NULL;
+    }
+
+    // Let an in-flight pump finish before taking over as the consumer, and
+    // submits already past the g_closed check finish queueing
+    while (g_pumping || g_submitting)
+    {
+        Sleep(1);
+    }
+
+    // Complete whatever never ran so blocked waiters return. queue_pop also
+    // returns NULL while a push is half linked, so only an empty queue ends
+    // the drain.
+    for (;;)
+    {
+        dispatch_job *job = queue_pop();
+        if (job)
+        {
+            job->result.i = 0;
+            dispatch_complete(job);
+        }
+        else if (g_tail == g_head)
+        {
+            break;
+        }
+        else
+        {
+            YieldProcessor();
+        }
+    }
+    notify_completed();
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static dispatch_conv parse_conv(lua_State *L, const char *name)
+{
+    if (strcmp(name, "cdecl") == 0)
+        return DISPATCH_CDECL;
+    if (strcmp(name, "stdcall") == 0)
+        return DISPATCH_STDCALL;
+    if (strcmp(name, "fastcall") == 0)
+        return DISPATCH_FASTCALL;
+    if (strcmp(name, "thiscall") == 0)
+        return DISPATCH_THISCALL;
+
+    luaL_error(L, "unknown calling convention '%s'", name);
+    return DISPATCH_CDECL;
+}
+
+// Address in a cdata pointer, or of a cdata array or struct, as
+// ffi.cast("uintptr_t", v) gives it
+static uint32_t cdata_address(lua_State *L, int idx)
+{
+    idx = idx > 0 ? idx : lua_gettop(L) + idx + 1;
+    lua_getglobal(L, "tonumber");
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_getfield(L, -1, "ffi");
+    lua_getfield(L, -1, "cast");
+    lua_replace(L, -3);
+    lua_pop(L, 1);
+    lua_pushliteral(L, "uintptr_t");
+    lua_pushvalue(L, idx);
+    lua_call(L, 2, 1);
+    lua_call(L, 1, 1);
+    uint32_t address = (uint32_t)(int64_t)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return address;
+}
+
+static uint32_t check_word(lua_State *L, int idx)
+{
+    switch (lua_type(L, idx))
+    {
+    case LUA_TNIL:
+    case LUA_TNONE:
+        return 0;
+    case LUA_TBOOLEAN:
+        return lua_toboolean(L, idx) ? 1 : 0;
+    case LUA_TNUMBER:
+        return (uint32_t)(int64_t)lua_tonumber(L, idx);
+    case LUA_TLIGHTUSERDATA:
+    case LUA_TSTRING:
+    case LUA_TUSERDATA:
+        // Strings and userdata are anchored until the job has run, see anchor_args
+        return (uint32_t)(uintptr_t)(lua_type(L, idx) == LUA_TSTRING ? (const void *)lua_tostring(L, idx)
+                                                                      : lua_topointer(L, idx));
+    case LUA_TCDATA:
+        return cdata_address(L, idx);
+    default:
+        luaL_argerror(L, idx, "expected number, boolean, string, pointer or cdata");
+        return 0;
+    }
+}
+
+static void push_word(lua_State *L, dispatch_job *job, uint32_t word)
+{
+    if (job->nwords >= DISPATCH_MAX_WORDS)
+    {
+        luaL_error(L, "too many arguments (max %d stack words)", DISPATCH_MAX_WORDS);
+    }
+    job->words[job->nwords++] = word;
+}
+
+// Encodes one argument according to its kind character
+static void encode_arg(lua_State *L, dispatch_job *job, char kind, int idx, int *regs_left)
+{
+    switch (kind)
+    {
+    case 'i':
+    case 'u':
+    case 'p':
+    case 'b':
+    case 'c':
+    case 'C':
+    case 's':
+    case 'S': {
+        uint32_t word = check_word(L, idx);
+        if (*regs_left > 0)
+        {
+            // fastcall fills ECX then EDX, thiscall only ECX
+            if (job->conv == DISPATCH_THISCALL || *regs_left == 2)
+                job->ecx = word;
+            else
+                job->edx = word;
+            (*regs_left)--;
+        }
+        else
+        {
+            push_word(L, job, word);
+        }
+        break;
+    }
+    case 'f': {
+        float    value = (float)luaL_checknumber(L, idx);
+        uint32_t word;
+        memcpy(&word, &value, sizeof(word));
+        push_word(L, job, word);
+        break;
+    }
+    case 'd':
+    case 'q': {
+        uint64_t bits;
+        if (kind == 'd')
+        {
+            double value = luaL_checknumber(L, idx);
+            memcpy(&bits, &value, sizeof(bits));
+        }
+        else
+        {
+            bits = (uint64_t)(int64_t)luaL_checknumber(L, idx);
+        }
+        push_word(L, job, (uint32_t)bits);
+        push_word(L, job, (uint32_t)(bits >> 32));
+        break;
+    }
+    default:
+        luaL_error(L, "unknown argument kind '%c'", kind);
+    }
+}
+
+int dispatch_push_result(lua_State *L, const dispatch_job *job)
+{
+    switch (job->ret_kind)
+    {
+    case 'v':
+        lua_pushnil(L);
+        break;
+    case 'i':
+        lua_pushnumber(L, (int32_t)(uint32_t)job->result.i);
+        break;
+    case 'u':
+    case 'p':
+        lua_pushnumber(L, (uint32_t)job->result.i);
+        break;
+    case 'q':
+        lua_pushnumber(L, (lua_Number)(int64_t)job->result.i);
+        break;
+    // Narrow results only define the low bits of EAX
+    case 'b':
+        lua_pushboolean(L, (uint8_t)job->result.i != 0);
+        break;
+    case 'c':
+        lua_pushnumber(L, (int8_t)(uint8_t)job->result.i);
+        break;
+    case 'C':
+        lua_pushnumber(L, (uint8_t)job->result.i);
+        break;
+    case 's':
+        lua_pushnumber(L, (int16_t)(uint16_t)job->result.i);
+        break;
+    case 'S':
+        lua_pushnumber(L, (uint16_t)job->result.i);
+        break;
+    default:
+        lua_pushnumber(L, job->result.d);
+        break;
+    }
+    return 1;
+}
+
+static future_ud *check_future(lua_State *L)
+{
+    return (future_ud *)luaL_checkudata(L, 1, FUTURE_MT);
+}
+
+// Job behind the future at idx, or NULL if the value is not a future
+dispatch_job *dispatch_to_job(lua_State *L, int idx)
+{
+    future_ud *ud = (future_ud *)lua_touserdata(L, idx);
+    if (!ud || !lua_getmetatable(L, idx))
+    {
+        return NULL;
+    }
+
+    luaL_getmetatable(L, FUTURE_MT);
+    bool is_future = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    return is_future ? ud->job : NULL;
+}
+
+// Keeps the call's string, userdata and cdata arguments in the registry,
+// with a reference to the job, until sweep_anchors sees it done. The future
+// alone cannot: it may be dropped after a wait times out, or its state
+// closed, with the job still queued.
+static void anchor_args(lua_State *L, dispatch_job *job, int first, int nargs)
+{
+    bool needed = false;
+    for (int i = 0; i < nargs; i++)
+    {
+        int type = lua_type(L, first + i);
+        needed = needed || type == LUA_TSTRING || type == LUA_TUSERDATA || type == LUA_TCDATA;
+    }
+    if (!needed)
+    {
+        return;
+    }
+
+    lua_getfield(L, LUA_REGISTRYINDEX, ANCHORS_KEY);
+    if (!lua_istable(L, -1))
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, ANCHORS_KEY);
+    }
+    lua_pushlightuserdata(L, job);
+    lua_createtable(L, nargs, 0);
+    for (int i = 0; i < nargs; i++)
+    {
+        lua_pushvalue(L, first + i);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    InterlockedIncrement(&job->refs);
+}
+
+// Releases the anchors of jobs that have run since
+static void sweep_anchors(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, ANCHORS_KEY);
+    if (!lua_istable(L, -1))
+    {
+        lua_pop(L, 1);
+        return;
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0)
+    {
+        lua_pop(L, 1);
+        dispatch_job *job = (dispatch_job *)lua_touserdata(L, -1);
+        if (job->state == DISPATCH_DONE)
+        {
+            // Clearing the current key is allowed during traversal
+            lua_pushvalue(L, -1);
+            lua_pushnil(L);
+            lua_rawset(L, -4);
+            dispatch_job_release(job);
+        }
+    }
+    lua_pop(L, 1);
+}
+
+// dispatch.call(addr, conv, argkinds, retkind, ...) -> future
+// Runs the function at addr on the main thread. argkinds is one character
+// per argument (i/u/p = 32-bit, f = float, d = double, q = int64; b/c/C/s/S
+// = bool, char, unsigned char, short, unsigned short). The narrow kinds
+// mask the result to its width.
+static int l_dispatch_call(lua_State *L)
+{
+    uint32_t      address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    dispatch_conv conv = parse_conv(L, luaL_optstring(L, 2, "cdecl"));
+    const char   *kinds = luaL_optstring(L, 3, "");
+    const char   *ret = luaL_optstring(L, 4, "i");
+    int           nargs = lua_gettop(L) > 4 ? lua_gettop(L) - 4 : 0;
+
+    sweep_anchors(L);
+    if (address == 0)
+    {
+        return luaL_argerror(L, 1, "null function address");
+    }
+    if ((int)strlen(kinds) != nargs)
+    {
+        return luaL_error(L, "signature expects %d arguments, got %d", (int)strlen(kinds), nargs);
+    }
+    if (!strchr(RET_KINDS, ret[0]) || ret[0] == '\0')
+    {
+        return luaL_argerror(L, 4, "unknown return kind");
+    }
+
+    // Userdata first, so a failed argument conversion still frees the job
+    future_ud *ud = (future_ud *)lua_newuserdata(L, sizeof(future_ud));
+    ud->job = NULL;
+    luaL_getmetatable(L, FUTURE_MT);
+    lua_setmetatable(L, -2);
+
+    ud->job = dispatch_job_new(NULL, NULL);
+    if (!ud->job)
+    {
+        return luaL_error(L, "out of memory");
+    }
+
+    dispatch_job *job = ud->job;
+    job->target = (void *)(uintptr_t)address;
+    job->conv = (uint8_t)conv;
+    job->ret_kind = ret[0];
+
+    int regs_left = conv == DISPATCH_FASTCALL ? 2 : conv == DISPATCH_THISCALL ? 1 : 0;
+    for (int i = 0; i < nargs; i++)
+    {
+        encode_arg(L, job, kinds[i], 5 + i, &regs_left);
+    }
+
+    if (!dispatch_submit(job))
+    {
+        return luaL_error(L, "main thread dispatcher is not attached");
+    }
+    anchor_args(L, job, 5, nargs);
+    return 1;
+}
+
+// Blocks until every call made from L has run, so its arguments can be
+// freed. States other than the console's call this before lua_close.
+void dispatch_settle(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, ANCHORS_KEY);
+    if (lua_istable(L, -1))
+    {
+        lua_pushnil(L);
+        while (lua_next(L, -2) != 0)
+        {
+            lua_pop(L, 1);
+            dispatch_wait((dispatch_job *)lua_touserdata(L, -1), INFINITE);
+        }
+    }
+    lua_pop(L, 1);
+    sweep_anchors(L);
+}
+
+static int l_future_ready(lua_State *L)
+{
+    future_ud *ud = check_future(L);
+    lua_pushboolean(L, ud->job && ud->job->state == DISPATCH_DONE);
+    return 1;
+}
+
+// future:wait([timeout_ms]) -> true, result | false, "timeout"
+static int l_future_wait(lua_State *L)
+{
+    future_ud *ud = check_future(L);
+    DWORD      timeout = (DWORD)luaL_optnumber(L, 2, INFINITE);
+
+    if (!ud->job || !dispatch_wait(ud->job, timeout))
+    {
+        lua_pushboolean(L, 0);
+        lua_pushliteral(L, "timeout");
+        return 2;
+    }
+
+    lua_pushboolean(L, 1);
+    return 1 + dispatch_push_result(L, ud->job);
+}
+
+static int l_future_result(lua_State *L)
+{
+    future_ud *ud = check_future(L);
+    if (!ud->job || ud->job->state != DISPATCH_DONE)
+    {
+        return luaL_error(L, "future is still pending");
+    }
+    return dispatch_push_result(L, ud->job);
+}
+
+// A job still queued keeps the reference anchor_args took
+static int l_future_gc(lua_State *L)
+{
+    future_ud *ud = check_future(L);
+    dispatch_job_release(ud->job);
+    ud->job = NULL;
+    return 0;
+}
+
+static int l_future_tostring(lua_State *L)
+{
+    future_ud *ud = check_future(L);
+    lua_pushfstring(L, "future: %p (%s)", (void *)ud->job,
+                    ud->job && ud->job->state == DISPATCH_DONE ? "done" : "pending");
+    return 1;
+}
+
+static int l_dispatch_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 6);
+    lua_pushboolean(L, g_hook != NULL);
+    lua_setfield(L, -2, "attached");
+    lua_pushnumber(L, g_mainThreadId);
+    lua_setfield(L, -2, "main_thread_id");
+    lua_pushnumber(L, g_stats.submitted);
+    lua_setfield(L, -2, "submitted");
+    lua_pushnumber(L, g_stats.completed);
+    lua_setfield(L, -2, "completed");
+    lua_pushnumber(L, g_stats.pumps);
+    lua_setfield(L, -2, "pumps");
+    lua_pushnumber(L, g_stats.max_batch);
+    lua_setfield(L, -2, "max_batch");
+    return 1;
+}
+
+static int l_dispatch_attached(lua_State *L)
+{
+    lua_pushboolean(L, g_hook != NULL);
+    return 1;
+}
+
+static const luaL_Reg future_methods[] = {
+    {"ready", l_future_ready}, {"wait", l_future_wait}, {"result", l_future_result}, {NULL, NULL}};
+
+static const luaL_Reg dispatch_funcs[] = {
+    {"call", l_dispatch_call}, {"stats", l_dispatch_stats}, {"attached", l_dispatch_attached}, {NULL, NULL}};
+
+int luaopen_dispatch(lua_State *L)
+{
+    luaL_newmetatable(L, FUTURE_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, future_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_future_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, l_future_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 1);
+
+    luaL_register(L, "dispatch", dispatch_funcs);
+    return 1;
+}
@@ -0,0 +1,71 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+
+#define DISPATCH_MAX_WORDS 32 /* Max stack words (int64/double args take two) */
+
+typedef enum
+{
+    DISPATCH_CDECL,
+    DISPATCH_STDCALL,
+    DISPATCH_FASTCALL,
+    DISPATCH_THISCALL
+} dispatch_conv;
+
+typedef enum
+{
+    DISPATCH_PENDING,
+    DISPATCH_DONE
+} dispatch_state;
+
+typedef struct dispatch_job dispatch_job;
+typedef void (*dispatch_fn)(dispatch_job *job);
+typedef void (*dispatch_fn_void)(void);
+
+// A unit of work executed on the game's main thread.
+// Game calls use the target/words/ecx/edx fields; native subsystems may
+// queue their own 'run' callback and keep context in 'user'.
+struct dispatch_job
+{
+    dispatch_job *volatile next; /* MPSC queue link, owned by the queue */
+    volatile LONG          refs;
+    volatile LONG          state;
+    HANDLE volatile        event; /* Lazily created by a blocking waiter */
+    dispatch_fn            run;
+    void                  *user;
+
+    void    *target;
+    uint8_t  conv;
+    char     ret_kind; /* 'v', 'i', 'u', 'p', 'q', 'f', 'd', or a narrow 'b', 'c', 'C', 's', 'S' */
+    uint8_t  nwords;
+    uint32_t words[DISPATCH_MAX_WORDS];
+    uint32_t ecx;
+    uint32_t edx;
+    union {
+        uint64_t i;
+        double   d;
+    } result;
+};
+
+bool          dispatch_init(DWORD main_thread_id);
+void          dispatch_shutdown(void);
+bool          dispatch_is_main_thread(void);
+DWORD         dispatch_main_thread(void);
+dispatch_job *dispatch_job_new(dispatch_fn run, void *user);
+void          dispatch_job_release(dispatch_job *job);
+bool          dispatch_submit(dispatch_job *job);
+bool          dispatch_wait(dispatch_job *job, DWORD timeout_ms);
+void          dispatch_pump(void);
+void          dispatch_set_pump_handler(dispatch_fn_void handler);
+void          dispatch_set_notify_event(HANDLE event);
+dispatch_job *dispatch_to_job(lua_State *L, int idx);
+int           dispatch_push_result(lua_State *L, const dispatch_job *job);
+void          dispatch_settle(lua_State *L);
+int           luaopen_dispatch(lua_State *L);
+
+#endif // DISPATCH_H
@@ -0,0 +1,557 @@
+/*
+ * frame.c: Per-frame Lua scheduler driven from the game loop.
+ *
+ * Lua callbacks registered with on_frame/on_tick run on the game's main
+ * thread, either from a detour on the game's frame function or, until one
+ * is attached, from the message pump hook paced by a thread timer. Each
+ * tick stops once the frame budget is used up and resumes with the next
+ * callback in line on the following frame. With nothing registered a tick
+ * only drains the dispatch queue and never touches Lua.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "dispatch.h"
+#include "frame.h"
+#include "frametime.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "luastate.h"
+#include "output.h"
+
+#define FRAME_DEFAULT_BUDGET_US 2000 /* Lua time allowed per frame */
+#define FRAME_PUMP_INTERVAL_MS 15    /* Pacing when driven by the message pump */
+#define FRAME_FPU_CONTROL 0x027F     /* Double precision, round to nearest, all masked */
+
+// Decorated names for symbols referenced from the detour stub
+#define ASM_SYMBOL(name) "_" #name
+
+typedef struct
+{
+    int      id;
+    int      ref;         /* Registry reference to the callback */
+    uint32_t interval_ms; /* 0 runs every frame */
+    int64_t  next_due;    /* QPC tick */
+    int64_t  last_run;
+    bool     active;
+} frame_task;
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t lua_ticks;
+    uint32_t callbacks;
+    uint32_t carried; /* Ticks cut short by the budget */
+    uint32_t skipped; /* Ticks skipped because the console held the state */
+    int64_t  last_ticks;
+    int64_t  max_ticks;
+} frame_stats;
+
+static frame_task    *g_tasks = NULL;
+static volatile LONG  g_taskCount = 0;
+static int            g_taskCapacity = 0;
+static int            g_nextTaskId = 1;
+static int            g_cursor = 0;
+static bool           g_inTick = false;
+
+static int64_t        g_qpcFrequency = 1;
+static int64_t        g_budgetTicks = 0;
+static int64_t        g_lastPumpTick = 0;
+static UINT_PTR       g_pumpTimer = 0;
+static frame_stats    g_stats = {0};
+
+static detour         g_frameDetour = {0};
+void *volatile        g_frameTrampoline = NULL;
+
+//============================================================================
+// TIMING
+//============================================================================
+
+static int64_t qpc_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+static double ticks_to_ms(int64_t ticks)
+{
+    return (double)ticks * 1000.0 / (double)g_qpcFrequency;
+}
+
+static uint16_t fpu_get_control(void)
+{
+    uint16_t cw;
+    __asm__ volatile("fnstcw %0" : "=m"(cw));
+    return cw;
+}
+
+static void fpu_set_control(uint16_t cw)
+{
+    __asm__ volatile("fldcw %0" : : "m"(cw));
+}
+
+// The game runs with its own x87 precision (Direct3D sets single); Lua
+// expects double. Returns the game's control word for frame_fpu_leave.
+uint16_t frame_fpu_enter(void)
+{
+    uint16_t saved = fpu_get_control();
+    fpu_set_control(FRAME_FPU_CONTROL);
+    return saved;
+}
+
+void frame_fpu_leave(uint16_t saved)
+{
+    fpu_set_control(saved);
+}
+
+//============================================================================
+// TASK LIST
+//============================================================================
+
+// Drops cancelled tasks. Only called outside of a tick, with the state held.
+// The carried-over cursor moves down with the task it points at.
+static void compact_tasks(void)
+{
+    int count = 0;
+    int cursor = g_cursor;
+    for (int i = 0; i < g_taskCount; i++)
+    {
+        if (g_tasks[i].active)
+        {
+            g_tasks[count++] = g_tasks[i];
+        }
+        else if (i < g_cursor)
+        {
+            cursor--;
+        }
+    }
+
+    g_cursor = cursor;
+    if (g_cursor >= count)
+    {
+        g_cursor = 0;
+    }
+    InterlockedExchange(&g_taskCount, count);
+}
+
+static void cancel_task(lua_State *L, frame_task *task)
+{
+    if (task->active)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, task->ref);
+        task->ref = LUA_NOREF;
+        task->active = false;
+    }
+}
+
+static void run_task(lua_State *L, frame_task *task, int64_t now)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, task->ref);
+    lua_pushnumber(L, task->last_run ? ticks_to_ms(now - task->last_run) : 0.0);
+    task->last_run = now;
+
+    if (lua_pcall(L, 1, 1, 0) != 0)
+    {
+        const char *error = lua_tostring(L, -1);
+        output_printf("[frame] Callback %d failed and was removed: %s\n", task->id, error ? error : "(unknown error)");
+        lua_pop(L, 1);
+        cancel_task(L, task);
+        return;
+    }
+
+    // Returning false unsubscribes the callback
+    if (lua_type(L, -1) == LUA_TBOOLEAN && !lua_toboolean(L, -1))
+    {
+        cancel_task(L, task);
+    }
+    lua_pop(L, 1);
+}
+
+// Runs due callbacks until the budget is spent, starting where the previous
+// frame stopped so a slow callback can't starve the ones after it.
+static void run_tasks(lua_State *L, int64_t start)
+{
+    int     count = g_taskCount;
+    int64_t deadline = start + g_budgetTicks;
+    int     ran = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        int         index = (g_cursor + i) % count;
+        frame_task *task = &g_tasks[index];
+        if (!task->active)
+        {
+            continue;
+        }
+
+        int64_t now = qpc_now();
+        if (task->interval_ms && now < task->next_due)
+        {
+            continue;
+        }
+
+        if (ran > 0 && now >= deadline)
+        {
+            g_cursor = index;
+            g_stats.carried++;
+            break;
+        }
+
+        run_task(L, task, now);
+        ran++;
+
+        if (task->interval_ms)
+        {
+            int64_t interval = (int64_t)task->interval_ms * g_qpcFrequency / 1000;
+            task->next_due += interval;
+            if (task->next_due <= now)
+            {
+                task->next_due = now + interval;
+            }
+        }
+    }
+
+    g_stats.callbacks += ran;
+}
+
+//============================================================================
+// TICK
+//============================================================================
+
+static void tick(bool from_detour)
+{
+    dispatch_pump();
+
+    if (g_taskCount == 0 || g_inTick)
+    {
+        return;
+    }
+
+    int64_t start = qpc_now();
+    if (!from_detour)
+    {
+        // The detour drives Lua once attached; the pump only paces a fallback
+        if (g_frameDetour.attached || ticks_to_ms(start - g_lastPumpTick) < FRAME_PUMP_INTERVAL_MS)
+        {
+            return;
+        }
+        g_lastPumpTick = start;
+    }
+
+    lua_State *L = luastate_try_acquire();
+    if (!L)
+    {
+        g_stats.skipped++;
+        return;
+    }
+
+    g_inTick = true;
+    uint16_t saved_cw = frame_fpu_enter();
+
+    run_tasks(L, start);
+    compact_tasks();
+
+    frame_fpu_leave(saved_cw);
+    g_inTick = false;
+
+    luastate_release();
+
+    g_stats.lua_ticks++;
+    g_stats.last_ticks = qpc_now() - start;
+    if (g_stats.last_ticks > g_stats.max_ticks)
+    {
+        g_stats.max_ticks = g_stats.last_ticks;
+    }
+}
+
+// Runs on the main thread once per frame (detour) or per pump message.
+// The whole tick, dispatched jobs included, is charged to our frame time.
+void frame_tick(bool from_detour)
+{
+    if (!dispatch_is_main_thread())
+    {
+        return;
+    }
+
+    int64_t work = frametime_enter();
+    tick(from_detour);
+    frametime_leave(work);
+}
+
+static void frame_pump_handler(void)
+{
+    frame_tick(false);
+}
+
+// Entered from the detour stub with all registers saved
+void frame_on_detour(void)
+{
+    g_stats.frames++;
+    frametime_mark(false);
+    frame_tick(true);
+}
+
+// Runs the tick, restores every register the game expects, then continues
+// into the original frame function through the trampoline.
+__attribute__((naked)) static void frame_detour_stub(void)
+{
+    __asm__ volatile("pushal\n\t"
+                     "pushfl\n\t"
+                     "call " ASM_SYMBOL(frame_on_detour) "\n\t"
+                     "popfl\n\t"
+                     "popal\n\t"
+                     "jmp *" ASM_SYMBOL(g_frameTrampoline) "\n\t");
+}
+
+//============================================================================
+// PUMP TIMER
+//============================================================================
+
+// Thread timers must be created on the thread whose queue they post to.
+// No TIMERPROC is used, so a WM_TIMER left over after unload is harmless.
+static void set_timer_job(dispatch_job *job)
+{
+    if (job->user)
+    {
+        g_pumpTimer = SetTimer(NULL, 0, FRAME_PUMP_INTERVAL_MS, NULL);
+    }
+    else if (g_pumpTimer)
+    {
+        KillTimer(NULL, g_pumpTimer);
+        g_pumpTimer = 0;
+    }
+}
+
+static void request_pump_timer(bool enable, DWORD wait_ms)
+{
+    dispatch_job *job = dispatch_job_new(set_timer_job, enable ? (void *)1 : NULL);
+    if (!job)
+    {
+        return;
+    }
+
+    if (dispatch_submit(job) && wait_ms)
+    {
+        dispatch_wait(job, wait_ms);
+    }
+    dispatch_job_release(job);
+}
+
+//============================================================================
+// LIFECYCLE
+//============================================================================
+
+void frame_init(void)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_qpcFrequency = frequency.QuadPart;
+    g_budgetTicks = (int64_t)FRAME_DEFAULT_BUDGET_US * g_qpcFrequency / 1000000;
+
+    dispatch_set_pump_handler(frame_pump_handler);
+}
+
+void frame_shutdown(void)
+{
+    if (g_frameDetour.attached)
+    {
+        detour_disable(&g_frameDetour);
+    }
+
+    if (g_pumpTimer)
+    {
+        request_pump_timer(false, 200);
+    }
+
+    dispatch_set_pump_handler(NULL);
+
+    // Registry references die with the state; only the array needs freeing
+    luastate_acquire();
+    InterlockedExchange(&g_taskCount, 0);
+    free(g_tasks);
+    g_tasks = NULL;
+    g_taskCapacity = 0;
+    luastate_release();
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static int add_task(lua_State *L, uint32_t interval_ms, int fn_index)
+{
+    luaL_checktype(L, fn_index, LUA_TFUNCTION);
+
+    if (!g_inTick)
+    {
+        compact_tasks();
+    }
+
+    if (g_taskCount == g_taskCapacity)
+    {
+        // Growing while a tick walks the array would invalidate its pointers
+        if (g_inTick)
+        {
+            return luaL_error(L, "cannot register more callbacks from inside a frame callback");
+        }
+
+        int         capacity = g_taskCapacity ? g_taskCapacity * 2 : 16;
+        frame_task *grown = realloc(g_tasks, capacity * sizeof(frame_task));
+        if (!grown)
+        {
+            return luaL_error(L, "out of memory");
+        }
+        g_tasks = grown;
+        g_taskCapacity = capacity;
+    }
+
+    lua_pushvalue(L, fn_index);
+
+    frame_task *task = &g_tasks[g_taskCount];
+    task->id = g_nextTaskId++;
+    task->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    task->interval_ms = interval_ms;
+    task->next_due = qpc_now() + (int64_t)interval_ms * g_qpcFrequency / 1000;
+    task->last_run = 0;
+    task->active = true;
+    InterlockedIncrement(&g_taskCount);
+
+    // Without a frame detour, keep the pump ticking even when the game is idle
+    if (!g_frameDetour.attached && !g_pumpTimer)
+    {
+        request_pump_timer(true, 0);
+    }
+
+    lua_pushinteger(L, task->id);
+    return 1;
+}
+
+// frame.on_frame(fn) -> id; fn(elapsed_ms) runs every frame
+static int l_frame_on_frame(lua_State *L)
+{
+    return add_task(L, 0, 1);
+}
+
+// frame.on_tick(ms, fn) -> id; fn(elapsed_ms) runs at most every ms milliseconds
+static int l_frame_on_tick(lua_State *L)
+{
+    lua_Number interval = luaL_checknumber(L, 1);
+    luaL_argcheck(L, interval >= 1, 1, "interval must be at least 1 ms");
+    return add_task(L, (uint32_t)interval, 2);
+}
+
+static int l_frame_cancel(lua_State *L)
+{
+    int id = luaL_checkint(L, 1);
+    for (int i = 0; i < g_taskCount; i++)
+    {
+        if (g_tasks[i].id == id && g_tasks[i].active)
+        {
+            cancel_task(L, &g_tasks[i]);
+            lua_pushboolean(L, 1);
+            return 1;
+        }
+    }
+    lua_pushboolean(L, 0);
+    return 1;
+}
+
+// frame.budget([ms]) -> ms; gets or sets the per-frame Lua budget
+static int l_frame_budget(lua_State *L)
+{
+    if (!lua_isnoneornil(L, 1))
+    {
+        lua_Number ms = luaL_checknumber(L, 1);
+        luaL_argcheck(L, ms > 0, 1, "budget must be positive");
+        g_budgetTicks = (int64_t)(ms * (double)g_qpcFrequency / 1000.0);
+    }
+    lua_pushnumber(L, ticks_to_ms(g_budgetTicks));
+    return 1;
+}
+
+// frame.attach(addr) hooks the game's per-frame function
+static int l_frame_attach(lua_State *L)
+{
+    uint32_t address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    if (g_frameDetour.attached)
+    {
+        return luaL_error(L, "frame function already hooked at 0x%08X", (unsigned)(uintptr_t)g_frameDetour.target);
+    }
+
+    // The stub may run as soon as the jump is written, so the trampoline
+    // it continues into is published before enabling
+    if (!detour_create(&g_frameDetour, (void *)(uintptr_t)address, (void *)frame_detour_stub))
+    {
+        return luaL_error(L, "cannot relocate prologue at 0x%08X (see hook_log.txt)", address);
+    }
+    g_frameTrampoline = g_frameDetour.trampoline;
+
+    if (!detour_enable(&g_frameDetour))
+    {
+        return luaL_error(L, "failed to hook frame function at 0x%08X", address);
+    }
+
+    if (g_pumpTimer)
+    {
+        request_pump_timer(false, 0);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int l_frame_detach(lua_State *L)
+{
+    bool detached = g_frameDetour.attached && detour_disable(&g_frameDetour);
+    if (detached && g_taskCount > 0 && !g_pumpTimer)
+    {
+        request_pump_timer(true, 0);
+    }
+    lua_pushboolean(L, detached);
+    return 1;
+}
+
+static int l_frame_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 10);
+    lua_pushstring(L, g_frameDetour.attached ? "detour" : "pump");
+    lua_setfield(L, -2, "source");
+    lua_pushnumber(L, g_frameDetour.attached ? (lua_Number)(uintptr_t)g_frameDetour.target : 0);
+    lua_setfield(L, -2, "frame_function");
+    lua_pushinteger(L, g_taskCount);
+    lua_setfield(L, -2, "callbacks");
+    lua_pushnumber(L, g_stats.frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushnumber(L, g_stats.lua_ticks);
+    lua_setfield(L, -2, "lua_ticks");
+    lua_pushnumber(L, g_stats.callbacks);
+    lua_setfield(L, -2, "callbacks_run");
+    lua_pushnumber(L, g_stats.carried);
+    lua_setfield(L, -2, "carried");
+    lua_pushnumber(L, g_stats.skipped);
+    lua_setfield(L, -2, "skipped");
+    lua_pushnumber(L, ticks_to_ms(g_stats.last_ticks));
+    lua_setfield(L, -2, "last_ms");
+    lua_pushnumber(L, ticks_to_ms(g_stats.max_ticks));
+    lua_setfield(L, -2, "max_ms");
+    return 1;
+}
+
+static const luaL_Reg frame_funcs[] = {{"on_frame", l_frame_on_frame}, {"on_tick", l_frame_on_tick},
+                                       {"cancel", l_frame_cancel},     {"budget", l_frame_budget},
+                                       {"attach", l_frame_attach},     {"detach", l_frame_detach},
+                                       {"stats", l_frame_stats},       {NULL, NULL}};
+
+int luaopen_frame(lua_State *L)
+{
+    luaL_register(L, "frame", frame_funcs);
+    return 1;
+}
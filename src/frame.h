@@ -0,0 +1,17 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+
+void     frame_init(void);
+void     frame_shutdown(void);
+void     frame_tick(bool from_detour);
+uint16_t frame_fpu_enter(void);
+void     frame_fpu_leave(uint16_t saved);
+int      luaopen_frame(lua_State *L);
+
+#endif // FRAME_H
@@ -0,0 +1,531 @@
+/*
+ * frametime.c: Frame-time collector and console overlay.
+ *
+ * A frame boundary is the entry of the game's present/flip call when that
+ * is hooked with frametime.attach, and otherwise the frame function hooked
+ * by frame.attach. The interval between boundaries goes into a latency
+ * histogram; intervals over the hitch threshold are also logged with how
+ * much of them was our own work. Our work is whatever runs on the main
+ * thread between frametime_enter/leave: frame ticks, dispatched jobs and
+ * hook callbacks. Every FRAMETIME_WINDOW_MS the recent numbers are rolled
+ * up and, if enabled, drawn as a status line on the top row of the console
+ * or into the console title.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "dispatch.h"
+#include "frame.h"
+#include "frametime.h"
+#include "lauxlib.h"
+#include "latency.h"
+
+#define FRAMETIME_STATUS_MAX 160
+
+// Decorated names for symbols referenced from the detour stub
+#define ASM_SYMBOL(name) "_" #name
+
+typedef enum
+{
+    OVERLAY_OFF = 0,
+    OVERLAY_STATUS, /* Top row of the console window */
+    OVERLAY_TITLE   /* Console window title */
+} overlay_mode;
+
+static const char *const g_overlayNames[] = {"off", "status", "title", NULL};
+
+typedef struct
+{
+    int64_t  at;       /* QPC tick of the boundary that ended the frame */
+    uint64_t frame_ns;
+    uint64_t mod_ns;
+} frametime_hitch;
+
+typedef struct
+{
+    int64_t  start;
+    uint32_t frames;
+    uint32_t hitches;
+    uint64_t frame_ns;
+    uint64_t mod_ns;
+    uint64_t max_ns;
+} frametime_window;
+
+static SRWLOCK           g_lock = SRWLOCK_INIT;
+static latency_histogram g_frames;
+static latency_histogram g_mod; /* Our work per frame */
+static uint64_t          g_hitches = 0;
+static uint64_t          g_modHitches = 0; /* Hitches where we took over half the frame */
+static uint64_t          g_hitchNs = (uint64_t)FRAMETIME_DEFAULT_HITCH_MS * 1000000;
+static frametime_hitch   g_hitchLog[FRAMETIME_HITCH_LOG];
+static uint32_t          g_hitchNext = 0;
+static uint64_t          g_lastFrameNs = 0;
+static uint64_t          g_lastModNs = 0;
+static int64_t           g_lastBoundary = 0;
+static frametime_window  g_window = {0};
+static frametime_window  g_recent = {0}; /* Last completed window */
+
+static int64_t           g_qpcFrequency = 0;
+static volatile LONGLONG g_modTicks = 0; /* Our work since the last boundary */
+static int               g_workDepth = 0; /* Main thread only */
+
+static overlay_mode      g_overlay = OVERLAY_OFF;
+static char              g_savedTitle[256] = "";
+
+static detour            g_presentDetour = {0};
+void *volatile           g_presentTrampoline = NULL;
+
+//============================================================================
+// TIMING
+//============================================================================
+
+static int64_t qpc_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+static uint64_t ticks_to_ns(int64_t ticks)
+{
+    if (ticks <= 0)
+    {
+        return 0;
+    }
+    return (uint64_t)(ticks / g_qpcFrequency) * 1000000000ull +
+           (uint64_t)(ticks % g_qpcFrequency) * 1000000000ull / (uint64_t)g_qpcFrequency;
+}
+
+static double ns_to_ms(uint64_t ns)
+{
+    return (double)ns / 1e6;
+}
+
+static void init_frequency(void)
+{
+    if (!g_qpcFrequency)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        g_qpcFrequency = frequency.QuadPart;
+    }
+}
+
+//============================================================================
+// WORK ACCOUNTING
+//============================================================================
+
+// Starts charging main-thread time to our own work. Nested sections (a hook
+// callback inside a dispatched job) are charged once, by the outermost.
+int64_t frametime_enter(void)
+{
+    if (!dispatch_is_main_thread() || g_workDepth++ > 0)
+    {
+        return 0;
+    }
+    return qpc_now();
+}
+
+void frametime_leave(int64_t start)
+{
+    if (!dispatch_is_main_thread())
+    {
+        return;
+    }
+
+    g_workDepth--;
+    if (start)
+    {
+        InterlockedExchangeAdd64(&g_modTicks, qpc_now() - start);
+    }
+}
+
+//============================================================================
+// OVERLAY
+//============================================================================
+
+static void format_status(char *buffer, size_t size)
+{
+    AcquireSRWLockShared(&g_lock);
+    frametime_window recent = g_recent;
+    uint64_t         hitches = g_hitches;
+    uint64_t         mod_hitches = g_modHitches;
+    uint64_t         p99 = latency_percentile(&g_frames, 99.0);
+    ReleaseSRWLockShared(&g_lock);
+
+    double span_ms = ns_to_ms(recent.frame_ns);
+    snprintf(buffer, size, "%5.1f fps | frame %5.1f ms (max %5.1f, p99 %5.1f) | hitches %llu (%llu ours) | mod %.2f ms/frame (%.1f%%)",
+             span_ms > 0 ? recent.frames * 1000.0 / span_ms : 0.0,
+             recent.frames ? span_ms / recent.frames : 0.0, ns_to_ms(recent.max_ns), ns_to_ms(p99),
+             (unsigned long long)hitches, (unsigned long long)mod_hitches,
+             recent.frames ? ns_to_ms(recent.mod_ns) / recent.frames : 0.0,
+             recent.frame_ns ? 100.0 * (double)recent.mod_ns / (double)recent.frame_ns : 0.0);
+}
+
+// Writes over the top visible row without moving the cursor, so the
+// console's own output keeps scrolling underneath
+static void draw_status_line(const char *text)
+{
+    HANDLE                     console = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (console == INVALID_HANDLE_VALUE || !GetConsoleScreenBufferInfo(console, &info))
+    {
+        return;
+    }
+
+    char  line[FRAMETIME_STATUS_MAX + 1];
+    DWORD width = (DWORD)(info.srWindow.Right - info.srWindow.Left + 1);
+    if (width > FRAMETIME_STATUS_MAX)
+    {
+        width = FRAMETIME_STATUS_MAX;
+    }
+    snprintf(line, sizeof(line), "%-*.*s", (int)width, (int)width, text);
+
+    COORD origin = {info.srWindow.Left, info.srWindow.Top};
+    DWORD written;
+    WriteConsoleOutputCharacterA(console, line, width, origin, &written);
+}
+
+static void draw_overlay(void)
+{
+    char text[FRAMETIME_STATUS_MAX];
+    format_status(text, sizeof(text));
+
+    if (g_overlay == OVERLAY_STATUS)
+    {
+        draw_status_line(text);
+    }
+    else if (g_overlay == OVERLAY_TITLE)
+    {
+        SetConsoleTitleA(text);
+    }
+}
+
+static void set_overlay(overlay_mode mode)
+{
+    if (mode == g_overlay)
+    {
+        return;
+    }
+
+    if (g_overlay == OVERLAY_TITLE && g_savedTitle[0])
+    {
+        SetConsoleTitleA(g_savedTitle);
+    }
+    if (mode == OVERLAY_TITLE && !GetConsoleTitleA(g_savedTitle, sizeof(g_savedTitle)))
+    {
+        g_savedTitle[0] = '\0';
+    }
+    g_overlay = mode;
+}
+
+//============================================================================
+// COLLECTOR
+//============================================================================
+
+static void record_frame(int64_t now, uint64_t frame_ns, uint64_t mod_ns)
+{
+    latency_record(&g_frames, frame_ns, true);
+    latency_record(&g_mod, mod_ns, true);
+    g_lastFrameNs = frame_ns;
+    g_lastModNs = mod_ns;
+
+    if (frame_ns >= g_hitchNs)
+    {
+        g_hitches++;
+        if (mod_ns * 2 >= frame_ns)
+        {
+            g_modHitches++;
+        }
+
+        frametime_hitch *hitch = &g_hitchLog[g_hitchNext++ % FRAMETIME_HITCH_LOG];
+        hitch->at = now;
+        hitch->frame_ns = frame_ns;
+        hitch->mod_ns = mod_ns;
+        g_window.hitches++;
+    }
+
+    g_window.frames++;
+    g_window.frame_ns += frame_ns;
+    g_window.mod_ns += mod_ns;
+    if (frame_ns > g_window.max_ns)
+    {
+        g_window.max_ns = frame_ns;
+    }
+}
+
+// Called at every frame boundary. Boundaries from the frame function are
+// ignored once the present call is hooked, so each frame counts once.
+void frametime_mark(bool from_present)
+{
+    if (!from_present && g_presentDetour.attached)
+    {
+        return;
+    }
+
+    int64_t now = qpc_now();
+    int64_t mod_ticks = InterlockedExchange64(&g_modTicks, 0);
+    bool    redraw = false;
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (g_lastBoundary)
+    {
+        record_frame(now, ticks_to_ns(now - g_lastBoundary), ticks_to_ns(mod_ticks));
+    }
+    else
+    {
+        g_window.start = now;
+    }
+    g_lastBoundary = now;
+
+    if (now - g_window.start >= (int64_t)FRAMETIME_WINDOW_MS * g_qpcFrequency / 1000)
+    {
+        g_recent = g_window;
+        memset(&g_window, 0, sizeof(g_window));
+        g_window.start = now;
+        redraw = g_overlay != OVERLAY_OFF;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    // Drawing is our work too; it lands in the next frame's share
+    if (redraw)
+    {
+        uint16_t saved_cw = frame_fpu_enter();
+        draw_overlay();
+        frame_fpu_leave(saved_cw);
+        InterlockedExchangeAdd64(&g_modTicks, qpc_now() - now);
+    }
+}
+
+static void reset_stats(void)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    latency_reset(&g_frames);
+    latency_reset(&g_mod);
+    g_hitches = 0;
+    g_modHitches = 0;
+    g_hitchNext = 0;
+    g_lastFrameNs = 0;
+    g_lastModNs = 0;
+    g_lastBoundary = 0;
+    memset(&g_window, 0, sizeof(g_window));
+    memset(&g_recent, 0, sizeof(g_recent));
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+// Entered from the detour stub with all registers saved
+void frametime_on_present(void)
+{
+    frametime_mark(true);
+}
+
+// Marks the boundary, restores every register, then continues into the
+// original present/flip function through the trampoline.
+__attribute__((naked)) static void frametime_present_stub(void)
+{
+    __asm__ volatile("pushal\n\t"
+                     "pushfl\n\t"
+                     "call " ASM_SYMBOL(frametime_on_present) "\n\t"
+                     "popfl\n\t"
+                     "popal\n\t"
+                     "jmp *" ASM_SYMBOL(g_presentTrampoline) "\n\t");
+}
+
+void frametime_shutdown(void)
+{
+    if (g_presentDetour.attached)
+    {
+        detour_disable(&g_presentDetour);
+    }
+    set_overlay(OVERLAY_OFF);
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+// frametime.attach(addr) hooks the game's present/flip call
+static int l_frametime_attach(lua_State *L)
+{
+    uint32_t address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    if (g_presentDetour.attached)
+    {
+        return luaL_error(L, "present function already hooked at 0x%08X",
+                          (unsigned)(uintptr_t)g_presentDetour.target);
+    }
+
+    if (!detour_create(&g_presentDetour, (void *)(uintptr_t)address, (void *)frametime_present_stub))
+    {
+        return luaL_error(L, "cannot relocate prologue at 0x%08X (see hook_log.txt)", address);
+    }
+    g_presentTrampoline = g_presentDetour.trampoline;
+
+    // Intervals measured against the old boundary source would mix the two
+    reset_stats();
+    if (!detour_enable(&g_presentDetour))
+    {
+        return luaL_error(L, "failed to hook present function at 0x%08X", address);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int l_frametime_detach(lua_State *L)
+{
+    bool detached = g_presentDetour.attached && detour_disable(&g_presentDetour);
+    if (detached)
+    {
+        reset_stats();
+    }
+    lua_pushboolean(L, detached);
+    return 1;
+}
+
+static void push_window(lua_State *L, const frametime_window *window)
+{
+    double span_ms = ns_to_ms(window->frame_ns);
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, window->frames);
+    lua_setfield(L, -2, "frames");
+    lua_pushnumber(L, span_ms > 0 ? window->frames * 1000.0 / span_ms : 0);
+    lua_setfield(L, -2, "fps");
+    lua_pushnumber(L, window->frames ? span_ms / window->frames : 0);
+    lua_setfield(L, -2, "mean_ms");
+    lua_pushnumber(L, ns_to_ms(window->max_ns));
+    lua_setfield(L, -2, "max_ms");
+    lua_pushnumber(L, window->hitches);
+    lua_setfield(L, -2, "hitches");
+    lua_pushnumber(L, window->frame_ns ? 100.0 * (double)window->mod_ns / (double)window->frame_ns : 0);
+    lua_setfield(L, -2, "mod_pct");
+}
+
+// frametime.stats() -> {source, frames, fps, frame = histogram stats, mod = histogram stats,
+//                       hitches, mod_hitches, hitch_ms, mod_pct, last_ms, last_mod_ms, recent}
+static int l_frametime_stats(lua_State *L)
+{
+    latency_histogram *frames = (latency_histogram *)lua_newuserdata(L, sizeof(latency_histogram));
+    latency_histogram *mod = (latency_histogram *)lua_newuserdata(L, sizeof(latency_histogram));
+
+    // Copied under the lock, summarized outside it, so the game never waits
+    // on percentile walks
+    AcquireSRWLockShared(&g_lock);
+    memcpy(frames, &g_frames, sizeof(*frames));
+    memcpy(mod, &g_mod, sizeof(*mod));
+    uint64_t         hitches = g_hitches;
+    uint64_t         mod_hitches = g_modHitches;
+    uint64_t         last_ns = g_lastFrameNs;
+    uint64_t         last_mod_ns = g_lastModNs;
+    frametime_window recent = g_recent;
+    ReleaseSRWLockShared(&g_lock);
+
+    lua_createtable(L, 0, 14);
+    lua_pushstring(L, g_presentDetour.attached ? "present" : (frames->count ? "frame" : "none"));
+    lua_setfield(L, -2, "source");
+    lua_pushnumber(L, g_presentDetour.attached ? (lua_Number)(uintptr_t)g_presentDetour.target : 0);
+    lua_setfield(L, -2, "present_function");
+    lua_pushnumber(L, (lua_Number)frames->count);
+    lua_setfield(L, -2, "frames");
+    lua_pushnumber(L, frames->sum ? (double)frames->count * 1e9 / (double)frames->sum : 0);
+    lua_setfield(L, -2, "fps");
+    latency_push_stats(L, frames);
+    lua_setfield(L, -2, "frame");
+    latency_push_stats(L, mod);
+    lua_setfield(L, -2, "mod");
+    lua_pushnumber(L, (lua_Number)hitches);
+    lua_setfield(L, -2, "hitches");
+    lua_pushnumber(L, (lua_Number)mod_hitches);
+    lua_setfield(L, -2, "mod_hitches");
+    lua_pushnumber(L, ns_to_ms(g_hitchNs));
+    lua_setfield(L, -2, "hitch_ms");
+    lua_pushnumber(L, frames->sum ? 100.0 * (double)mod->sum / (double)frames->sum : 0);
+    lua_setfield(L, -2, "mod_pct");
+    lua_pushnumber(L, ns_to_ms(last_ns));
+    lua_setfield(L, -2, "last_ms");
+    lua_pushnumber(L, ns_to_ms(last_mod_ns));
+    lua_setfield(L, -2, "last_mod_ms");
+    push_window(L, &recent);
+    lua_setfield(L, -2, "recent");
+    return 1;
+}
+
+// frametime.hitches() -> array of {ago_ms, frame_ms, mod_ms}, newest first
+static int l_frametime_hitches(lua_State *L)
+{
+    frametime_hitch log[FRAMETIME_HITCH_LOG];
+    AcquireSRWLockShared(&g_lock);
+    uint32_t next = g_hitchNext;
+    memcpy(log, g_hitchLog, sizeof(log));
+    ReleaseSRWLockShared(&g_lock);
+
+    uint32_t count = next < FRAMETIME_HITCH_LOG ? next : FRAMETIME_HITCH_LOG;
+    int64_t  now = qpc_now();
+    lua_createtable(L, (int)count, 0);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const frametime_hitch *hitch = &log[(next - 1 - i) % FRAMETIME_HITCH_LOG];
+        lua_createtable(L, 0, 3);
+        lua_pushnumber(L, ns_to_ms(ticks_to_ns(now - hitch->at)));
+        lua_setfield(L, -2, "ago_ms");
+        lua_pushnumber(L, ns_to_ms(hitch->frame_ns));
+        lua_setfield(L, -2, "frame_ms");
+        lua_pushnumber(L, ns_to_ms(hitch->mod_ns));
+        lua_setfield(L, -2, "mod_ms");
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+    return 1;
+}
+
+// frametime.threshold([ms]) -> ms; gets or sets the hitch threshold
+static int l_frametime_threshold(lua_State *L)
+{
+    if (!lua_isnoneornil(L, 1))
+    {
+        lua_Number ms = luaL_checknumber(L, 1);
+        luaL_argcheck(L, ms > 0, 1, "threshold must be positive");
+        g_hitchNs = (uint64_t)(ms * 1e6);
+    }
+    lua_pushnumber(L, ns_to_ms(g_hitchNs));
+    return 1;
+}
+
+// frametime.overlay([mode]) -> mode; mode is "status", "title" or "off"/false
+static int l_frametime_overlay(lua_State *L)
+{
+    if (lua_isboolean(L, 1) && !lua_toboolean(L, 1))
+    {
+        set_overlay(OVERLAY_OFF);
+    }
+    else if (!lua_isnoneornil(L, 1))
+    {
+        set_overlay((overlay_mode)luaL_checkoption(L, 1, NULL, g_overlayNames));
+    }
+    lua_pushstring(L, g_overlayNames[g_overlay]);
+    return 1;
+}
+
+static int l_frametime_reset(lua_State *L)
+{
+    (void)L;
+    reset_stats();
+    return 0;
+}
+
+static const luaL_Reg frametime_funcs[] = {{"attach", l_frametime_attach},       {"detach", l_frametime_detach},
+                                           {"stats", l_frametime_stats},         {"hitches", l_frametime_hitches},
+                                           {"threshold", l_frametime_threshold}, {"overlay", l_frametime_overlay},
+                                           {"reset", l_frametime_reset},         {NULL, NULL}};
+
+int luaopen_frametime(lua_State *L)
+{
+    init_frequency();
+    reset_stats();
+    luaL_register(L, "frametime", frametime_funcs);
+    return 1;
+}
@@ -0,0 +1,20 @@
+#ifndef FRAMETIME_H
+#define FRAMETIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+
+#define FRAMETIME_DEFAULT_HITCH_MS 50 /* Frames longer than this count as hitches */
+#define FRAMETIME_WINDOW_MS 500       /* Recent-stats window and overlay refresh */
+#define FRAMETIME_HITCH_LOG 32        /* Most recent hitches kept */
+
+void    frametime_mark(bool from_present);
+int64_t frametime_enter(void);
+void    frametime_leave(int64_t start);
+void    frametime_shutdown(void);
+int     luaopen_frametime(lua_State *L);
+
+#endif // FRAMETIME_H
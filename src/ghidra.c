@@ -0,0 +1,1131 @@
+/*
+ * ghidra.c: Import of Ghidra symbol exports into registry files.
+ *
+ * ghidra.import() streams a CSV export of the Functions or Symbol Table
+ * window, or a JSON array of function objects as export scripts write
+ * them, straight into a regfile_builder: the file is read in fixed blocks
+ * and each row is kept only until it is added, so memory grows with the
+ * registry being written and not with the export. Ghidra prototypes are
+ * rewritten as FFI signatures on the way, with parameter names dropped and
+ * Ghidra's own types (undefined4, uint, ...) mapped to C ones.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "ghidra.h"
+#include "lauxlib.h"
+#include "regfile.h"
+
+typedef enum
+{
+    FIELD_NONE,
+    FIELD_NAME,
+    FIELD_ADDRESS,
+    FIELD_SIGNATURE,
+    FIELD_SIZE,
+    FIELD_DESCRIPTION,
+    FIELD_TYPE,
+    FIELD_COUNT
+} field_id;
+
+// Column and key names, compared lowercased with spaces and underscores
+// removed ("Function Signature", "entry_point")
+static const struct
+{
+    const char *key;
+    field_id    field;
+} g_fieldNames[] = {{"name", FIELD_NAME},
+                    {"functionname", FIELD_NAME},
+                    {"symbol", FIELD_NAME},
+                    {"location", FIELD_ADDRESS},
+                    {"address", FIELD_ADDRESS},
+                    {"entrypoint", FIELD_ADDRESS},
+                    {"entry", FIELD_ADDRESS},
+                    {"functionsignature", FIELD_SIGNATURE},
+                    {"signature", FIELD_SIGNATURE},
+                    {"prototype", FIELD_SIGNATURE},
+                    {"functionsize", FIELD_SIZE},
+                    {"size", FIELD_SIZE},
+                    {"length", FIELD_SIZE},
+                    {"comment", FIELD_DESCRIPTION},
+                    {"description", FIELD_DESCRIPTION},
+                    {"type", FIELD_TYPE},
+                    {"symboltype", FIELD_TYPE},
+                    {"kind", FIELD_TYPE}};
+
+typedef struct
+{
+    char fields[FIELD_COUNT][GHIDRA_FIELD_SIZE];
+    bool truncated[FIELD_COUNT];
+    bool numeric_address; /* JSON number: decimal rather than hex text */
+} import_row;
+
+typedef struct
+{
+    FILE            *file;
+    regfile_builder *builder;
+    const char      *error;
+    uint32_t         line;
+    uint32_t         functions;
+    uint32_t         skipped;
+    uint32_t         duplicates;
+    size_t           position;
+    size_t           length;
+    uint8_t          buffer[GHIDRA_READ_SIZE];
+} importer;
+
+//============================================================================
+// SIGNATURES
+//============================================================================
+
+// Ghidra and Win32 type names the FFI can take as they are, or their
+// C equivalents; anything else is an unknown struct or typedef
+static const struct
+{
+    const char *ghidra;
+    const char *ffi;
+} g_typeNames[] = {
+    {"void", "void"},
+    {"bool", "bool"},
+    {"char", "char"},
+    {"signed char", "signed char"},
+    {"unsigned char", "unsigned char"},
+    {"short", "short"},
+    {"unsigned short", "unsigned short"},
+    {"int", "int"},
+    {"unsigned int", "unsigned int"},
+    {"unsigned", "unsigned int"},
+    {"long", "long"},
+    {"unsigned long", "unsigned long"},
+    {"long long", "long long"},
+    {"unsigned long long", "unsigned long long"},
+    {"float", "float"},
+    {"double", "double"},
+    {"wchar_t", "wchar_t"},
+    {"size_t", "size_t"},
+    {"int8_t", "int8_t"},
+    {"int16_t", "int16_t"},
+    {"int32_t", "int32_t"},
+    {"int64_t", "int64_t"},
+    {"uint8_t", "uint8_t"},
+    {"uint16_t", "uint16_t"},
+    {"uint32_t", "uint32_t"},
+    {"uint64_t", "uint64_t"},
+    {"uchar", "unsigned char"},
+    {"schar", "signed char"},
+    {"ushort", "unsigned short"},
+    {"uint", "unsigned int"},
+    {"ulong", "unsigned long"},
+    {"longlong", "long long"},
+    {"ulonglong", "unsigned long long"},
+    {"wchar16", "uint16_t"},
+    {"undefined", "uint8_t"},
+    {"undefined1", "uint8_t"},
+    {"undefined2", "uint16_t"},
+    {"undefined4", "uint32_t"},
+    {"undefined8", "uint64_t"},
+    {"byte", "uint8_t"},
+    {"sbyte", "int8_t"},
+    {"word", "uint16_t"},
+    {"sword", "int16_t"},
+    {"dword", "uint32_t"},
+    {"sdword", "int32_t"},
+    {"qword", "uint64_t"},
+    {"sqword", "int64_t"},
+    {"BOOL", "int"},
+    {"BYTE", "uint8_t"},
+    {"WORD", "uint16_t"},
+    {"DWORD", "uint32_t"},
+    {"UINT", "unsigned int"},
+    {"LONG", "long"},
+    {"HANDLE", "void *"},
+    {"HWND", "void *"},
+    {"HMODULE", "void *"},
+    {"HINSTANCE", "void *"},
+    {"LPVOID", "void *"},
+    {"LPCVOID", "const void *"},
+    {"LPSTR", "char *"},
+    {"LPCSTR", "const char *"},
+};
+
+static const char *g_conventions[] = {"__stdcall", "__cdecl", "__fastcall", "__thiscall"};
+
+// Words that are part of a type and never a parameter name
+static const char *g_typeWords[] = {"void",  "bool",   "char",     "short", "int",    "long",  "float",
+                                    "double", "signed", "unsigned", "const", "volatile", "struct", "union",
+                                    "enum"};
+
+typedef struct
+{
+    char  *out;
+    size_t size;
+    size_t length;
+    bool   overflow;
+} text_buffer;
+
+static void append(text_buffer *text, const char *data, size_t length)
+{
+    if (text->length + length >= text->size)
+    {
+        text->overflow = true;
+        return;
+    }
+    memcpy(text->out + text->length, data, length);
+    text->length += length;
+    text->out[text->length] = '\0';
+}
+
+static void append_string(text_buffer *text, const char *data)
+{
+    append(text, data, strlen(data));
+}
+
+static bool is_word_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == ':' || c == '$' || c == '@' || c == '?' || c == '<' ||
+           c == '>' || c == '~';
+}
+
+static bool is_type_word(const char *word, size_t length)
+{
+    for (size_t i = 0; i < sizeof(g_typeWords) / sizeof(g_typeWords[0]); i++)
+    {
+        if (strlen(g_typeWords[i]) == length && strncmp(g_typeWords[i], word, length) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_qualifier(const char *word, size_t length)
+{
+    return (length == 5 && strncmp(word, "const", 5) == 0) || (length == 8 && strncmp(word, "volatile", 8) == 0) ||
+           (length == 6 && strncmp(word, "struct", 6) == 0) || (length == 5 && strncmp(word, "union", 5) == 0) ||
+           (length == 4 && strncmp(word, "enum", 4) == 0);
+}
+
+// Rewrites one declaration ("char * param_2", "uint", "undefined4 *") as an
+// FFI type. `named` says whether a trailing identifier is a name to drop.
+// Returns false for declarations that cannot be read, such as inline
+// function pointers.
+static bool convert_type(const char *decl, size_t length, bool named, text_buffer *text)
+{
+    struct
+    {
+        const char *start;
+        size_t      length;
+    } words[16];
+    int  word_count = 0;
+    int  stars = 0;
+    bool constant = false;
+
+    for (size_t i = 0; i < length;)
+    {
+        char c = decl[i];
+        if (c == '*' || c == '[')
+        {
+            stars++; /* Arrays decay to pointers as parameters */
+            if (c == '[')
+            {
+                while (i < length && decl[i] != ']')
+                {
+                    i++;
+                }
+            }
+            i++;
+        }
+        else if (is_word_char(c))
+        {
+            size_t start = i;
+            while (i < length && is_word_char(decl[i]))
+            {
+                i++;
+            }
+            if (word_count == (int)(sizeof(words) / sizeof(words[0])))
+            {
+                return false;
+            }
+            words[word_count].start = decl + start;
+            words[word_count].length = i - start;
+            word_count++;
+        }
+        else if (isspace((unsigned char)c) || c == ']')
+        {
+            i++;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // A name follows at least one other word that is not a qualifier
+    if (named && word_count >= 2)
+    {
+        const char *last = words[word_count - 1].start;
+        size_t      last_length = words[word_count - 1].length;
+        int         type_words = 0;
+        for (int i = 0; i < word_count - 1; i++)
+        {
+            type_words += !is_qualifier(words[i].start, words[i].length);
+        }
+        if (type_words > 0 && !is_type_word(last, last_length))
+        {
+            word_count--;
+        }
+    }
+
+    char        base[GHIDRA_FIELD_SIZE];
+    text_buffer base_text = {base, sizeof(base), 0, false};
+    base[0] = '\0';
+    for (int i = 0; i < word_count; i++)
+    {
+        if (is_qualifier(words[i].start, words[i].length))
+        {
+            constant = constant || strncmp(words[i].start, "const", words[i].length) == 0;
+            continue;
+        }
+        if (base_text.length > 0)
+        {
+            append(&base_text, " ", 1);
+        }
+        append(&base_text, words[i].start, words[i].length);
+    }
+    if (base_text.overflow || base[0] == '\0')
+    {
+        return false;
+    }
+
+    const char *mapped = NULL;
+    for (size_t i = 0; i < sizeof(g_typeNames) / sizeof(g_typeNames[0]); i++)
+    {
+        if (strcmp(g_typeNames[i].ghidra, base) == 0)
+        {
+            mapped = g_typeNames[i].ffi;
+            break;
+        }
+    }
+
+    // Unknown types stay opaque: pointers to them are void pointers, and
+    // by value they are taken to be a register's worth
+    if (!mapped)
+    {
+        mapped = stars > 0 ? "void" : "uint32_t";
+        constant = false;
+    }
+    if (constant && stars > 0 && strncmp(mapped, "const ", 6) != 0)
+    {
+        append_string(text, "const ");
+    }
+    append_string(text, mapped);
+    if (stars > 0)
+    {
+        append(text, " ", mapped[strlen(mapped) - 1] == '*' ? 0 : 1);
+        for (int i = 0; i < stars; i++)
+        {
+            append(text, "*", 1);
+        }
+    }
+    return true;
+}
+
+// Converts a Ghidra prototype such as
+//   "undefined4 __stdcall FUN_00401000(int param_1, char * param_2)"
+// to an FFI signature: "uint32_t __stdcall(int, char *)"
+bool ghidra_signature(const char *prototype, char *out, size_t size)
+{
+    const char *open = strchr(prototype, '(');
+    const char *close = strrchr(prototype, ')');
+    if (!open || !close || close < open || size == 0)
+    {
+        return false;
+    }
+
+    text_buffer text = {out, size, 0, false};
+    out[0] = '\0';
+
+    // Return type and calling convention, then the function name
+    const char *convention = NULL;
+    char        head[GHIDRA_FIELD_SIZE];
+    size_t      head_length = 0;
+    const char *name_end = open;
+    while (name_end > prototype && isspace((unsigned char)name_end[-1]))
+    {
+        name_end--;
+    }
+    const char *name_start = name_end;
+    while (name_start > prototype && is_word_char(name_start[-1]))
+    {
+        name_start--;
+    }
+    // In "int(int)" or "int __stdcall(int)" no name comes before the parentheses
+    size_t name_length = (size_t)(name_end - name_start);
+    bool   unnamed = name_start == prototype || is_type_word(name_start, name_length);
+    for (size_t i = 0; !unnamed && i < sizeof(g_conventions) / sizeof(g_conventions[0]); i++)
+    {
+        unnamed = strlen(g_conventions[i]) == name_length && strncmp(g_conventions[i], name_start, name_length) == 0;
+    }
+    if (unnamed)
+    {
+        name_start = name_end;
+    }
+
+    for (const char *p = prototype; p < name_start;)
+    {
+        const char *word = p;
+        while (p < name_start && is_word_char(*p))
+        {
+            p++;
+        }
+        size_t word_length = (size_t)(p - word);
+        bool   skip = false;
+        for (size_t i = 0; word_length && i < sizeof(g_conventions) / sizeof(g_conventions[0]); i++)
+        {
+            if (strlen(g_conventions[i]) == word_length && strncmp(g_conventions[i], word, word_length) == 0)
+            {
+                convention = g_conventions[i];
+                skip = true;
+            }
+        }
+        if (word_length == 0)
+        {
+            p++;
+            word_length = 1;
+        }
+        else if (!skip && word_length > 2 && word[0] == '_' && word[1] == '_')
+        {
+            skip = true; /* Conventions the FFI has no use for */
+        }
+        if (!skip)
+        {
+            if (head_length + word_length >= sizeof(head))
+            {
+                return false;
+            }
+            memcpy(head + head_length, word, word_length);
+            head_length += word_length;
+        }
+    }
+    if (head_length == 0 || !convert_type(head, head_length, false, &text))
+    {
+        return false;
+    }
+    if (convention)
+    {
+        append(&text, " ", 1);
+        append_string(&text, convention);
+    }
+    append(&text, "(", 1);
+
+    // Parameters, split at top-level commas
+    const char *p = open + 1;
+    bool        first = true;
+    while (p < close)
+    {
+        const char *end = p;
+        int         depth = 0;
+        while (end < close && (depth > 0 || *end != ','))
+        {
+            depth += *end == '(' || *end == '[';
+            depth -= *end == ')' || *end == ']';
+            end++;
+        }
+        const char *start = p;
+        const char *stop = end;
+        while (start < stop && isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        while (stop > start && isspace((unsigned char)stop[-1]))
+        {
+            stop--;
+        }
+        size_t length = (size_t)(stop - start);
+
+        bool none = length == 0 || (length == 4 && strncmp(start, "void", 4) == 0);
+        if (!none)
+        {
+            if (!first)
+            {
+                append(&text, ", ", 2);
+            }
+            if (length == 3 && strncmp(start, "...", 3) == 0)
+            {
+                append(&text, "...", 3);
+            }
+            else if (!convert_type(start, length, true, &text))
+            {
+                return false;
+            }
+            first = false;
+        }
+        p = end + 1;
+    }
+    append(&text, ")", 1);
+    return !text.overflow;
+}
+
+//============================================================================
+// READING
+//============================================================================
+
+static int next_char(importer *im)
+{
+    if (im->position == im->length)
+    {
+        im->length = fread(im->buffer, 1, sizeof(im->buffer), im->file);
+        im->position = 0;
+        if (im->length == 0)
+        {
+            return EOF;
+        }
+    }
+    int c = im->buffer[im->position++];
+    im->line += c == '\n';
+    return c;
+}
+
+static int peek_char(importer *im)
+{
+    int c = next_char(im);
+    if (c != EOF)
+    {
+        im->position--;
+        im->line -= c == '\n';
+    }
+    return c;
+}
+
+static field_id field_for(const char *key)
+{
+    char   normal[32];
+    size_t length = 0;
+    for (; *key && length < sizeof(normal) - 1; key++)
+    {
+        if (*key != ' ' && *key != '_')
+        {
+            normal[length++] = (char)tolower((unsigned char)*key);
+        }
+    }
+    normal[length] = '\0';
+
+    for (size_t i = 0; i < sizeof(g_fieldNames) / sizeof(g_fieldNames[0]); i++)
+    {
+        if (strcmp(g_fieldNames[i].key, normal) == 0)
+        {
+            return g_fieldNames[i].field;
+        }
+    }
+    return FIELD_NONE;
+}
+
+// "ram:00401000", "0x401000" and "00401000" are all hex; JSON numbers are
+// decimal. Returns false for anything else or for address 0.
+static bool parse_address(const char *text, bool numeric, uint32_t *address)
+{
+    const char *colon = strrchr(text, ':');
+    if (colon && !numeric)
+    {
+        text = colon + 1;
+    }
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    char              *end;
+    unsigned long long value = strtoull(text, &end, numeric ? 10 : 16);
+    while (isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    if (end == text || *end != '\0' || value == 0 || value > 0xFFFFFFFFull)
+    {
+        return false;
+    }
+    *address = (uint32_t)value;
+    return true;
+}
+
+static bool case_equal(const char *a, const char *b)
+{
+    for (; *a && *b; a++, b++)
+    {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b))
+        {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+// Adds a complete row. Rows of a Symbol Table export that are not
+// functions (labels, data, externals) are skipped.
+static void add_row(importer *im, import_row *row)
+{
+    const char *type = row->fields[FIELD_TYPE];
+    uint32_t    address;
+    if ((type[0] && !case_equal(type, "function")) || !row->fields[FIELD_NAME][0] || row->truncated[FIELD_NAME] ||
+        !parse_address(row->fields[FIELD_ADDRESS], row->numeric_address, &address))
+    {
+        im->skipped++;
+        return;
+    }
+
+    // Prototypes that cannot be read still register, under a signature to
+    // correct by hand
+    char signature[GHIDRA_FIELD_SIZE];
+    if (!row->fields[FIELD_SIGNATURE][0] || row->truncated[FIELD_SIGNATURE] ||
+        !ghidra_signature(row->fields[FIELD_SIGNATURE], signature, sizeof(signature)))
+    {
+        strcpy(signature, GHIDRA_DEFAULT_SIGNATURE);
+    }
+
+    regfile_record record = {0};
+    record.name = row->fields[FIELD_NAME];
+    record.address = address;
+    record.signature = signature;
+    record.size = (uint32_t)strtoul(row->fields[FIELD_SIZE], NULL, 10);
+    record.description = row->fields[FIELD_DESCRIPTION][0] ? row->fields[FIELD_DESCRIPTION] : NULL;
+
+    regfile_result result = regfile_builder_add(im->builder, &record);
+    if (result == REGFILE_ADDED)
+    {
+        im->functions++;
+    }
+    else if (result == REGFILE_DUPLICATE)
+    {
+        im->duplicates++;
+    }
+    else
+    {
+        im->error = "out of memory";
+    }
+}
+
+//============================================================================
+// CSV
+//============================================================================
+
+// Reads one field into out (cut at size), leaving *row_end set when it was
+// the last of its row. Returns false at the end of the file.
+static bool csv_field(importer *im, char *out, size_t size, bool *truncated, bool *row_end)
+{
+    size_t length = 0;
+    bool   quoted = false;
+    int    c = next_char(im);
+    *truncated = false;
+    *row_end = false;
+    if (c == EOF)
+    {
+        return false;
+    }
+
+    if (c == '"')
+    {
+        quoted = true;
+        c = next_char(im);
+    }
+    for (;; c = next_char(im))
+    {
+        if (c == EOF)
+        {
+            *row_end = true;
+            break;
+        }
+        if (quoted && c == '"')
+        {
+            if (peek_char(im) != '"')
+            {
+                quoted = false;
+                continue;
+            }
+            c = next_char(im); /* "" is a literal quote */
+        }
+        else if (!quoted && c == ',')
+        {
+            break;
+        }
+        else if (!quoted && (c == '\n' || c == '\r'))
+        {
+            if (c == '\r' && peek_char(im) == '\n')
+            {
+                next_char(im);
+            }
+            *row_end = true;
+            break;
+        }
+
+        if (length + 1 < size)
+        {
+            out[length++] = (char)c;
+        }
+        else
+        {
+            *truncated = true;
+        }
+    }
+    out[length] = '\0';
+    return true;
+}
+
+static void import_csv(importer *im, import_row *row)
+{
+    field_id columns[GHIDRA_MAX_COLUMNS];
+    int      column_count = 0;
+    bool     has_name = false, has_address = false;
+    bool     truncated, row_end = false;
+    char     field[GHIDRA_FIELD_SIZE];
+
+    while (!row_end && csv_field(im, field, sizeof(field), &truncated, &row_end))
+    {
+        field_id id = field_for(field);
+        has_name = has_name || id == FIELD_NAME;
+        has_address = has_address || id == FIELD_ADDRESS;
+        if (column_count < GHIDRA_MAX_COLUMNS)
+        {
+            columns[column_count++] = id;
+        }
+    }
+    if (!has_name || !has_address)
+    {
+        im->error = "no Name and Location columns in the CSV header";
+        return;
+    }
+
+    for (;;)
+    {
+        for (int i = 0; i < FIELD_COUNT; i++)
+        {
+            row->fields[i][0] = '\0';
+            row->truncated[i] = false;
+        }
+        int  column = 0;
+        bool any = false;
+        row_end = false;
+        while (!row_end && csv_field(im, field, sizeof(field), &truncated, &row_end))
+        {
+            field_id id = column < column_count ? columns[column] : FIELD_NONE;
+            if (id != FIELD_NONE && !row->fields[id][0])
+            {
+                strcpy(row->fields[id], field);
+                row->truncated[id] = truncated;
+            }
+            any = any || field[0];
+            column++;
+        }
+        if (!row_end && column == 0)
+        {
+            break; /* End of the file */
+        }
+        if (any)
+        {
+            add_row(im, row);
+            if (im->error)
+            {
+                return;
+            }
+        }
+    }
+}
+
+//============================================================================
+// JSON
+//============================================================================
+
+static int skip_space(importer *im)
+{
+    int c = peek_char(im);
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+    {
+        next_char(im);
+        c = peek_char(im);
+    }
+    return c;
+}
+
+static bool json_fail(importer *im, const char *error)
+{
+    if (!im->error)
+    {
+        im->error = error;
+    }
+    return false;
+}
+
+static int hex_digit(int c)
+{
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                                                                                         : -1;
+}
+
+// Reads a string after its opening quote into out, if given
+static bool json_string(importer *im, char *out, size_t size, bool *truncated)
+{
+    size_t length = 0;
+    for (;;)
+    {
+        int c = next_char(im);
+        if (c == EOF || c == '\n')
+        {
+            return json_fail(im, "unterminated string");
+        }
+        if (c == '"')
+        {
+            break;
+        }
+        if (c == '\\')
+        {
+            c = next_char(im);
+            switch (c)
+            {
+            case 'n':
+                c = '\n';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'f':
+                c = '\f';
+                break;
+            case 'u': {
+                int value = 0;
+                for (int i = 0; i < 4; i++)
+                {
+                    int digit = hex_digit(next_char(im));
+                    if (digit < 0)
+                    {
+                        return json_fail(im, "bad \\u escape");
+                    }
+                    value = value * 16 + digit;
+                }
+                c = value < 0x80 ? value : '?'; /* Symbol names are ASCII */
+                break;
+            }
+            case '"':
+            case '\\':
+            case '/':
+                break;
+            default:
+                return json_fail(im, "bad escape");
+            }
+        }
+        if (out && length + 1 < size)
+        {
+            out[length++] = (char)c;
+        }
+        else if (out && truncated)
+        {
+            *truncated = true;
+        }
+    }
+    if (out)
+    {
+        out[length] = '\0';
+    }
+    return true;
+}
+
+// Numbers and literals, kept as text
+static bool json_scalar(importer *im, char *out, size_t size)
+{
+    size_t length = 0;
+    int    c = peek_char(im);
+    while (c != EOF && (isalnum(c) || c == '-' || c == '+' || c == '.'))
+    {
+        next_char(im);
+        if (out && length + 1 < size)
+        {
+            out[length++] = (char)c;
+        }
+        c = peek_char(im);
+    }
+    if (length == 0 && out)
+    {
+        return json_fail(im, "unexpected character");
+    }
+    if (out)
+    {
+        out[length] = '\0';
+    }
+    return true;
+}
+
+static bool json_value(importer *im, int depth, char *out, size_t size, bool *truncated, bool *numeric);
+
+// Reads an object after its opening brace; one with an address is taken
+// for a function, whatever it is nested in
+static bool json_object(importer *im, int depth)
+{
+    import_row *row = calloc(1, sizeof(import_row));
+    if (!row)
+    {
+        return json_fail(im, "out of memory");
+    }
+
+    bool ok = true;
+    bool any = false;
+    if (skip_space(im) == '}')
+    {
+        next_char(im);
+    }
+    else
+    {
+        for (;;)
+        {
+            char key[64];
+            bool cut = false;
+            if (skip_space(im) != '"')
+            {
+                ok = json_fail(im, "expected a key");
+                break;
+            }
+            next_char(im);
+            if (!json_string(im, key, sizeof(key), &cut))
+            {
+                ok = false;
+                break;
+            }
+            if (skip_space(im) != ':')
+            {
+                ok = json_fail(im, "expected ':'");
+                break;
+            }
+            next_char(im);
+
+            field_id id = cut ? FIELD_NONE : field_for(key);
+            bool     numeric = false;
+            if (id != FIELD_NONE)
+            {
+                any = true;
+                ok = json_value(im, depth + 1, row->fields[id], GHIDRA_FIELD_SIZE, &row->truncated[id], &numeric);
+                row->numeric_address = row->numeric_address || (id == FIELD_ADDRESS && numeric);
+            }
+            else
+            {
+                ok = json_value(im, depth + 1, NULL, 0, NULL, NULL);
+            }
+            if (!ok)
+            {
+                break;
+            }
+
+            int c = skip_space(im);
+            next_char(im);
+            if (c == '}')
+            {
+                break;
+            }
+            if (c != ',')
+            {
+                ok = json_fail(im, "expected ',' or '}'");
+                break;
+            }
+        }
+    }
+
+    if (ok && any && row->fields[FIELD_ADDRESS][0])
+    {
+        add_row(im, row);
+        ok = !im->error;
+    }
+    free(row);
+    return ok;
+}
+
+static bool json_array(importer *im, int depth)
+{
+    if (skip_space(im) == ']')
+    {
+        next_char(im);
+        return true;
+    }
+    for (;;)
+    {
+        if (!json_value(im, depth + 1, NULL, 0, NULL, NULL))
+        {
+            return false;
+        }
+        int c = skip_space(im);
+        next_char(im);
+        if (c == ']')
+        {
+            return true;
+        }
+        if (c != ',')
+        {
+            return json_fail(im, "expected ',' or ']'");
+        }
+    }
+}
+
+// Reads any value. Strings and scalars go to out when it is given; objects
+// and arrays are walked for functions and leave out empty.
+static bool json_value(importer *im, int depth, char *out, size_t size, bool *truncated, bool *numeric)
+{
+    if (depth > GHIDRA_MAX_DEPTH)
+    {
+        return json_fail(im, "nested too deeply");
+    }
+
+    int c = skip_space(im);
+    switch (c)
+    {
+    case '{':
+        next_char(im);
+        return json_object(im, depth);
+    case '[':
+        next_char(im);
+        return json_array(im, depth);
+    case '"':
+        next_char(im);
+        return json_string(im, out, size, truncated);
+    case EOF:
+        return json_fail(im, "unexpected end of file");
+    default:
+        if (numeric)
+        {
+            *numeric = isdigit(c) != 0;
+        }
+        return json_scalar(im, out, size);
+    }
+}
+
+static void import_json(importer *im)
+{
+    if (json_value(im, 0, NULL, 0, NULL, NULL) && skip_space(im) != EOF)
+    {
+        json_fail(im, "trailing data");
+    }
+}
+
+//============================================================================
+// LUA API
+//============================================================================
+
+// ghidra.import(path, output) -> {functions, skipped, duplicates, format, ms} | nil, err
+// Reads a Ghidra export and writes the functions in it to the registry
+// file at output. The format is taken from the first character.
+static int l_ghidra_import(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+    const char *output = luaL_checkstring(L, 2);
+
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    importer   *im = calloc(1, sizeof(importer));
+    import_row *row = calloc(1, sizeof(import_row));
+    if (!im || !row || !(im->builder = regfile_builder_new()))
+    {
+        free(im);
+        free(row);
+        return luaL_error(L, "ghidra.import: out of memory");
+    }
+    im->line = 1;
+
+    im->file = fopen(path, "rb");
+    if (!im->file)
+    {
+        regfile_builder_free(im->builder);
+        free(im);
+        free(row);
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot open %s", path);
+        return 2;
+    }
+
+    // UTF-8 byte order mark, as some exporters write one
+    int c = peek_char(im);
+    if (c == 0xEF)
+    {
+        next_char(im);
+        next_char(im);
+        next_char(im);
+    }
+    bool json = skip_space(im) == '[' || peek_char(im) == '{';
+    if (json)
+    {
+        import_json(im);
+    }
+    else
+    {
+        import_csv(im, row);
+    }
+    fclose(im->file);
+
+    bool written = !im->error && regfile_builder_write(im->builder, output);
+    QueryPerformanceCounter(&end);
+
+    int results;
+    if (im->error)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s:%d: %s", path, (int)im->line, im->error);
+        results = 2;
+    }
+    else if (!written)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot write %s", output);
+        results = 2;
+    }
+    else
+    {
+        lua_createtable(L, 0, 5);
+        lua_pushnumber(L, im->functions);
+        lua_setfield(L, -2, "functions");
+        lua_pushnumber(L, im->skipped);
+        lua_setfield(L, -2, "skipped");
+        lua_pushnumber(L, im->duplicates);
+        lua_setfield(L, -2, "duplicates");
+        lua_pushstring(L, json ? "json" : "csv");
+        lua_setfield(L, -2, "format");
+        lua_pushnumber(L, (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart);
+        lua_setfield(L, -2, "ms");
+        results = 1;
+    }
+
+    regfile_builder_free(im->builder);
+    free(im);
+    free(row);
+    return results;
+}
+
+// ghidra.signature(prototype) -> FFI signature or nil
+static int l_ghidra_signature(lua_State *L)
+{
+    const char *prototype = luaL_checkstring(L, 1);
+    char        signature[GHIDRA_FIELD_SIZE];
+    if (ghidra_signature(prototype, signature, sizeof(signature)))
+    {
+        lua_pushstring(L, signature);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static const luaL_Reg ghidra_funcs[] = {{"import", l_ghidra_import}, {"signature", l_ghidra_signature}, {NULL, NULL}};
+
+int luaopen_ghidra(lua_State *L)
+{
+    luaL_register(L, "ghidra", ghidra_funcs);
+    return 1;
+}
@@ -0,0 +1,18 @@
+#ifndef GHIDRA_H
+#define GHIDRA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lua.h"
+
+#define GHIDRA_READ_SIZE 65536  /* Export files are read in blocks of this size */
+#define GHIDRA_FIELD_SIZE 1024  /* Longer fields are cut; names that long are skipped */
+#define GHIDRA_MAX_COLUMNS 64   /* CSV columns past this are ignored */
+#define GHIDRA_MAX_DEPTH 32     /* JSON nesting limit */
+#define GHIDRA_DEFAULT_SIGNATURE "int()"
+
+bool ghidra_signature(const char *prototype, char *out, size_t size);
+int  luaopen_ghidra(lua_State *L);
+
+#endif // GHIDRA_H
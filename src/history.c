@@ -0,0 +1,366 @@
+/*
+ * history.c: Console command history with a persistent log.
+ *
+ * Entries live in one fixed arena used as a ring: each new command is
+ * written after the previous one and the oldest entries are dropped to
+ * make room, so memory stays at HISTORY_ARENA_SIZE no matter how long the
+ * session runs. A parallel ring of index records holds each entry's
+ * offset, length and first bytes; prefix searches compare those bytes
+ * before touching the text.
+ *
+ * Every command is also appended to a text log, one per line with
+ * backslash escapes. Nothing is read at startup: the first use loads the
+ * tail of the log that fits the arena, and rewrites the log with only
+ * that tail once it has grown past HISTORY_COMPACT_SIZE.
+ *
+ * Numbers shown by `history` stay the same for the whole session; an
+ * entry's number is one more than the number of entries before it.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "history.h"
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length; /* Without the terminator */
+    uint32_t key;    /* First four bytes, zero padded */
+} history_entry;
+
+static char          g_arena[HISTORY_ARENA_SIZE];
+static history_entry g_entries[HISTORY_MAX_ENTRIES];
+static uint32_t      g_oldest = 0; /* Ring index of the oldest entry */
+static uint32_t      g_count = 0;
+static uint32_t      g_write = 0;  /* Arena offset after the newest entry */
+static uint32_t      g_first = 1;  /* Number of the oldest entry */
+
+static char          g_path[MAX_PATH] = "";
+static FILE         *g_log = NULL;
+static bool          g_loaded = false;
+
+//============================================================================
+// RING
+//============================================================================
+
+static uint32_t prefix_key(const char *text, uint32_t length)
+{
+    uint32_t key = 0;
+    for (uint32_t i = 0; i < 4 && i < length; i++)
+    {
+        key |= (uint32_t)(uint8_t)text[i] << (i * 8);
+    }
+    return key;
+}
+
+static history_entry *entry_at(uint32_t position)
+{
+    return &g_entries[(g_oldest + position) & (HISTORY_MAX_ENTRIES - 1)];
+}
+
+static void evict_oldest(void)
+{
+    g_oldest = (g_oldest + 1) & (HISTORY_MAX_ENTRIES - 1);
+    g_count--;
+    g_first++;
+    if (g_count == 0)
+    {
+        g_write = 0;
+    }
+}
+
+static bool overlaps(const history_entry *entry, uint32_t offset, uint32_t size)
+{
+    return entry->offset < offset + size && offset < entry->offset + entry->length + 1;
+}
+
+// Entries sit in the arena in insertion order, wrapping at the end, so the
+// ones in the way of the next write are always the oldest
+static void ring_push(const char *text, uint32_t length)
+{
+    uint32_t size = length + 1;
+
+    if (g_count == HISTORY_MAX_ENTRIES)
+    {
+        evict_oldest();
+    }
+
+    if (g_write + size > HISTORY_ARENA_SIZE)
+    {
+        // Entries left at the end are from the previous lap
+        while (g_count > 0 && entry_at(0)->offset >= g_write)
+        {
+            evict_oldest();
+        }
+        g_write = 0;
+    }
+    while (g_count > 0 && overlaps(entry_at(0), g_write, size))
+    {
+        evict_oldest();
+    }
+
+    history_entry *entry = entry_at(g_count);
+    entry->offset = g_write;
+    entry->length = length;
+    entry->key = prefix_key(text, length);
+    memcpy(g_arena + g_write, text, length);
+    g_arena[g_write + length] = '\0';
+
+    g_write += size;
+    g_count++;
+}
+
+static const char *entry_text(const history_entry *entry)
+{
+    return g_arena + entry->offset;
+}
+
+//============================================================================
+// LOG FILE
+//============================================================================
+
+static void write_escaped(FILE *file, const char *text, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if (c == '\\')
+        {
+            fputs("\\\\", file);
+        }
+        else if (c == '\n')
+        {
+            fputs("\\n", file);
+        }
+        else if (c == '\r')
+        {
+            fputs("\\r", file);
+        }
+        else
+        {
+            fputc(c, file);
+        }
+    }
+    fputc('\n', file);
+}
+
+// Unescapes in place and returns the new length
+static uint32_t unescape(char *text, uint32_t length)
+{
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if (c == '\\' && i + 1 < length)
+        {
+            char next = text[++i];
+            c = next == 'n' ? '\n' : next == 'r' ? '\r' : next;
+        }
+        text[out++] = c;
+    }
+    return out;
+}
+
+static void compact_log(void)
+{
+    char temp[MAX_PATH + 4];
+    snprintf(temp, sizeof(temp), "%s.tmp", g_path);
+
+    FILE *file = fopen(temp, "wb");
+    if (!file)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < g_count; i++)
+    {
+        const history_entry *entry = entry_at(i);
+        write_escaped(file, entry_text(entry), entry->length);
+    }
+    if (fclose(file) != 0 || !MoveFileExA(temp, g_path, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(temp);
+    }
+}
+
+// Reads the part of the log that can still be in memory
+static void load_log(void)
+{
+    g_loaded = true;
+
+    FILE *file = g_path[0] ? fopen(g_path, "rb") : NULL;
+    if (!file)
+    {
+        return;
+    }
+
+    long size = 0;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        size = ftell(file);
+    }
+    long start = size > HISTORY_ARENA_SIZE ? size - HISTORY_ARENA_SIZE : 0;
+
+    char *buffer = malloc(HISTORY_ARENA_SIZE + 1);
+    if (!buffer || fseek(file, start, SEEK_SET) != 0)
+    {
+        free(buffer);
+        fclose(file);
+        return;
+    }
+    size_t read = fread(buffer, 1, HISTORY_ARENA_SIZE, file);
+    fclose(file);
+
+    // The first line is a fragment unless the log is read from its start
+    char *line = buffer;
+    char *end = buffer + read;
+    if (start > 0)
+    {
+        char *newline = memchr(buffer, '\n', read);
+        line = newline ? newline + 1 : end;
+    }
+
+    while (line < end)
+    {
+        char    *newline = memchr(line, '\n', (size_t)(end - line));
+        uint32_t length = (uint32_t)((newline ? newline : end) - line);
+        if (length > 0 && line[length - 1] == '\r')
+        {
+            length--;
+        }
+        length = unescape(line, length);
+        if (length > 0 && length < HISTORY_MAX_ENTRY)
+        {
+            ring_push(line, length);
+        }
+        line = newline ? newline + 1 : end;
+    }
+    free(buffer);
+
+    if (size > HISTORY_COMPACT_SIZE)
+    {
+        compact_log();
+    }
+}
+
+static void ensure_loaded(void)
+{
+    if (!g_loaded)
+    {
+        load_log();
+    }
+}
+
+//============================================================================
+// PUBLIC API
+//============================================================================
+
+// Sets the log file; it is not read until the history is first used
+void history_init(const char *path)
+{
+    snprintf(g_path, sizeof(g_path), "%s", path ? path : "");
+}
+
+void history_add(const char *command)
+{
+    uint32_t length = (uint32_t)strlen(command);
+    if (length == 0 || length >= HISTORY_MAX_ENTRY)
+    {
+        return;
+    }
+
+    ensure_loaded();
+
+    // Avoid duplicate consecutive commands
+    if (g_count > 0)
+    {
+        const history_entry *newest = entry_at(g_count - 1);
+        if (newest->length == length && memcmp(entry_text(newest), command, length) == 0)
+        {
+            return;
+        }
+    }
+    ring_push(command, length);
+
+    if (!g_log && g_path[0])
+    {
+        g_log = fopen(g_path, "ab");
+    }
+    if (g_log)
+    {
+        write_escaped(g_log, command, length);
+        fflush(g_log);
+    }
+}
+
+uint32_t history_count(void)
+{
+    ensure_loaded();
+    return g_count;
+}
+
+// Number of the oldest entry still held
+uint32_t history_first(void)
+{
+    ensure_loaded();
+    return g_first;
+}
+
+// Entry by number, or NULL once it has been dropped. The text is valid
+// until the next history_add.
+const char *history_get(uint32_t number)
+{
+    ensure_loaded();
+    if (number < g_first || number - g_first >= g_count)
+    {
+        return NULL;
+    }
+    return entry_text(entry_at(number - g_first));
+}
+
+// Number of the newest entry before `before` that starts with prefix,
+// or 0. Pass 0 for `before` to search from the newest entry.
+uint32_t history_find(const char *prefix, uint32_t before)
+{
+    ensure_loaded();
+
+    uint32_t length = (uint32_t)strlen(prefix);
+    uint32_t key_bytes = length < 4 ? length : 4;
+    uint32_t mask = key_bytes == 4 ? 0xFFFFFFFFu : (1u << (key_bytes * 8)) - 1;
+    uint32_t key = prefix_key(prefix, length);
+
+    uint32_t position = g_count;
+    if (before && before - g_first < g_count)
+    {
+        position = before - g_first;
+    }
+    else if (before && before < g_first)
+    {
+        return 0;
+    }
+
+    while (position-- > 0)
+    {
+        const history_entry *entry = entry_at(position);
+        if ((entry->key & mask) == key && entry->length >= length &&
+            memcmp(entry_text(entry), prefix, length) == 0)
+        {
+            return g_first + position;
+        }
+    }
+    return 0;
+}
+
+void history_shutdown(void)
+{
+    if (g_log)
+    {
+        fclose(g_log);
+        g_log = NULL;
+    }
+}
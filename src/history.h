@@ -0,0 +1,20 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HISTORY_ARENA_SIZE (64 * 1024)                /* Text of the entries kept in memory */
+#define HISTORY_MAX_ENTRIES 1024                      /* Power of two */
+#define HISTORY_MAX_ENTRY (HISTORY_ARENA_SIZE / 8)    /* Longer commands are not kept */
+#define HISTORY_COMPACT_SIZE (4 * HISTORY_ARENA_SIZE) /* File size that triggers a rewrite */
+
+void        history_init(const char *path);
+void        history_add(const char *command);
+uint32_t    history_count(void);
+uint32_t    history_first(void);
+const char *history_get(uint32_t number);
+uint32_t    history_find(const char *prefix, uint32_t before);
+void        history_shutdown(void);
+
+#endif // HISTORY_H
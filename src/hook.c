@@ -0,0 +1,642 @@
+/*
+ * hook.c: Inline hooks on game functions with native counting and Lua
+ * pre/post callbacks.
+ *
+ * Each hook owns a small block of generated code. The detour jumps to a
+ * router (jmp [route]) that points at one of two stubs:
+ *
+ *   counting   lock inc [calls]; jmp [trampoline]
+ *              Never leaves the stub. Costs one locked add per call.
+ *   callback   saves registers and calls hook_on_enter, which counts,
+ *              runs the pre callback and, for post callbacks or timing,
+ *              swaps the return address for hook_return_stub. That stub
+ *              finds the caller's address again on a per-thread shadow
+ *              stack, runs the post callback and returns there.
+ *
+ * Switching between them only rewrites the route pointer. Callbacks run
+ * only if this thread can take the Lua state without waiting and is not
+ * already running Lua (a hooked function called from Lua itself), so a
+ * hook never blocks the game; calls that could not run one are counted
+ * as skipped.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "frame.h"
+#include "frametime.h"
+#include "hook.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "luastate.h"
+#include "output.h"
+#include "ringlog.h"
+#include "trace.h"
+
+#define HOOK_MAX_DEPTH 64 /* Nested hooked calls tracked per thread */
+#define HOOK_CODE_SIZE 64
+
+#define ROUTER_OFFSET   0
+#define COUNTING_OFFSET 8
+#define CALLBACK_OFFSET 24
+
+// Decorated names for symbols referenced from the return stub
+#define ASM_SYMBOL(name) "_" #name
+
+// Registers as saved by pushfl; pushal, followed by the return address
+typedef struct
+{
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t eflags;
+    uint32_t ret;
+    uint32_t args[]; /* Stack arguments; only valid on entry */
+} hook_regs;
+
+typedef struct
+{
+    hook_entry *entry;
+    uint32_t    ret;  /* Caller's return address */
+    uint32_t    slot; /* Stack address it was stored at */
+    int64_t     start;
+} hook_frame;
+
+typedef struct
+{
+    int        depth;
+    hook_frame frames[HOOK_MAX_DEPTH];
+} hook_thread;
+
+static hook_entry    g_hooks[HOOK_MAX];
+static volatile LONG g_hookCount = 0;
+static DWORD         g_flsIndex = FLS_OUT_OF_INDEXES;
+static int64_t       g_qpcFrequency = 1;
+
+void hook_return_stub(void);
+
+//============================================================================
+// TIMING
+//============================================================================
+
+static int64_t qpc_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+static double ticks_to_ms(int64_t ticks)
+{
+    return (double)ticks * 1000.0 / (double)g_qpcFrequency;
+}
+
+static void add_ticks(hook_entry *entry, int64_t ticks)
+{
+    LONGLONG old;
+    do
+    {
+        old = entry->total_ticks;
+    } while (InterlockedCompareExchange64(&entry->total_ticks, old + ticks, old) != old);
+
+    while ((old = entry->max_ticks) < ticks && InterlockedCompareExchange64(&entry->max_ticks, ticks, old) != old)
+    {
+    }
+}
+
+//============================================================================
+// LUA CALLBACKS
+//============================================================================
+
+static int push_args(lua_State *L, const hook_entry *entry, const hook_regs *regs)
+{
+    int in_registers = entry->conv == HOOK_THISCALL ? 1 : entry->conv == HOOK_FASTCALL ? 2 : 0;
+    for (int i = 0; i < entry->argc; i++)
+    {
+        uint32_t value = i < in_registers ? (i == 0 ? regs->ecx : regs->edx) : regs->args[i - in_registers];
+        lua_pushnumber(L, value);
+    }
+    return entry->argc;
+}
+
+// pre(args...) on entry, post(result, elapsed_ms) on return
+static void run_callback(hook_entry *entry, const hook_regs *regs, bool pre, int64_t ticks)
+{
+    lua_State *L = luastate_held() ? NULL : luastate_try_acquire();
+    if (!L)
+    {
+        InterlockedIncrement(&entry->skipped);
+        return;
+    }
+
+    int ref = pre ? entry->pre_ref : entry->post_ref;
+    if (ref == LUA_NOREF)
+    {
+        luastate_release();
+        return;
+    }
+
+    int64_t  work = frametime_enter();
+    uint16_t saved_cw = frame_fpu_enter();
+    int      top = lua_gettop(L);
+    int      nargs = 2;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    if (pre)
+    {
+        nargs = push_args(L, entry, regs);
+    }
+    else
+    {
+        lua_pushnumber(L, regs->eax);
+        lua_pushnumber(L, ticks_to_ms(ticks));
+    }
+
+    if (lua_pcall(L, nargs, 0, 0) != 0)
+    {
+        const char *error = lua_tostring(L, -1);
+        output_printf("[hook] %s callback at 0x%08X failed and was removed: %s\n", pre ? "pre" : "post",
+                      (unsigned)entry->address, error ? error : "(unknown error)");
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        if (pre)
+        {
+            entry->pre_ref = LUA_NOREF;
+        }
+        else
+        {
+            entry->post_ref = LUA_NOREF;
+        }
+        InterlockedIncrement(&entry->errors);
+    }
+    else
+    {
+        InterlockedIncrement(&entry->lua_calls);
+    }
+
+    lua_settop(L, top);
+    frame_fpu_leave(saved_cw);
+    frametime_leave(work);
+    luastate_release();
+}
+
+//============================================================================
+// STUB TARGETS
+//============================================================================
+
+static void WINAPI free_thread(void *value)
+{
+    free(value);
+}
+
+static hook_thread *current_thread(void)
+{
+    hook_thread *thread = (hook_thread *)FlsGetValue(g_flsIndex);
+    if (!thread)
+    {
+        thread = calloc(1, sizeof(hook_thread));
+        if (thread && !FlsSetValue(g_flsIndex, thread))
+        {
+            free(thread);
+            thread = NULL;
+        }
+    }
+    return thread;
+}
+
+// Called from a hook's callback stub with the caller's registers
+static void hook_on_enter(hook_entry *entry, hook_regs *regs)
+{
+    InterlockedIncrement(&entry->calls);
+
+    if (entry->pre_ref != LUA_NOREF)
+    {
+        run_callback(entry, regs, true, 0);
+    }
+
+    if (!entry->timed && entry->post_ref == LUA_NOREF)
+    {
+        return;
+    }
+
+    hook_thread *thread = current_thread();
+    if (!thread)
+    {
+        return;
+    }
+
+    // Frames whose return slot is at or below ours belong to calls that
+    // were unwound past (exceptions, longjmp) and will never return here.
+    // The exception is a hooked function tail-calling another: its frame
+    // shares our slot, which already holds hook_return_stub, and still
+    // returns once we have.
+    uint32_t slot = (uint32_t)(uintptr_t)&regs->ret;
+    bool     chained = regs->ret == (uint32_t)(uintptr_t)hook_return_stub;
+    while (thread->depth > 0 && (thread->frames[thread->depth - 1].slot < slot ||
+                                 (!chained && thread->frames[thread->depth - 1].slot == slot)))
+    {
+        thread->depth--;
+    }
+    if (thread->depth == HOOK_MAX_DEPTH)
+    {
+        return;
+    }
+
+    hook_frame *frame = &thread->frames[thread->depth++];
+    frame->entry = entry;
+    frame->ret = regs->ret;
+    frame->slot = slot;
+    regs->ret = (uint32_t)(uintptr_t)hook_return_stub;
+    frame->start = qpc_now();
+}
+
+// Called from hook_return_stub; puts the caller's return address back into
+// the slot the stub returns through
+void hook_on_return(hook_regs *regs)
+{
+    int64_t      end = qpc_now();
+    hook_thread *thread = (hook_thread *)FlsGetValue(g_flsIndex);
+    uint32_t     slot = (uint32_t)(uintptr_t)&regs->ret;
+
+    // Without a frame there is no return address to go back to
+    if (!thread || thread->depth == 0)
+    {
+        logf("[HOOK] Return through the stub with no frame on thread %lu", GetCurrentThreadId());
+        FatalAppExitA(0, "Hooked function returned without a saved return address");
+    }
+
+    // Ours is the innermost frame still above this slot; anything deeper
+    // was unwound past. A frame at the same slot is a tail-calling hook's
+    // and returns right after ours.
+    while (thread->depth > 1 && thread->frames[thread->depth - 2].slot < slot)
+    {
+        thread->depth--;
+    }
+    hook_frame frame = thread->frames[--thread->depth];
+    hook_entry  *entry = frame.entry;
+    int64_t      ticks = end - frame.start;
+
+    regs->ret = frame.ret;
+    add_ticks(entry, ticks);
+
+    if (entry->name && trace_active())
+    {
+        int64_t values[3] = {ticks * 1000000 / g_qpcFrequency, TRACE_FLAG_OK, (int32_t)regs->eax};
+        trace_emit(TRACE_CALL, entry->name, values, 3);
+    }
+
+    if (entry->post_ref != LUA_NOREF)
+    {
+        run_callback(entry, regs, false, ticks);
+    }
+}
+
+// Hooked functions return here instead of to their caller. x87 state is
+// saved whole since a float result is still in st(0).
+__attribute__((naked)) void hook_return_stub(void)
+{
+    __asm__ volatile("pushl $0\n\t"
+                     "pushfl\n\t"
+                     "pushal\n\t"
+                     "movl %esp, %eax\n\t"
+                     "subl $108, %esp\n\t"
+                     "fnsave (%esp)\n\t"
+                     "pushl %eax\n\t"
+                     "call " ASM_SYMBOL(hook_on_return) "\n\t"
+                     "addl $4, %esp\n\t"
+                     "frstor (%esp)\n\t"
+                     "addl $108, %esp\n\t"
+                     "popal\n\t"
+                     "popfl\n\t"
+                     "ret\n\t");
+}
+
+//============================================================================
+// CODE GENERATION
+//============================================================================
+
+static uint8_t *emit_u32(uint8_t *p, uint32_t value)
+{
+    memcpy(p, &value, 4);
+    return p + 4;
+}
+
+static uint8_t *emit_jmp_indirect(uint8_t *p, void *volatile *slot)
+{
+    *p++ = 0xFF; // jmp dword [slot]
+    *p++ = 0x25;
+    return emit_u32(p, (uint32_t)(uintptr_t)slot);
+}
+
+static void build_stubs(hook_entry *entry)
+{
+    uint8_t *code = entry->code;
+
+    emit_jmp_indirect(code + ROUTER_OFFSET, &entry->route);
+
+    // Counting stub. lock inc changes arithmetic flags, which no calling
+    // convention expects to survive a call.
+    uint8_t *p = code + COUNTING_OFFSET;
+    *p++ = 0xF0; // lock inc dword [calls]
+    *p++ = 0xFF;
+    *p++ = 0x05;
+    p = emit_u32(p, (uint32_t)(uintptr_t)&entry->calls);
+    emit_jmp_indirect(p, &entry->trampoline);
+
+    // Callback stub
+    p = code + CALLBACK_OFFSET;
+    *p++ = 0x9C; // pushfl
+    *p++ = 0x60; // pushal
+    *p++ = 0x54; // push esp (hook_regs *)
+    *p++ = 0x68; // push entry
+    p = emit_u32(p, (uint32_t)(uintptr_t)entry);
+    *p++ = 0xE8; // call hook_on_enter
+    p = emit_u32(p, (uint32_t)((uintptr_t)hook_on_enter - (uintptr_t)(p + 4)));
+    *p++ = 0x83; // add esp, 8
+    *p++ = 0xC4;
+    *p++ = 0x08;
+    *p++ = 0x61; // popal
+    *p++ = 0x9D; // popfl
+    emit_jmp_indirect(p, &entry->trampoline);
+}
+
+static void update_route(hook_entry *entry)
+{
+    bool     callbacks = entry->timed || entry->pre_ref != LUA_NOREF || entry->post_ref != LUA_NOREF;
+    uint8_t *stub = entry->code + (callbacks ? CALLBACK_OFFSET : COUNTING_OFFSET);
+    InterlockedExchangePointer((void *volatile *)&entry->route, stub);
+}
+
+//============================================================================
+// HOOK TABLE
+//============================================================================
+
+hook_entry *hook_find(uint32_t address)
+{
+    for (LONG i = 0; i < g_hookCount; i++)
+    {
+        if (g_hooks[i].address == address)
+        {
+            return &g_hooks[i];
+        }
+    }
+    return NULL;
+}
+
+// Entries are never reused: threads may still be inside their stubs or
+// have a pending return through them
+static hook_entry *create_entry(uint32_t address)
+{
+    if (g_hookCount == HOOK_MAX)
+    {
+        return NULL;
+    }
+
+    hook_entry *entry = &g_hooks[g_hookCount];
+    memset(entry, 0, sizeof(*entry));
+    entry->code = detour_alloc_code(HOOK_CODE_SIZE);
+    if (!entry->code)
+    {
+        return NULL;
+    }
+
+    entry->address = address;
+    entry->pre_ref = LUA_NOREF;
+    entry->post_ref = LUA_NOREF;
+    build_stubs(entry);
+
+    if (!detour_create(&entry->detour, (void *)(uintptr_t)address, entry->code + ROUTER_OFFSET))
+    {
+        return NULL;
+    }
+    entry->trampoline = entry->detour.trampoline;
+    entry->route = entry->code + COUNTING_OFFSET;
+
+    InterlockedIncrement(&g_hookCount);
+    return entry;
+}
+
+static void clear_callbacks(lua_State *L, hook_entry *entry)
+{
+    if (entry->pre_ref != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, entry->pre_ref);
+        entry->pre_ref = LUA_NOREF;
+    }
+    if (entry->post_ref != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, entry->post_ref);
+        entry->post_ref = LUA_NOREF;
+    }
+}
+
+// Unpatches every hook. Callbacks still pending on other threads find the
+// Lua state detached and are skipped; calls already inside a hooked
+// function still return through hook_return_stub, so the module must stay
+// loaded.
+void hook_shutdown(void)
+{
+    for (LONG i = 0; i < g_hookCount; i++)
+    {
+        hook_entry *entry = &g_hooks[i];
+        if (entry->detour.attached)
+        {
+            detour_disable(&entry->detour);
+        }
+        InterlockedExchangePointer((void *volatile *)&entry->route, entry->code + COUNTING_OFFSET);
+    }
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static uint8_t check_conv(lua_State *L, const char *name)
+{
+    static const char *const names[] = {"cdecl", "stdcall", "thiscall", "fastcall"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            return (uint8_t)i;
+        }
+    }
+    return (uint8_t)luaL_error(L, "unknown calling convention '%s'", name);
+}
+
+static int take_callback(lua_State *L, int opts, const char *field)
+{
+    lua_getfield(L, opts, field);
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        return LUA_NOREF;
+    }
+    luaL_checktype(L, -1, LUA_TFUNCTION);
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+// hook.attach(addr [, {pre=fn, post=fn, timed=bool, argc=n, conv=s, name=s}])
+// Hooks addr, or replaces the options of an existing hook. Without
+// callbacks or timing the hook only counts calls.
+static int l_hook_attach(lua_State *L)
+{
+    uint32_t address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    bool     has_opts = lua_istable(L, 2);
+
+    hook_entry *entry = hook_find(address);
+    if (!entry)
+    {
+        entry = create_entry(address);
+        if (!entry)
+        {
+            return luaL_error(L, g_hookCount == HOOK_MAX ? "too many hooks"
+                                                         : "cannot relocate prologue at 0x%08X (see hook_log.txt)",
+                              address);
+        }
+    }
+
+    // Drop the old callbacks and count-only while the new ones are set up
+    clear_callbacks(L, entry);
+    entry->timed = false;
+    update_route(entry);
+
+    if (has_opts)
+    {
+        lua_getfield(L, 2, "argc");
+        int argc = (int)luaL_optinteger(L, -1, 0);
+        luaL_argcheck(L, argc >= 0 && argc <= HOOK_MAX_ARGS, 2, "argc out of range");
+        entry->argc = (uint8_t)argc;
+        lua_getfield(L, 2, "conv");
+        entry->conv = check_conv(L, luaL_optstring(L, -1, "cdecl"));
+        lua_getfield(L, 2, "name");
+        entry->name = lua_isstring(L, -1) ? ringlog_intern(lua_tostring(L, -1)) : 0;
+        lua_getfield(L, 2, "timed");
+        entry->timed = lua_toboolean(L, -1) != 0;
+        lua_pop(L, 4);
+
+        entry->pre_ref = take_callback(L, 2, "pre");
+        entry->post_ref = take_callback(L, 2, "post");
+    }
+    update_route(entry);
+
+    if (!entry->detour.attached && !detour_enable(&entry->detour))
+    {
+        clear_callbacks(L, entry);
+        return luaL_error(L, "failed to hook 0x%08X", address);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int l_hook_detach(lua_State *L)
+{
+    hook_entry *entry = hook_find((uint32_t)(int64_t)luaL_checknumber(L, 1));
+    bool        detached = entry && entry->detour.attached && detour_disable(&entry->detour);
+    if (entry)
+    {
+        clear_callbacks(L, entry);
+        entry->timed = false;
+        update_route(entry);
+    }
+    lua_pushboolean(L, detached);
+    return 1;
+}
+
+static void push_stats(lua_State *L, const hook_entry *entry)
+{
+    uint32_t calls = (uint32_t)entry->calls;
+    double   total_ms = ticks_to_ms(entry->total_ticks);
+
+    lua_createtable(L, 0, 12);
+    lua_pushnumber(L, entry->address);
+    lua_setfield(L, -2, "address");
+    if (entry->name)
+    {
+        lua_pushstring(L, ringlog_name(entry->name));
+        lua_setfield(L, -2, "name");
+    }
+    lua_pushboolean(L, entry->detour.attached);
+    lua_setfield(L, -2, "attached");
+    lua_pushstring(L, entry->route == entry->code + COUNTING_OFFSET ? "count" : "callback");
+    lua_setfield(L, -2, "mode");
+    lua_pushnumber(L, calls);
+    lua_setfield(L, -2, "calls");
+    lua_pushnumber(L, (uint32_t)entry->lua_calls);
+    lua_setfield(L, -2, "lua_calls");
+    lua_pushnumber(L, (uint32_t)entry->skipped);
+    lua_setfield(L, -2, "skipped");
+    lua_pushnumber(L, (uint32_t)entry->errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushnumber(L, total_ms);
+    lua_setfield(L, -2, "total_ms");
+    lua_pushnumber(L, calls && entry->total_ticks ? total_ms * 1000.0 / calls : 0);
+    lua_setfield(L, -2, "avg_us");
+    lua_pushnumber(L, ticks_to_ms(entry->max_ticks) * 1000.0);
+    lua_setfield(L, -2, "max_us");
+}
+
+// hook.stats(addr) -> table or nil
+static int l_hook_stats(lua_State *L)
+{
+    hook_entry *entry = hook_find((uint32_t)(int64_t)luaL_checknumber(L, 1));
+    if (!entry)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    push_stats(L, entry);
+    return 1;
+}
+
+// hook.reset(addr) zeroes the counters
+static int l_hook_reset(lua_State *L)
+{
+    hook_entry *entry = hook_find((uint32_t)(int64_t)luaL_checknumber(L, 1));
+    if (entry)
+    {
+        InterlockedExchange(&entry->calls, 0);
+        InterlockedExchange(&entry->lua_calls, 0);
+        InterlockedExchange(&entry->skipped, 0);
+        InterlockedExchange(&entry->errors, 0);
+        InterlockedExchange64(&entry->total_ticks, 0);
+        InterlockedExchange64(&entry->max_ticks, 0);
+    }
+    lua_pushboolean(L, entry != NULL);
+    return 1;
+}
+
+// hook.list() -> stats of every hook ever attached
+static int l_hook_list(lua_State *L)
+{
+    lua_createtable(L, g_hookCount, 0);
+    for (LONG i = 0; i < g_hookCount; i++)
+    {
+        push_stats(L, &g_hooks[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static const luaL_Reg hook_funcs[] = {{"attach", l_hook_attach}, {"detach", l_hook_detach},
+                                      {"stats", l_hook_stats},   {"reset", l_hook_reset},
+                                      {"list", l_hook_list},     {NULL, NULL}};
+
+int luaopen_hook(lua_State *L)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_qpcFrequency = frequency.QuadPart;
+
+    if (g_flsIndex == FLS_OUT_OF_INDEXES)
+    {
+        g_flsIndex = FlsAlloc(free_thread);
+    }
+
+    luaL_register(L, "hook", hook_funcs);
+    return 1;
+}
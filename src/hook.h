@@ -0,0 +1,49 @@
+#ifndef HOOK_H
+#define HOOK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "lua.h"
+
+#define HOOK_MAX 256
+#define HOOK_MAX_ARGS 16
+
+enum
+{
+    HOOK_CDECL = 0,
+    HOOK_STDCALL = 1,
+    HOOK_THISCALL = 2, /* First argument in ECX */
+    HOOK_FASTCALL = 3  /* First two arguments in ECX, EDX */
+};
+
+typedef struct
+{
+    /* Read by the generated stubs; keep these first */
+    void *volatile route;      /* Stub the hook currently jumps to */
+    void *volatile trampoline; /* Original function */
+    volatile LONG  calls;      /* Wraps at 2^32 */
+
+    detour          detour;
+    uint8_t        *code;       /* Router, counting stub, callback stub */
+    uint32_t        address;
+    uint32_t        name;       /* ringlog/trace id, 0 for none */
+    uint8_t         argc;
+    uint8_t         conv;
+    bool            timed;      /* Measure each call natively */
+    int             pre_ref;    /* Lua registry refs, LUA_NOREF when unset */
+    int             post_ref;
+    volatile LONG   lua_calls;
+    volatile LONG   skipped;    /* Callbacks not run: Lua busy or re-entered */
+    volatile LONG   errors;
+    volatile LONGLONG total_ticks;
+    volatile LONGLONG max_ticks;
+} hook_entry;
+
+hook_entry *hook_find(uint32_t address);
+void        hook_shutdown(void);
+int         luaopen_hook(lua_State *L);
+
+#endif // HOOK_H
@@ -0,0 +1,247 @@
+/*
+ * latency.c: Wall-clock call timing and latency histograms.
+ *
+ * latency.now() reads QueryPerformanceCounter, so timings are wall time
+ * with sub-microsecond resolution; os.clock() is process CPU time on the
+ * MSVC CRT. Histograms are HDR-style log-linear buckets of nanoseconds:
+ * recording is an index computation and an increment, and percentiles
+ * walk about a thousand counters. Each histogram is one fixed-size
+ * userdata, so per-function stats allocate nothing after creation.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "latency.h"
+
+#define LATENCY_MT "luaapi.latency"
+
+static LARGE_INTEGER g_qpcFrequency;
+static LARGE_INTEGER g_qpcBase;
+static INIT_ONCE     g_clockOnce = INIT_ONCE_STATIC_INIT;
+
+//============================================================================
+// HISTOGRAM
+//============================================================================
+
+static uint32_t bucket_index(uint64_t value)
+{
+    if (value < 2 * LATENCY_SUB_COUNT)
+    {
+        return (uint32_t)value;
+    }
+    if (value >> LATENCY_MAX_BITS)
+    {
+        value = (1ull << LATENCY_MAX_BITS) - 1;
+    }
+
+    uint32_t msb = 63 - (uint32_t)__builtin_clzll(value);
+    uint32_t shift = msb - LATENCY_SUB_BITS;
+    return shift * LATENCY_SUB_COUNT + (uint32_t)(value >> shift);
+}
+
+// Largest value that lands in a bucket
+static uint64_t bucket_high(uint32_t index)
+{
+    if (index < 2 * LATENCY_SUB_COUNT)
+    {
+        return index;
+    }
+
+    uint32_t shift = index / LATENCY_SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(index % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT) << shift;
+    return low + (1ull << shift) - 1;
+}
+
+void latency_reset(latency_histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void latency_record(latency_histogram *h, uint64_t ns, bool ok)
+{
+    if (h->count == 0 || ns < h->min)
+    {
+        h->min = ns;
+    }
+    if (ns > h->max)
+    {
+        h->max = ns;
+    }
+    h->count++;
+    h->sum += ns;
+    h->buckets[bucket_index(ns)]++;
+    if (!ok)
+    {
+        h->errors++;
+    }
+}
+
+// Smallest recorded value that percent of all values are at or below,
+// to bucket precision
+uint64_t latency_percentile(const latency_histogram *h, double percent)
+{
+    if (h->count == 0)
+    {
+        return 0;
+    }
+    if (percent >= 100.0)
+    {
+        return h->max;
+    }
+
+    uint64_t rank = (uint64_t)(percent / 100.0 * (double)h->count + 0.999999);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t high = bucket_high(i);
+            return high < h->max ? (high > h->min ? high : h->min) : h->max;
+        }
+    }
+    return h->max;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static double ns_to_ms(uint64_t ns)
+{
+    return (double)ns / 1e6;
+}
+
+static latency_histogram *check_histogram(lua_State *L)
+{
+    return (latency_histogram *)luaL_checkudata(L, 1, LATENCY_MT);
+}
+
+// latency.now() -> milliseconds on the performance counter
+static int l_latency_now(lua_State *L)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    lua_pushnumber(L, (double)(now.QuadPart - g_qpcBase.QuadPart) * 1000.0 / (double)g_qpcFrequency.QuadPart);
+    return 1;
+}
+
+// latency.new() -> histogram
+static int l_latency_new(lua_State *L)
+{
+    latency_histogram *h = (latency_histogram *)lua_newuserdata(L, sizeof(latency_histogram));
+    latency_reset(h);
+    luaL_getmetatable(L, LATENCY_MT);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// h:record(elapsed_ms [, ok])
+static int l_hist_record(lua_State *L)
+{
+    latency_histogram *h = check_histogram(L);
+    double             ns = luaL_checknumber(L, 2) * 1e6;
+    bool               ok = lua_isnoneornil(L, 3) || lua_toboolean(L, 3);
+    latency_record(h, ns > 0 ? (uint64_t)ns : 0, ok);
+    return 0;
+}
+
+// h:percentile(p) -> milliseconds
+static int l_hist_percentile(lua_State *L)
+{
+    latency_histogram *h = check_histogram(L);
+    lua_pushnumber(L, ns_to_ms(latency_percentile(h, luaL_checknumber(L, 2))));
+    return 1;
+}
+
+// Pushes {count, errors, total_ms, min_ms, mean_ms, p50_ms, p90_ms, p99_ms, p999_ms, max_ms}
+void latency_push_stats(lua_State *L, const latency_histogram *h)
+{
+    static const struct
+    {
+        const char *field;
+        double      percent;
+    } points[] = {{"p50_ms", 50.0}, {"p90_ms", 90.0}, {"p99_ms", 99.0}, {"p999_ms", 99.9}};
+
+    lua_createtable(L, 0, 10);
+    lua_pushnumber(L, (lua_Number)h->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)h->errors);
+    lua_setfield(L, -2, "errors");
+    lua_pushnumber(L, ns_to_ms(h->sum));
+    lua_setfield(L, -2, "total_ms");
+    lua_pushnumber(L, ns_to_ms(h->min));
+    lua_setfield(L, -2, "min_ms");
+    lua_pushnumber(L, h->count ? ns_to_ms(h->sum) / (double)h->count : 0);
+    lua_setfield(L, -2, "mean_ms");
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++)
+    {
+        lua_pushnumber(L, ns_to_ms(latency_percentile(h, points[i].percent)));
+        lua_setfield(L, -2, points[i].field);
+    }
+    lua_pushnumber(L, ns_to_ms(h->max));
+    lua_setfield(L, -2, "max_ms");
+}
+
+// h:stats() -> see latency_push_stats
+static int l_hist_stats(lua_State *L)
+{
+    latency_push_stats(L, check_histogram(L));
+    return 1;
+}
+
+static int l_hist_reset(lua_State *L)
+{
+    latency_reset(check_histogram(L));
+    return 0;
+}
+
+static int l_hist_count(lua_State *L)
+{
+    lua_pushnumber(L, (lua_Number)check_histogram(L)->count);
+    return 1;
+}
+
+static const luaL_Reg histogram_methods[] = {{"record", l_hist_record}, {"percentile", l_hist_percentile},
+                                             {"stats", l_hist_stats},   {"reset", l_hist_reset},
+                                             {"count", l_hist_count},   {NULL, NULL}};
+
+static const luaL_Reg latency_funcs[] = {{"now", l_latency_now}, {"new", l_latency_new}, {NULL, NULL}};
+
+// The base is process-wide; worker states open this module too and must
+// not move latency.now() under the console
+static BOOL WINAPI init_clock(PINIT_ONCE once, void *param, void **context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    QueryPerformanceFrequency(&g_qpcFrequency);
+    QueryPerformanceCounter(&g_qpcBase);
+    return TRUE;
+}
+
+int luaopen_latency(lua_State *L)
+{
+    InitOnceExecuteOnce(&g_clockOnce, init_clock, NULL, NULL);
+
+    luaL_newmetatable(L, LATENCY_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, histogram_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_hist_count);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
+    luaL_register(L, "latency", latency_funcs);
+    return 1;
+}
@@ -0,0 +1,32 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+// Log-linear buckets: exact below 64 ns, then 32 per power of two, so any
+// value is reported within about 3% of what was recorded
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB_COUNT (1u << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 42 /* Values clamp at 2^42 ns, about 73 minutes */
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t errors;
+    uint64_t sum; /* Nanoseconds */
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latency_histogram;
+
+void     latency_reset(latency_histogram *h);
+void     latency_record(latency_histogram *h, uint64_t ns, bool ok);
+uint64_t latency_percentile(const latency_histogram *h, double percent);
+void     latency_push_stats(lua_State *L, const latency_histogram *h);
+int      luaopen_latency(lua_State *L);
+
+#endif // LATENCY_H
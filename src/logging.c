@@ -1,5 +1,23 @@
 /*
- * logging.c: A simple file-based logging implementation.
+ * logging.c: Asynchronous file logging through per-thread staging rings.
+ *
+ * logf() formats one record (QPC tick header plus text) on the caller's
+ * stack, copies it into a ring owned by the calling thread and publishes it
+ * with a single interlocked store. Nothing on that path takes a lock or
+ * touches the disk. A background writer merges all rings in tick order,
+ * turns ticks into wall-clock stamps from a base captured at startup, and
+ * coalesces the lines into large WriteFile calls. It wakes on a timer, when a
+ * ring fills past half, and an unhandled exception filter drains everything
+ * synchronously before the process goes down.
+ *
+ * Segments rotate by size: once hook_log.txt would pass max_bytes the writer
+ * renames it to hook_log.1.txt, shifts older segments up to hook_log.<keep>.txt
+ * (dropping the oldest) and starts a fresh file. Rotated segments can be
+ * NTFS-compressed. All of this happens on the writer, so logf never waits.
+ *
+ * The same rings carry binary records for other consumers (the trace file,
+ * see trace.c): log_push() stages raw bytes, and the writer hands them and
+ * every text line to the installed sink in the same tick order.
  */
 
 #define WIN32_LEAN_AND_MEAN
@@ -12,69 +30,573 @@
 #include <windows.h>
 #include <winsock2.h>
 
+#include "lauxlib.h"
 #include "logging.h"
+#include "lua.h"
 
-logging_context       g_logctx = {0};
+#define LOG_STAGE_SIZE (64u * 1024u) /* Per-thread staging ring, power of two */
+#define LOG_LINE_MAX   1024u         /* Longest formatted line */
+#define LOG_BATCH_SIZE (64u * 1024u) /* Bytes coalesced per WriteFile */
+#define LOG_FLUSH_MS   100u          /* Writer wakes at least this often */
+#define LOG_WAKE_BYTES (LOG_STAGE_SIZE / 2)
+#define LOG_CRASH_WAIT 500u /* ms the crash path waits for a busy writer */
 
-static const uint32_t max_log_lines = 50000u; /* Max lines before rollover */
+#define LOG_DEFAULT_MAX_BYTES (8u * 1024u * 1024u)
+#define LOG_DEFAULT_KEEP      8u
+#define LOG_MAX_KEEP          99u
+#define LOG_MIN_BYTES         (64u * 1024u)
 
-// Resets the log file by truncating it to zero length.
-// This is called when the log file exceeds the maximum number of lines.
-static void reset_log_file(void)
+typedef struct
 {
-    if (g_logctx.log_file != INVALID_HANDLE_VALUE)
+    uint64_t tick;
+    uint32_t thread;
+    uint16_t length;
+    uint8_t  type; /* LOG_RECORD_* */
+    uint8_t  reserved;
+} log_header;
+
+typedef struct log_stage
+{
+    struct log_stage *next;  /* Registry link, stages are never unlinked */
+    volatile LONG     owner; /* Thread id, 0 once the thread has exited */
+    volatile LONG     head;  /* Bytes published by the owner */
+    volatile LONG     tail;  /* Bytes consumed by the writer */
+    volatile LONG     dropped;
+    uint32_t          limit; /* Writer-only: head snapshot for this pass */
+    char              data[LOG_STAGE_SIZE];
+} log_stage;
+
+logging_context                     g_logctx = {0};
+
+static log_stage *volatile          g_stages = NULL;
+static char                         g_batch[LOG_BATCH_SIZE];
+static uint32_t                     g_batchLength = 0;
+static LPTOP_LEVEL_EXCEPTION_FILTER g_previousFilter = NULL;
+static log_sink_fn                  g_sink = NULL;
+static volatile LONG                g_pushing = 0; /* stage_push calls in flight, waited out by close_logging */
+
+// Cached "[YYYY-MM-DD HH:MM:SS." prefix for the second last written
+static uint64_t                     g_stampSecond = UINT64_MAX;
+static char                         g_stampPrefix[32];
+static int                          g_stampLength = 0;
+
+//============================================================================
+// Staging rings
+//============================================================================
+
+static void stage_write(log_stage *stage, uint32_t pos, const void *src, uint32_t len)
+{
+    uint32_t offset = pos & (LOG_STAGE_SIZE - 1);
+    uint32_t first = LOG_STAGE_SIZE - offset;
+    if (first >= len)
+    {
+        memcpy(stage->data + offset, src, len);
+    }
+    else
     {
-        SetFilePointer(g_logctx.log_file, 0, NULL, FILE_BEGIN);
-        SetEndOfFile(g_logctx.log_file);
-        g_logctx.log_line_count = 0;
+        memcpy(stage->data + offset, src, first);
+        memcpy(stage->data, (const char *)src + first, len - first);
     }
 }
 
-// Writes a formatted string to the log file.
-// This function is thread-safe.
-void logf(const char *fmt, ...)
+static void stage_read(const log_stage *stage, uint32_t pos, void *dst, uint32_t len)
+{
+    uint32_t offset = pos & (LOG_STAGE_SIZE - 1);
+    uint32_t first = LOG_STAGE_SIZE - offset;
+    if (first >= len)
+    {
+        memcpy(dst, stage->data + offset, len);
+    }
+    else
+    {
+        memcpy(dst, stage->data + offset, first);
+        memcpy((char *)dst + first, stage->data, len - first);
+    }
+}
+
+static uint32_t record_size(uint32_t length)
+{
+    return ((uint32_t)sizeof(log_header) + length + 7u) & ~7u;
+}
+
+// Runs when a thread exits; its ring stays linked so the writer can finish
+// draining it, and the next new thread adopts it.
+static void WINAPI release_stage(void *value)
+{
+    log_stage *stage = (log_stage *)value;
+    if (stage)
+    {
+        InterlockedExchange(&stage->owner, 0);
+    }
+}
+
+static log_stage *current_stage(void)
+{
+    log_stage *stage = (log_stage *)FlsGetValue(g_logctx.fls_index);
+    if (stage)
+    {
+        return stage;
+    }
+
+    LONG self = (LONG)GetCurrentThreadId();
+    for (stage = g_stages; stage; stage = stage->next)
+    {
+        if (stage->owner == 0 && InterlockedCompareExchange(&stage->owner, self, 0) == 0)
+        {
+            FlsSetValue(g_logctx.fls_index, stage);
+            return stage;
+        }
+    }
+
+    stage = (log_stage *)VirtualAlloc(NULL, sizeof(log_stage), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!stage)
+    {
+        return NULL;
+    }
+    stage->owner = self;
+
+    log_stage *head;
+    do
+    {
+        head = g_stages;
+        stage->next = head;
+    } while (InterlockedCompareExchangePointer((void *volatile *)&g_stages, stage, head) != head);
+
+    FlsSetValue(g_logctx.fls_index, stage);
+    return stage;
+}
+
+//============================================================================
+// Writer side
+//============================================================================
+
+static void segment_path(uint32_t index, wchar_t *out)
+{
+    if (index == 0)
+    {
+        swprintf_s(out, MAX_PATH, L"%ls.txt", g_logctx.log_stem);
+    }
+    else
+    {
+        swprintf_s(out, MAX_PATH, L"%ls.%u.txt", g_logctx.log_stem, index);
+    }
+}
+
+static HANDLE open_segment(DWORD disposition)
+{
+    wchar_t path[MAX_PATH];
+    segment_path(0, path);
+    return CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, disposition,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+static void compress_segment(const wchar_t *path)
+{
+    HANDLE file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE)
+    {
+        USHORT format = COMPRESSION_FORMAT_DEFAULT;
+        DWORD  returned;
+        DeviceIoControl(file, FSCTL_SET_COMPRESSION, &format, sizeof(format), NULL, 0, &returned, NULL);
+        CloseHandle(file);
+    }
+}
+
+// Closes the current segment, shifts hook_log.N.txt up by one and starts a
+// new hook_log.txt. If the current file cannot be renamed (someone holds it
+// without FILE_SHARE_DELETE), it is reopened for append instead so nothing
+// is lost. Caller holds the drain lock.
+static void rotate_locked(void)
+{
+    wchar_t from[MAX_PATH], to[MAX_PATH];
+    uint32_t keep = g_logctx.keep_segments;
+
+    FlushFileBuffers(g_logctx.log_file);
+    CloseHandle(g_logctx.log_file);
+
+    bool moved;
+    if (keep == 0)
+    {
+        segment_path(0, from);
+        moved = DeleteFileW(from) != 0;
+    }
+    else
+    {
+        segment_path(keep, to);
+        DeleteFileW(to);
+        for (uint32_t i = keep - 1; i > 0; i--)
+        {
+            segment_path(i, from);
+            segment_path(i + 1, to);
+            MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING);
+        }
+        segment_path(0, from);
+        segment_path(1, to);
+        moved = MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+    }
+
+    g_logctx.log_file = open_segment(moved ? CREATE_ALWAYS : OPEN_ALWAYS);
+    if (g_logctx.log_file == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    if (moved)
+    {
+        g_logctx.segment_bytes = 0;
+        g_logctx.rotations++;
+        if (keep > 0 && g_logctx.compress_segments)
+        {
+            compress_segment(to);
+        }
+    }
+    else
+    {
+        SetFilePointer(g_logctx.log_file, 0, NULL, FILE_END);
+        g_logctx.rotate_failures++;
+    }
+}
+
+static void write_batch(void)
 {
-    if (!g_logctx.critical_section_initialized || g_logctx.log_file == INVALID_HANDLE_VALUE)
+    if (g_logctx.rotate_requested ||
+        (g_logctx.segment_bytes > 0 && g_logctx.segment_bytes + g_batchLength > g_logctx.max_bytes))
     {
+        g_logctx.rotate_requested = 0;
+        rotate_locked();
+    }
+    if (g_logctx.log_file == INVALID_HANDLE_VALUE)
+    {
+        g_batchLength = 0;
         return;
     }
 
-    EnterCriticalSection(&g_logctx.critical_section);
+    uint32_t offset = 0;
+    while (offset < g_batchLength)
+    {
+        DWORD written = 0;
+        if (!WriteFile(g_logctx.log_file, g_batch + offset, g_batchLength - offset, &written, NULL) || written == 0)
+        {
+            break;
+        }
+        offset += written;
+    }
+    g_logctx.segment_bytes += offset;
+    g_batchLength = 0;
+}
 
-    if (++g_logctx.log_line_count > max_log_lines)
+static void batch_append(const char *text, uint32_t length)
+{
+    if (g_batchLength + length > sizeof(g_batch))
     {
-        reset_log_file();
+        write_batch();
     }
+    memcpy(g_batch + g_batchLength, text, length);
+    g_batchLength += length;
+}
 
-    SYSTEMTIME st;
-    GetLocalTime(&st);
-    char timestamp[64];
-    int  timestamp_len = snprintf(timestamp, sizeof(timestamp), "[%04d-%02d-%02d %02d:%02d:%02d.%03d] ", st.wYear,
-                                  st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond, st.wMilliseconds);
+// Converts a QPC tick to a "[YYYY-MM-DD HH:MM:SS.mmm] " stamp. The date and
+// time part is only rebuilt when the second changes.
+static int format_stamp(uint64_t tick, char *out)
+{
+    int64_t  delta = (int64_t)(tick - g_logctx.qpc_base);
+    int64_t  frequency = g_logctx.qpc_frequency;
+    int64_t  units = (delta / frequency) * 10000000 + (delta % frequency) * 10000000 / frequency;
+    uint64_t filetime = g_logctx.filetime_base + (uint64_t)units;
+    uint64_t second = filetime / 10000000u;
 
-    char buffer[1024];
-    memcpy(buffer, timestamp, timestamp_len);
+    if (second != g_stampSecond)
+    {
+        FILETIME   ft;
+        SYSTEMTIME st;
+        ft.dwLowDateTime = (DWORD)filetime;
+        ft.dwHighDateTime = (DWORD)(filetime >> 32);
+        FileTimeToSystemTime(&ft, &st);
+        g_stampLength = snprintf(g_stampPrefix, sizeof(g_stampPrefix), "[%04d-%02d-%02d %02d:%02d:%02d.", st.wYear,
+                                 st.wMonth, st.wDay, st.wHour, st.wMinute, st.wSecond);
+        g_stampSecond = second;
+    }
 
-    va_list ap;
-    va_start(ap, fmt);
-    int len = vsnprintf(buffer + timestamp_len, sizeof(buffer) - timestamp_len, fmt, ap);
-    va_end(ap);
+    unsigned millis = (unsigned)((filetime / 10000u) % 1000u);
+    memcpy(out, g_stampPrefix, g_stampLength);
+    out[g_stampLength + 0] = (char)('0' + millis / 100);
+    out[g_stampLength + 1] = (char)('0' + millis / 10 % 10);
+    out[g_stampLength + 2] = (char)('0' + millis % 10);
+    out[g_stampLength + 3] = ']';
+    out[g_stampLength + 4] = ' ';
+    return g_stampLength + 5;
+}
+
+static void emit_line(uint64_t tick, const char *text, uint32_t length)
+{
+    char stamp[48];
+    int  stampLength = format_stamp(tick, stamp);
+    batch_append(stamp, (uint32_t)stampLength);
+    batch_append(text, length);
+}
+
+// Moves every record published so far into the batch buffer, merging the
+// per-thread rings by tick so lines from different threads stay in order.
+// Caller holds the drain lock.
+static void drain_locked(void)
+{
+    for (log_stage *stage = g_stages; stage; stage = stage->next)
+    {
+        stage->limit = (uint32_t)stage->head;
+
+        LONG dropped = stage->dropped ? InterlockedExchange(&stage->dropped, 0) : 0;
+        if (dropped)
+        {
+            LARGE_INTEGER now;
+            char          note[96];
+            QueryPerformanceCounter(&now);
+            int length = snprintf(note, sizeof(note), "[LOG] %ld records dropped, thread %lu staging buffer full\n",
+                                  (long)dropped, (unsigned long)stage->owner);
+            emit_line((uint64_t)now.QuadPart, note, (uint32_t)length);
+        }
+    }
 
-    if (len > 0)
+    for (;;)
     {
-        if (buffer[timestamp_len + len - 1] != '\n')
+        log_stage *best = NULL;
+        log_header bestHeader = {0};
+
+        for (log_stage *stage = g_stages; stage; stage = stage->next)
+        {
+            uint32_t tail = (uint32_t)stage->tail;
+            if (tail == stage->limit)
+            {
+                continue;
+            }
+
+            log_header header;
+            stage_read(stage, tail, &header, sizeof(header));
+            if (!best || header.tick < bestHeader.tick)
+            {
+                best = stage;
+                bestHeader = header;
+            }
+        }
+
+        if (!best)
+        {
+            break;
+        }
+
+        char     data[LOG_LINE_MAX];
+        uint32_t tail = (uint32_t)best->tail;
+        stage_read(best, tail + (uint32_t)sizeof(log_header), data, bestHeader.length);
+        InterlockedExchange(&best->tail, (LONG)(tail + record_size(bestHeader.length)));
+
+        if (bestHeader.type == LOG_RECORD_TEXT)
         {
-            buffer[timestamp_len + len] = '\n';
-            buffer[timestamp_len + len + 1] = '\0';
-            len++;
+            emit_line(bestHeader.tick, data, bestHeader.length);
         }
+        if (g_sink)
+        {
+            g_sink(bestHeader.type, bestHeader.tick, bestHeader.thread, data, bestHeader.length);
+        }
+    }
+
+    write_batch();
+    if (g_sink)
+    {
+        g_sink(0, 0, 0, NULL, 0);
+    }
+}
+
+static DWORD WINAPI writer_main(LPVOID param)
+{
+    (void)param;
+
+    for (;;)
+    {
+        WaitForSingleObject(g_logctx.wake_event, LOG_FLUSH_MS);
+
+        EnterCriticalSection(&g_logctx.drain_lock);
+        drain_locked();
+        LeaveCriticalSection(&g_logctx.drain_lock);
+
+        if (g_logctx.writer_quit)
+        {
+            return 0;
+        }
+    }
+}
 
-        DWORD written;
-        WriteFile(g_logctx.log_file, buffer, timestamp_len + len, &written, NULL);
+// Drains on the faulting thread so the lines leading up to a crash reach
+// the file even if the writer never runs again.
+static LONG WINAPI crash_filter(EXCEPTION_POINTERS *info)
+{
+    if (g_logctx.running)
+    {
+        EXCEPTION_RECORD *record = info->ExceptionRecord;
+        logf("[HOOK] Unhandled exception 0x%08lX at %p", (unsigned long)record->ExceptionCode,
+             record->ExceptionAddress);
+
+        // Drain even without the lock when the writer is wedged; losing the
+        // lines would be worse than a torn batch.
+        DWORD start = GetTickCount();
+        bool  locked;
+        while (!(locked = TryEnterCriticalSection(&g_logctx.drain_lock)) && GetTickCount() - start < LOG_CRASH_WAIT)
+        {
+            Sleep(1);
+        }
+        drain_locked();
         FlushFileBuffers(g_logctx.log_file);
+        if (locked)
+        {
+            LeaveCriticalSection(&g_logctx.drain_lock);
+        }
+    }
+
+    return g_previousFilter ? g_previousFilter(info) : EXCEPTION_CONTINUE_SEARCH;
+}
+
+void log_flush(void)
+{
+    if (!g_logctx.running)
+    {
+        return;
+    }
+
+    EnterCriticalSection(&g_logctx.drain_lock);
+    drain_locked();
+    FlushFileBuffers(g_logctx.log_file);
+    LeaveCriticalSection(&g_logctx.drain_lock);
+}
+
+//============================================================================
+// Producer side
+//============================================================================
+
+// Copies a record whose header is already filled in into the calling
+// thread's ring. Returns false when the ring is full and it was dropped.
+static bool stage_push(void *record, uint32_t length)
+{
+    // Counted before running is checked again, so close_logging can wait
+    // for every push that still saw it set before freeing the stages
+    InterlockedIncrement(&g_pushing);
+    log_stage *stage = g_logctx.running ? current_stage() : NULL;
+    if (!stage)
+    {
+        InterlockedDecrement(&g_pushing);
+        return false;
+    }
+
+    uint32_t size = record_size(length);
+    uint32_t head = (uint32_t)stage->head;
+    uint32_t used = head - (uint32_t)stage->tail;
+    if (LOG_STAGE_SIZE - used < size)
+    {
+        InterlockedIncrement(&stage->dropped);
+        SetEvent(g_logctx.wake_event);
+        InterlockedDecrement(&g_pushing);
+        return false;
+    }
+
+    stage_write(stage, head, record, (uint32_t)sizeof(log_header) + length);
+    InterlockedExchange(&stage->head, (LONG)(head + size));
+
+    if (!g_logctx.writer_thread)
+    {
+        log_flush();
+    }
+    else if (used < LOG_WAKE_BYTES && used + size >= LOG_WAKE_BYTES)
+    {
+        SetEvent(g_logctx.wake_event);
+    }
+    InterlockedDecrement(&g_pushing);
+    return true;
+}
+
+// Stages length bytes of data as a record of the given type for the sink.
+// Same cost and guarantees as logf, without the formatting.
+bool log_push(uint8_t type, const void *data, uint32_t length)
+{
+    if (!g_logctx.running || length > LOG_LINE_MAX)
+    {
+        return false;
+    }
+
+    union
+    {
+        log_header header;
+        char       bytes[sizeof(log_header) + LOG_LINE_MAX];
+    } record;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    record.header.tick = (uint64_t)now.QuadPart;
+    record.header.thread = GetCurrentThreadId();
+    record.header.length = (uint16_t)length;
+    record.header.type = type;
+    record.header.reserved = 0;
+    memcpy(record.bytes + sizeof(log_header), data, length);
+
+    return stage_push(&record, length);
+}
+
+// Installs the function the writer passes every drained record to, then
+// calls with data NULL once per pass so it can flush. NULL removes it.
+void log_set_sink(log_sink_fn sink)
+{
+    if (!g_logctx.running)
+    {
+        return;
+    }
+
+    EnterCriticalSection(&g_logctx.drain_lock);
+    g_sink = sink;
+    LeaveCriticalSection(&g_logctx.drain_lock);
+}
+
+// Writes a formatted string to the log file.
+// This function is thread-safe and never blocks on the file.
+void logf(const char *fmt, ...)
+{
+    if (!g_logctx.running)
+    {
+        return;
+    }
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    // Header and text are built contiguously so publishing is one copy
+    union
+    {
+        log_header header;
+        char       bytes[sizeof(log_header) + LOG_LINE_MAX];
+    } record;
+    char *text = record.bytes + sizeof(log_header);
+
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(text, LOG_LINE_MAX - 1, fmt, ap);
+    va_end(ap);
+
+    if (len < 0)
+    {
+        return;
+    }
+    if (len > (int)LOG_LINE_MAX - 2)
+    {
+        len = (int)LOG_LINE_MAX - 2;
+    }
+    if (len == 0 || text[len - 1] != '\n')
+    {
+        text[len++] = '\n';
     }
 
-    LeaveCriticalSection(&g_logctx.critical_section);
+    record.header.tick = (uint64_t)now.QuadPart;
+    record.header.thread = GetCurrentThreadId();
+    record.header.length = (uint16_t)len;
+    record.header.type = LOG_RECORD_TEXT;
+    record.header.reserved = 0;
+
+    stage_push(&record, (uint32_t)len);
 }
 
 static char *GetErrorDescription(int errorCode)
@@ -112,40 +634,216 @@ void log_winsock_error(const char *prefix, SOCKET s, int error)
     }
 }
 
+//============================================================================
+// Lifecycle
+//============================================================================
+
 bool init_logging(HMODULE hModule)
 {
-    InitializeCriticalSection(&g_logctx.critical_section);
-    g_logctx.critical_section_initialized = true;
-
-    wchar_t dllPath[MAX_PATH];
-    GetModuleFileNameW(hModule, dllPath, MAX_PATH);
-    PathRemoveFileSpecW(dllPath);
-    wcscat_s(dllPath, MAX_PATH, L"\\hook_log.txt");
-
-    g_logctx.log_file =
-        CreateFileW(dllPath, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    GetModuleFileNameW(hModule, g_logctx.log_stem, MAX_PATH);
+    PathRemoveFileSpecW(g_logctx.log_stem);
+    wcscat_s(g_logctx.log_stem, MAX_PATH, L"\\hook_log");
 
+    g_logctx.log_file = open_segment(OPEN_ALWAYS);
     if (g_logctx.log_file == INVALID_HANDLE_VALUE)
     {
         return false;
     }
 
+    g_logctx.fls_index = FlsAlloc(release_stage);
+    if (g_logctx.fls_index == FLS_OUT_OF_INDEXES)
+    {
+        CloseHandle(g_logctx.log_file);
+        g_logctx.log_file = INVALID_HANDLE_VALUE;
+        return false;
+    }
+
+    // Append to what the last session left; the first batch rotates it out
+    // if it is already full
+    LARGE_INTEGER size;
     SetFilePointer(g_logctx.log_file, 0, NULL, FILE_END);
-    logf("[HOOK] DLL attached to process %lu, log: %ls", GetCurrentProcessId(), dllPath);
+    g_logctx.segment_bytes = GetFileSizeEx(g_logctx.log_file, &size) ? (uint64_t)size.QuadPart : 0;
+    g_logctx.max_bytes = LOG_DEFAULT_MAX_BYTES;
+    g_logctx.keep_segments = LOG_DEFAULT_KEEP;
+
+    // Wall-clock base for converting record ticks, in local time
+    LARGE_INTEGER frequency, counter;
+    FILETIME      utc, local;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    GetSystemTimeAsFileTime(&utc);
+    FileTimeToLocalFileTime(&utc, &local);
+    g_logctx.qpc_frequency = frequency.QuadPart;
+    g_logctx.qpc_base = (uint64_t)counter.QuadPart;
+    g_logctx.filetime_base = ((uint64_t)local.dwHighDateTime << 32) | local.dwLowDateTime;
+
+    InitializeCriticalSection(&g_logctx.drain_lock);
+    g_logctx.wake_event = CreateEventA(NULL, FALSE, FALSE, NULL);
+    g_logctx.writer_quit = 0;
+    g_logctx.running = 1;
+
+    // Without a writer thread logf drains synchronously, as it used to
+    if (g_logctx.wake_event)
+    {
+        g_logctx.writer_thread = CreateThread(NULL, 0, writer_main, NULL, 0, NULL);
+    }
+
+    g_previousFilter = SetUnhandledExceptionFilter(crash_filter);
+
+    logf("[HOOK] DLL attached to process %lu, log: %ls.txt", GetCurrentProcessId(), g_logctx.log_stem);
     return true;
 }
 
 void close_logging(void)
 {
-    if (g_logctx.log_file != INVALID_HANDLE_VALUE)
+    if (!g_logctx.running)
     {
-        CloseHandle(g_logctx.log_file);
-        g_logctx.log_file = INVALID_HANDLE_VALUE;
+        return;
+    }
+
+    // New lines are dropped from here on; pushes already under way finish
+    // before the writer stops and the stages go away
+    InterlockedExchange(&g_logctx.running, 0);
+    while (g_pushing)
+    {
+        Sleep(1);
+    }
+
+    if (g_logctx.writer_thread)
+    {
+        g_logctx.writer_quit = 1;
+        SetEvent(g_logctx.wake_event);
+        WaitForSingleObject(g_logctx.writer_thread, INFINITE);
+        CloseHandle(g_logctx.writer_thread);
+        g_logctx.writer_thread = NULL;
+    }
+
+    // Only restore the filter if nothing else replaced ours since
+    LPTOP_LEVEL_EXCEPTION_FILTER current = SetUnhandledExceptionFilter(g_previousFilter);
+    if (current != crash_filter)
+    {
+        SetUnhandledExceptionFilter(current);
+    }
+
+    // log_flush is a no-op once running is clear
+    EnterCriticalSection(&g_logctx.drain_lock);
+    drain_locked();
+    FlushFileBuffers(g_logctx.log_file);
+    LeaveCriticalSection(&g_logctx.drain_lock);
+
+    CloseHandle(g_logctx.log_file);
+    g_logctx.log_file = INVALID_HANDLE_VALUE;
+
+    if (g_logctx.wake_event)
+    {
+        CloseHandle(g_logctx.wake_event);
+        g_logctx.wake_event = NULL;
+    }
+
+    FlsFree(g_logctx.fls_index);
+    log_stage *stage = (log_stage *)InterlockedExchangePointer((void *volatile *)&g_stages, NULL);
+    while (stage)
+    {
+        log_stage *next = stage->next;
+        VirtualFree(stage, 0, MEM_RELEASE);
+        stage = next;
     }
 
-    if (g_logctx.critical_section_initialized)
+    DeleteCriticalSection(&g_logctx.drain_lock);
+}
+
+//============================================================================
+// Lua bindings
+//============================================================================
+
+// hooklog.write(text)
+static int l_hooklog_write(lua_State *L)
+{
+    logf("%s", luaL_checkstring(L, 1));
+    return 0;
+}
+
+// hooklog.flush(): drains every thread's staged lines to disk now
+static int l_hooklog_flush(lua_State *L)
+{
+    (void)L;
+    log_flush();
+    return 0;
+}
+
+// hooklog.rotate(): starts a new segment on the writer's next pass
+static int l_hooklog_rotate(lua_State *L)
+{
+    (void)L;
+    if (g_logctx.running)
     {
-        DeleteCriticalSection(&g_logctx.critical_section);
-        g_logctx.critical_section_initialized = false;
+        g_logctx.rotate_requested = 1;
+        SetEvent(g_logctx.wake_event);
     }
+    return 0;
+}
+
+// hooklog.config([{max_bytes=, keep=, compress=}]) -> current settings
+static int l_hooklog_config(lua_State *L)
+{
+    if (!g_logctx.running)
+    {
+        return luaL_error(L, "hook log is not open");
+    }
+
+    EnterCriticalSection(&g_logctx.drain_lock);
+    if (lua_istable(L, 1))
+    {
+        lua_getfield(L, 1, "max_bytes");
+        if (!lua_isnil(L, -1))
+        {
+            lua_Number bytes = luaL_checknumber(L, -1);
+            g_logctx.max_bytes = bytes < LOG_MIN_BYTES ? LOG_MIN_BYTES : (uint64_t)bytes;
+        }
+        lua_getfield(L, 1, "keep");
+        if (!lua_isnil(L, -1))
+        {
+            lua_Integer keep = luaL_checkinteger(L, -1);
+            g_logctx.keep_segments = keep < 0 ? 0 : keep > LOG_MAX_KEEP ? LOG_MAX_KEEP : (uint32_t)keep;
+        }
+        lua_getfield(L, 1, "compress");
+        if (!lua_isnil(L, -1))
+        {
+            g_logctx.compress_segments = lua_toboolean(L, -1) ? 1 : 0;
+        }
+        lua_pop(L, 3);
+    }
+
+    char path[MAX_PATH * 3];
+    snprintf(path, sizeof(path), "%ls.txt", g_logctx.log_stem);
+
+    lua_createtable(L, 0, 7);
+    lua_pushnumber(L, (lua_Number)g_logctx.max_bytes);
+    lua_setfield(L, -2, "max_bytes");
+    lua_pushinteger(L, (lua_Integer)g_logctx.keep_segments);
+    lua_setfield(L, -2, "keep");
+    lua_pushboolean(L, g_logctx.compress_segments);
+    lua_setfield(L, -2, "compress");
+    lua_pushnumber(L, (lua_Number)g_logctx.segment_bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushinteger(L, (lua_Integer)g_logctx.rotations);
+    lua_setfield(L, -2, "rotations");
+    lua_pushinteger(L, (lua_Integer)g_logctx.rotate_failures);
+    lua_setfield(L, -2, "rotate_failures");
+    lua_pushstring(L, path);
+    lua_setfield(L, -2, "path");
+    LeaveCriticalSection(&g_logctx.drain_lock);
+    return 1;
+}
+
+static const luaL_Reg hooklog_funcs[] = {{"write", l_hooklog_write},
+                                         {"flush", l_hooklog_flush},
+                                         {"rotate", l_hooklog_rotate},
+                                         {"config", l_hooklog_config},
+                                         {NULL, NULL}};
+
+int luaopen_logging(lua_State *L)
+{
+    luaL_register(L, "hooklog", hooklog_funcs);
+    return 1;
 }
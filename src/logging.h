@@ -6,12 +6,39 @@
 #include <windows.h>
 #include <winsock2.h>
 
+#include "lua.h"
+
+// Record types carried by the staging rings
+enum
+{
+    LOG_RECORD_TEXT = 0,  // A line for hook_log.txt
+    LOG_RECORD_TRACE = 1  // Binary trace event, see trace.c
+};
+
+// Receives drained records on the writer thread, in tick order. Called with
+// data NULL after each pass.
+typedef void (*log_sink_fn)(uint8_t type, uint64_t tick, uint32_t thread, const void *data, uint32_t length);
+
 typedef struct
 {
-    CRITICAL_SECTION critical_section;
-    bool             critical_section_initialized;
+    CRITICAL_SECTION drain_lock; // Held by whoever moves staged lines to the file
     HANDLE           log_file;
-    UINT32           log_line_count;
+    HANDLE           writer_thread;
+    HANDLE           wake_event;
+    DWORD            fls_index;
+    volatile LONG    running;
+    volatile LONG    writer_quit;
+    wchar_t          log_stem[MAX_PATH]; // Path without ".txt"; segments are <stem>.N.txt
+    uint64_t         segment_bytes;      // Size of the current hook_log.txt
+    uint64_t         max_bytes;          // Rotate once a batch would pass this
+    uint32_t         keep_segments;      // Rotated segments kept, oldest deleted
+    uint32_t         rotations;
+    uint32_t         rotate_failures;
+    volatile LONG    rotate_requested;
+    int              compress_segments; // NTFS-compress segments once rotated
+    int64_t          qpc_frequency;
+    uint64_t         qpc_base;
+    uint64_t         filetime_base; // Local FILETIME matching qpc_base
 } logging_context;
 
 extern logging_context g_logctx;
@@ -19,6 +46,10 @@ extern logging_context g_logctx;
 bool                   init_logging(HMODULE hModule);
 void                   close_logging(void);
 void                   logf(const char *fmt, ...);
+void                   log_flush(void);
+bool                   log_push(uint8_t type, const void *data, uint32_t length);
+void                   log_set_sink(log_sink_fn sink);
 void                   log_winsock_error(const char *prefix, SOCKET s, int error);
+int                    luaopen_logging(lua_State *L);
 
 #endif // LOGGING_H
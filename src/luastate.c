@@ -0,0 +1,95 @@
+/*
+ * luastate.c: Ownership of the shared Lua state across threads.
+ *
+ * The console thread and the game's main thread (frame callbacks) both run
+ * Lua on the same state. Whoever executes Lua holds this lock; the main
+ * thread only ever try-acquires it so the game never waits on the console.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <windows.h>
+
+#include "luastate.h"
+
+static CRITICAL_SECTION     g_lock;
+static bool                 g_lockInitialized = false;
+static lua_State *volatile  g_L = NULL;
+static volatile DWORD       g_owner = 0; /* Thread holding the lock, 0 if free */
+static int                  g_depth = 0;
+
+void luastate_init(lua_State *L)
+{
+    if (!g_lockInitialized)
+    {
+        InitializeCriticalSection(&g_lock);
+        g_lockInitialized = true;
+    }
+    g_L = L;
+}
+
+// Detaches the state so no other thread picks it up; call before lua_close
+void luastate_shutdown(void)
+{
+    if (!g_lockInitialized)
+    {
+        return;
+    }
+
+    EnterCriticalSection(&g_lock);
+    g_L = NULL;
+    LeaveCriticalSection(&g_lock);
+}
+
+// Blocks until the state is free. The lock is recursive, so Lua code that
+// re-enters native code which acquires it again on the same thread is fine.
+lua_State *luastate_acquire(void)
+{
+    EnterCriticalSection(&g_lock);
+    if (g_depth++ == 0)
+    {
+        g_owner = GetCurrentThreadId();
+    }
+    return g_L;
+}
+
+// Returns NULL (without holding the lock) if another thread is running Lua
+lua_State *luastate_try_acquire(void)
+{
+    if (!g_lockInitialized || !g_L)
+    {
+        return NULL;
+    }
+
+    if (!TryEnterCriticalSection(&g_lock))
+    {
+        return NULL;
+    }
+
+    if (!g_L)
+    {
+        LeaveCriticalSection(&g_lock);
+        return NULL;
+    }
+    if (g_depth++ == 0)
+    {
+        g_owner = GetCurrentThreadId();
+    }
+    return g_L;
+}
+
+void luastate_release(void)
+{
+    if (--g_depth == 0)
+    {
+        g_owner = 0;
+    }
+    LeaveCriticalSection(&g_lock);
+}
+
+// True if this thread already holds the state. Native code reached from
+// Lua (an FFI call into a hooked function, say) must not run Lua again.
+bool luastate_held(void)
+{
+    return g_owner == GetCurrentThreadId();
+}
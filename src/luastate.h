@@ -0,0 +1,16 @@
+#ifndef LUASTATE_H
+#define LUASTATE_H
+
+#include <stdbool.h>
+#include <windows.h>
+
+#include "lua.h"
+
+void       luastate_init(lua_State *L);
+void       luastate_shutdown(void);
+lua_State *luastate_acquire(void);
+lua_State *luastate_try_acquire(void);
+void       luastate_release(void);
+bool       luastate_held(void);
+
+#endif // LUASTATE_H
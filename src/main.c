@@ -11,9 +11,12 @@
  * - System diagnostic functions
  * - Memory read/write operations
  * - Persistent function save/load
+ * - Batched main-thread call dispatcher
+ * - Buffered console output drained by a background thread
  * - Clean DLL unloading without affecting main game
  */
 
+#define WIN32_LEAN_AND_MEAN
 #include "lauxlib.h"
 #include "lua.h"
 #include "lualib.h"
@@ -23,14 +26,46 @@
 #include <string.h>
 #include <windows.h>
 
+#include "chunk.h"
+#include "dispatch.h"
+#include "frame.h"
+#include "frametime.h"
+#include "ghidra.h"
+#include "history.h"
+#include "hook.h"
+#include "latency.h"
+#include "logging.h"
+#include "luastate.h"
+#include "memview.h"
+#include "output.h"
+#include "pool.h"
+#include "profiler.h"
+#include "regfile.h"
+#include "regions.h"
+#include "remote.h"
+#include "ringlog.h"
+#include "scan.h"
+#include "sched.h"
+#include "sigcache.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "trace.h"
+#include "walker.h"
+#include "watch.h"
+#include "workers.h"
+
 //============================================================================
 // CONFIGURATION AND CONSTANTS
 //============================================================================
 
-#define CONSOLE_BUFFER_SIZE 4096
+#define CONSOLE_BUFFER_SIZE 4096             /* Initial input line buffer */
+#define CONSOLE_MAX_INPUT (16 * 1024 * 1024) /* Longest single input line */
+#define CONSOLE_CANCEL_CHUNK "."             /* Discards a multi-line chunk */
 #define CONSOLE_TITLE "Europa 1400 - Lua Console v1.0"
 #define INIT_SCRIPT_PATH "lua/init.lua"
-#define MAX_COMMAND_HISTORY 100
+#define SIGCACHE_PATH "lua/sigcache.txt"
+#define HISTORY_PATH "lua/history.log"
+#define HISTORY_SHOW_DEFAULT 50
 
 // Console colors for better visibility
 #define COLOR_ERROR FOREGROUND_RED | FOREGROUND_INTENSITY
@@ -46,31 +81,38 @@
 // Module handle for self-unloading
 static HMODULE g_hModule = NULL;
 
+// Game main thread (the thread that loaded the ASI), target of the dispatcher
+static DWORD g_mainThreadId = 0;
+
 // Console state
 static HANDLE g_hConsole = NULL;
 static WORD   g_originalConsoleAttributes = 0;
 
-// Command history
-static char g_commandHistory[MAX_COMMAND_HISTORY][CONSOLE_BUFFER_SIZE];
-static int  g_historyCount = 0;
-static int  g_historyIndex = 0;
+// Input reader: lines are read on their own thread so background jobs keep
+// running while the prompt waits
+static char  *g_inputLine = NULL;
+static size_t g_inputCapacity = 0;
+static BOOL   g_inputEof = FALSE;
+static BOOL   g_inputTooLong = FALSE;
+static HANDLE g_inputReady = NULL;    // A line (or end of input) is available
+static HANDLE g_inputConsumed = NULL; // The line was processed, read the next
+static HANDLE g_inputQuit = NULL;
+static HANDLE g_inputThread = NULL;
+
+// Startup timing, as performance counter ticks from DLL attach
+static LARGE_INTEGER g_attachTime = {0};
+static struct
+{
+    double console_ms; /* Console window and streams */
+    double runtime_ms; /* Lua state and native modules */
+    double init_ms;    /* init.lua */
+    double total_ms;   /* Attach to ready prompt */
+} g_startup = {0};
 
 //============================================================================
 // UTILITY FUNCTIONS
 //============================================================================
 
-/**
- * Set console text color for better visual feedback
- * @param color Color attribute (use COLOR_* constants)
- */
-static void SetConsoleColor(WORD color)
-{
-    if (g_hConsole)
-    {
-        SetConsoleTextAttribute(g_hConsole, color);
-    }
-}
-
 /**
  * Reset console color to original
  */
@@ -84,55 +126,16 @@ static void ResetConsoleColor(void)
 
 /**
  * Print colored message to console
+ * The color travels with the text through the output buffer
  * @param color Color to use
  * @param format Printf-style format string
  */
 static void PrintColored(WORD color, const char *format, ...)
 {
-    SetConsoleColor(color);
-
     va_list args;
     va_start(args, format);
-    vprintf(format, args);
+    output_vcolored(color, format, args);
     va_end(args);
-
-    ResetConsoleColor();
-}
-
-/**
- * Add command to history buffer
- * @param command Command to add
- */
-static void AddToHistory(const char *command)
-{
-    if (strlen(command) == 0)
-        return;
-
-    // Avoid duplicate consecutive commands
-    if (g_historyCount > 0 && strcmp(g_commandHistory[g_historyCount - 1], command) == 0)
-    {
-        return;
-    }
-
-    // Add to history
-    if (g_historyCount < MAX_COMMAND_HISTORY)
-    {
-        strncpy(g_commandHistory[g_historyCount], command, CONSOLE_BUFFER_SIZE - 1);
-        g_commandHistory[g_historyCount][CONSOLE_BUFFER_SIZE - 1] = '\0';
-        g_historyCount++;
-    }
-    else
-    {
-        // Shift history buffer
-        for (int i = 0; i < MAX_COMMAND_HISTORY - 1; i++)
-        {
-            strcpy(g_commandHistory[i], g_commandHistory[i + 1]);
-        }
-        strncpy(g_commandHistory[MAX_COMMAND_HISTORY - 1], command, CONSOLE_BUFFER_SIZE - 1);
-        g_commandHistory[MAX_COMMAND_HISTORY - 1][CONSOLE_BUFFER_SIZE - 1] = '\0';
-    }
-
-    g_historyIndex = g_historyCount;
 }
 
 /**
@@ -242,6 +245,81 @@ static void TrimString(char *str)
     }
 }
 
+/**
+ * List history entries, oldest first
+ * @param prefix NULL for the most recent entries, otherwise only entries
+ *               starting with it
+ */
+static void ShowHistory(const char *prefix)
+{
+    uint32_t first = history_first();
+    uint32_t end = first + history_count();
+
+    if (!prefix)
+    {
+        PrintColored(COLOR_INFO, "Command History:\n");
+        uint32_t start = end - first > HISTORY_SHOW_DEFAULT ? end - HISTORY_SHOW_DEFAULT : first;
+        for (uint32_t number = start; number < end; number++)
+        {
+            output_printf("%4u: %s\n", number, history_get(number));
+        }
+        return;
+    }
+
+    // Newest matches are found first; print them in order
+    uint32_t matches[HISTORY_SHOW_DEFAULT];
+    uint32_t count = 0;
+    for (uint32_t number = history_find(prefix, 0); number && count < HISTORY_SHOW_DEFAULT;
+         number = history_find(prefix, number))
+    {
+        matches[count++] = number;
+    }
+
+    PrintColored(COLOR_INFO, "History matching \"%s\":\n", prefix);
+    while (count-- > 0)
+    {
+        output_printf("%4u: %s\n", matches[count], history_get(matches[count]));
+    }
+}
+
+/**
+ * Expand a history reference: !! is the last command, !<n> entry n and
+ * !<prefix> the newest command starting with prefix
+ * @param command Command starting with '!'
+ * @return Newly allocated command, or NULL if nothing matched
+ */
+static char *ExpandHistory(const char *command)
+{
+    const char *reference = command + 1;
+    uint32_t    number;
+
+    if (strcmp(reference, "!") == 0)
+    {
+        number = history_find("", 0);
+    }
+    else if (reference[0] >= '0' && reference[0] <= '9' && strspn(reference, "0123456789") == strlen(reference))
+    {
+        number = (uint32_t)strtoul(reference, NULL, 10);
+    }
+    else
+    {
+        number = history_find(reference, 0);
+    }
+
+    const char *text = number ? history_get(number) : NULL;
+    if (!text)
+    {
+        return NULL;
+    }
+
+    char *expanded = malloc(strlen(text) + 1);
+    if (expanded)
+    {
+        strcpy(expanded, text);
+    }
+    return expanded;
+}
+
 /**
  * Check if command is a built-in console command
  * @param command Command to check
@@ -251,16 +329,34 @@ static BOOL HandleBuiltinCommand(const char *command)
 {
     if (strcmp(command, "cls") == 0 || strcmp(command, "clear") == 0)
     {
+        output_flush();
         system("cls");
         return TRUE;
     }
 
-    if (strcmp(command, "history") == 0)
+    if (strcmp(command, "history") == 0 || strncmp(command, "history ", 8) == 0)
     {
-        PrintColored(COLOR_INFO, "Command History:\n");
-        for (int i = 0; i < g_historyCount; i++)
+        ShowHistory(command[7] ? command + 8 : NULL);
+        return TRUE;
+    }
+
+    if (strcmp(command, "jobs") == 0)
+    {
+        PrintColored(COLOR_INFO, "Jobs:\n");
+        sched_print_jobs();
+        return TRUE;
+    }
+
+    if (strncmp(command, "kill ", 5) == 0)
+    {
+        int id = atoi(command + 5);
+        if (sched_kill(id))
+        {
+            PrintColored(COLOR_SUCCESS, "Job %d killed\n", id);
+        }
+        else
         {
-            printf("%3d: %s\n", i + 1, g_commandHistory[i]);
+            PrintColored(COLOR_ERROR, "No job with id %d\n", id);
         }
         return TRUE;
     }
@@ -274,6 +370,100 @@ static BOOL HandleBuiltinCommand(const char *command)
     return FALSE;
 }
 
+/**
+ * Runs a freshly loaded chunk as a job; frame callbacks wait while it
+ * executes. Chunks that sleep or await continue in the background.
+ * Called with the state held.
+ * @param L Lua state, with the chunk or load error on top
+ * @param status Result of loading it
+ * @param label Job label
+ */
+static void RunLoadedChunk(lua_State *L, int status, const char *label)
+{
+    output_command_begin();
+    if (status == 0)
+    {
+        int job = sched_spawn(L, label);
+        if (job > 0)
+        {
+            PrintColored(COLOR_INFO, "[job %d] running in background (jobs, kill %d)\n", job, job);
+        }
+        status = job < 0;
+    }
+    if (status != 0)
+    {
+        const char *error = lua_tostring(L, -1);
+        PrintColored(COLOR_ERROR, "Lua error: %s\n", error ? error : "(unknown error)");
+        lua_pop(L, 1);
+    }
+    output_command_end();
+}
+
+/**
+ * Compiles and runs the pending chunk unless it needs more lines
+ * @param L Lua state
+ */
+static void RunPendingChunk(lua_State *L)
+{
+    if (chunk_open())
+    {
+        return;
+    }
+
+    luastate_acquire();
+    int status = chunk_load(L);
+    if (chunk_incomplete(L, status))
+    {
+        lua_pop(L, 1);
+        luastate_release();
+        return;
+    }
+
+    // History keeps the whole chunk when it fits
+    size_t length = chunk_length();
+    if (length < HISTORY_MAX_ENTRY)
+    {
+        char text[HISTORY_MAX_ENTRY];
+        chunk_copy(text, sizeof(text));
+        history_add(text);
+    }
+
+    char label[CHUNK_NAME_SIZE];
+    snprintf(label, sizeof(label), "%s", chunk_name());
+    chunk_reset();
+    RunLoadedChunk(L, status, label);
+    luastate_release();
+}
+
+/**
+ * Adds a line to the pending chunk, or discards the chunk on a lone "."
+ * @param L Lua state
+ * @param line Input line as read
+ */
+static void ContinueChunk(lua_State *L, const char *line)
+{
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+    {
+        length--;
+    }
+
+    if (length == sizeof(CONSOLE_CANCEL_CHUNK) - 1 && memcmp(line, CONSOLE_CANCEL_CHUNK, length) == 0)
+    {
+        PrintColored(COLOR_WARNING, "Chunk discarded\n");
+        chunk_reset();
+        return;
+    }
+
+    if (!chunk_append(line, length))
+    {
+        PrintColored(COLOR_ERROR, "Memory allocation failed\n");
+        chunk_reset();
+        return;
+    }
+    RunPendingChunk(L);
+}
+
 /**
  * Processes a single line of user input with enhanced features
  * @param L Lua state
@@ -282,6 +472,13 @@ static BOOL HandleBuiltinCommand(const char *command)
  */
 static int ProcessCommand(lua_State *L, const char *line)
 {
+    // Lines after the first of a chunk are Lua, kept as typed
+    if (chunk_pending())
+    {
+        ContinueChunk(L, line);
+        return 0;
+    }
+
     // Create a working copy and trim whitespace
     char *command = malloc(strlen(line) + 1);
     if (!command)
@@ -307,29 +504,81 @@ static int ProcessCommand(lua_State *L, const char *line)
         return 1;
     }
 
-    // Add to command history
-    AddToHistory(command);
+    // History references run the command they name
+    if (command[0] == '!' && command[1])
+    {
+        char *expanded = ExpandHistory(command);
+        if (!expanded)
+        {
+            PrintColored(COLOR_ERROR, "%s: event not found\n", command);
+            free(command);
+            return 0;
+        }
+        free(command);
+        command = expanded;
+        PrintColored(COLOR_INFO, "%s\n", command);
+    }
 
     // Handle built-in commands
     if (HandleBuiltinCommand(command))
     {
+        history_add(command);
         free(command);
         return 0;
     }
 
-    // Execute Lua command with error handling
-    int result = luaL_dostring(L, command);
-    if (result != 0)
+    // Scripts run as jobs, streamed from the file
+    if (strncmp(command, "run ", 4) == 0)
     {
-        const char *error = lua_tostring(L, -1);
-        PrintColored(COLOR_ERROR, "Lua error: %s\n", error ? error : "(unknown error)");
-        lua_pop(L, 1);
+        history_add(command);
+        luastate_acquire();
+        RunLoadedChunk(L, luaL_loadfile(L, command + 4), command);
+        luastate_release();
+        free(command);
+        return 0;
     }
 
+    // Lua input; runs once the chunk it starts is complete
+    if (!chunk_append(command, strlen(command)))
+    {
+        PrintColored(COLOR_ERROR, "Memory allocation failed\n");
+        chunk_reset();
+    }
     free(command);
+    RunPendingChunk(L);
     return 0;
 }
 
+/**
+ * Milliseconds since DLL_PROCESS_ATTACH
+ * @return Elapsed time in ms
+ */
+static double MsSinceAttach(void)
+{
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (double)(now.QuadPart - g_attachTime.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+}
+
+/**
+ * Publish startup phase timings to Lua as the startup_times table
+ * @param L Lua state
+ */
+static void PublishStartupTimes(lua_State *L)
+{
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, g_startup.console_ms);
+    lua_setfield(L, -2, "console_ms");
+    lua_pushnumber(L, g_startup.runtime_ms);
+    lua_setfield(L, -2, "runtime_ms");
+    lua_pushnumber(L, g_startup.init_ms);
+    lua_setfield(L, -2, "init_ms");
+    lua_pushnumber(L, g_startup.total_ms);
+    lua_setfield(L, -2, "total_ms");
+    lua_setglobal(L, "startup_times");
+}
+
 /**
  * Display minimal console status after initialization
  */
@@ -337,61 +586,166 @@ static void ShowConsoleReady(void)
 {
     // Just show that the console is ready - let Lua handle the welcome
     PrintColored(COLOR_SUCCESS, "Console ready. ");
-    printf("Type ");
+    output_printf("Type ");
     PrintColored(COLOR_INFO, "help()");
-    printf(" for commands, ");
+    output_printf(" for commands, ");
     PrintColored(COLOR_INFO, "cls");
-    printf(" to clear, ");
+    output_printf(" to clear, ");
     PrintColored(COLOR_INFO, "exit");
-    printf(" to quit.\n\n");
+    output_printf(" to quit.\n\n");
+}
+
+/**
+ * Reads one line of any length up to CONSOLE_MAX_INPUT into g_inputLine
+ * Longer lines are dropped and flagged in g_inputTooLong
+ * @return FALSE at end of input
+ */
+static BOOL ReadInputLine(void)
+{
+    size_t length = 0;
+    g_inputTooLong = FALSE;
+
+    while (1)
+    {
+        if (g_inputCapacity - length < 2)
+        {
+            size_t capacity = g_inputCapacity ? g_inputCapacity * 2 : CONSOLE_BUFFER_SIZE;
+            char  *grown = capacity <= CONSOLE_MAX_INPUT ? realloc(g_inputLine, capacity) : NULL;
+            if (!grown)
+            {
+                // Drop the rest of the line
+                int c;
+                while ((c = getchar()) != '\n' && c != EOF)
+                    ;
+                g_inputTooLong = TRUE;
+                return TRUE;
+            }
+            g_inputLine = grown;
+            g_inputCapacity = capacity;
+        }
+
+        if (!fgets(g_inputLine + length, (int)(g_inputCapacity - length), stdin))
+        {
+            // A last line without a newline still counts
+            g_inputLine[length] = '\0';
+            return length > 0;
+        }
+        length += strlen(g_inputLine + length);
+        if (length > 0 && g_inputLine[length - 1] == '\n')
+        {
+            return TRUE;
+        }
+    }
+}
+
+/**
+ * Input thread - reads one line at a time and hands it to the console loop
+ * @param param Unused
+ */
+static DWORD WINAPI InputThread(LPVOID param)
+{
+    HANDLE handles[2] = {g_inputConsumed, g_inputQuit};
+
+    while (1)
+    {
+        if (!ReadInputLine())
+        {
+            g_inputEof = TRUE;
+            SetEvent(g_inputReady);
+            return 0;
+        }
+
+        SetEvent(g_inputReady);
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+        {
+            return 0;
+        }
+    }
+}
+
+/**
+ * Show the input prompt
+ */
+static void ShowPrompt(void)
+{
+    PrintColored(COLOR_SUCCESS, chunk_pending() ? "  >> " : "lua> ");
+    output_flush();
 }
 
 /**
  * Main console loop - handles user input and command execution with enhanced features
+ * Background jobs are resumed whenever they are due while waiting for input
  * @param L Lua state
  */
 static void RunConsoleLoop(lua_State *L)
 {
-    char inputBuffer[CONSOLE_BUFFER_SIZE];
+    g_inputReady = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_inputConsumed = CreateEvent(NULL, FALSE, FALSE, NULL);
+    g_inputQuit = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (g_inputReady && g_inputConsumed && g_inputQuit)
+    {
+        g_inputThread = CreateThread(NULL, 0, InputThread, NULL, 0, NULL);
+    }
+    if (!g_inputThread)
+    {
+        PrintColored(COLOR_ERROR, "Failed to start console input thread\n");
+        return;
+    }
 
     // Show minimal ready message (Lua init.lua handles the main welcome)
+    g_startup.total_ms = MsSinceAttach();
+    luastate_acquire();
+    PublishStartupTimes(L);
+    luastate_release();
+    PrintColored(COLOR_INFO, "Ready %.0f ms after attach (console %.0f, runtime %.0f, init.lua %.0f)\n",
+                 g_startup.total_ms, g_startup.console_ms, g_startup.runtime_ms, g_startup.init_ms);
     ShowConsoleReady();
+    ShowPrompt();
 
     // Main input loop
     while (1)
     {
-        // Show prompt with color
-        SetConsoleColor(COLOR_SUCCESS);
-        printf("lua> ");
-        ResetConsoleColor();
-        fflush(stdout);
+        DWORD  timeout = sched_run();
+        HANDLE handles[2] = {g_inputReady, sched_wake_event()};
+        DWORD  count = handles[1] ? 2 : 1;
 
-        // Read user input with buffer overflow protection
-        if (!fgets(inputBuffer, sizeof(inputBuffer), stdin))
+        if (WaitForMultipleObjects(count, handles, FALSE, timeout) != WAIT_OBJECT_0)
+        {
+            continue;
+        }
+
+        if (g_inputEof)
         {
             PrintColored(COLOR_WARNING, "\nEnd of input reached. Exiting...\n");
             break;
         }
 
-        // Check for buffer overflow
-        if (strlen(inputBuffer) == sizeof(inputBuffer) - 1 && inputBuffer[sizeof(inputBuffer) - 2] != '\n')
+        if (g_inputTooLong)
         {
-            PrintColored(COLOR_ERROR, "Input too long! Maximum %d characters.\n", CONSOLE_BUFFER_SIZE - 1);
-
-            // Clear remaining input from buffer
-            int c;
-            while ((c = getchar()) != '\n' && c != EOF)
-                ;
-            continue;
+            PrintColored(COLOR_ERROR, "Input too long! Maximum %d characters.\n", CONSOLE_MAX_INPUT - 1);
         }
-
-        // Process the command
-        if (ProcessCommand(L, inputBuffer) == 1)
+        else if (ProcessCommand(L, g_inputLine) == 1)
         {
             PrintColored(COLOR_SUCCESS, "Goodbye!\n");
             break;
         }
+
+        SetEvent(g_inputConsumed);
+        ShowPrompt();
     }
+
+    // The reader is parked between lines (or already gone at end of input)
+    SetEvent(g_inputQuit);
+    WaitForSingleObject(g_inputThread, 1000);
+    CloseHandle(g_inputThread);
+    g_inputThread = NULL;
+
+    CloseHandle(g_inputReady);
+    CloseHandle(g_inputConsumed);
+    CloseHandle(g_inputQuit);
+    free(g_inputLine);
+    g_inputLine = NULL;
+    g_inputCapacity = 0;
 }
 
 /**
@@ -426,6 +780,27 @@ static DWORD WINAPI ConsoleThread(LPVOID param)
         printf("Warning: Could not setup console window properties\n");
     }
 
+    // Console text goes through a buffer drained by a background thread
+    if (!output_init(g_hConsole, g_originalConsoleAttributes))
+    {
+        PrintColored(COLOR_WARNING, "Warning: Output buffer unavailable, console writes are synchronous\n");
+    }
+
+    g_startup.console_ms = MsSinceAttach();
+    init_logging(g_hModule);
+
+    // Hook the game's message pump so queued calls run on its main thread
+    if (!dispatch_init(g_mainThreadId))
+    {
+        PrintColored(COLOR_WARNING, "Warning: Main thread dispatcher unavailable, game.call_main() disabled\n");
+    }
+
+    // Worker threads for native scans, sized to leave a core for the game
+    if (!pool_init(0))
+    {
+        PrintColored(COLOR_WARNING, "Warning: Worker pool unavailable, scans run single-threaded\n");
+    }
+
     // Initialize Lua state with error checking
     L = luaL_newstate();
     if (!L)
@@ -434,16 +809,90 @@ static DWORD WINAPI ConsoleThread(LPVOID param)
         goto cleanup;
     }
 
-    // Load standard Lua libraries
+    // Load standard Lua libraries and native modules
     luaL_openlibs(L);
+    luaopen_dispatch(L);
+    lua_pop(L, 1);
+    luaopen_frame(L);
+    lua_pop(L, 1);
+    luaopen_sched(L);
+    lua_pop(L, 1);
+    luaopen_scan(L);
+    lua_pop(L, 1);
+    luaopen_sigcache(L);
+    lua_pop(L, 1);
+    luaopen_snapshot(L);
+    lua_pop(L, 1);
+    luaopen_memview(L);
+    lua_pop(L, 1);
+    luaopen_regions(L);
+    lua_pop(L, 1);
+    luaopen_ringlog(L);
+    lua_pop(L, 1);
+    luaopen_latency(L);
+    lua_pop(L, 1);
+    luaopen_frametime(L);
+    lua_pop(L, 1);
+    luaopen_logging(L);
+    lua_pop(L, 1);
+    luaopen_trace(L);
+    lua_pop(L, 1);
+    luaopen_hook(L);
+    lua_pop(L, 1);
+    luaopen_profiler(L);
+    lua_pop(L, 1);
+    luaopen_output(L);
+    lua_pop(L, 1);
+    luaopen_chunk(L);
+    lua_pop(L, 1);
+    luaopen_regfile(L);
+    lua_pop(L, 1);
+    luaopen_ghidra(L);
+    lua_pop(L, 1);
+    luaopen_symbols(L);
+    lua_pop(L, 1);
+    luaopen_walker(L);
+    lua_pop(L, 1);
+    luaopen_watch(L);
+    lua_pop(L, 1);
+    luaopen_workers(L);
+    lua_pop(L, 1);
+    luaopen_remote(L);
+    lua_pop(L, 1);
+    luastate_init(L);
+    frame_init();
+    if (!sched_init())
+    {
+        PrintColored(COLOR_WARNING, "Warning: Job scheduler could not create its wake event\n");
+    }
     PrintColored(COLOR_INFO, "%s initialized\n", LUA_VERSION);
 
+    // Address space map and fault guard for direct memory access
+    regions_init();
+    if (!memview_init())
+    {
+        PrintColored(COLOR_WARNING, "Warning: Memory fault guard unavailable, bad reads will crash\n");
+    }
+
+    // Signatures resolved by earlier sessions of this game build
+    sigcache_load(SIGCACHE_PATH);
+
+    // Command history log; read on first use, not here
+    history_init(HISTORY_PATH);
+
     // Load initialization script
-    if (!LoadInitScript(L))
+    double script_start = MsSinceAttach();
+    g_startup.runtime_ms = script_start - g_startup.console_ms;
+    luastate_acquire();
+    BOOL loaded = LoadInitScript(L);
+    luastate_release();
+    g_startup.init_ms = MsSinceAttach() - script_start;
+    sigcache_save();
+    if (!loaded)
     {
         PrintColored(COLOR_ERROR, "Failed to load initialization script\n");
         PrintColored(COLOR_WARNING, "Console will start with limited functionality\n");
-        printf("You can still execute Lua commands manually.\n\n");
+        output_printf("You can still execute Lua commands manually.\n\n");
     }
     else
     {
@@ -456,16 +905,49 @@ static DWORD WINAPI ConsoleThread(LPVOID param)
 cleanup:
     PrintColored(COLOR_INFO, "Shutting down console...\n");
 
-    // Clean up Lua resources
+    // Detach from the game loop and message pump before the module can go away.
+    // A thread that outlives its stop timeout may still be running our code,
+    // so whatever it can reach stays up and the module stays loaded.
+    BOOL stopped = remote_shutdown();
+    profiler_shutdown();
+    frametime_shutdown();
+    frame_shutdown();
+    hook_shutdown();
+    watch_shutdown();
+    stopped = workers_shutdown() && stopped;
+    dispatch_shutdown();
+    sched_shutdown();
+    sigcache_shutdown();
+    if (stopped)
+    {
+        pool_shutdown();
+    }
+
+    // Clean up Lua resources once the main thread can no longer reach them
     if (L)
     {
+        luastate_shutdown();
         lua_close(L);
         L = NULL;
     }
+    if (stopped)
+    {
+        chunk_shutdown();
+        memview_shutdown();
+        regions_shutdown();
+    }
 
-    // Reset console colors
+    // Drain pending output, then reset console colors
+    output_shutdown();
     ResetConsoleColor();
 
+    history_shutdown();
+    if (stopped)
+    {
+        trace_stop();
+        close_logging();
+    }
+
     // Give user a moment to see shutdown message
     Sleep(1000);
 
@@ -481,7 +963,13 @@ cleanup:
     FreeConsole();
 
     // Self-unload DLL without affecting main game process
-    if (g_hModule)
+    if (g_hModule && !stopped)
+    {
+        HMODULE pinned;
+        GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN, (LPCSTR)g_hModule,
+                           &pinned);
+    }
+    else if (g_hModule)
     {
         HANDLE hUnloadThread = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)FreeLibrary, g_hModule, 0, NULL);
         if (hUnloadThread)
@@ -508,6 +996,10 @@ BOOL APIENTRY DllMain(HINSTANCE hInstance, DWORD dwReason, LPVOID lpReserved)
     case DLL_PROCESS_ATTACH: {
         // Store module handle for self-unloading capability
         g_hModule = (HMODULE)hInstance;
+        QueryPerformanceCounter(&g_attachTime);
+
+        // ASI loaders attach us from the game's main thread
+        g_mainThreadId = GetCurrentThreadId();
 
         // Optimize performance by disabling thread attach/detach notifications
         DisableThreadLibraryCalls(g_hModule);
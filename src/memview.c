@@ -0,0 +1,175 @@
+/*
+ * memview.c: Direct, fault-guarded access to game memory.
+ *
+ * The DLL shares the game's address space, so reads and writes are plain
+ * loads and stores once the target range is known to be mapped. Ranges
+ * are checked against the cached region map; a vectored exception
+ * handler catches the rare access violation when memory was freed after
+ * the check and turns it into an error return instead of a crash.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "logging.h"
+#include "memview.h"
+#include "regions.h"
+
+typedef struct
+{
+    jmp_buf           jump;
+    volatile uint32_t fault;
+} guard_frame;
+
+static DWORD g_guardSlot = TLS_OUT_OF_INDEXES;
+static void *g_guardHandler = NULL;
+
+// Entered in place of the faulting instruction; unwinds to memview_copy
+__attribute__((noinline, noreturn)) static void guard_landing(void)
+{
+    guard_frame *frame = (guard_frame *)TlsGetValue(g_guardSlot);
+    longjmp(frame->jump, 1);
+}
+
+static LONG CALLBACK guard_handler(EXCEPTION_POINTERS *info)
+{
+    if (info->ExceptionRecord->ExceptionCode != EXCEPTION_ACCESS_VIOLATION)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    // Faults in the game's own code must look untouched, last error included
+    DWORD        error = GetLastError();
+    guard_frame *frame = (guard_frame *)TlsGetValue(g_guardSlot);
+    SetLastError(error);
+    if (!frame)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    frame->fault = (uint32_t)info->ExceptionRecord->ExceptionInformation[1];
+    info->ContextRecord->Eip = (DWORD)(uintptr_t)guard_landing;
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+bool memview_init(void)
+{
+    g_guardSlot = TlsAlloc();
+    if (g_guardSlot == TLS_OUT_OF_INDEXES)
+    {
+        return false;
+    }
+
+    g_guardHandler = AddVectoredExceptionHandler(1, guard_handler);
+    if (!g_guardHandler)
+    {
+        TlsFree(g_guardSlot);
+        g_guardSlot = TLS_OUT_OF_INDEXES;
+        return false;
+    }
+    return true;
+}
+
+void memview_shutdown(void)
+{
+    if (g_guardHandler)
+    {
+        RemoveVectoredExceptionHandler(g_guardHandler);
+        g_guardHandler = NULL;
+    }
+    if (g_guardSlot != TLS_OUT_OF_INDEXES)
+    {
+        TlsFree(g_guardSlot);
+        g_guardSlot = TLS_OUT_OF_INDEXES;
+    }
+}
+
+// Copies length bytes; on an access violation stores the faulting address
+// in *fault (if given) and returns false
+bool memview_copy(void *dst, const void *src, size_t length, uint32_t *fault)
+{
+    guard_frame frame;
+
+    if (!g_guardHandler)
+    {
+        memcpy(dst, src, length);
+        return true;
+    }
+
+    frame.fault = 0;
+    if (setjmp(frame.jump))
+    {
+        TlsSetValue(g_guardSlot, NULL);
+        if (fault)
+        {
+            *fault = frame.fault;
+        }
+        return false;
+    }
+
+    TlsSetValue(g_guardSlot, &frame);
+    memcpy(dst, src, length);
+    TlsSetValue(g_guardSlot, NULL);
+    return true;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static uint32_t check_address(lua_State *L, int idx)
+{
+    return (uint32_t)(int64_t)luaL_checknumber(L, idx);
+}
+
+// mem.readable(addr [, size]) -> true if the whole range can be read
+static int l_mem_readable(lua_State *L)
+{
+    lua_pushboolean(L, regions_check(check_address(L, 1), (uint32_t)luaL_optnumber(L, 2, 1), false));
+    return 1;
+}
+
+// mem.writable(addr [, size]) -> true if the whole range can be written
+static int l_mem_writable(lua_State *L)
+{
+    lua_pushboolean(L, regions_check(check_address(L, 1), (uint32_t)luaL_optnumber(L, 2, 1), true));
+    return 1;
+}
+
+// mem.copy(dst, src, size) copies between addresses, raising on a fault
+static int l_mem_copy(lua_State *L)
+{
+    uint32_t dst = check_address(L, 1);
+    uint32_t src = check_address(L, 2);
+    uint32_t size = (uint32_t)luaL_checknumber(L, 3);
+    uint32_t fault = 0;
+
+    if (!memview_copy((void *)(uintptr_t)dst, (const void *)(uintptr_t)src, size, &fault))
+    {
+        // The region map still listed this memory; have it look again
+        regions_invalidate(fault, 1);
+
+        char message[96];
+        snprintf(message, sizeof(message), "access violation at 0x%08X copying %u bytes from 0x%08X to 0x%08X",
+                 fault, size, src, dst);
+        return luaL_error(L, "%s", message);
+    }
+
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static const luaL_Reg memview_funcs[] = {
+    {"readable", l_mem_readable}, {"writable", l_mem_writable}, {"copy", l_mem_copy}, {NULL, NULL}};
+
+int luaopen_memview(lua_State *L)
+{
+    luaL_register(L, "mem", memview_funcs);
+    return 1;
+}
@@ -0,0 +1,15 @@
+#ifndef MEMVIEW_H
+#define MEMVIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+bool memview_init(void);
+void memview_shutdown(void);
+bool memview_copy(void *dst, const void *src, size_t length, uint32_t *fault);
+int  luaopen_memview(lua_State *L);
+
+#endif // MEMVIEW_H
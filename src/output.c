@@ -0,0 +1,735 @@
+/*
+ * output.c: Buffered console output with a background flusher.
+ *
+ * Lua's print, PrintColored and the native modules' console messages all
+ * append to one ring buffer; a flusher thread drains it to the console in
+ * chunks of up to OUTPUT_CHUNK_SIZE, so a script printing thousands of
+ * lines only pays for a memcpy per line. Writers wait only when the ring
+ * is full. Colors travel in the text as ANSI SGR sequences: on consoles
+ * with virtual terminal processing they are written as-is, otherwise the
+ * flusher turns them into SetConsoleTextAttribute calls once per color
+ * change rather than once per message.
+ *
+ * Output can be diverted to a file instead (quiet mode), or only the part
+ * of one console command's output past a line limit (pager mode). Escape
+ * sequences are stripped from file output.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "output.h"
+
+#define OUTPUT_FORMAT_SIZE 1024 /* Formatted messages up to this size avoid malloc */
+#define OUTPUT_SGR_SIZE 8       /* "\x1b[97m" */
+#define OUTPUT_RESET "\x1b[0m"
+
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+
+typedef struct
+{
+    uint64_t written;     /* Bytes accepted from writers */
+    uint64_t flushed;     /* Bytes written to the console */
+    uint64_t chunks;      /* Console writes */
+    uint64_t stalls;      /* Writes that waited for space */
+    uint64_t max_pending;
+    uint64_t diverted;    /* Bytes written to a file instead */
+} output_stats;
+
+typedef enum
+{
+    PARSE_TEXT = 0,
+    PARSE_ESCAPE, /* Saw ESC */
+    PARSE_CSI     /* Saw ESC [, collecting parameters */
+} parse_state;
+
+static char              *g_buffer = NULL;
+static uint64_t           g_head = 0; /* Next byte to flush */
+static uint64_t           g_tail = 0; /* Next byte to write */
+static bool               g_inFlight = false;
+static SRWLOCK            g_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE g_space = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE g_drained = CONDITION_VARIABLE_INIT;
+static HANDLE             g_wake = NULL;
+static HANDLE             g_thread = NULL;
+static volatile bool      g_running = false;
+static output_stats       g_stats = {0};
+
+static HANDLE             g_console = NULL;
+static WORD               g_defaultAttributes = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+static bool               g_vt = false;
+
+// Attribute translation state, used only by whichever thread writes to
+// the console (the flusher, or the caller before it starts)
+static parse_state        g_parse = PARSE_TEXT;
+static int                g_sgrParam = 0;
+
+// Quiet mode: everything goes to a file
+static FILE              *g_quiet = NULL;
+static char               g_quietPath[MAX_PATH] = "";
+static uint64_t           g_quietLines = 0;
+
+// Pager mode: a command's output past g_pageLimit lines goes to a file
+static uint32_t           g_pageLimit = 0;
+static char               g_pagePath[MAX_PATH] = OUTPUT_DEFAULT_PAGE_FILE;
+static bool               g_inCommand = false;
+static uint32_t           g_commandLines = 0;
+static FILE              *g_spill = NULL;
+static uint32_t           g_spillLines = 0;
+
+//============================================================================
+// CONSOLE WRITES
+//============================================================================
+
+static void write_raw(const char *data, size_t length)
+{
+    if (!g_console || g_console == INVALID_HANDLE_VALUE)
+    {
+        fwrite(data, 1, length, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    DWORD written;
+    while (length > 0)
+    {
+        DWORD part = length > OUTPUT_CHUNK_SIZE ? OUTPUT_CHUNK_SIZE : (DWORD)length;
+        if (!WriteFile(g_console, data, part, &written, NULL) || written == 0)
+        {
+            return;
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+// Maps one SGR parameter onto console attributes, keeping the background
+static void apply_sgr(int code)
+{
+    WORD attributes = g_defaultAttributes;
+    if ((code >= 30 && code <= 37) || (code >= 90 && code <= 97))
+    {
+        int color = code >= 90 ? code - 90 : code - 30;
+        attributes = (WORD)((g_defaultAttributes & 0xF0) | ((color & 1) ? FOREGROUND_RED : 0) |
+                            ((color & 2) ? FOREGROUND_GREEN : 0) | ((color & 4) ? FOREGROUND_BLUE : 0) |
+                            (code >= 90 ? FOREGROUND_INTENSITY : 0));
+    }
+    else if (code != 0 && code != 39)
+    {
+        return;
+    }
+    SetConsoleTextAttribute(g_console, attributes);
+}
+
+// Writes text runs and applies the SGR sequences between them. Sequences
+// may be split across calls.
+static void write_translated(const char *data, size_t length)
+{
+    size_t run = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+        switch (g_parse)
+        {
+        case PARSE_TEXT:
+            if (c == '\x1b')
+            {
+                write_raw(data + run, i - run);
+                g_parse = PARSE_ESCAPE;
+            }
+            break;
+        case PARSE_ESCAPE:
+            g_parse = c == '[' ? PARSE_CSI : PARSE_TEXT;
+            g_sgrParam = 0;
+            run = i + 1;
+            break;
+        case PARSE_CSI:
+            if (c >= '0' && c <= '9')
+            {
+                g_sgrParam = g_sgrParam * 10 + (c - '0');
+            }
+            else if (c == ';' || c == 'm')
+            {
+                apply_sgr(g_sgrParam);
+                g_sgrParam = 0;
+                g_parse = c == 'm' ? PARSE_TEXT : PARSE_CSI;
+            }
+            else
+            {
+                g_parse = PARSE_TEXT; /* Not ours; drop it */
+            }
+            run = i + 1;
+            break;
+        }
+    }
+    if (g_parse == PARSE_TEXT)
+    {
+        write_raw(data + run, length - run);
+    }
+}
+
+static void console_write(const char *data, size_t length)
+{
+    if (g_vt)
+    {
+        write_raw(data, length);
+    }
+    else
+    {
+        write_translated(data, length);
+    }
+}
+
+//============================================================================
+// FILE OUTPUT
+//============================================================================
+
+static uint32_t count_lines(const char *data, size_t length)
+{
+    uint32_t    lines = 0;
+    const char *end = data + length;
+    while ((data = memchr(data, '\n', (size_t)(end - data))) != NULL)
+    {
+        lines++;
+        data++;
+    }
+    return lines;
+}
+
+// Writers emit each escape sequence within one write, so no state carries
+static void write_stripped(FILE *file, const char *data, size_t length)
+{
+    const char *end = data + length;
+    while (data < end)
+    {
+        const char *escape = memchr(data, '\x1b', (size_t)(end - data));
+        const char *stop = escape ? escape : end;
+        fwrite(data, 1, (size_t)(stop - data), file);
+        if (!escape)
+        {
+            break;
+        }
+
+        data = escape + 1;
+        if (data < end && *data == '[')
+        {
+            while (++data < end && ((*data >= '0' && *data <= '9') || *data == ';'))
+                ;
+            if (data < end)
+            {
+                data++;
+            }
+        }
+    }
+}
+
+// Takes the write if a file wants it. Called with the lock held.
+static bool divert(const char *data, size_t length)
+{
+    if (g_quiet)
+    {
+        write_stripped(g_quiet, data, length);
+        g_quietLines += count_lines(data, length);
+        g_stats.diverted += length;
+        return true;
+    }
+
+    if (!g_pageLimit || !g_inCommand)
+    {
+        return false;
+    }
+
+    uint32_t lines = count_lines(data, length);
+    if (!g_spill)
+    {
+        if (g_commandLines + lines <= g_pageLimit)
+        {
+            g_commandLines += lines;
+            return false;
+        }
+        g_spill = fopen(g_pagePath, "w");
+        if (!g_spill)
+        {
+            return false;
+        }
+    }
+
+    write_stripped(g_spill, data, length);
+    g_spillLines += lines;
+    g_stats.diverted += length;
+    return true;
+}
+
+//============================================================================
+// RING AND FLUSHER
+//============================================================================
+
+void output_write(const char *data, size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&g_lock);
+    g_stats.written += length;
+
+    if (divert(data, length))
+    {
+        ReleaseSRWLockExclusive(&g_lock);
+        return;
+    }
+
+    // Before the flusher starts (and after it stops) writes go straight out
+    if (!g_running)
+    {
+        console_write(data, length);
+        g_stats.flushed += length;
+        ReleaseSRWLockExclusive(&g_lock);
+        return;
+    }
+
+    while (length > 0)
+    {
+        uint64_t pending = g_tail - g_head;
+        if (pending == OUTPUT_BUFFER_SIZE)
+        {
+            g_stats.stalls++;
+            SetEvent(g_wake);
+            SleepConditionVariableSRW(&g_space, &g_lock, INFINITE, 0);
+            continue;
+        }
+
+        size_t   space = (size_t)(OUTPUT_BUFFER_SIZE - pending);
+        size_t   offset = (size_t)(g_tail % OUTPUT_BUFFER_SIZE);
+        size_t   part = length < space ? length : space;
+        size_t   first = part < OUTPUT_BUFFER_SIZE - offset ? part : OUTPUT_BUFFER_SIZE - offset;
+
+        memcpy(g_buffer + offset, data, first);
+        memcpy(g_buffer, data + first, part - first);
+        g_tail += part;
+        data += part;
+        length -= part;
+
+        if (g_tail - g_head > g_stats.max_pending)
+        {
+            g_stats.max_pending = g_tail - g_head;
+        }
+    }
+
+    ReleaseSRWLockExclusive(&g_lock);
+    SetEvent(g_wake);
+}
+
+static DWORD WINAPI flusher_thread(LPVOID param)
+{
+    (void)param;
+    char *chunk = malloc(OUTPUT_CHUNK_SIZE);
+    if (!chunk)
+    {
+        return 1;
+    }
+
+    while (1)
+    {
+        WaitForSingleObject(g_wake, INFINITE);
+
+        AcquireSRWLockExclusive(&g_lock);
+        while (g_tail != g_head)
+        {
+            // Copy out and free the space before the slow console write
+            uint64_t pending = g_tail - g_head;
+            size_t   part = pending < OUTPUT_CHUNK_SIZE ? (size_t)pending : OUTPUT_CHUNK_SIZE;
+            size_t   offset = (size_t)(g_head % OUTPUT_BUFFER_SIZE);
+            size_t   first = part < OUTPUT_BUFFER_SIZE - offset ? part : OUTPUT_BUFFER_SIZE - offset;
+
+            memcpy(chunk, g_buffer + offset, first);
+            memcpy(chunk + first, g_buffer, part - first);
+            g_head += part;
+            g_inFlight = true;
+            WakeAllConditionVariable(&g_space);
+            ReleaseSRWLockExclusive(&g_lock);
+
+            console_write(chunk, part);
+
+            AcquireSRWLockExclusive(&g_lock);
+            g_stats.flushed += part;
+            g_stats.chunks++;
+        }
+        g_inFlight = false;
+        WakeAllConditionVariable(&g_drained);
+        bool running = g_running;
+        ReleaseSRWLockExclusive(&g_lock);
+
+        if (!running)
+        {
+            break;
+        }
+    }
+
+    free(chunk);
+    return 0;
+}
+
+// Waits until everything written so far has reached the console
+void output_flush(void)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    while (g_thread && (g_tail != g_head || g_inFlight))
+    {
+        SetEvent(g_wake);
+        SleepConditionVariableSRW(&g_drained, &g_lock, 100, 0);
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+//============================================================================
+// FORMATTED OUTPUT
+//============================================================================
+
+static size_t sgr_for(WORD color, char *out)
+{
+    int index = ((color & FOREGROUND_RED) ? 1 : 0) | ((color & FOREGROUND_GREEN) ? 2 : 0) |
+                ((color & FOREGROUND_BLUE) ? 4 : 0);
+    int code = ((color & FOREGROUND_INTENSITY) ? 90 : 30) + index;
+    return (size_t)snprintf(out, OUTPUT_SGR_SIZE, "\x1b[%dm", code);
+}
+
+// Formats into one write so a message is never split by another thread's.
+// A color of 0 writes the text plain.
+static void write_formatted(WORD color, const char *format, va_list args)
+{
+    char   stack[OUTPUT_FORMAT_SIZE];
+    char  *text = stack;
+    size_t prefix = color ? sgr_for(color, stack) : 0;
+    size_t suffix = color ? sizeof(OUTPUT_RESET) - 1 : 0;
+
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(stack + prefix, sizeof(stack) - prefix, format, copy);
+    va_end(copy);
+    if (length < 0)
+    {
+        return;
+    }
+
+    if (prefix + (size_t)length + suffix >= sizeof(stack))
+    {
+        text = malloc(prefix + (size_t)length + suffix + 1);
+        if (!text)
+        {
+            return;
+        }
+        memcpy(text, stack, prefix);
+        vsnprintf(text + prefix, (size_t)length + 1, format, args);
+    }
+
+    memcpy(text + prefix + length, OUTPUT_RESET, suffix);
+    output_write(text, prefix + (size_t)length + suffix);
+
+    if (text != stack)
+    {
+        free(text);
+    }
+}
+
+void output_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    write_formatted(0, format, args);
+    va_end(args);
+}
+
+void output_vcolored(WORD color, const char *format, va_list args)
+{
+    write_formatted(color, format, args);
+}
+
+//============================================================================
+// COMMAND SCOPE
+//============================================================================
+
+// Console commands bracket their execution so pager mode can count lines
+void output_command_begin(void)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    g_inCommand = true;
+    g_commandLines = 0;
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+void output_command_end(void)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    g_inCommand = false;
+    uint32_t spilled = g_spill ? g_spillLines : 0;
+    if (g_spill)
+    {
+        fclose(g_spill);
+        g_spill = NULL;
+        g_spillLines = 0;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    if (spilled)
+    {
+        output_printf("[output] %u more lines written to %s\n", spilled, g_pagePath);
+    }
+}
+
+//============================================================================
+// LIFECYCLE
+//============================================================================
+
+bool output_init(HANDLE console, WORD default_attributes)
+{
+    g_console = console;
+    if (default_attributes)
+    {
+        g_defaultAttributes = default_attributes;
+    }
+
+    DWORD mode;
+    g_vt = GetConsoleMode(console, &mode) && SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+    g_buffer = malloc(OUTPUT_BUFFER_SIZE);
+    g_wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!g_buffer || !g_wake)
+    {
+        return false;
+    }
+
+    g_running = true;
+    g_thread = CreateThread(NULL, 0, flusher_thread, NULL, 0, NULL);
+    if (!g_thread)
+    {
+        g_running = false;
+        return false;
+    }
+    return true;
+}
+
+void output_shutdown(void)
+{
+    if (!g_thread)
+    {
+        return;
+    }
+
+    output_flush();
+
+    AcquireSRWLockExclusive(&g_lock);
+    g_running = false;
+    ReleaseSRWLockExclusive(&g_lock);
+    SetEvent(g_wake);
+    // No timeout: the flusher may sit in WriteConsole (a QuickEdit selection
+    // blocks it) and the module is unloaded once this returns; with
+    // g_running false it has nothing else to wait for
+    WaitForSingleObject(g_thread, INFINITE);
+    CloseHandle(g_thread);
+    g_thread = NULL;
+
+    if (g_quiet)
+    {
+        fclose(g_quiet);
+        g_quiet = NULL;
+    }
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+// print(...) with the same formatting as Lua's, as one buffered write
+static int l_print(lua_State *L)
+{
+    int n = lua_gettop(L);
+    lua_getglobal(L, "tostring");
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    for (int i = 1; i <= n; i++)
+    {
+        lua_pushvalue(L, n + 1);
+        lua_pushvalue(L, i);
+        lua_call(L, 1, 1);
+        if (!lua_isstring(L, -1))
+        {
+            return luaL_error(L, "'tostring' must return a string to 'print'");
+        }
+        if (i > 1)
+        {
+            luaL_addchar(&b, '\t');
+        }
+        luaL_addvalue(&b);
+    }
+    luaL_addchar(&b, '\n');
+    luaL_pushresult(&b);
+
+    size_t      length;
+    const char *text = lua_tolstring(L, -1, &length);
+    output_write(text, length);
+    return 0;
+}
+
+// Starts or stops quiet mode; returns the lines written when stopping
+static int set_quiet(lua_State *L, const char *path)
+{
+    output_flush();
+
+    AcquireSRWLockExclusive(&g_lock);
+    FILE    *previous = g_quiet;
+    uint64_t lines = g_quietLines;
+    g_quiet = NULL;
+    g_quietLines = 0;
+
+    FILE *file = NULL;
+    if (path)
+    {
+        file = fopen(path, "w");
+        if (file)
+        {
+            snprintf(g_quietPath, sizeof(g_quietPath), "%s", path);
+            g_quiet = file;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+
+    if (previous)
+    {
+        fclose(previous);
+    }
+    if (path && !file)
+    {
+        return luaL_error(L, "cannot open %s", path);
+    }
+    return (int)lines;
+}
+
+// output.quiet(path) sends all output to a file; output.quiet(false) ends
+// it and returns the number of lines written
+static int l_output_quiet(lua_State *L)
+{
+    if (lua_toboolean(L, 1))
+    {
+        set_quiet(L, luaL_checkstring(L, 1));
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    bool active = g_quiet != NULL;
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s", g_quietPath);
+    int lines = set_quiet(L, NULL);
+    if (active)
+    {
+        output_printf("[output] %d lines written to %s\n", lines, path);
+    }
+    lua_pushinteger(L, lines);
+    return 1;
+}
+
+// output.capture(path, fn, ...) -> fn's results, with its output in path
+static int l_output_capture(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    if (g_quiet)
+    {
+        return luaL_error(L, "output is already going to %s", g_quietPath);
+    }
+
+    set_quiet(L, path);
+    int status = lua_pcall(L, lua_gettop(L) - 2, LUA_MULTRET, 0);
+    int lines = set_quiet(L, NULL);
+    if (status != 0)
+    {
+        return lua_error(L);
+    }
+
+    output_printf("[output] %d lines written to %s\n", lines, path);
+    return lua_gettop(L) - 1; /* Everything above the path */
+}
+
+// output.pager(lines [, path]) diverts a command's output past `lines`
+// lines to a file; output.pager(false) turns it off
+static int l_output_pager(lua_State *L)
+{
+    if (!lua_isnone(L, 1))
+    {
+        uint32_t    limit = lua_toboolean(L, 1) ? (uint32_t)luaL_checkinteger(L, 1) : 0;
+        const char *path = luaL_optstring(L, 2, OUTPUT_DEFAULT_PAGE_FILE);
+
+        AcquireSRWLockExclusive(&g_lock);
+        g_pageLimit = limit;
+        snprintf(g_pagePath, sizeof(g_pagePath), "%s", path);
+        ReleaseSRWLockExclusive(&g_lock);
+    }
+
+    if (g_pageLimit)
+    {
+        lua_pushinteger(L, g_pageLimit);
+    }
+    else
+    {
+        lua_pushboolean(L, 0);
+    }
+    return 1;
+}
+
+static int l_output_flush(lua_State *L)
+{
+    (void)L;
+    output_flush();
+    return 0;
+}
+
+static int l_output_stats(lua_State *L)
+{
+    AcquireSRWLockShared(&g_lock);
+    output_stats stats = g_stats;
+    uint64_t     pending = g_tail - g_head;
+    ReleaseSRWLockShared(&g_lock);
+
+    lua_createtable(L, 0, 9);
+    lua_pushnumber(L, (lua_Number)stats.written);
+    lua_setfield(L, -2, "written");
+    lua_pushnumber(L, (lua_Number)stats.flushed);
+    lua_setfield(L, -2, "flushed");
+    lua_pushnumber(L, (lua_Number)stats.diverted);
+    lua_setfield(L, -2, "diverted");
+    lua_pushnumber(L, (lua_Number)stats.chunks);
+    lua_setfield(L, -2, "chunks");
+    lua_pushnumber(L, (lua_Number)stats.stalls);
+    lua_setfield(L, -2, "stalls");
+    lua_pushnumber(L, (lua_Number)pending);
+    lua_setfield(L, -2, "pending");
+    lua_pushnumber(L, (lua_Number)stats.max_pending);
+    lua_setfield(L, -2, "max_pending");
+    lua_pushboolean(L, g_vt);
+    lua_setfield(L, -2, "vt");
+    lua_pushstring(L, g_quiet ? "quiet" : (g_pageLimit ? "pager" : "console"));
+    lua_setfield(L, -2, "mode");
+    return 1;
+}
+
+static const luaL_Reg output_funcs[] = {{"quiet", l_output_quiet}, {"capture", l_output_capture},
+                                        {"pager", l_output_pager}, {"flush", l_output_flush},
+                                        {"stats", l_output_stats}, {NULL, NULL}};
+
+int luaopen_output(lua_State *L)
+{
+    lua_register(L, "print", l_print);
+    luaL_register(L, "output", output_funcs);
+    return 1;
+}
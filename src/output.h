@@ -0,0 +1,25 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <windows.h>
+
+#include "lua.h"
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024) /* Pending text before writers wait */
+#define OUTPUT_CHUNK_SIZE (64 * 1024)    /* Largest single console write */
+#define OUTPUT_DEFAULT_PAGE_FILE "lua/output.txt"
+
+bool output_init(HANDLE console, WORD default_attributes);
+void output_write(const char *data, size_t length);
+void output_printf(const char *format, ...);
+void output_vcolored(WORD color, const char *format, va_list args);
+void output_flush(void);
+void output_command_begin(void);
+void output_command_end(void);
+void output_shutdown(void);
+int  luaopen_output(lua_State *L);
+
+#endif // OUTPUT_H
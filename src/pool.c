@@ -0,0 +1,177 @@
+/*
+ * pool.c: Fixed worker pool for data-parallel native work.
+ *
+ * pool_for() hands out loop indices through a shared atomic counter, so
+ * uneven items (large and small memory regions) balance themselves. The
+ * calling thread takes part and gets its slot back once every index ran.
+ * Workers never touch Lua.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <windows.h>
+
+#include "logging.h"
+#include "pool.h"
+
+typedef struct
+{
+    pool_fn       fn;
+    void         *ctx;
+    LONG          count;
+    volatile LONG next;
+} pool_batch;
+
+typedef struct
+{
+    int index;
+} pool_worker;
+
+static HANDLE               g_threads[POOL_MAX_THREADS];
+static pool_worker          g_workers[POOL_MAX_THREADS];
+static int                  g_threadCount = 0;
+static HANDLE               g_startSemaphore = NULL;
+static HANDLE               g_doneEvent = NULL;
+static pool_batch *volatile g_batch = NULL;
+static volatile LONG        g_active = 0;
+static volatile LONG        g_busy = 0;
+static volatile LONG        g_quit = 0;
+
+static void drain(pool_batch *batch, int worker)
+{
+    LONG index;
+    while ((index = InterlockedIncrement(&batch->next) - 1) < batch->count)
+    {
+        batch->fn(batch->ctx, (int)index, worker);
+    }
+}
+
+static DWORD WINAPI worker_main(LPVOID param)
+{
+    pool_worker *self = (pool_worker *)param;
+
+    for (;;)
+    {
+        WaitForSingleObject(g_startSemaphore, INFINITE);
+        if (g_quit)
+        {
+            return 0;
+        }
+
+        drain(g_batch, self->index);
+        if (InterlockedDecrement(&g_active) == 0)
+        {
+            SetEvent(g_doneEvent);
+        }
+    }
+}
+
+// threads <= 0 sizes the pool to leave one core for the game
+bool pool_init(int threads)
+{
+    if (g_threadCount > 0)
+    {
+        return true;
+    }
+
+    if (threads <= 0)
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = (int)info.dwNumberOfProcessors - 1;
+    }
+    if (threads > POOL_MAX_THREADS - 1)
+    {
+        threads = POOL_MAX_THREADS - 1;
+    }
+    if (threads <= 0)
+    {
+        return true;
+    }
+
+    g_startSemaphore = CreateSemaphore(NULL, 0, POOL_MAX_THREADS, NULL);
+    g_doneEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!g_startSemaphore || !g_doneEvent)
+    {
+        pool_shutdown();
+        return false;
+    }
+
+    g_quit = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        g_workers[g_threadCount].index = g_threadCount + 1;
+        HANDLE thread = CreateThread(NULL, 0, worker_main, &g_workers[g_threadCount], 0, NULL);
+        if (!thread)
+        {
+            break;
+        }
+        SetThreadPriority(thread, THREAD_PRIORITY_BELOW_NORMAL);
+        g_threads[g_threadCount++] = thread;
+    }
+
+    logf("[POOL] Started %d worker threads", g_threadCount);
+    return g_threadCount > 0;
+}
+
+void pool_shutdown(void)
+{
+    if (g_threadCount > 0)
+    {
+        InterlockedExchange(&g_quit, 1);
+        ReleaseSemaphore(g_startSemaphore, g_threadCount, NULL);
+        WaitForMultipleObjects(g_threadCount, g_threads, TRUE, 5000);
+        for (int i = 0; i < g_threadCount; i++)
+        {
+            CloseHandle(g_threads[i]);
+        }
+        g_threadCount = 0;
+    }
+
+    if (g_startSemaphore)
+    {
+        CloseHandle(g_startSemaphore);
+        g_startSemaphore = NULL;
+    }
+    if (g_doneEvent)
+    {
+        CloseHandle(g_doneEvent);
+        g_doneEvent = NULL;
+    }
+}
+
+// Workers plus the calling thread
+int pool_size(void)
+{
+    return g_threadCount + 1;
+}
+
+// Runs fn for every index in [0, count) and returns when all are done.
+// Only one loop runs on the pool at a time; a second caller, or a nested
+// call from inside fn, runs its loop inline on the calling thread.
+void pool_for(int count, pool_fn fn, void *ctx)
+{
+    pool_batch batch = {fn, ctx, count, 0};
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    if (g_threadCount == 0 || count == 1 || InterlockedCompareExchange(&g_busy, 1, 0) != 0)
+    {
+        drain(&batch, 0);
+        return;
+    }
+
+    LONG wake = count - 1 < g_threadCount ? count - 1 : g_threadCount;
+    g_batch = &batch;
+    InterlockedExchange(&g_active, wake);
+    ReleaseSemaphore(g_startSemaphore, wake, NULL);
+
+    drain(&batch, 0);
+    WaitForSingleObject(g_doneEvent, INFINITE);
+
+    g_batch = NULL;
+    InterlockedExchange(&g_busy, 0);
+}
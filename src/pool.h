@@ -0,0 +1,18 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <windows.h>
+
+#define POOL_MAX_THREADS 16
+
+// Runs one item of a parallel loop. worker is 0 for the calling thread and
+// 1..pool_size()-1 for pool threads, for indexing per-worker scratch space.
+typedef void (*pool_fn)(void *ctx, int index, int worker);
+
+bool pool_init(int threads);
+void pool_shutdown(void);
+int  pool_size(void);
+void pool_for(int count, pool_fn fn, void *ctx);
+
+#endif // POOL_H
@@ -0,0 +1,865 @@
+/*
+ * profiler.c: Sampling profiler for one thread, normally the game's main
+ * thread.
+ *
+ * A sampler thread wakes every interval, suspends the target, copies EIP
+ * and up to depth - 1 return addresses found by walking the EBP chain into
+ * a preallocated ring, and resumes it. Nothing that can take a lock runs
+ * while the target is suspended: no allocation, no logging, no region
+ * lookups. Code built without frame pointers cuts the walk short, so the
+ * innermost frame is exact and the rest is best effort.
+ *
+ * Reports are built after sampling stops. Each address is attributed to
+ * the nearest registered function below it in the same module (the caller
+ * passes the registry as a symbol table), otherwise to module+RVA. They
+ * give per-function self/total sample counts and, optionally, a file of
+ * collapsed stacks ("outer;inner count") for flamegraph.pl or speedscope.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+#include <mmsystem.h>
+
+#include "dispatch.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "profiler.h"
+#include "regions.h"
+#include "symbols.h"
+
+#define PROFILER_MAX_BYTES   (16u * 1024u * 1024u) /* Sample ring limit */
+#define PROFILER_MAX_SAMPLES 65536u /* Ring size when sampling until stopped */
+#define PROFILER_NEAR_LIMIT  0x10000u /* Symbol reach outside any module */
+#define PROFILER_LABEL_SIZE  96
+
+typedef struct
+{
+    HANDLE         target;
+    HANDLE         sampler;
+    HANDLE         stop_event;
+    DWORD          thread_id;
+    uint32_t       interval_ms;
+    uint32_t       depth;
+    uint32_t       stride;      /* Words per sample: count, then addresses */
+    uint32_t       capacity;    /* Samples in the ring */
+    uint32_t      *samples;
+    uint32_t       stack_base;  /* Top of the target's stack, 0 if unknown */
+    int64_t        start_tick;
+    int64_t        stop_tick;
+    int64_t        deadline;    /* 0 to sample until stopped */
+    volatile LONG  running;
+    volatile LONG  written;     /* Samples taken; the ring keeps the last capacity */
+    volatile LONG  missed;      /* Suspend or context failures */
+} profiler_state;
+
+static profiler_state g_prof;
+static int64_t        g_qpcFrequency = 1;
+
+static int64_t qpc_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+//============================================================================
+// SAMPLING
+//============================================================================
+
+// Reads the stack top from the target's TEB; the walk never leaves
+// [esp, stack_base)
+static uint32_t target_stack_base(HANDLE thread)
+{
+    CONTEXT ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ContextFlags = CONTEXT_SEGMENTS;
+
+    LDT_ENTRY entry;
+    if (!GetThreadContext(thread, &ctx) || !GetThreadSelectorEntry(thread, ctx.SegFs, &entry))
+    {
+        return 0;
+    }
+
+    uint32_t teb = entry.BaseLow | ((uint32_t)entry.HighWord.Bytes.BaseMid << 16) |
+                   ((uint32_t)entry.HighWord.Bytes.BaseHi << 24);
+    return (uint32_t)(uintptr_t)((const NT_TIB *)(uintptr_t)teb)->StackBase;
+}
+
+static void take_sample(void)
+{
+    uint32_t *out = g_prof.samples + ((uint32_t)g_prof.written % g_prof.capacity) * g_prof.stride;
+
+    if (SuspendThread(g_prof.target) == (DWORD)-1)
+    {
+        InterlockedIncrement(&g_prof.missed);
+        return;
+    }
+
+    CONTEXT ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.ContextFlags = CONTEXT_CONTROL;
+    if (!GetThreadContext(g_prof.target, &ctx))
+    {
+        ResumeThread(g_prof.target);
+        InterlockedIncrement(&g_prof.missed);
+        return;
+    }
+
+    // Frames are [saved ebp, return address] pairs, each above the last
+    uint32_t count = 0;
+    uint32_t frame = ctx.Ebp;
+    uint32_t low = ctx.Esp;
+    out[1 + count++] = ctx.Eip;
+    while (count < g_prof.depth && frame >= low && (frame & 3) == 0 && frame + 8 <= g_prof.stack_base)
+    {
+        const uint32_t *words = (const uint32_t *)(uintptr_t)frame;
+        uint32_t        next = words[0];
+        uint32_t        ret = words[1];
+        if (ret == 0)
+        {
+            break;
+        }
+        out[1 + count++] = ret;
+        low = frame + 8;
+        frame = next;
+    }
+
+    ResumeThread(g_prof.target);
+
+    out[0] = count;
+    InterlockedIncrement(&g_prof.written);
+}
+
+static DWORD WINAPI sampler_main(LPVOID param)
+{
+    (void)param;
+
+    // Sleep granularity is 15.6 ms unless raised
+    timeBeginPeriod(1);
+    while (WaitForSingleObject(g_prof.stop_event, g_prof.interval_ms) == WAIT_TIMEOUT)
+    {
+        if (g_prof.deadline && qpc_now() >= g_prof.deadline)
+        {
+            break;
+        }
+        take_sample();
+    }
+    timeEndPeriod(1);
+
+    g_prof.stop_tick = qpc_now();
+    InterlockedExchange(&g_prof.running, 0);
+    return 0;
+}
+
+static void release_session(void)
+{
+    if (g_prof.sampler)
+    {
+        SetEvent(g_prof.stop_event);
+        WaitForSingleObject(g_prof.sampler, INFINITE);
+        CloseHandle(g_prof.sampler);
+        g_prof.sampler = NULL;
+    }
+    if (g_prof.stop_event)
+    {
+        CloseHandle(g_prof.stop_event);
+        g_prof.stop_event = NULL;
+    }
+    if (g_prof.target)
+    {
+        CloseHandle(g_prof.target);
+        g_prof.target = NULL;
+    }
+}
+
+bool profiler_start(DWORD thread_id, uint32_t interval_ms, uint32_t duration_ms, uint32_t depth)
+{
+    if (g_prof.running || thread_id == 0)
+    {
+        return false;
+    }
+    release_session();
+
+    if (depth < 1 || depth > PROFILER_MAX_DEPTH)
+    {
+        depth = PROFILER_DEFAULT_DEPTH;
+    }
+    if (interval_ms < 1)
+    {
+        interval_ms = PROFILER_DEFAULT_INTERVAL;
+    }
+
+    uint32_t stride = depth + 1;
+    uint32_t capacity = duration_ms ? duration_ms / interval_ms + 16 : PROFILER_MAX_SAMPLES;
+    if (capacity > PROFILER_MAX_BYTES / (stride * sizeof(uint32_t)))
+    {
+        capacity = PROFILER_MAX_BYTES / (stride * sizeof(uint32_t));
+    }
+
+    // Keep the previous ring if it is big enough
+    if (!g_prof.samples || g_prof.capacity * g_prof.stride < capacity * stride)
+    {
+        if (g_prof.samples)
+        {
+            VirtualFree(g_prof.samples, 0, MEM_RELEASE);
+        }
+        g_prof.samples = VirtualAlloc(NULL, capacity * stride * sizeof(uint32_t), MEM_COMMIT | MEM_RESERVE,
+                                      PAGE_READWRITE);
+        if (!g_prof.samples)
+        {
+            g_prof.capacity = 0;
+            return false;
+        }
+    }
+
+    g_prof.target = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_INFORMATION, FALSE,
+                               thread_id);
+    g_prof.stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!g_prof.target || !g_prof.stop_event)
+    {
+        release_session();
+        return false;
+    }
+
+    g_prof.thread_id = thread_id;
+    g_prof.interval_ms = interval_ms;
+    g_prof.depth = depth;
+    g_prof.stride = stride;
+    g_prof.capacity = capacity;
+    g_prof.stack_base = target_stack_base(g_prof.target);
+    g_prof.written = 0;
+    g_prof.missed = 0;
+    g_prof.start_tick = qpc_now();
+    g_prof.stop_tick = 0;
+    g_prof.deadline = duration_ms ? g_prof.start_tick + (int64_t)duration_ms * g_qpcFrequency / 1000 : 0;
+    g_prof.running = 1;
+
+    g_prof.sampler = CreateThread(NULL, 0, sampler_main, NULL, 0, NULL);
+    if (!g_prof.sampler)
+    {
+        g_prof.running = 0;
+        release_session();
+        return false;
+    }
+    SetThreadPriority(g_prof.sampler, THREAD_PRIORITY_TIME_CRITICAL);
+
+    logf("[PROFILE] Sampling thread %lu every %u ms, %u frames deep%s", (unsigned long)thread_id, interval_ms,
+         depth, g_prof.stack_base ? "" : " (stack bounds unknown, EIP only)");
+    return true;
+}
+
+// Stops sampling; returns the number of samples kept
+uint32_t profiler_stop(void)
+{
+    release_session();
+    return (uint32_t)g_prof.written < g_prof.capacity ? (uint32_t)g_prof.written : g_prof.capacity;
+}
+
+bool profiler_running(void)
+{
+    return g_prof.running != 0;
+}
+
+void profiler_shutdown(void)
+{
+    release_session();
+    if (g_prof.samples)
+    {
+        VirtualFree(g_prof.samples, 0, MEM_RELEASE);
+        g_prof.samples = NULL;
+        g_prof.capacity = 0;
+    }
+}
+
+//============================================================================
+// REPORTS
+//============================================================================
+
+typedef struct
+{
+    uint32_t address;
+    char     name[PROFILER_LABEL_SIZE];
+} profiler_symbol;
+
+typedef struct
+{
+    uint32_t key;  /* Symbol address, or the sampled address itself */
+    uint32_t self; /* Samples with this site innermost */
+    uint32_t total;
+    uint32_t mark; /* Last sample counted in total, + 1 */
+    char     label[PROFILER_LABEL_SIZE];
+} profiler_site;
+
+// Open-addressed uint32 -> index; a value of 0 marks an empty slot
+typedef struct
+{
+    uint32_t *keys;
+    uint32_t *values;
+    uint32_t  mask;
+    uint32_t  count;
+} index_map;
+
+typedef struct
+{
+    profiler_symbol *symbols;
+    int              symbol_count;
+    profiler_site   *sites;
+    uint32_t         site_count;
+    uint32_t         site_capacity;
+    index_map        by_address; /* Sampled address -> site + 1 */
+    index_map        by_key;     /* Site key -> site + 1 */
+    uint32_t        *stacks;     /* Per sample: count, then site indices */
+} profiler_report;
+
+static bool map_init(index_map *m, uint32_t size)
+{
+    m->keys = calloc(size, sizeof(uint32_t));
+    m->values = calloc(size, sizeof(uint32_t));
+    m->mask = size - 1;
+    m->count = 0;
+    return m->keys && m->values;
+}
+
+static void map_free(index_map *m)
+{
+    free(m->keys);
+    free(m->values);
+}
+
+static uint32_t *map_slot(index_map *m, uint32_t key)
+{
+    uint32_t i = (key * 2654435761u) & m->mask;
+    while (m->values[i] && m->keys[i] != key)
+    {
+        i = (i + 1) & m->mask;
+    }
+    return &m->values[i];
+}
+
+// Stores key -> value (non-zero), growing at half load
+static bool map_put(index_map *m, uint32_t key, uint32_t value)
+{
+    if ((m->count + 1) * 2 > m->mask + 1)
+    {
+        index_map bigger;
+        if (!map_init(&bigger, (m->mask + 1) * 2))
+        {
+            map_free(&bigger);
+            return false;
+        }
+        for (uint32_t i = 0; i <= m->mask; i++)
+        {
+            if (m->values[i])
+            {
+                map_put(&bigger, m->keys[i], m->values[i]);
+            }
+        }
+        map_free(m);
+        *m = bigger;
+    }
+
+    uint32_t *slot = map_slot(m, key);
+    if (!*slot)
+    {
+        m->keys[slot - m->values] = key;
+        m->count++;
+    }
+    *slot = value;
+    return true;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    uint32_t x = ((const profiler_symbol *)a)->address;
+    uint32_t y = ((const profiler_symbol *)b)->address;
+    return x < y ? -1 : x > y;
+}
+
+// Nearest symbol at or below address
+static const profiler_symbol *nearest_symbol(const profiler_report *r, uint32_t address)
+{
+    int lo = 0;
+    int hi = r->symbol_count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (r->symbols[mid].address <= address)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo > 0 ? &r->symbols[lo - 1] : NULL;
+}
+
+static void clean_label(char *label)
+{
+    for (; *label; label++)
+    {
+        if (*label == ';' || *label == '\n')
+        {
+            *label = ':';
+        }
+    }
+}
+
+// Site index for a sampled address, or UINT32_MAX when out of memory
+static uint32_t site_for(profiler_report *r, uint32_t address)
+{
+    uint32_t *known = map_slot(&r->by_address, address);
+    if (*known)
+    {
+        return *known - 1;
+    }
+
+    regions_module         module;
+    bool                   in_module = regions_module_of(address, &module);
+    const profiler_symbol *symbol = nearest_symbol(r, address);
+    if (symbol && !(in_module ? symbol->address >= module.base : address - symbol->address < PROFILER_NEAR_LIMIT))
+    {
+        symbol = NULL;
+    }
+
+    uint32_t  key = symbol ? symbol->address : address;
+    uint32_t *existing = map_slot(&r->by_key, key);
+    uint32_t  site = *existing ? *existing - 1 : r->site_count;
+
+    if (!*existing)
+    {
+        if (r->site_count == r->site_capacity)
+        {
+            uint32_t       capacity = r->site_capacity ? r->site_capacity * 2 : 256;
+            profiler_site *grown = realloc(r->sites, capacity * sizeof(profiler_site));
+            if (!grown)
+            {
+                return UINT32_MAX;
+            }
+            r->sites = grown;
+            r->site_capacity = capacity;
+        }
+
+        profiler_site *s = &r->sites[r->site_count++];
+        memset(s, 0, sizeof(*s));
+        s->key = key;
+        if (symbol)
+        {
+            snprintf(s->label, sizeof(s->label), "%s", symbol->name);
+        }
+        else if (in_module)
+        {
+            snprintf(s->label, sizeof(s->label), "%s+0x%X", module.name, (unsigned)(address - module.base));
+        }
+        else
+        {
+            snprintf(s->label, sizeof(s->label), "0x%08X", (unsigned)address);
+        }
+        clean_label(s->label);
+
+        if (!map_put(&r->by_key, key, site + 1))
+        {
+            return UINT32_MAX;
+        }
+    }
+
+    return map_put(&r->by_address, address, site + 1) ? site : UINT32_MAX;
+}
+
+// Reads {[address] = name} from the table at index
+static void load_symbols(lua_State *L, int index, profiler_report *r)
+{
+    int count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0)
+    {
+        count++;
+        lua_pop(L, 1);
+    }
+
+    r->symbols = count ? malloc(count * sizeof(profiler_symbol)) : NULL;
+    if (!r->symbols)
+    {
+        return;
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, index) != 0)
+    {
+        if (lua_type(L, -2) == LUA_TNUMBER && lua_type(L, -1) == LUA_TSTRING)
+        {
+            profiler_symbol *s = &r->symbols[r->symbol_count++];
+            s->address = (uint32_t)(int64_t)lua_tonumber(L, -2);
+            snprintf(s->name, sizeof(s->name), "%s", lua_tostring(L, -1));
+        }
+        lua_pop(L, 1);
+    }
+    qsort(r->symbols, r->symbol_count, sizeof(profiler_symbol), compare_symbols);
+}
+
+static void add_index_symbol(void *context, uint32_t address, uint32_t size, const char *name)
+{
+    (void)size;
+    profiler_report *r = context;
+    profiler_symbol *s = &r->symbols[r->symbol_count++];
+    s->address = address;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+}
+
+// Registered functions from the address index, already in address order
+static void load_index_symbols(profiler_report *r)
+{
+    uint32_t count = symbols_count();
+    r->symbols = count ? malloc(count * sizeof(profiler_symbol)) : NULL;
+    if (r->symbols)
+    {
+        symbols_each(add_index_symbol, r, count);
+    }
+}
+
+static void free_report(profiler_report *r)
+{
+    free(r->symbols);
+    free(r->sites);
+    free(r->stacks);
+    map_free(&r->by_address);
+    map_free(&r->by_key);
+}
+
+// Ring index of the oldest sample still kept
+static uint32_t first_sample(void)
+{
+    return (uint32_t)g_prof.written > g_prof.capacity ? (uint32_t)g_prof.written % g_prof.capacity : 0;
+}
+
+// Attributes every kept sample; fills stacks with site indices
+static bool build_report(profiler_report *r, uint32_t kept)
+{
+    uint32_t stride = g_prof.stride;
+    r->stacks = malloc((size_t)kept * stride * sizeof(uint32_t));
+    if (!r->stacks || !map_init(&r->by_address, 1024) || !map_init(&r->by_key, 256))
+    {
+        return false;
+    }
+
+    uint32_t first = first_sample();
+    for (uint32_t i = 0; i < kept; i++)
+    {
+        const uint32_t *sample = g_prof.samples + ((first + i) % g_prof.capacity) * stride;
+        uint32_t       *stack = r->stacks + i * stride;
+        uint32_t        count = sample[0];
+
+        stack[0] = count;
+        for (uint32_t j = 0; j < count; j++)
+        {
+            // Return addresses point past the call; look up the call itself
+            uint32_t site = site_for(r, j == 0 ? sample[1] : sample[1 + j] - 1);
+            if (site == UINT32_MAX)
+            {
+                return false;
+            }
+            stack[1 + j] = site;
+
+            profiler_site *s = &r->sites[site];
+            if (j == 0)
+            {
+                s->self++;
+            }
+            if (s->mark != i + 1)
+            {
+                s->mark = i + 1;
+                s->total++;
+            }
+        }
+    }
+    return true;
+}
+
+static const uint32_t *g_sortStacks;
+static uint32_t        g_sortStride;
+
+// Orders samples by their stacks, outermost frame first
+static int compare_stacks(const void *a, const void *b)
+{
+    const uint32_t *x = g_sortStacks + *(const uint32_t *)a * g_sortStride;
+    const uint32_t *y = g_sortStacks + *(const uint32_t *)b * g_sortStride;
+    uint32_t        i = x[0];
+    uint32_t        j = y[0];
+    while (i > 0 && j > 0)
+    {
+        if (x[i] != y[j])
+        {
+            return x[i] < y[j] ? -1 : 1;
+        }
+        i--;
+        j--;
+    }
+    return i == j ? 0 : i < j ? -1 : 1;
+}
+
+static bool write_collapsed(const profiler_report *r, uint32_t kept, const char *path)
+{
+    uint32_t *order = malloc((size_t)kept * sizeof(uint32_t));
+    FILE     *out = order ? fopen(path, "w") : NULL;
+    if (!out)
+    {
+        free(order);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < kept; i++)
+    {
+        order[i] = i;
+    }
+    g_sortStacks = r->stacks;
+    g_sortStride = g_prof.stride;
+    qsort(order, kept, sizeof(uint32_t), compare_stacks);
+
+    for (uint32_t i = 0; i < kept;)
+    {
+        uint32_t run = 1;
+        while (i + run < kept && compare_stacks(&order[i], &order[i + run]) == 0)
+        {
+            run++;
+        }
+
+        const uint32_t *stack = r->stacks + order[i] * g_prof.stride;
+        for (uint32_t j = stack[0]; j > 0; j--)
+        {
+            fprintf(out, "%s%s", r->sites[stack[j]].label, j > 1 ? ";" : "");
+        }
+        fprintf(out, " %u\n", (unsigned)run);
+        i += run;
+    }
+
+    fclose(out);
+    free(order);
+    return true;
+}
+
+static int compare_self(const void *a, const void *b)
+{
+    const profiler_site *x = *(profiler_site *const *)a;
+    const profiler_site *y = *(profiler_site *const *)b;
+    if (x->self != y->self)
+    {
+        return x->self > y->self ? -1 : 1;
+    }
+    return x->total > y->total ? -1 : x->total < y->total;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static uint32_t opt_uint_field(lua_State *L, int index, const char *field, uint32_t fallback)
+{
+    uint32_t value = fallback;
+    if (lua_istable(L, index))
+    {
+        lua_getfield(L, index, field);
+        if (lua_isnumber(L, -1))
+        {
+            value = (uint32_t)lua_tonumber(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+    return value;
+}
+
+// profiler.start([{thread=id, interval=ms, seconds=n, depth=n}]) -> true | nil, error
+// Samples the game's main thread by default; seconds = 0 samples until stop
+static int l_profiler_start(lua_State *L)
+{
+    DWORD    thread = opt_uint_field(L, 1, "thread", dispatch_main_thread());
+    uint32_t interval = opt_uint_field(L, 1, "interval", PROFILER_DEFAULT_INTERVAL);
+    uint32_t depth = opt_uint_field(L, 1, "depth", PROFILER_DEFAULT_DEPTH);
+    double   seconds = 0;
+    if (lua_istable(L, 1))
+    {
+        lua_getfield(L, 1, "seconds");
+        seconds = luaL_optnumber(L, -1, 0);
+        lua_pop(L, 1);
+    }
+
+    if (g_prof.running)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "profiler already running");
+        return 2;
+    }
+    if (thread == 0 || thread == GetCurrentThreadId())
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, thread ? "cannot profile the calling thread" : "main thread unknown");
+        return 2;
+    }
+    if (!profiler_start(thread, interval, seconds > 0 ? (uint32_t)(seconds * 1000.0) : 0, depth))
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot sample thread %d (error %d)", (int)thread, (int)GetLastError());
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// profiler.stop() -> samples kept
+static int l_profiler_stop(lua_State *L)
+{
+    lua_pushnumber(L, profiler_stop());
+    return 1;
+}
+
+// profiler.wait([ms]) -> true once a timed run has finished
+static int l_profiler_wait(lua_State *L)
+{
+    DWORD timeout = lua_isnumber(L, 1) ? (DWORD)lua_tonumber(L, 1) : INFINITE;
+    bool  done = !g_prof.sampler || WaitForSingleObject(g_prof.sampler, timeout) == WAIT_OBJECT_0;
+    lua_pushboolean(L, done);
+    return 1;
+}
+
+static int l_profiler_running(lua_State *L)
+{
+    lua_pushboolean(L, g_prof.running != 0);
+    return 1;
+}
+
+static void push_summary(lua_State *L, uint32_t kept)
+{
+    int64_t end = g_prof.running ? qpc_now() : g_prof.stop_tick;
+    lua_pushnumber(L, kept);
+    lua_setfield(L, -2, "samples");
+    lua_pushnumber(L, (uint32_t)g_prof.written);
+    lua_setfield(L, -2, "taken");
+    lua_pushnumber(L, (uint32_t)g_prof.missed);
+    lua_setfield(L, -2, "missed");
+    lua_pushnumber(L, g_prof.thread_id);
+    lua_setfield(L, -2, "thread");
+    lua_pushnumber(L, g_prof.interval_ms);
+    lua_setfield(L, -2, "interval");
+    lua_pushnumber(L, g_prof.depth);
+    lua_setfield(L, -2, "depth");
+    lua_pushnumber(L, g_prof.start_tick ? (double)(end - g_prof.start_tick) * 1000.0 / g_qpcFrequency : 0);
+    lua_setfield(L, -2, "duration_ms");
+}
+
+// profiler.stats() -> {running, samples, taken, missed, thread, interval, depth, duration_ms}
+static int l_profiler_stats(lua_State *L)
+{
+    uint32_t taken = (uint32_t)g_prof.written;
+    lua_createtable(L, 0, 8);
+    lua_pushboolean(L, g_prof.running != 0);
+    lua_setfield(L, -2, "running");
+    push_summary(L, taken < g_prof.capacity ? taken : g_prof.capacity);
+    return 1;
+}
+
+// profiler.report([{symbols = {[address] = name}, top = n, collapsed = path}])
+// Without symbols, samples are named from the registered functions
+// -> summary with top = {{name, address, self, total, self_pct, total_pct}, ...}
+static int l_profiler_report(lua_State *L)
+{
+    if (g_prof.running)
+    {
+        return luaL_error(L, "profiler still running; call profiler.stop() first");
+    }
+
+    uint32_t    top = opt_uint_field(L, 1, "top", 20);
+    const char *collapsed = NULL;
+    uint32_t    taken = (uint32_t)g_prof.written;
+    uint32_t    kept = taken < g_prof.capacity ? taken : g_prof.capacity;
+
+    profiler_report report;
+    memset(&report, 0, sizeof(report));
+    if (lua_istable(L, 1))
+    {
+        lua_getfield(L, 1, "symbols");
+        if (lua_istable(L, -1))
+        {
+            load_symbols(L, lua_gettop(L), &report);
+        }
+        lua_pop(L, 1);
+        lua_getfield(L, 1, "collapsed");
+        collapsed = lua_tostring(L, -1);
+    }
+    if (!report.symbols)
+    {
+        load_index_symbols(&report);
+    }
+
+    if (kept && !build_report(&report, kept))
+    {
+        free_report(&report);
+        return luaL_error(L, "out of memory building profile");
+    }
+
+    lua_createtable(L, 0, 10);
+    push_summary(L, kept);
+
+    if (collapsed && kept)
+    {
+        bool written = write_collapsed(&report, kept, collapsed);
+        lua_pushstring(L, collapsed);
+        lua_setfield(L, -2, written ? "collapsed" : "collapsed_error");
+    }
+
+    profiler_site **ranked = report.site_count ? malloc(report.site_count * sizeof(profiler_site *)) : NULL;
+    uint32_t        shown = 0;
+    if (ranked)
+    {
+        for (uint32_t i = 0; i < report.site_count; i++)
+        {
+            ranked[i] = &report.sites[i];
+        }
+        qsort(ranked, report.site_count, sizeof(profiler_site *), compare_self);
+        shown = top < report.site_count ? top : report.site_count;
+    }
+
+    lua_createtable(L, shown, 0);
+    for (uint32_t i = 0; i < shown; i++)
+    {
+        const profiler_site *s = ranked[i];
+        lua_createtable(L, 0, 6);
+        lua_pushstring(L, s->label);
+        lua_setfield(L, -2, "name");
+        lua_pushnumber(L, s->key);
+        lua_setfield(L, -2, "address");
+        lua_pushnumber(L, s->self);
+        lua_setfield(L, -2, "self");
+        lua_pushnumber(L, s->total);
+        lua_setfield(L, -2, "total");
+        lua_pushnumber(L, 100.0 * s->self / kept);
+        lua_setfield(L, -2, "self_pct");
+        lua_pushnumber(L, 100.0 * s->total / kept);
+        lua_setfield(L, -2, "total_pct");
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "top");
+
+    free(ranked);
+    free_report(&report);
+    return 1;
+}
+
+static const luaL_Reg profiler_funcs[] = {{"start", l_profiler_start},     {"stop", l_profiler_stop},
+                                          {"wait", l_profiler_wait},       {"running", l_profiler_running},
+                                          {"stats", l_profiler_stats},     {"report", l_profiler_report},
+                                          {NULL, NULL}};
+
+int luaopen_profiler(lua_State *L)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_qpcFrequency = frequency.QuadPart;
+
+    luaL_register(L, "profiler", profiler_funcs);
+    return 1;
+}
@@ -0,0 +1,20 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+
+#define PROFILER_MAX_DEPTH 32
+#define PROFILER_DEFAULT_DEPTH 16
+#define PROFILER_DEFAULT_INTERVAL 1 /* Milliseconds between samples */
+
+bool     profiler_start(DWORD thread_id, uint32_t interval_ms, uint32_t duration_ms, uint32_t depth);
+uint32_t profiler_stop(void);
+bool     profiler_running(void);
+void     profiler_shutdown(void);
+int      luaopen_profiler(lua_State *L);
+
+#endif // PROFILER_H
@@ -0,0 +1,819 @@
+/*
+ * regfile.c: Binary function registry files behind game.save / game.load.
+ *
+ * regfile.write() and the regfile_builder API (used by the Ghidra importer)
+ * turn a list of registrations into one file sorted by address, with each
+ * signature stored once, a hash index on names and the descriptions in a
+ * section of their own (see regformat.h). regfile.open()
+ * maps such a file read-only and checks every offset once; after that a
+ * lookup by name is a hash probe and a lookup by address a binary search,
+ * both straight on the mapped bytes. game.load keeps the file mapped and
+ * only turns an entry into a callable registration when it is first used.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "regfile.h"
+#include "regformat.h"
+
+#define REGFILE_MT "regfile"
+#define REGFILE_MIN_INDEX 16
+
+typedef struct
+{
+    const uint8_t         *base; /* NULL once closed */
+    uint32_t               size;
+    const reg_file_header *header;
+    const reg_entry       *entries;
+    reg_entry             *widened; /* v1 entries converted at open, or NULL */
+    const uint32_t        *index;
+    const uint32_t        *signatures;
+    const uint32_t        *descriptions;
+    const char            *strings;
+} regfile;
+
+typedef struct
+{
+    reg_entry entry;
+    uint32_t  description;
+} build_item;
+
+// Open addressing map from string pool offsets to values
+typedef struct
+{
+    uint32_t *keys; /* Offset + 1, 0 for an empty slot */
+    uint32_t *values;
+    uint32_t  capacity;
+    uint32_t  count;
+} offset_map;
+
+struct regfile_builder
+{
+    build_item *items;
+    uint32_t    count;
+    uint32_t    capacity;
+
+    char       *pool;
+    uint32_t    pool_size;
+    uint32_t    pool_capacity;
+    offset_map  strings;    /* Dedupes the pool; keyed on the strings' hashes */
+    offset_map  names;      /* Name offset -> item, for duplicate checks */
+    offset_map  signatures; /* Signature offset -> table index */
+    uint32_t   *signature_offsets;
+    uint32_t    signature_count;
+    uint32_t    signature_capacity;
+
+    const char *want_text; /* String being looked up by intern() */
+    size_t      want_length;
+};
+
+static uint32_t hash_name(const char *name, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+//============================================================================
+// WRITING
+//============================================================================
+
+static bool grow(void **data, uint32_t *capacity, uint32_t needed, size_t element, uint32_t initial)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+    uint32_t size = *capacity ? *capacity : initial;
+    while (size < needed)
+    {
+        size *= 2;
+    }
+    void *grown = realloc(*data, (size_t)size * element);
+    if (!grown)
+    {
+        return false;
+    }
+    *data = grown;
+    *capacity = size;
+    return true;
+}
+
+// Slot for key in the map: where it is, or the empty slot it would take.
+// `hash` is the key's hash; `equal` compares stored and wanted keys.
+static uint32_t map_slot(const offset_map *map, uint32_t hash, const regfile_builder *b, uint32_t key,
+                         bool (*equal)(const regfile_builder *, uint32_t, uint32_t))
+{
+    uint32_t mask = map->capacity - 1;
+    uint32_t slot = hash & mask;
+    while (map->keys[slot] != 0 && !equal(b, map->keys[slot] - 1, key))
+    {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool same_offset(const regfile_builder *b, uint32_t stored, uint32_t key)
+{
+    (void)b;
+    return stored == key;
+}
+
+static uint32_t hash_offset(uint32_t offset)
+{
+    return offset * 2654435761u;
+}
+
+// Keeps the load factor under one half. String keys are stored by offset,
+// so rehashing needs the pool to hash them again.
+static bool map_reserve(offset_map *map, const regfile_builder *b, bool string_keys)
+{
+    if ((map->count + 1) * 2 <= map->capacity)
+    {
+        return true;
+    }
+
+    offset_map grown = {0};
+    grown.capacity = map->capacity ? map->capacity * 2 : 1024;
+    grown.keys = calloc(grown.capacity, sizeof(uint32_t));
+    grown.values = calloc(grown.capacity, sizeof(uint32_t));
+    if (!grown.keys || !grown.values)
+    {
+        free(grown.keys);
+        free(grown.values);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < map->capacity; i++)
+    {
+        if (map->keys[i] == 0)
+        {
+            continue;
+        }
+        uint32_t    key = map->keys[i] - 1;
+        const char *text = b->pool + key;
+        uint32_t    hash = string_keys ? hash_name(text, strlen(text)) : hash_offset(key);
+        uint32_t    slot = map_slot(&grown, hash, b, key, same_offset);
+        grown.keys[slot] = key + 1;
+        grown.values[slot] = map->values[i];
+    }
+    grown.count = map->count;
+
+    free(map->keys);
+    free(map->values);
+    *map = grown;
+    return true;
+}
+
+static void map_free(offset_map *map)
+{
+    free(map->keys);
+    free(map->values);
+}
+
+static bool same_string(const regfile_builder *b, uint32_t stored, uint32_t key)
+{
+    (void)key;
+    const char *text = b->pool + stored;
+    return strncmp(text, b->want_text, b->want_length) == 0 && text[b->want_length] == '\0';
+}
+
+// Offset of a string in the pool, stored once. The text is compared against
+// the pool in place, so it is only copied in when it is new.
+static uint32_t intern(regfile_builder *b, const char *text)
+{
+    size_t length = strlen(text);
+    if (!map_reserve(&b->strings, b, true))
+    {
+        return REG_NONE;
+    }
+
+    b->want_text = text;
+    b->want_length = length;
+    uint32_t hash = hash_name(text, length);
+    uint32_t slot = map_slot(&b->strings, hash, b, 0, same_string);
+    if (b->strings.keys[slot] != 0)
+    {
+        return b->strings.keys[slot] - 1;
+    }
+
+    if (b->pool_size + length + 1 > 0x7FFFFFFF ||
+        !grow((void **)&b->pool, &b->pool_capacity, b->pool_size + (uint32_t)length + 1, 1, 65536))
+    {
+        return REG_NONE;
+    }
+    uint32_t offset = b->pool_size;
+    memcpy(b->pool + offset, text, length + 1);
+    b->pool_size += (uint32_t)length + 1;
+
+    b->strings.keys[slot] = offset + 1;
+    b->strings.count++;
+    return offset;
+}
+
+regfile_builder *regfile_builder_new(void)
+{
+    return calloc(1, sizeof(regfile_builder));
+}
+
+void regfile_builder_free(regfile_builder *b)
+{
+    if (!b)
+    {
+        return;
+    }
+    free(b->items);
+    free(b->pool);
+    map_free(&b->strings);
+    map_free(&b->names);
+    map_free(&b->signatures);
+    free(b->signature_offsets);
+    free(b);
+}
+
+uint32_t regfile_builder_count(const regfile_builder *b)
+{
+    return b->count;
+}
+
+// Adds a function. A name already added is left as it was.
+regfile_result regfile_builder_add(regfile_builder *b, const regfile_record *record)
+{
+    uint32_t name = intern(b, record->name);
+    uint32_t signature = intern(b, record->signature);
+    uint32_t pattern = record->pattern ? intern(b, record->pattern) : REG_NONE;
+    uint32_t description = record->description ? intern(b, record->description) : REG_NONE;
+    if (name == REG_NONE || signature == REG_NONE || (record->pattern && pattern == REG_NONE) ||
+        (record->description && description == REG_NONE) || !map_reserve(&b->names, b, false) ||
+        !map_reserve(&b->signatures, b, false))
+    {
+        return REGFILE_NO_MEMORY;
+    }
+
+    uint32_t slot = map_slot(&b->names, hash_offset(name), b, name, same_offset);
+    if (b->names.keys[slot] != 0)
+    {
+        return REGFILE_DUPLICATE;
+    }
+
+    // Signature table index, assigned in order of first use
+    uint32_t signature_slot = map_slot(&b->signatures, hash_offset(signature), b, signature, same_offset);
+    if (b->signatures.keys[signature_slot] == 0)
+    {
+        if (!grow((void **)&b->signature_offsets, &b->signature_capacity, b->signature_count + 1, sizeof(uint32_t),
+                  256))
+        {
+            return REGFILE_NO_MEMORY;
+        }
+        b->signature_offsets[b->signature_count] = signature;
+        b->signatures.keys[signature_slot] = signature + 1;
+        b->signatures.values[signature_slot] = b->signature_count++;
+        b->signatures.count++;
+    }
+
+    if (!grow((void **)&b->items, &b->capacity, b->count + 1, sizeof(build_item), 1024))
+    {
+        return REGFILE_NO_MEMORY;
+    }
+    build_item *item = &b->items[b->count];
+    item->entry.address = record->address;
+    item->entry.size = record->size;
+    item->entry.name = name;
+    item->entry.name_hash = hash_name(record->name, strlen(record->name));
+    item->entry.signature = b->signatures.values[signature_slot];
+    item->entry.pattern = pattern;
+    item->entry.pattern_offset = record->pattern_offset;
+    item->description = description;
+
+    b->names.keys[slot] = name + 1;
+    b->names.values[slot] = b->count++;
+    b->names.count++;
+    return REGFILE_ADDED;
+}
+
+static int compare_items(const void *a, const void *b)
+{
+    const reg_entry *x = &((const build_item *)a)->entry;
+    const reg_entry *y = &((const build_item *)b)->entry;
+    if (x->address != y->address)
+    {
+        return x->address < y->address ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+// Writes a section padded to the next 4-byte boundary
+static bool write_section(FILE *file, const void *data, size_t size)
+{
+    static const char padding[4] = {0};
+    size_t            pad = (4 - size % 4) % 4;
+    return fwrite(data, 1, size, file) == size && fwrite(padding, 1, pad, file) == pad;
+}
+
+static uint32_t aligned(uint32_t size)
+{
+    return (size + 3) & ~3u;
+}
+
+// Sorts the entries and writes the file through a temporary, so a reader
+// never sees half of one. The builder can be written again afterwards.
+bool regfile_builder_write(regfile_builder *b, const char *path)
+{
+    uint32_t count = b->count;
+    qsort(b->items, count, sizeof(build_item), compare_items);
+
+    uint32_t index_size = REGFILE_MIN_INDEX;
+    while (index_size < count * 2)
+    {
+        index_size *= 2;
+    }
+    uint32_t  *index = calloc(index_size, sizeof(uint32_t));
+    reg_entry *entries = calloc(count ? count : 1, sizeof(reg_entry));
+    uint32_t  *descriptions = calloc(count ? count : 1, sizeof(uint32_t));
+    bool       ok = index && entries && descriptions;
+
+    // Names are unique, so every probe ends at an empty slot
+    for (uint32_t i = 0; ok && i < count; i++)
+    {
+        entries[i] = b->items[i].entry;
+        descriptions[i] = b->items[i].description;
+
+        uint32_t slot = entries[i].name_hash & (index_size - 1);
+        while (index[slot] != 0)
+        {
+            slot = (slot + 1) & (index_size - 1);
+        }
+        index[slot] = i + 1;
+    }
+
+    reg_file_header header = {0};
+    memcpy(header.magic, REG_MAGIC, sizeof(header.magic));
+    header.version = REG_VERSION;
+    header.count = count;
+    header.signature_count = b->signature_count;
+    header.index_size = index_size;
+    header.entries_offset = aligned(sizeof(header));
+    header.index_offset = header.entries_offset + count * sizeof(reg_entry);
+    header.signatures_offset = header.index_offset + index_size * sizeof(uint32_t);
+    header.descriptions_offset = header.signatures_offset + b->signature_count * sizeof(uint32_t);
+    header.strings_offset = header.descriptions_offset + count * sizeof(uint32_t);
+    header.strings_size = b->pool_size;
+
+    char temp[MAX_PATH + 4];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *file = ok ? fopen(temp, "wb") : NULL;
+    if (file)
+    {
+        ok = write_section(file, &header, sizeof(header)) &&
+             write_section(file, entries, count * sizeof(reg_entry)) &&
+             write_section(file, index, index_size * sizeof(uint32_t)) &&
+             write_section(file, b->signature_offsets, b->signature_count * sizeof(uint32_t)) &&
+             write_section(file, descriptions, count * sizeof(uint32_t)) &&
+             write_section(file, b->pool, b->pool_size);
+        ok = fclose(file) == 0 && ok && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+        if (!ok)
+        {
+            DeleteFileA(temp);
+        }
+    }
+    else
+    {
+        ok = false;
+    }
+
+    free(index);
+    free(entries);
+    free(descriptions);
+
+    // Item indices changed with the sort
+    for (uint32_t i = 0; i < b->names.capacity; i++)
+    {
+        b->names.keys[i] = 0;
+    }
+    b->names.count = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t name = b->items[i].entry.name;
+        uint32_t slot = map_slot(&b->names, hash_offset(name), b, name, same_offset);
+        b->names.keys[slot] = name + 1;
+        b->names.values[slot] = i;
+        b->names.count++;
+    }
+    return ok;
+}
+
+static const char *opt_field(lua_State *L, int table, const char *key)
+{
+    lua_getfield(L, table, key);
+    const char *value = lua_isstring(L, -1) ? lua_tostring(L, -1) : NULL;
+    lua_pop(L, 1); /* Still referenced from the entry table */
+    return value;
+}
+
+// regfile.write(path, entries) -> count | nil, err
+// entries: array of {name, address, signature [, size] [, description] [, pattern, offset]}
+static int l_regfile_write(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    uint32_t count = (uint32_t)lua_objlen(L, 2);
+
+    regfile_builder *b = regfile_builder_new();
+    if (!b)
+    {
+        return luaL_error(L, "regfile.write: out of memory");
+    }
+
+    for (uint32_t i = 1; i <= count; i++)
+    {
+        lua_rawgeti(L, 2, (int)i);
+        int table = lua_gettop(L);
+
+        regfile_record record = {0};
+        const char    *error = NULL;
+        if (lua_istable(L, table))
+        {
+            record.name = opt_field(L, table, "name");
+            record.signature = opt_field(L, table, "signature");
+            record.description = opt_field(L, table, "description");
+            record.pattern = opt_field(L, table, "pattern");
+            lua_getfield(L, table, "address");
+            lua_Number address = lua_tonumber(L, -1);
+            lua_getfield(L, table, "size");
+            record.size = (uint32_t)lua_tonumber(L, -1);
+            lua_getfield(L, table, "offset");
+            record.pattern_offset = (int32_t)lua_tointeger(L, -1);
+            lua_pop(L, 3);
+
+            record.address = (uint32_t)address;
+            if (!record.name || !record.signature || address <= 0 || address > 0xFFFFFFFF)
+            {
+                error = "entry needs name, address and signature";
+            }
+        }
+        else
+        {
+            error = "entry is not a table";
+        }
+
+        regfile_result result = error ? REGFILE_NO_MEMORY : regfile_builder_add(b, &record);
+        if (!error && result == REGFILE_DUPLICATE)
+        {
+            error = "duplicate name";
+        }
+        else if (!error && result == REGFILE_NO_MEMORY)
+        {
+            error = "out of memory";
+        }
+        if (error)
+        {
+            regfile_builder_free(b);
+            return luaL_error(L, "regfile.write: entry %d: %s", (int)i, error);
+        }
+        lua_pop(L, 1);
+    }
+
+    bool ok = regfile_builder_write(b, path);
+    regfile_builder_free(b);
+    if (!ok)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot write %s", path);
+        return 2;
+    }
+    lua_pushnumber(L, count);
+    return 1;
+}
+
+//============================================================================
+// MAPPED FILES
+//============================================================================
+
+static bool within(const regfile *reg, uint32_t offset, uint32_t count, uint32_t size)
+{
+    return offset % 4 == 0 && offset <= reg->size && (uint64_t)count * size <= reg->size - offset;
+}
+
+static bool valid_string(const regfile *reg, uint32_t offset)
+{
+    return offset < reg->header->strings_size;
+}
+
+// Checks every offset once so lookups need no bounds checks
+static const char *validate(regfile *reg)
+{
+    if (reg->size < sizeof(reg_file_header))
+    {
+        return "file too small";
+    }
+    const reg_file_header *header = (const reg_file_header *)reg->base;
+    reg->header = header;
+    if (memcmp(header->magic, REG_MAGIC, sizeof(header->magic)) != 0)
+    {
+        return "not a registry file";
+    }
+    if (header->version != REG_VERSION && header->version != REG_VERSION_1)
+    {
+        return "unsupported registry version";
+    }
+    bool   v1 = header->version == REG_VERSION_1;
+    size_t entry_size = v1 ? sizeof(reg_entry_v1) : sizeof(reg_entry);
+
+    // The index must have an empty slot for lookups to stop on, and count * 2
+    // must not wrap
+    uint32_t index_size = header->index_size;
+    if (header->count > UINT32_MAX / 2 || index_size < REGFILE_MIN_INDEX || index_size < header->count * 2 ||
+        (index_size & (index_size - 1)) != 0 ||
+        !within(reg, header->entries_offset, header->count, (uint32_t)entry_size) ||
+        !within(reg, header->index_offset, index_size, sizeof(uint32_t)) ||
+        !within(reg, header->signatures_offset, header->signature_count, sizeof(uint32_t)) ||
+        !within(reg, header->descriptions_offset, header->count, sizeof(uint32_t)) ||
+        !within(reg, header->strings_offset, header->strings_size, 1) || header->strings_size == 0)
+    {
+        return "section out of bounds";
+    }
+
+    if (v1)
+    {
+        // Widened once so lookups see one layout; the sizes are unknown
+        const reg_entry_v1 *old = (const reg_entry_v1 *)(reg->base + header->entries_offset);
+        reg->widened = malloc((header->count ? header->count : 1) * sizeof(reg_entry));
+        if (!reg->widened)
+        {
+            return "out of memory";
+        }
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            reg->widened[i] = (reg_entry){.address = old[i].address,
+                                          .size = 0,
+                                          .name = old[i].name,
+                                          .name_hash = old[i].name_hash,
+                                          .signature = old[i].signature,
+                                          .pattern = old[i].pattern,
+                                          .pattern_offset = old[i].pattern_offset};
+        }
+        reg->entries = reg->widened;
+    }
+    else
+    {
+        reg->entries = (const reg_entry *)(reg->base + header->entries_offset);
+    }
+    reg->index = (const uint32_t *)(reg->base + header->index_offset);
+    reg->signatures = (const uint32_t *)(reg->base + header->signatures_offset);
+    reg->descriptions = (const uint32_t *)(reg->base + header->descriptions_offset);
+    reg->strings = (const char *)(reg->base + header->strings_offset);
+
+    if (reg->strings[header->strings_size - 1] != '\0')
+    {
+        return "unterminated string section";
+    }
+    for (uint32_t i = 0; i < header->count; i++)
+    {
+        const reg_entry *entry = &reg->entries[i];
+        if (!valid_string(reg, entry->name) || entry->signature >= header->signature_count ||
+            (entry->pattern != REG_NONE && !valid_string(reg, entry->pattern)) ||
+            (reg->descriptions[i] != REG_NONE && !valid_string(reg, reg->descriptions[i])))
+        {
+            return "corrupt entry";
+        }
+    }
+    for (uint32_t i = 0; i < header->signature_count; i++)
+    {
+        if (!valid_string(reg, reg->signatures[i]))
+        {
+            return "corrupt signature table";
+        }
+    }
+    for (uint32_t i = 0; i < index_size; i++)
+    {
+        if (reg->index[i] > header->count)
+        {
+            return "corrupt name index";
+        }
+    }
+    return NULL;
+}
+
+static regfile *check_regfile(lua_State *L)
+{
+    regfile *reg = (regfile *)luaL_checkudata(L, 1, REGFILE_MT);
+    if (!reg->base)
+    {
+        luaL_error(L, "registry file is closed");
+    }
+    return reg;
+}
+
+// 1-based entry index argument
+static const reg_entry *check_entry(lua_State *L, regfile *reg, uint32_t *position)
+{
+    lua_Integer i = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, i >= 1 && (lua_Number)i <= reg->header->count, 2, "entry index out of range");
+    *position = (uint32_t)i - 1;
+    return &reg->entries[*position];
+}
+
+// regfile.open(path) -> reg | nil, err
+static int l_regfile_open(lua_State *L)
+{
+    const char *path = luaL_checkstring(L, 1);
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot open %s", path);
+        return 2;
+    }
+
+    DWORD  size = GetFileSize(file, NULL);
+    HANDLE mapping = size && size != INVALID_FILE_SIZE ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)
+                                                        : NULL;
+    const uint8_t *base = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (mapping)
+    {
+        CloseHandle(mapping); /* The view keeps the mapping alive */
+    }
+    CloseHandle(file);
+    if (!base)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot map %s", path);
+        return 2;
+    }
+
+    regfile *reg = (regfile *)lua_newuserdata(L, sizeof(regfile));
+    memset(reg, 0, sizeof(*reg));
+    reg->base = base;
+    reg->size = size;
+    luaL_getmetatable(L, REGFILE_MT);
+    lua_setmetatable(L, -2);
+
+    const char *error = validate(reg);
+    if (error)
+    {
+        free(reg->widened);
+        reg->widened = NULL;
+        UnmapViewOfFile(reg->base);
+        reg->base = NULL;
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s: %s", path, error);
+        return 2;
+    }
+    return 1;
+}
+
+static int l_reg_count(lua_State *L)
+{
+    lua_pushnumber(L, check_regfile(L)->header->count);
+    return 1;
+}
+
+// reg:find(name) -> entry index or nil
+static int l_reg_find(lua_State *L)
+{
+    regfile    *reg = check_regfile(L);
+    size_t      length;
+    const char *name = luaL_checklstring(L, 2, &length);
+    uint32_t    hash = hash_name(name, length);
+    uint32_t    mask = reg->header->index_size - 1;
+
+    for (uint32_t slot = hash & mask, probes = 0; probes <= mask; slot = (slot + 1) & mask, probes++)
+    {
+        uint32_t position = reg->index[slot];
+        if (position == 0)
+        {
+            break;
+        }
+        const reg_entry *entry = &reg->entries[position - 1];
+        if (entry->name_hash == hash && strcmp(reg->strings + entry->name, name) == 0)
+        {
+            lua_pushnumber(L, position);
+            return 1;
+        }
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+// reg:entry(i) -> name, address, signature, pattern|nil, offset, size
+static int l_reg_entry(lua_State *L)
+{
+    regfile         *reg = check_regfile(L);
+    uint32_t         position;
+    const reg_entry *entry = check_entry(L, reg, &position);
+
+    lua_pushstring(L, reg->strings + entry->name);
+    lua_pushnumber(L, entry->address);
+    lua_pushstring(L, reg->strings + reg->signatures[entry->signature]);
+    if (entry->pattern != REG_NONE)
+    {
+        lua_pushstring(L, reg->strings + entry->pattern);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    lua_pushinteger(L, entry->pattern_offset);
+    lua_pushnumber(L, entry->size);
+    return 6;
+}
+
+// reg:description(i) -> string or nil
+static int l_reg_description(lua_State *L)
+{
+    regfile *reg = check_regfile(L);
+    uint32_t position;
+    check_entry(L, reg, &position);
+
+    uint32_t offset = reg->descriptions[position];
+    if (offset == REG_NONE)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushstring(L, reg->strings + offset);
+    }
+    return 1;
+}
+
+// reg:at(address) -> index of the last entry at or below address, or nil
+static int l_reg_at(lua_State *L)
+{
+    regfile   *reg = check_regfile(L);
+    lua_Number address = luaL_checknumber(L, 2);
+
+    uint32_t low = 0, high = reg->header->count;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (reg->entries[middle].address <= address)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    if (low == 0)
+    {
+        lua_pushnil(L);
+    }
+    else
+    {
+        lua_pushnumber(L, low);
+    }
+    return 1;
+}
+
+static int l_reg_close(lua_State *L)
+{
+    regfile *reg = (regfile *)luaL_checkudata(L, 1, REGFILE_MT);
+    if (reg->base)
+    {
+        free(reg->widened);
+        reg->widened = NULL;
+        UnmapViewOfFile(reg->base);
+        reg->base = NULL;
+    }
+    return 0;
+}
+
+static const luaL_Reg regfile_methods[] = {{"count", l_reg_count},
+                                           {"find", l_reg_find},
+                                           {"entry", l_reg_entry},
+                                           {"description", l_reg_description},
+                                           {"at", l_reg_at},
+                                           {"close", l_reg_close},
+                                           {NULL, NULL}};
+
+static const luaL_Reg regfile_funcs[] = {{"open", l_regfile_open}, {"write", l_regfile_write}, {NULL, NULL}};
+
+int luaopen_regfile(lua_State *L)
+{
+    luaL_newmetatable(L, REGFILE_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, regfile_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_reg_close);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, l_reg_count);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
+    luaL_register(L, "regfile", regfile_funcs);
+    return 1;
+}
@@ -0,0 +1,39 @@
+#ifndef REGFILE_H
+#define REGFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+// One function for regfile_builder_add. Strings are copied; pattern and
+// description may be NULL.
+typedef struct
+{
+    const char *name;
+    const char *signature;
+    const char *description;
+    const char *pattern;
+    uint32_t    address;
+    uint32_t    size;
+    int32_t     pattern_offset;
+} regfile_record;
+
+typedef enum
+{
+    REGFILE_ADDED,
+    REGFILE_DUPLICATE,
+    REGFILE_NO_MEMORY
+} regfile_result;
+
+typedef struct regfile_builder regfile_builder;
+
+regfile_builder *regfile_builder_new(void);
+regfile_result   regfile_builder_add(regfile_builder *b, const regfile_record *record);
+uint32_t         regfile_builder_count(const regfile_builder *b);
+bool             regfile_builder_write(regfile_builder *b, const char *path);
+void             regfile_builder_free(regfile_builder *b);
+
+int luaopen_regfile(lua_State *L);
+
+#endif // REGFILE_H
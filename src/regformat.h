@@ -0,0 +1,66 @@
+/* regformat.h: On-disk layout of binary function registry files */
+
+#ifndef REGFORMAT_H
+#define REGFORMAT_H
+
+#include <stdint.h>
+
+/*
+ * A registry file is a reg_file_header followed by these sections, each
+ * at the offset the header gives (little endian, 4-byte aligned):
+ *
+ *   entries       reg_entry[count], sorted by address
+ *   index         uint32_t[index_size], open addressing on name_hash with
+ *                 linear probing; entry index + 1, 0 for an empty slot
+ *   signatures    uint32_t[signature_count], string offsets; each distinct
+ *                 signature is stored once and entries refer to it by index
+ *   descriptions  uint32_t[count], string offset per entry or REG_NONE;
+ *                 only read when a description is asked for
+ *   strings       NUL-terminated strings, strings_size bytes in total
+ *
+ * String fields are offsets into the strings section. Name hashes are
+ * 32-bit FNV-1a of the name's bytes.
+ */
+
+#define REG_MAGIC   "E14REG\0\0"
+#define REG_VERSION 2
+#define REG_VERSION_1 1 /* Still read: entries are reg_entry_v1, without a size */
+#define REG_NONE    0xFFFFFFFFu
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint32_t signature_count;
+    uint32_t index_size; /* Power of two, at least twice count */
+    uint32_t entries_offset;
+    uint32_t index_offset;
+    uint32_t signatures_offset;
+    uint32_t descriptions_offset;
+    uint32_t strings_offset;
+    uint32_t strings_size;
+} reg_file_header;
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;           /* Bytes of code from address, 0 when not known */
+    uint32_t name;
+    uint32_t name_hash;
+    uint32_t signature;      /* Index into the signature table */
+    uint32_t pattern;        /* Byte signature to resolve the address from, or REG_NONE */
+    int32_t  pattern_offset; /* Distance from the pattern match to the function */
+} reg_entry;
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t name;
+    uint32_t name_hash;
+    uint32_t signature;
+    uint32_t pattern;
+    int32_t  pattern_offset;
+} reg_entry_v1;
+
+#endif // REGFORMAT_H
@@ -0,0 +1,1046 @@
+/*
+ * regions.c: Shared index of the process address space.
+ *
+ * A sorted table of committed regions (with allocation base, type and
+ * protection) plus a table of loaded modules, built once from VirtualQuery
+ * and a toolhelp walk. Lookups are binary searches with no system calls.
+ *
+ * The table stays current incrementally: detours on the ntdll calls that
+ * allocate, free, protect, map and unmap memory record the touched range
+ * in a lock-free ring, and the next lookup re-queries just those ranges.
+ * Module loads and unloads arrive through the loader's DLL notification.
+ * If the hooks can't be placed, lookups fall back to refreshing the whole
+ * table at most every REGIONS_REFRESH_MS.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tlhelp32.h>
+#include <windows.h>
+
+#include "detour.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "regions.h"
+
+#define REGIONS_REFRESH_MS 250
+#define REGIONS_DIRTY_SLOTS 1024 /* Power of two */
+#define REGIONS_PAGE 0x1000u
+
+#define PROTECT_WRITE (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+#define PROTECT_READ (PROTECT_WRITE | PAGE_READONLY | PAGE_EXECUTE_READ)
+#define PROTECT_EXEC (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)
+
+typedef struct
+{
+    volatile LONG seq; /* Claim index + 1 once lo/hi are written */
+    uint32_t      lo;
+    uint32_t      hi;
+} dirty_slot;
+
+typedef struct
+{
+    regions_entry *items;
+    int            count;
+    int            capacity;
+} entry_list;
+
+static CRITICAL_SECTION g_lock;
+static bool             g_lockReady = false;
+static entry_list       g_table = {NULL, 0, 0};
+static entry_list       g_scratch = {NULL, 0, 0};
+static DWORD            g_refreshed = 0;
+static uint32_t         g_refreshes = 0;
+static uint32_t         g_updates = 0;
+static volatile LONG    g_generation = 0;
+
+static regions_module *g_modules = NULL;
+static int             g_moduleCount = 0;
+static DWORD           g_modulesRefreshed = 0;
+static volatile LONG   g_modulesDirty = 1;
+static void           *g_dllCookie = NULL;
+
+static dirty_slot    g_dirty[REGIONS_DIRTY_SLOTS];
+static volatile LONG g_dirtyNext = 0;
+static LONG          g_dirtyRead = 0;
+static bool          g_watching = false;
+
+//============================================================================
+// PROTECTION
+//============================================================================
+
+bool regions_readable(DWORD protect)
+{
+    return !(protect & (PAGE_GUARD | PAGE_NOACCESS)) && (protect & PROTECT_READ);
+}
+
+bool regions_writable(DWORD protect)
+{
+    return !(protect & (PAGE_GUARD | PAGE_NOACCESS)) && (protect & PROTECT_WRITE);
+}
+
+bool regions_executable(DWORD protect)
+{
+    return !(protect & (PAGE_GUARD | PAGE_NOACCESS)) && (protect & PROTECT_EXEC);
+}
+
+static bool access_allowed(DWORD protect, bool write)
+{
+    return write ? regions_writable(protect) : regions_readable(protect);
+}
+
+//============================================================================
+// TABLE
+//============================================================================
+
+static bool list_push(entry_list *list, const MEMORY_BASIC_INFORMATION *mbi)
+{
+    if (list->count == list->capacity)
+    {
+        int            grown_capacity = list->capacity ? list->capacity * 2 : 1024;
+        regions_entry *grown = realloc(list->items, grown_capacity * sizeof(regions_entry));
+        if (!grown)
+        {
+            return false;
+        }
+        list->items = grown;
+        list->capacity = grown_capacity;
+    }
+
+    regions_entry *e = &list->items[list->count++];
+    e->base = (uint32_t)(uintptr_t)mbi->BaseAddress;
+    e->end = e->base + (uint32_t)mbi->RegionSize;
+    e->alloc_base = (uint32_t)(uintptr_t)mbi->AllocationBase;
+    e->protect = mbi->Protect;
+    e->type = mbi->Type;
+    return true;
+}
+
+// Queries [address, hi) into list. Returns where the walk stopped, which
+// is a region boundary at or past hi.
+static uint32_t query_range(entry_list *list, uint32_t address, uint32_t hi, bool *ok)
+{
+    while (address < hi)
+    {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQuery((LPCVOID)(uintptr_t)address, &mbi, sizeof(mbi)) != sizeof(mbi))
+        {
+            return hi; /* Past the top of user space */
+        }
+
+        uint32_t end = (uint32_t)((uintptr_t)mbi.BaseAddress + mbi.RegionSize);
+        if (mbi.State == MEM_COMMIT && !list_push(list, &mbi))
+        {
+            *ok = false;
+            return hi;
+        }
+        if (end <= address)
+        {
+            return hi;
+        }
+        address = end;
+    }
+    return address;
+}
+
+// Caller holds g_lock
+static bool refresh_locked(void)
+{
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    // Anything recorded from here on is re-applied over the fresh table
+    g_dirtyRead = g_dirtyNext;
+
+    bool ok = true;
+    g_table.count = 0;
+    query_range(&g_table, (uint32_t)(uintptr_t)si.lpMinimumApplicationAddress,
+                (uint32_t)(uintptr_t)si.lpMaximumApplicationAddress, &ok);
+
+    g_refreshed = GetTickCount();
+    g_refreshes++;
+    InterlockedIncrement(&g_generation);
+    return ok;
+}
+
+// First entry ending above address
+static int lower_bound_locked(uint32_t address)
+{
+    int lo = 0, hi = g_table.count;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (g_table.items[mid].end <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Joins entry index into its predecessor when they describe one region
+static void merge_locked(int index)
+{
+    if (index <= 0 || index >= g_table.count)
+    {
+        return;
+    }
+
+    regions_entry *prev = &g_table.items[index - 1];
+    regions_entry *next = &g_table.items[index];
+    if (prev->end == next->base && prev->alloc_base == next->alloc_base && prev->protect == next->protect &&
+        prev->type == next->type)
+    {
+        prev->end = next->end;
+        memmove(next, next + 1, (g_table.count - index - 1) * sizeof(regions_entry));
+        g_table.count--;
+    }
+}
+
+// Re-queries [lo, hi) and splices the result over the stale entries
+static bool update_locked(uint32_t lo, uint32_t hi)
+{
+    lo &= ~(REGIONS_PAGE - 1);
+    hi = hi > lo ? ((hi - 1) | (REGIONS_PAGE - 1)) + 1 : lo + REGIONS_PAGE;
+    if (hi == 0)
+    {
+        hi = 0xFFFFF000u;
+    }
+
+    int first = lower_bound_locked(lo);
+    if (first < g_table.count && g_table.items[first].base < lo)
+    {
+        lo = g_table.items[first].base;
+    }
+
+    // Grow the window until neither old nor new entries cross its end
+    bool     ok = true;
+    uint32_t address = lo;
+    int      stop;
+    g_scratch.count = 0;
+    for (;;)
+    {
+        address = query_range(&g_scratch, address, hi, &ok);
+        hi = address;
+
+        stop = first;
+        while (stop < g_table.count && g_table.items[stop].base < hi)
+        {
+            stop++;
+        }
+        if (!ok || stop == first || g_table.items[stop - 1].end <= hi)
+        {
+            break;
+        }
+        hi = g_table.items[stop - 1].end;
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    int added = g_scratch.count;
+    int removed = stop - first;
+    int needed = g_table.count - removed + added;
+    if (needed > g_table.capacity)
+    {
+        regions_entry *grown = realloc(g_table.items, needed * sizeof(regions_entry));
+        if (!grown)
+        {
+            return false;
+        }
+        g_table.items = grown;
+        g_table.capacity = needed;
+    }
+
+    memmove(&g_table.items[first + added], &g_table.items[stop], (g_table.count - stop) * sizeof(regions_entry));
+    memcpy(&g_table.items[first], g_scratch.items, added * sizeof(regions_entry));
+    g_table.count = needed;
+
+    // VirtualQuery reports from the queried page, so rejoin split regions
+    merge_locked(first + added);
+    merge_locked(first);
+    g_updates++;
+    return true;
+}
+
+// Applies recorded changes; caller holds g_lock
+static void sync_locked(void)
+{
+    if (!g_watching)
+    {
+        return;
+    }
+
+    LONG end = g_dirtyNext;
+    if ((uint32_t)(end - g_dirtyRead) > REGIONS_DIRTY_SLOTS)
+    {
+        refresh_locked(); /* Ring overflowed */
+        return;
+    }
+
+    bool changed = false;
+    while (g_dirtyRead != end)
+    {
+        dirty_slot *slot = &g_dirty[g_dirtyRead & (REGIONS_DIRTY_SLOTS - 1)];
+        LONG        seq = slot->seq;
+        if (seq != g_dirtyRead + 1)
+        {
+            if ((int32_t)((uint32_t)seq - (uint32_t)(g_dirtyRead + 1)) > 0)
+            {
+                refresh_locked(); /* Overwritten before we got to it */
+                return;
+            }
+            break; /* Claimed but not yet published */
+        }
+
+        // A writer lapping the ring may be rewriting this slot right now
+        uint32_t lo = slot->lo, hi = slot->hi;
+        if ((uint32_t)(g_dirtyNext - g_dirtyRead) > REGIONS_DIRTY_SLOTS || !update_locked(lo, hi))
+        {
+            refresh_locked();
+            return;
+        }
+        g_dirtyRead++;
+        changed = true;
+    }
+
+    if (changed)
+    {
+        InterlockedIncrement(&g_generation);
+    }
+}
+
+// Index of the entry containing address, or -1
+static int find_locked(uint32_t address)
+{
+    int index = lower_bound_locked(address);
+    return index < g_table.count && g_table.items[index].base <= address ? index : -1;
+}
+
+static bool covered_locked(uint32_t address, uint32_t end, bool write)
+{
+    int index = find_locked(address);
+    if (index < 0)
+    {
+        return false;
+    }
+
+    // Walk contiguous regions until the range is covered
+    for (; index < g_table.count; index++)
+    {
+        const regions_entry *r = &g_table.items[index];
+        if (r->base > address || !access_allowed(r->protect, write))
+        {
+            return false;
+        }
+        if (end <= r->end)
+        {
+            return true;
+        }
+        address = r->end;
+    }
+    return false;
+}
+
+static bool covered_direct(uint32_t address, uint32_t end, bool write)
+{
+    while (address < end)
+    {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (VirtualQuery((LPCVOID)(uintptr_t)address, &mbi, sizeof(mbi)) != sizeof(mbi) ||
+            mbi.State != MEM_COMMIT || !access_allowed(mbi.Protect, write))
+        {
+            return false;
+        }
+        address = (uint32_t)((uintptr_t)mbi.BaseAddress + mbi.RegionSize);
+        if (address == 0)
+        {
+            return true; /* Region ends at the top of the address space */
+        }
+    }
+    return true;
+}
+
+// Rebuilds an unwatched table when it is old enough to be worth it
+static bool maybe_refresh_locked(void)
+{
+    if (g_watching || GetTickCount() - g_refreshed < REGIONS_REFRESH_MS)
+    {
+        return false;
+    }
+    refresh_locked();
+    return true;
+}
+
+//============================================================================
+// MODULES
+//============================================================================
+
+static int compare_modules(const void *a, const void *b)
+{
+    uint32_t x = ((const regions_module *)a)->base, y = ((const regions_module *)b)->base;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void refresh_modules_locked(void)
+{
+    InterlockedExchange(&g_modulesDirty, 0);
+    g_modulesRefreshed = GetTickCount();
+
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE | TH32CS_SNAPMODULE32, GetCurrentProcessId());
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    MODULEENTRY32 entry;
+    int           count = 0, capacity = 0;
+    regions_module *modules = NULL;
+
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Module32First(snapshot, &entry); more; more = Module32Next(snapshot, &entry))
+    {
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 128;
+            regions_module *grown = realloc(modules, capacity * sizeof(regions_module));
+            if (!grown)
+            {
+                break;
+            }
+            modules = grown;
+        }
+
+        regions_module *m = &modules[count++];
+        m->base = (uint32_t)(uintptr_t)entry.modBaseAddr;
+        m->end = m->base + entry.modBaseSize;
+        lstrcpynA(m->name, entry.szModule, sizeof(m->name));
+        lstrcpynA(m->path, entry.szExePath, sizeof(m->path));
+    }
+    CloseHandle(snapshot);
+
+    // A failed walk keeps the previous list
+    if (count == 0)
+    {
+        free(modules);
+        return;
+    }
+
+    qsort(modules, count, sizeof(regions_module), compare_modules);
+    free(g_modules);
+    g_modules = modules;
+    g_moduleCount = count;
+}
+
+static void sync_modules_locked(void)
+{
+    if (g_modulesDirty || (!g_dllCookie && GetTickCount() - g_modulesRefreshed >= REGIONS_REFRESH_MS))
+    {
+        refresh_modules_locked();
+    }
+}
+
+static const regions_module *module_at_locked(uint32_t address)
+{
+    int lo = 0, hi = g_moduleCount - 1;
+    while (lo <= hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (address < g_modules[mid].base)
+            hi = mid - 1;
+        else if (address >= g_modules[mid].end)
+            lo = mid + 1;
+        else
+            return &g_modules[mid];
+    }
+    return NULL;
+}
+
+//============================================================================
+// CHANGE NOTIFICATION
+//============================================================================
+
+// Called from any thread, possibly with others suspended: no locks, no heap
+static void note_change(uint32_t address, SIZE_T size)
+{
+    LONG        index = InterlockedIncrement(&g_dirtyNext) - 1;
+    dirty_slot *slot = &g_dirty[index & (REGIONS_DIRTY_SLOTS - 1)];
+    uint32_t    end = address + (uint32_t)size;
+
+    slot->lo = address;
+    slot->hi = end > address ? end : address + 1; /* Unknown size: the allocation at address */
+    InterlockedExchange(&slot->seq, index + 1);
+}
+
+enum
+{
+    HOOK_ALLOCATE,
+    HOOK_FREE,
+    HOOK_PROTECT,
+    HOOK_MAP,
+    HOOK_UNMAP,
+    HOOK_COUNT
+};
+
+typedef LONG(NTAPI *nt_allocate_fn)(HANDLE, void **, ULONG_PTR, SIZE_T *, ULONG, ULONG);
+typedef LONG(NTAPI *nt_free_fn)(HANDLE, void **, SIZE_T *, ULONG);
+typedef LONG(NTAPI *nt_protect_fn)(HANDLE, void **, SIZE_T *, ULONG, ULONG *);
+typedef LONG(NTAPI *nt_map_fn)(HANDLE, HANDLE, void **, ULONG_PTR, SIZE_T, LARGE_INTEGER *, SIZE_T *, DWORD, ULONG,
+                               ULONG);
+typedef LONG(NTAPI *nt_unmap_fn)(HANDLE, void *);
+typedef void(CALLBACK *ldr_notify_fn)(ULONG, const void *, void *);
+typedef LONG(NTAPI *ldr_register_fn)(ULONG, ldr_notify_fn, void *, void **);
+typedef LONG(NTAPI *ldr_unregister_fn)(void *);
+
+static detour g_hooks[HOOK_COUNT];
+
+// The calls may also target a child or other process, whose changes say
+// nothing about our address space
+static bool is_own_process(HANDLE process)
+{
+    return process == (HANDLE)(intptr_t)-1 || GetProcessId(process) == GetCurrentProcessId();
+}
+
+static LONG NTAPI hook_allocate(HANDLE process, void **base, ULONG_PTR zero_bits, SIZE_T *size, ULONG type,
+                                ULONG protect)
+{
+    LONG status = ((nt_allocate_fn)g_hooks[HOOK_ALLOCATE].trampoline)(process, base, zero_bits, size, type, protect);
+    if (status >= 0 && is_own_process(process))
+    {
+        note_change((uint32_t)(uintptr_t)*base, *size);
+    }
+    return status;
+}
+
+static LONG NTAPI hook_free(HANDLE process, void **base, SIZE_T *size, ULONG type)
+{
+    LONG status = ((nt_free_fn)g_hooks[HOOK_FREE].trampoline)(process, base, size, type);
+    if (status >= 0 && is_own_process(process))
+    {
+        note_change((uint32_t)(uintptr_t)*base, *size);
+    }
+    return status;
+}
+
+static LONG NTAPI hook_protect(HANDLE process, void **base, SIZE_T *size, ULONG protect, ULONG *old)
+{
+    LONG status = ((nt_protect_fn)g_hooks[HOOK_PROTECT].trampoline)(process, base, size, protect, old);
+    if (status >= 0 && is_own_process(process))
+    {
+        note_change((uint32_t)(uintptr_t)*base, *size);
+    }
+    return status;
+}
+
+static LONG NTAPI hook_map(HANDLE section, HANDLE process, void **base, ULONG_PTR zero_bits, SIZE_T commit,
+                           LARGE_INTEGER *offset, SIZE_T *view_size, DWORD inherit, ULONG type, ULONG protect)
+{
+    LONG status = ((nt_map_fn)g_hooks[HOOK_MAP].trampoline)(section, process, base, zero_bits, commit, offset,
+                                                           view_size, inherit, type, protect);
+    if (status >= 0 && is_own_process(process))
+    {
+        note_change((uint32_t)(uintptr_t)*base, *view_size);
+    }
+    return status;
+}
+
+static LONG NTAPI hook_unmap(HANDLE process, void *base)
+{
+    LONG status = ((nt_unmap_fn)g_hooks[HOOK_UNMAP].trampoline)(process, base);
+    if (status >= 0 && is_own_process(process))
+    {
+        note_change((uint32_t)(uintptr_t)base, 0);
+    }
+    return status;
+}
+
+static void CALLBACK dll_notification(ULONG reason, const void *data, void *context)
+{
+    (void)reason;
+    (void)data;
+    (void)context;
+    InterlockedExchange(&g_modulesDirty, 1);
+}
+
+static void unwatch(void)
+{
+    g_watching = false;
+    for (int i = 0; i < HOOK_COUNT; i++)
+    {
+        if (g_hooks[i].attached)
+        {
+            detour_disable(&g_hooks[i]);
+        }
+    }
+
+    if (g_dllCookie)
+    {
+        ldr_unregister_fn unregister =
+            (ldr_unregister_fn)(void *)GetProcAddress(GetModuleHandleA("ntdll.dll"), "LdrUnregisterDllNotification");
+        if (unregister)
+        {
+            unregister(g_dllCookie);
+        }
+        g_dllCookie = NULL;
+    }
+}
+
+static bool watch(void)
+{
+    static const char *const names[HOOK_COUNT] = {"NtAllocateVirtualMemory", "NtFreeVirtualMemory",
+                                                  "NtProtectVirtualMemory", "NtMapViewOfSection",
+                                                  "NtUnmapViewOfSection"};
+    void *const hooks[HOOK_COUNT] = {(void *)hook_allocate, (void *)hook_free, (void *)hook_protect,
+                                     (void *)hook_map, (void *)hook_unmap};
+    HMODULE ntdll = GetModuleHandleA("ntdll.dll");
+    if (!ntdll)
+    {
+        return false;
+    }
+
+    ldr_register_fn reg = (ldr_register_fn)(void *)GetProcAddress(ntdll, "LdrRegisterDllNotification");
+    if (!reg || reg(0, dll_notification, NULL, &g_dllCookie) < 0)
+    {
+        g_dllCookie = NULL;
+    }
+
+    // All trampolines exist before any patch, so a hook never runs half-built
+    for (int i = 0; i < HOOK_COUNT; i++)
+    {
+        void *target = (void *)GetProcAddress(ntdll, names[i]);
+        if (!target || !detour_create(&g_hooks[i], target, hooks[i]))
+        {
+            logf("[REGIONS] Cannot hook %s, falling back to periodic refresh", names[i]);
+            return false;
+        }
+    }
+
+    for (int i = 0; i < HOOK_COUNT; i++)
+    {
+        if (!detour_enable(&g_hooks[i]))
+        {
+            logf("[REGIONS] Cannot patch %s, falling back to periodic refresh", names[i]);
+            unwatch();
+            return false;
+        }
+    }
+
+    g_watching = true;
+    return true;
+}
+
+//============================================================================
+// PUBLIC API
+//============================================================================
+
+void regions_init(void)
+{
+    if (g_lockReady)
+    {
+        return;
+    }
+    InitializeCriticalSection(&g_lock);
+    g_lockReady = true;
+
+    // Hooks go in first so nothing between the walk and them is missed
+    bool watched = watch();
+
+    EnterCriticalSection(&g_lock);
+    refresh_locked();
+    refresh_modules_locked();
+    logf("[REGIONS] Mapped %d regions and %d modules (%s)", g_table.count, g_moduleCount,
+         watched ? "tracking changes" : "periodic refresh");
+    LeaveCriticalSection(&g_lock);
+}
+
+void regions_shutdown(void)
+{
+    if (!g_lockReady)
+    {
+        return;
+    }
+
+    unwatch();
+
+    EnterCriticalSection(&g_lock);
+    free(g_table.items);
+    free(g_scratch.items);
+    free(g_modules);
+    memset(&g_table, 0, sizeof(g_table));
+    memset(&g_scratch, 0, sizeof(g_scratch));
+    g_modules = NULL;
+    g_moduleCount = 0;
+    LeaveCriticalSection(&g_lock);
+
+    DeleteCriticalSection(&g_lock);
+    g_lockReady = false;
+}
+
+bool regions_refresh(void)
+{
+    if (!g_lockReady)
+    {
+        return false;
+    }
+
+    EnterCriticalSection(&g_lock);
+    bool ok = refresh_locked();
+    refresh_modules_locked();
+    LeaveCriticalSection(&g_lock);
+    return ok;
+}
+
+// Marks a range as possibly changed, e.g. after a fault on memory the
+// table still listed
+void regions_invalidate(uint32_t address, uint32_t size)
+{
+    if (g_watching)
+    {
+        note_change(address, size);
+    }
+    else if (g_lockReady)
+    {
+        EnterCriticalSection(&g_lock);
+        g_refreshed = GetTickCount() - REGIONS_REFRESH_MS;
+        LeaveCriticalSection(&g_lock);
+    }
+}
+
+// Bumped whenever the table changes
+uint32_t regions_generation(void)
+{
+    return (uint32_t)g_generation;
+}
+
+// True if [address, address + size) is committed and allows the access
+bool regions_check(uint32_t address, uint32_t size, bool write)
+{
+    uint32_t end = address + (size ? size : 1);
+    if (end < address || !g_lockReady)
+    {
+        return false;
+    }
+
+    EnterCriticalSection(&g_lock);
+    sync_locked();
+    bool ok = covered_locked(address, end, write);
+    if (!ok && !g_watching)
+    {
+        ok = maybe_refresh_locked() ? covered_locked(address, end, write) : covered_direct(address, end, write);
+    }
+    LeaveCriticalSection(&g_lock);
+    return ok;
+}
+
+// The committed region containing address
+bool regions_find(uint32_t address, regions_entry *out)
+{
+    if (!g_lockReady)
+    {
+        return false;
+    }
+
+    EnterCriticalSection(&g_lock);
+    sync_locked();
+    int index = find_locked(address);
+    if (index < 0 && maybe_refresh_locked())
+    {
+        index = find_locked(address);
+    }
+    if (index >= 0)
+    {
+        *out = g_table.items[index];
+    }
+    LeaveCriticalSection(&g_lock);
+    return index >= 0;
+}
+
+// Copies the committed regions overlapping [start, stop) in address order,
+// clipped to the range. Returns the count (caller frees *out), -1 on failure.
+int regions_copy(uint32_t start, uint32_t stop, regions_entry **out)
+{
+    *out = NULL;
+    if (!g_lockReady)
+    {
+        return -1;
+    }
+
+    EnterCriticalSection(&g_lock);
+    sync_locked();
+    if (!g_watching)
+    {
+        refresh_locked(); /* Callers want the current layout, not one 250 ms old */
+    }
+
+    int first = lower_bound_locked(start);
+    int stop_index = first;
+    while (stop_index < g_table.count && g_table.items[stop_index].base < stop)
+    {
+        stop_index++;
+    }
+
+    int count = stop_index - first;
+    regions_entry *copy = malloc((count ? count : 1) * sizeof(regions_entry));
+    if (copy)
+    {
+        memcpy(copy, &g_table.items[first], count * sizeof(regions_entry));
+        if (count)
+        {
+            copy[0].base = copy[0].base > start ? copy[0].base : start;
+            copy[count - 1].end = copy[count - 1].end < stop ? copy[count - 1].end : stop;
+        }
+    }
+    LeaveCriticalSection(&g_lock);
+
+    *out = copy;
+    return copy ? count : -1;
+}
+
+// The loaded module whose image contains address
+bool regions_module_of(uint32_t address, regions_module *out)
+{
+    if (!g_lockReady)
+    {
+        return false;
+    }
+
+    EnterCriticalSection(&g_lock);
+    sync_modules_locked();
+    const regions_module *m = module_at_locked(address);
+    if (m)
+    {
+        *out = *m;
+    }
+    LeaveCriticalSection(&g_lock);
+    return m != NULL;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static const char *type_name(DWORD type)
+{
+    switch (type)
+    {
+    case MEM_IMAGE:
+        return "image";
+    case MEM_MAPPED:
+        return "mapped";
+    default:
+        return "private";
+    }
+}
+
+// Caller holds g_lock with modules synced
+static void push_entry(lua_State *L, const regions_entry *e)
+{
+    char protect[4] = {regions_readable(e->protect) ? 'r' : '-', regions_writable(e->protect) ? 'w' : '-',
+                       regions_executable(e->protect) ? 'x' : '-', 0};
+
+    lua_createtable(L, 0, 7);
+    lua_pushnumber(L, e->base);
+    lua_setfield(L, -2, "base");
+    lua_pushnumber(L, e->end - e->base);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, e->alloc_base);
+    lua_setfield(L, -2, "alloc_base");
+    lua_pushstring(L, protect);
+    lua_setfield(L, -2, "protect");
+    lua_pushboolean(L, (e->protect & PAGE_GUARD) != 0);
+    lua_setfield(L, -2, "guard");
+    lua_pushstring(L, type_name(e->type));
+    lua_setfield(L, -2, "type");
+
+    const regions_module *m = e->type == MEM_IMAGE ? module_at_locked(e->base) : NULL;
+    if (m)
+    {
+        lua_pushstring(L, m->name);
+        lua_setfield(L, -2, "module");
+    }
+}
+
+static void push_module(lua_State *L, const regions_module *m)
+{
+    lua_createtable(L, 0, 4);
+    lua_pushstring(L, m->name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, m->base);
+    lua_setfield(L, -2, "base");
+    lua_pushnumber(L, m->end - m->base);
+    lua_setfield(L, -2, "size");
+    lua_pushstring(L, m->path);
+    lua_setfield(L, -2, "path");
+}
+
+// mem.region_of(addr) -> region table, or nil if nothing is committed there
+static int l_mem_region_of(lua_State *L)
+{
+    uint32_t      address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    regions_entry e;
+
+    if (!regions_find(address, &e))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    EnterCriticalSection(&g_lock);
+    sync_modules_locked();
+    push_entry(L, &e);
+    LeaveCriticalSection(&g_lock);
+    return 1;
+}
+
+static bool opt_flag(lua_State *L, int opts, const char *field)
+{
+    lua_getfield(L, opts, field);
+    bool value = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+    return value;
+}
+
+// mem.regions([opts]) -> { region, ... } in address order
+// opts: start, stop, module, readable, writable, exec
+static int l_mem_regions(lua_State *L)
+{
+    uint32_t start = 0, stop = 0xFFFFFFFFu;
+    bool     has_opts = lua_istable(L, 1);
+    bool     readable = has_opts && opt_flag(L, 1, "readable");
+    bool     writable = has_opts && opt_flag(L, 1, "writable");
+    bool     exec = has_opts && opt_flag(L, 1, "exec");
+
+    if (has_opts)
+    {
+        lua_getfield(L, 1, "start");
+        start = lua_isnil(L, -1) ? start : (uint32_t)(int64_t)lua_tonumber(L, -1);
+        lua_getfield(L, 1, "stop");
+        stop = lua_isnil(L, -1) ? stop : (uint32_t)(int64_t)lua_tonumber(L, -1);
+        lua_getfield(L, 1, "module");
+        const char *module = lua_tostring(L, -1);
+        if (module)
+        {
+            bool found = false;
+            EnterCriticalSection(&g_lock);
+            sync_modules_locked();
+            for (int i = 0; i < g_moduleCount && !found; i++)
+            {
+                if (lstrcmpiA(g_modules[i].name, module) == 0)
+                {
+                    start = g_modules[i].base;
+                    stop = g_modules[i].end;
+                    found = true;
+                }
+            }
+            LeaveCriticalSection(&g_lock);
+            if (!found)
+            {
+                return luaL_error(L, "module '%s' is not loaded", module);
+            }
+        }
+        lua_pop(L, 3);
+    }
+
+    regions_entry *entries;
+    int            count = regions_copy(start, stop, &entries);
+    if (count < 0)
+    {
+        return luaL_error(L, "out of memory");
+    }
+
+    lua_createtable(L, count, 0);
+    EnterCriticalSection(&g_lock);
+    sync_modules_locked();
+    for (int i = 0, n = 0; i < count; i++)
+    {
+        const regions_entry *e = &entries[i];
+        if ((readable && !regions_readable(e->protect)) || (writable && !regions_writable(e->protect)) ||
+            (exec && !regions_executable(e->protect)))
+        {
+            continue;
+        }
+        push_entry(L, e);
+        lua_rawseti(L, -2, ++n);
+    }
+    LeaveCriticalSection(&g_lock);
+
+    free(entries);
+    return 1;
+}
+
+// mem.modules() -> { {name, base, size, path}, ... } in address order
+static int l_mem_modules(lua_State *L)
+{
+    EnterCriticalSection(&g_lock);
+    sync_modules_locked();
+    lua_createtable(L, g_moduleCount, 0);
+    for (int i = 0; i < g_moduleCount; i++)
+    {
+        push_module(L, &g_modules[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    LeaveCriticalSection(&g_lock);
+    return 1;
+}
+
+// mem.module_of(addr) -> module table, or nil
+static int l_mem_module_of(lua_State *L)
+{
+    regions_module m;
+    if (!regions_module_of((uint32_t)(int64_t)luaL_checknumber(L, 1), &m))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    push_module(L, &m);
+    return 1;
+}
+
+static int l_mem_regions_info(lua_State *L)
+{
+    EnterCriticalSection(&g_lock);
+    sync_locked();
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, g_table.count);
+    lua_setfield(L, -2, "regions");
+    lua_pushnumber(L, g_moduleCount);
+    lua_setfield(L, -2, "modules");
+    lua_pushnumber(L, (uint32_t)g_generation);
+    lua_setfield(L, -2, "generation");
+    lua_pushnumber(L, g_refreshes);
+    lua_setfield(L, -2, "refreshes");
+    lua_pushnumber(L, g_updates);
+    lua_setfield(L, -2, "updates");
+    lua_pushboolean(L, g_watching);
+    lua_setfield(L, -2, "tracking");
+    LeaveCriticalSection(&g_lock);
+    return 1;
+}
+
+static int l_mem_regions_refresh(lua_State *L)
+{
+    if (!regions_refresh())
+    {
+        return luaL_error(L, "out of memory");
+    }
+    lua_pushnumber(L, regions_generation());
+    return 1;
+}
+
+static const luaL_Reg regions_funcs[] = {{"region_of", l_mem_region_of},
+                                         {"regions", l_mem_regions},
+                                         {"modules", l_mem_modules},
+                                         {"module_of", l_mem_module_of},
+                                         {"regions_info", l_mem_regions_info},
+                                         {"regions_refresh", l_mem_regions_refresh},
+                                         {NULL, NULL}};
+
+int luaopen_regions(lua_State *L)
+{
+    luaL_register(L, "mem", regions_funcs);
+    return 1;
+}
@@ -0,0 +1,41 @@
+#ifndef REGIONS_H
+#define REGIONS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+
+typedef struct
+{
+    uint32_t base;
+    uint32_t end;
+    uint32_t alloc_base;
+    DWORD    protect;
+    DWORD    type; /* MEM_IMAGE, MEM_MAPPED or MEM_PRIVATE */
+} regions_entry;
+
+typedef struct
+{
+    uint32_t base;
+    uint32_t end;
+    char     name[64];
+    char     path[MAX_PATH];
+} regions_module;
+
+void     regions_init(void);
+void     regions_shutdown(void);
+bool     regions_refresh(void);
+void     regions_invalidate(uint32_t address, uint32_t size);
+uint32_t regions_generation(void);
+bool     regions_check(uint32_t address, uint32_t size, bool write);
+bool     regions_find(uint32_t address, regions_entry *out);
+int      regions_copy(uint32_t start, uint32_t stop, regions_entry **out);
+bool     regions_module_of(uint32_t address, regions_module *out);
+bool     regions_readable(DWORD protect);
+bool     regions_writable(DWORD protect);
+bool     regions_executable(DWORD protect);
+int      luaopen_regions(lua_State *L);
+
+#endif // REGIONS_H
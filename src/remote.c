@@ -0,0 +1,1098 @@
+/*
+ * remote.c: Remote control endpoint for external tooling.
+ *
+ * An optional server thread listens on a named pipe or a loopback TCP port
+ * and speaks the framed protocol in remoteformat.h, one client at a time.
+ * Every complete request in a read is served as one pipeline: consecutive
+ * eval, call and read requests become a single dispatch job, so a burst of
+ * them costs one trip through the game's message pump, and their responses
+ * go back in one write. Scans run on the server thread and the worker pool,
+ * as mem.scan does from the console.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "dispatch.h"
+#include "frame.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "luastate.h"
+#include "memview.h"
+#include "remote.h"
+#include "scan.h"
+
+// Lifecycle of one submission of a batch to the main thread
+enum
+{
+    BATCH_QUEUED = 0,
+    BATCH_RUNNING = 1,
+    BATCH_DONE = 2,
+    BATCH_ABANDONED = 3 /* remote.stop gave up waiting; the job skips it when it runs */
+};
+
+typedef struct
+{
+    uint8_t *data;
+    size_t   length;
+    size_t   capacity;
+    bool     failed; /* An append ran out of memory */
+} remote_buffer;
+
+typedef struct
+{
+    const uint8_t *frames[REMOTE_BATCH_MAX]; /* Requests, each a header followed by its payload */
+    int            count;
+    int            next;  /* First request not served yet */
+    size_t         bytes; /* Read lengths queued, bounds the responses */
+    volatile LONG  state;
+    bool           busy; /* Stopped at an eval because another thread holds the Lua state */
+    dispatch_job  *call; /* Reused for REMOTE_CALL; carries the dispatcher's call thunk */
+    remote_buffer  out;
+} remote_batch;
+
+typedef struct
+{
+    HANDLE     pipe;
+    SOCKET     socket;
+    OVERLAPPED overlapped;
+} remote_conn;
+
+typedef struct
+{
+    volatile LONG connections;
+    volatile LONG requests;
+    volatile LONG batches;
+    volatile LONG busy_retries;
+    volatile LONG dropped; /* Connections closed over a malformed frame */
+    uint64_t      bytes_in;  /* Written by the server thread only */
+    uint64_t      bytes_out;
+} remote_stats;
+
+static HANDLE        g_thread = NULL;
+static HANDLE        g_stopEvent = NULL;
+static HANDLE        g_pipe = INVALID_HANDLE_VALUE; /* Listening pipe instance, or ... */
+static SOCKET        g_listen = INVALID_SOCKET;     /* ... listening socket */
+static HANDLE        g_acceptEvent = NULL;
+static bool          g_winsock = false;
+static volatile LONG g_connected = 0;
+static char          g_endpoint[128];
+static remote_stats  g_stats = {0};
+
+static bool stopping(void)
+{
+    return WaitForSingleObject(g_stopEvent, 0) == WAIT_OBJECT_0;
+}
+
+//============================================================================
+// RESPONSE BUFFERS
+//============================================================================
+
+static bool buffer_reserve(remote_buffer *b, size_t extra)
+{
+    if (b->failed)
+    {
+        return false;
+    }
+    if (b->length + extra <= b->capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = b->capacity ? b->capacity : REMOTE_RECV_SIZE;
+    while (capacity < b->length + extra)
+    {
+        capacity *= 2;
+    }
+    uint8_t *grown = realloc(b->data, capacity);
+    if (!grown)
+    {
+        b->failed = true;
+        return false;
+    }
+    b->data = grown;
+    b->capacity = capacity;
+    return true;
+}
+
+static void put(remote_buffer *b, const void *data, size_t length)
+{
+    if (buffer_reserve(b, length))
+    {
+        memcpy(b->data + b->length, data, length);
+        b->length += length;
+    }
+}
+
+// Starts a response frame; frame_end fills in its length
+static size_t frame_begin(remote_buffer *b, const remote_header *request, uint8_t flags, uint16_t status)
+{
+    remote_header header = {0, request->id, request->op, flags, status};
+    size_t        at = b->length;
+    put(b, &header, sizeof(header));
+    return at;
+}
+
+static void frame_end(remote_buffer *b, size_t at)
+{
+    if (!b->failed)
+    {
+        uint32_t length = (uint32_t)(b->length - at - sizeof(remote_header));
+        memcpy(b->data + at, &length, sizeof(length));
+    }
+}
+
+static void respond(remote_buffer *b, const remote_header *request, uint8_t flags, uint16_t status, const void *data,
+                    size_t length)
+{
+    size_t at = frame_begin(b, request, flags, status);
+    put(b, data, length);
+    frame_end(b, at);
+}
+
+static void respond_error(remote_buffer *b, const remote_header *request, uint16_t status, const char *format, ...)
+{
+    char    message[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    if (length < 0 || length >= (int)sizeof(message))
+    {
+        length = (int)strlen(message);
+    }
+    respond(b, request, 0, status, message, (size_t)length);
+}
+
+static void put_string(remote_buffer *b, uint8_t type, const char *text, size_t length)
+{
+    uint32_t size = (uint32_t)length;
+    put(b, &type, 1);
+    put(b, &size, sizeof(size));
+    put(b, text, length);
+}
+
+static void put_value(remote_buffer *b, lua_State *L, int index)
+{
+    uint8_t type;
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+        type = REMOTE_VALUE_NIL;
+        put(b, &type, 1);
+        break;
+    case LUA_TBOOLEAN:
+    {
+        uint8_t value[2] = {REMOTE_VALUE_BOOLEAN, (uint8_t)(lua_toboolean(L, index) != 0)};
+        put(b, value, sizeof(value));
+        break;
+    }
+    case LUA_TNUMBER:
+    {
+        double number = lua_tonumber(L, index);
+        type = REMOTE_VALUE_NUMBER;
+        put(b, &type, 1);
+        put(b, &number, sizeof(number));
+        break;
+    }
+    case LUA_TSTRING:
+    {
+        size_t      length;
+        const char *text = lua_tolstring(L, index, &length);
+        put_string(b, REMOTE_VALUE_STRING, text, length);
+        break;
+    }
+    default:
+    {
+        char text[64];
+        int  length = snprintf(text, sizeof(text), "%s: %p", luaL_typename(L, index), lua_topointer(L, index));
+        put_string(b, REMOTE_VALUE_OTHER, text, (size_t)length);
+        break;
+    }
+    }
+}
+
+//============================================================================
+// MAIN THREAD REQUESTS
+//============================================================================
+
+static void serve_eval(lua_State *L, remote_buffer *out, const remote_header *request, const uint8_t *payload)
+{
+    int top = lua_gettop(L);
+    int status = luaL_loadbuffer(L, (const char *)payload, request->length, "=remote");
+    if (status == 0)
+    {
+        status = lua_pcall(L, 0, LUA_MULTRET, 0);
+    }
+
+    if (status != 0)
+    {
+        size_t      length = 0;
+        const char *error = lua_tolstring(L, -1, &length);
+        if (!error)
+        {
+            error = "(unknown error)";
+            length = strlen(error);
+        }
+        respond(out, request, 0, REMOTE_ERROR, error, length);
+    }
+    else
+    {
+        size_t at = frame_begin(out, request, 0, REMOTE_OK);
+        for (int i = top + 1; i <= lua_gettop(L); i++)
+        {
+            put_value(out, L, i);
+        }
+        frame_end(out, at);
+    }
+    lua_settop(L, top);
+}
+
+static void serve_call(remote_batch *batch, const remote_header *request, const uint8_t *payload)
+{
+    remote_call call;
+    if (request->length < sizeof(call))
+    {
+        respond_error(&batch->out, request, REMOTE_BAD_REQUEST, "call needs a remote_call header");
+        return;
+    }
+    memcpy(&call, payload, sizeof(call));
+
+    if (call.nwords > DISPATCH_MAX_WORDS || request->length != sizeof(call) + call.nwords * sizeof(uint32_t))
+    {
+        respond_error(&batch->out, request, REMOTE_BAD_REQUEST, "call payload does not match %u stack words",
+                      (unsigned)call.nwords);
+        return;
+    }
+    if (call.address == 0)
+    {
+        respond_error(&batch->out, request, REMOTE_BAD_REQUEST, "null function address");
+        return;
+    }
+    if (call.conv > DISPATCH_THISCALL || call.ret_kind == '\0' || !strchr("viupqfdbcCsS", call.ret_kind))
+    {
+        respond_error(&batch->out, request, REMOTE_BAD_REQUEST, "unknown calling convention or return kind");
+        return;
+    }
+
+    // Already on the main thread: run the dispatcher's thunk directly
+    dispatch_job *job = batch->call;
+    job->target = (void *)(uintptr_t)call.address;
+    job->conv = call.conv;
+    job->ret_kind = call.ret_kind;
+    job->nwords = call.nwords;
+    job->ecx = call.ecx;
+    job->edx = call.edx;
+    job->result.i = 0;
+    memcpy(job->words, payload + sizeof(call), call.nwords * sizeof(uint32_t));
+    job->run(job);
+
+    respond(&batch->out, request, 0, REMOTE_OK, &job->result, sizeof(job->result));
+}
+
+static void serve_read(remote_buffer *out, const remote_header *request, const uint8_t *payload)
+{
+    remote_read read;
+    if (request->length != sizeof(read))
+    {
+        respond_error(out, request, REMOTE_BAD_REQUEST, "read needs a remote_read payload");
+        return;
+    }
+    memcpy(&read, payload, sizeof(read));
+    if (read.length > REMOTE_MAX_READ || read.address + read.length < read.address)
+    {
+        respond_error(out, request, REMOTE_BAD_REQUEST, "read of %u bytes at 0x%08X is out of range",
+                      (unsigned)read.length, (unsigned)read.address);
+        return;
+    }
+
+    const uint8_t *source = (const uint8_t *)(uintptr_t)read.address;
+    uint32_t       offset = 0;
+    do
+    {
+        uint32_t part = read.length - offset < REMOTE_STREAM_CHUNK ? read.length - offset : REMOTE_STREAM_CHUNK;
+        bool     last = offset + part == read.length;
+        size_t   at = frame_begin(out, request, last ? 0 : REMOTE_FLAG_MORE, REMOTE_OK);
+        if (!buffer_reserve(out, part))
+        {
+            return;
+        }
+
+        uint32_t fault = 0;
+        if (!memview_copy(out->data + out->length, source + offset, part, &fault))
+        {
+            // The frames already streamed stand; the error ends the response
+            out->length = at;
+            respond_error(out, request, REMOTE_ERROR, "access violation reading 0x%08X", (unsigned)fault);
+            return;
+        }
+        out->length += part;
+        frame_end(out, at);
+        offset += part;
+    } while (offset < read.length);
+}
+
+// Serves the batch from batch->next on. Stops early at an eval while the
+// Lua state is taken; the server thread submits the rest again.
+static void run_batch(dispatch_job *job)
+{
+    remote_batch *batch = (remote_batch *)job->user;
+    if (InterlockedCompareExchange(&batch->state, BATCH_RUNNING, BATCH_QUEUED) != BATCH_QUEUED)
+    {
+        return;
+    }
+
+    lua_State *L = NULL;
+    uint16_t   saved_cw = 0;
+    batch->busy = false;
+    while (batch->next < batch->count && !batch->out.failed)
+    {
+        remote_header  request;
+        const uint8_t *frame = batch->frames[batch->next];
+        memcpy(&request, frame, sizeof(request));
+        const uint8_t *payload = frame + sizeof(request);
+
+        if (request.op == REMOTE_EVAL)
+        {
+            // Lua already running on this thread (a frame callback calling
+            // into the pump) must not be re-entered
+            if (!L)
+            {
+                L = luastate_held() ? NULL : luastate_try_acquire();
+                if (!L)
+                {
+                    batch->busy = true;
+                    break;
+                }
+                saved_cw = frame_fpu_enter();
+            }
+            serve_eval(L, &batch->out, &request, payload);
+        }
+        else if (request.op == REMOTE_CALL)
+        {
+            serve_call(batch, &request, payload);
+        }
+        else
+        {
+            serve_read(&batch->out, &request, payload);
+        }
+        batch->next++;
+    }
+
+    if (L)
+    {
+        frame_fpu_leave(saved_cw);
+        luastate_release();
+    }
+    InterlockedExchange(&batch->state, BATCH_DONE);
+}
+
+// Runs the queued requests on the main thread, retrying while the console
+// holds the Lua state. Returns false if the server is stopping; the batch
+// is then BATCH_ABANDONED if a job still references it.
+static bool run_pending(remote_batch *batch)
+{
+    while (batch->next < batch->count && !batch->out.failed)
+    {
+        dispatch_job *job = dispatch_job_new(run_batch, batch);
+        if (!job)
+        {
+            batch->out.failed = true;
+            break;
+        }
+
+        batch->state = BATCH_QUEUED;
+        if (!dispatch_submit(job))
+        {
+            dispatch_job_release(job);
+            for (; batch->next < batch->count; batch->next++)
+            {
+                remote_header request;
+                memcpy(&request, batch->frames[batch->next], sizeof(request));
+                respond_error(&batch->out, &request, REMOTE_ERROR, "main thread dispatcher is not attached");
+            }
+            break;
+        }
+
+        while (!dispatch_wait(job, REMOTE_WAIT_SLICE_MS))
+        {
+            if (stopping() &&
+                InterlockedCompareExchange(&batch->state, BATCH_ABANDONED, BATCH_QUEUED) == BATCH_QUEUED)
+            {
+                dispatch_job_release(job);
+                return false;
+            }
+        }
+        dispatch_job_release(job);
+        InterlockedIncrement(&g_stats.batches);
+
+        if (batch->busy)
+        {
+            InterlockedIncrement(&g_stats.busy_retries);
+            if (WaitForSingleObject(g_stopEvent, REMOTE_BUSY_RETRY_MS) == WAIT_OBJECT_0)
+            {
+                return false;
+            }
+        }
+    }
+
+    batch->count = 0;
+    batch->next = 0;
+    batch->bytes = 0;
+    return true;
+}
+
+//============================================================================
+// TRANSPORT
+//============================================================================
+
+// Waits for the connection's overlapped operation. On remote.stop the
+// operation is cancelled and waited out so the OVERLAPPED can be reused.
+static bool wait_io(remote_conn *conn)
+{
+    HANDLE handles[2] = {conn->overlapped.hEvent, g_stopEvent};
+    if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+    {
+        return true;
+    }
+
+    DWORD  done;
+    HANDLE file = conn->pipe != INVALID_HANDLE_VALUE ? conn->pipe : (HANDLE)conn->socket;
+    CancelIoEx(file, &conn->overlapped);
+    GetOverlappedResult(file, &conn->overlapped, &done, TRUE);
+    return false;
+}
+
+// Bytes read, 0 once the client disconnected, -1 on failure or remote.stop
+static int conn_read(remote_conn *conn, uint8_t *data, size_t capacity)
+{
+    DWORD done = 0;
+    ResetEvent(conn->overlapped.hEvent);
+
+    if (conn->pipe != INVALID_HANDLE_VALUE)
+    {
+        if (!ReadFile(conn->pipe, data, (DWORD)capacity, &done, &conn->overlapped))
+        {
+            DWORD error = GetLastError();
+            if (error != ERROR_IO_PENDING)
+            {
+                return error == ERROR_BROKEN_PIPE ? 0 : -1;
+            }
+            if (!wait_io(conn))
+            {
+                return -1;
+            }
+            if (!GetOverlappedResult(conn->pipe, &conn->overlapped, &done, FALSE))
+            {
+                return GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+            }
+        }
+        return (int)done;
+    }
+
+    WSABUF buffer = {(ULONG)capacity, (char *)data};
+    DWORD  flags = 0;
+    if (WSARecv(conn->socket, &buffer, 1, &done, &flags, &conn->overlapped, NULL) == SOCKET_ERROR)
+    {
+        int error = WSAGetLastError();
+        if (error != WSA_IO_PENDING)
+        {
+            log_winsock_error("[REMOTE] recv", conn->socket, error);
+            return -1;
+        }
+        if (!wait_io(conn))
+        {
+            return -1;
+        }
+        if (!WSAGetOverlappedResult(conn->socket, &conn->overlapped, &done, FALSE, &flags))
+        {
+            log_winsock_error("[REMOTE] recv", conn->socket, WSAGetLastError());
+            return -1;
+        }
+    }
+    return (int)done;
+}
+
+static bool conn_write(remote_conn *conn, const uint8_t *data, size_t length)
+{
+    while (length > 0)
+    {
+        DWORD done = 0;
+        DWORD part = length > 0x100000 ? 0x100000 : (DWORD)length;
+        ResetEvent(conn->overlapped.hEvent);
+
+        if (conn->pipe != INVALID_HANDLE_VALUE)
+        {
+            if (!WriteFile(conn->pipe, data, part, &done, &conn->overlapped) &&
+                (GetLastError() != ERROR_IO_PENDING || !wait_io(conn) ||
+                 !GetOverlappedResult(conn->pipe, &conn->overlapped, &done, FALSE)))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            WSABUF buffer = {part, (char *)data};
+            DWORD  flags = 0;
+            if (WSASend(conn->socket, &buffer, 1, &done, 0, &conn->overlapped, NULL) == SOCKET_ERROR)
+            {
+                int error = WSAGetLastError();
+                if (error != WSA_IO_PENDING || !wait_io(conn) ||
+                    !WSAGetOverlappedResult(conn->socket, &conn->overlapped, &done, FALSE, &flags))
+                {
+                    log_winsock_error("[REMOTE] send", conn->socket, error == WSA_IO_PENDING ? WSAGetLastError() : error);
+                    return false;
+                }
+            }
+        }
+
+        data += done;
+        length -= done;
+        g_stats.bytes_out += done;
+    }
+    return true;
+}
+
+static bool send_output(remote_conn *conn, remote_batch *batch)
+{
+    if (batch->out.failed)
+    {
+        logf("[REMOTE] Out of memory building responses, dropping the client");
+        return false;
+    }
+    bool ok = conn_write(conn, batch->out.data, batch->out.length);
+    batch->out.length = 0;
+    return ok;
+}
+
+// Waits for the next client. False on remote.stop or a failed accept.
+static bool accept_client(remote_conn *conn)
+{
+    if (g_pipe != INVALID_HANDLE_VALUE)
+    {
+        conn->pipe = g_pipe;
+        ResetEvent(conn->overlapped.hEvent);
+        if (ConnectNamedPipe(g_pipe, &conn->overlapped))
+        {
+            return true;
+        }
+
+        DWORD done, error = GetLastError();
+        if (error == ERROR_PIPE_CONNECTED)
+        {
+            return true;
+        }
+        if (error == ERROR_IO_PENDING && wait_io(conn) && GetOverlappedResult(g_pipe, &conn->overlapped, &done, FALSE))
+        {
+            return true;
+        }
+        if (error == ERROR_NO_DATA)
+        {
+            // The client came and went before we looked; free the instance
+            DisconnectNamedPipe(g_pipe);
+        }
+        else if (!stopping())
+        {
+            logf("[REMOTE] Waiting for a client on %s failed (error %lu)", g_endpoint, GetLastError());
+        }
+        return false;
+    }
+
+    SOCKET client = INVALID_SOCKET;
+    while (client == INVALID_SOCKET)
+    {
+        HANDLE handles[2] = {g_acceptEvent, g_stopEvent};
+        if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+        {
+            return false;
+        }
+        ResetEvent(g_acceptEvent);
+
+        client = accept(g_listen, NULL, NULL);
+        int error = client == INVALID_SOCKET ? WSAGetLastError() : 0;
+        if (error && error != WSAEWOULDBLOCK)
+        {
+            log_winsock_error("[REMOTE] accept", g_listen, error);
+            return false;
+        }
+    }
+
+    // Accepted sockets inherit the listener's event selection and non-blocking mode
+    u_long blocking = 0;
+    int    nodelay = 1;
+    WSAEventSelect(client, NULL, 0);
+    ioctlsocket(client, FIONBIO, &blocking);
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+    conn->pipe = INVALID_HANDLE_VALUE;
+    conn->socket = client;
+    return true;
+}
+
+static void close_client(remote_conn *conn)
+{
+    if (conn->pipe != INVALID_HANDLE_VALUE)
+    {
+        DisconnectNamedPipe(conn->pipe);
+    }
+    else if (conn->socket != INVALID_SOCKET)
+    {
+        shutdown(conn->socket, SD_BOTH);
+        closesocket(conn->socket);
+    }
+    conn->socket = INVALID_SOCKET;
+}
+
+//============================================================================
+// SERVER THREAD
+//============================================================================
+
+// Scans run here rather than on the main thread, which they would stall
+static void serve_scan(remote_buffer *out, const remote_header *request, const uint8_t *payload)
+{
+    remote_scan scan;
+    char        text[SCAN_MAX_PATTERN * 3 + 1];
+    size_t      length = request->length - sizeof(scan);
+    if (request->length <= sizeof(scan) || length >= sizeof(text))
+    {
+        respond_error(out, request, REMOTE_BAD_REQUEST, "scan needs a remote_scan header and a pattern");
+        return;
+    }
+    memcpy(&scan, payload, sizeof(scan));
+    memcpy(text, payload + sizeof(scan), length);
+    text[length] = '\0';
+
+    scan_pattern pattern;
+    const char  *error = scan_parse_pattern(&pattern, text);
+    if (error)
+    {
+        respond_error(out, request, REMOTE_BAD_REQUEST, "%s", error);
+        return;
+    }
+    pattern.align = scan.align;
+
+    scan_range range;
+    scan_full_range(&range);
+    if (scan.start)
+    {
+        range.start = scan.start;
+    }
+    if (scan.stop)
+    {
+        range.stop = scan.stop;
+    }
+
+    // Responses sent earlier may hold copies of game memory, which would
+    // show up as hits
+    if (out->data)
+    {
+        memset(out->data, 0, out->capacity);
+    }
+
+    size_t     limit = scan.limit ? scan.limit : (size_t)-1;
+    scan_hits  hits = {0};
+    scan_stats stats;
+    if (!scan_memory(&pattern, &range, limit, &hits, &stats))
+    {
+        free(hits.items);
+        respond_error(out, request, REMOTE_ERROR, "out of memory");
+        return;
+    }
+
+    size_t count = hits.count < limit ? hits.count : limit;
+    size_t per_frame = REMOTE_STREAM_CHUNK / sizeof(uint32_t);
+    size_t sent = 0;
+    do
+    {
+        size_t part = count - sent < per_frame ? count - sent : per_frame;
+        bool   last = sent + part == count;
+        respond(out, request, last ? 0 : REMOTE_FLAG_MORE, REMOTE_OK, hits.items + sent, part * sizeof(uint32_t));
+        sent += part;
+    } while (sent < count);
+    free(hits.items);
+}
+
+// Serves a run of complete frames in order. False ends the connection.
+static bool serve_frames(remote_conn *conn, remote_batch *batch, const uint8_t *data, size_t length)
+{
+    size_t at = 0;
+    while (at < length)
+    {
+        remote_header  request;
+        const uint8_t *frame = data + at;
+        memcpy(&request, frame, sizeof(request));
+        at += sizeof(request) + request.length;
+        InterlockedIncrement(&g_stats.requests);
+
+        switch (request.op)
+        {
+        case REMOTE_EVAL:
+        case REMOTE_CALL:
+        case REMOTE_READ:
+            batch->frames[batch->count++] = frame;
+            if (request.op == REMOTE_READ && request.length == sizeof(remote_read))
+            {
+                remote_read read;
+                memcpy(&read, frame + sizeof(request), sizeof(read));
+                batch->bytes += read.length;
+            }
+            if ((batch->count == REMOTE_BATCH_MAX || batch->bytes >= REMOTE_BATCH_BYTES) &&
+                (!run_pending(batch) || !send_output(conn, batch)))
+            {
+                return false;
+            }
+            break;
+
+        case REMOTE_PING:
+            if (!run_pending(batch))
+            {
+                return false;
+            }
+            respond(&batch->out, &request, 0, REMOTE_OK, frame + sizeof(request), request.length);
+            break;
+
+        case REMOTE_SCAN:
+            if (!run_pending(batch) || !send_output(conn, batch))
+            {
+                return false;
+            }
+            serve_scan(&batch->out, &request, frame + sizeof(request));
+            break;
+
+        default:
+            if (!run_pending(batch))
+            {
+                return false;
+            }
+            respond_error(&batch->out, &request, REMOTE_UNKNOWN_OP, "unknown op %u", (unsigned)request.op);
+            break;
+        }
+    }
+
+    return run_pending(batch) && send_output(conn, batch);
+}
+
+static void serve_client(remote_conn *conn)
+{
+    remote_buffer in = {0};
+    remote_batch *batch = calloc(1, sizeof(*batch));
+    if (!batch || !(batch->call = dispatch_job_new(NULL, NULL)))
+    {
+        free(batch);
+        return;
+    }
+
+    remote_header hello = {0, 0, REMOTE_HELLO, 0, REMOTE_OK};
+    uint32_t      version = REMOTE_VERSION;
+    respond(&batch->out, &hello, 0, REMOTE_OK, &version, sizeof(version));
+    bool open = send_output(conn, batch);
+
+    while (open && buffer_reserve(&in, REMOTE_RECV_SIZE))
+    {
+        int read = conn_read(conn, in.data + in.length, in.capacity - in.length);
+        if (read <= 0)
+        {
+            break;
+        }
+        in.length += (size_t)read;
+        g_stats.bytes_in += (uint64_t)read;
+
+        // Everything received so far that forms whole frames is one pipeline
+        size_t        complete = 0;
+        remote_header request;
+        while (in.length - complete >= sizeof(request))
+        {
+            memcpy(&request, in.data + complete, sizeof(request));
+            if (request.length > REMOTE_MAX_PAYLOAD || in.length - complete - sizeof(request) < request.length)
+            {
+                break;
+            }
+            complete += sizeof(request) + request.length;
+        }
+
+        if (complete > 0 && !serve_frames(conn, batch, in.data, complete))
+        {
+            break;
+        }
+        if (in.length - complete >= sizeof(request) && request.length > REMOTE_MAX_PAYLOAD)
+        {
+            respond_error(&batch->out, &request, REMOTE_BAD_REQUEST, "frame of %u bytes exceeds the limit",
+                          (unsigned)request.length);
+            send_output(conn, batch);
+            InterlockedIncrement(&g_stats.dropped);
+            break;
+        }
+
+        memmove(in.data, in.data + complete, in.length - complete);
+        in.length -= complete;
+    }
+
+    free(in.data);
+    if (batch->state == BATCH_ABANDONED)
+    {
+        // The main thread may still pick the job up; it only reads the state
+        return;
+    }
+    dispatch_job_release(batch->call);
+    free(batch->out.data);
+    free(batch);
+}
+
+static DWORD WINAPI server_main(LPVOID param)
+{
+    (void)param;
+    remote_conn conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.pipe = INVALID_HANDLE_VALUE;
+    conn.socket = INVALID_SOCKET;
+    conn.overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (!conn.overlapped.hEvent)
+    {
+        return 1;
+    }
+
+    while (!stopping())
+    {
+        if (!accept_client(&conn))
+        {
+            WaitForSingleObject(g_stopEvent, REMOTE_RETRY_MS);
+            continue;
+        }
+
+        InterlockedIncrement(&g_stats.connections);
+        InterlockedExchange(&g_connected, 1);
+        logf("[REMOTE] Client connected on %s", g_endpoint);
+        serve_client(&conn);
+        close_client(&conn);
+        InterlockedExchange(&g_connected, 0);
+        logf("[REMOTE] Client disconnected from %s", g_endpoint);
+    }
+
+    CloseHandle(conn.overlapped.hEvent);
+    return 0;
+}
+
+//============================================================================
+// LIFECYCLE
+//============================================================================
+
+static void close_listener(void)
+{
+    if (g_pipe != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(g_pipe);
+        g_pipe = INVALID_HANDLE_VALUE;
+    }
+    if (g_listen != INVALID_SOCKET)
+    {
+        closesocket(g_listen);
+        g_listen = INVALID_SOCKET;
+    }
+    if (g_acceptEvent)
+    {
+        WSACloseEvent(g_acceptEvent);
+        g_acceptEvent = NULL;
+    }
+    if (g_winsock)
+    {
+        WSACleanup();
+        g_winsock = false;
+    }
+}
+
+// One instance only, local clients only, and never an existing pipe of
+// the same name that another process created first
+static const char *open_pipe(const char *name)
+{
+    snprintf(g_endpoint, sizeof(g_endpoint), "\\\\.\\pipe\\%s", name);
+    g_pipe = CreateNamedPipeA(g_endpoint, PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                              PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1,
+                              REMOTE_PIPE_BUFFER, REMOTE_PIPE_BUFFER, 0, NULL);
+    return g_pipe == INVALID_HANDLE_VALUE ? "cannot create" : NULL;
+}
+
+// Loopback only: eval runs arbitrary code in the game
+static const char *open_socket(uint16_t port)
+{
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+    {
+        return "winsock unavailable for";
+    }
+    g_winsock = true;
+
+    struct sockaddr_in address;
+    int                size = sizeof(address);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    g_listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    g_acceptEvent = WSACreateEvent();
+    if (g_listen == INVALID_SOCKET || g_acceptEvent == WSA_INVALID_EVENT ||
+        bind(g_listen, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR ||
+        listen(g_listen, 1) == SOCKET_ERROR || WSAEventSelect(g_listen, g_acceptEvent, FD_ACCEPT) == SOCKET_ERROR ||
+        getsockname(g_listen, (struct sockaddr *)&address, &size) == SOCKET_ERROR)
+    {
+        snprintf(g_endpoint, sizeof(g_endpoint), "127.0.0.1:%u", (unsigned)port);
+        if (g_acceptEvent == WSA_INVALID_EVENT)
+        {
+            g_acceptEvent = NULL;
+        }
+        return "cannot listen on";
+    }
+
+    // Port 0 asks for any free port; report the one we got
+    snprintf(g_endpoint, sizeof(g_endpoint), "127.0.0.1:%u", (unsigned)ntohs(address.sin_port));
+    return NULL;
+}
+
+// Stops the server; a client still connected is dropped. A request still
+// running (a long scan or eval) can outlast the timeout, in which case the
+// thread is left to finish and false is returned.
+static bool remote_stop(DWORD timeout_ms)
+{
+    if (!g_thread)
+    {
+        return true;
+    }
+
+    SetEvent(g_stopEvent);
+    if (WaitForSingleObject(g_thread, timeout_ms) != WAIT_OBJECT_0)
+    {
+        return false;
+    }
+
+    close_listener();
+    CloseHandle(g_thread);
+    g_thread = NULL;
+    CloseHandle(g_stopEvent);
+    g_stopEvent = NULL;
+    return true;
+}
+
+// False if the server thread is still running; it may be in the pool or
+// logging, so those and the module must then stay up
+bool remote_shutdown(void)
+{
+    if (!remote_stop(REMOTE_STOP_MS))
+    {
+        logf("[REMOTE] Server thread did not stop within %d ms", REMOTE_STOP_MS);
+        return false;
+    }
+    return true;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+// remote.start([{pipe = name} | {port = n}]) -> endpoint | nil, error
+// Serves \\.\pipe\europa1400-lua by default; port serves 127.0.0.1 instead
+static int l_remote_start(lua_State *L)
+{
+    const char *pipe = REMOTE_PIPE_DEFAULT;
+    int         port = -1;
+    if (lua_istable(L, 1))
+    {
+        lua_getfield(L, 1, "pipe");
+        pipe = luaL_optstring(L, -1, REMOTE_PIPE_DEFAULT);
+        lua_getfield(L, 1, "port");
+        port = lua_isnil(L, -1) ? -1 : (int)luaL_checknumber(L, -1);
+        lua_pop(L, 2);
+        luaL_argcheck(L, port >= -1 && port <= 65535, 1, "port out of range");
+        luaL_argcheck(L, *pipe && !strpbrk(pipe, "\\/"), 1, "pipe name must not be empty or contain slashes");
+    }
+
+    // A server told to stop earlier may have finished by now
+    if (g_thread && (!stopping() || !remote_stop(0)))
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, stopping() ? "still stopping %s" : "already serving %s", g_endpoint);
+        return 2;
+    }
+
+    const char *error = port >= 0 ? open_socket((uint16_t)port) : open_pipe(pipe);
+    if (!error)
+    {
+        g_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        g_thread = g_stopEvent ? CreateThread(NULL, 0, server_main, NULL, 0, NULL) : NULL;
+        error = g_thread ? NULL : "cannot start a server thread for";
+    }
+    if (error)
+    {
+        int code = port >= 0 && g_winsock ? WSAGetLastError() : (int)GetLastError();
+        lua_pushnil(L);
+        lua_pushfstring(L, "%s %s (error %d)", error, g_endpoint, code);
+        close_listener();
+        if (g_stopEvent)
+        {
+            CloseHandle(g_stopEvent);
+            g_stopEvent = NULL;
+        }
+        return 2;
+    }
+
+    logf("[REMOTE] Serving %s", g_endpoint);
+    lua_pushstring(L, g_endpoint);
+    return 1;
+}
+
+// remote.stop([timeout_ms]) -> true once the server is down | false, "busy"
+static int l_remote_stop(lua_State *L)
+{
+    DWORD timeout = (DWORD)luaL_optnumber(L, 1, REMOTE_STOP_MS);
+    if (!remote_stop(timeout))
+    {
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, "busy");
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static int l_remote_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 10);
+    lua_pushboolean(L, g_thread != NULL && !stopping());
+    lua_setfield(L, -2, "running");
+    if (g_thread)
+    {
+        lua_pushstring(L, g_endpoint);
+        lua_setfield(L, -2, "endpoint");
+    }
+    lua_pushboolean(L, g_connected != 0);
+    lua_setfield(L, -2, "connected");
+    lua_pushnumber(L, g_stats.connections);
+    lua_setfield(L, -2, "connections");
+    lua_pushnumber(L, g_stats.requests);
+    lua_setfield(L, -2, "requests");
+    lua_pushnumber(L, g_stats.batches);
+    lua_setfield(L, -2, "batches");
+    lua_pushnumber(L, g_stats.busy_retries);
+    lua_setfield(L, -2, "busy_retries");
+    lua_pushnumber(L, g_stats.dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushnumber(L, (lua_Number)g_stats.bytes_in);
+    lua_setfield(L, -2, "bytes_in");
+    lua_pushnumber(L, (lua_Number)g_stats.bytes_out);
+    lua_setfield(L, -2, "bytes_out");
+    return 1;
+}
+
+static const luaL_Reg remote_funcs[] = {
+    {"start", l_remote_start}, {"stop", l_remote_stop}, {"stats", l_remote_stats}, {NULL, NULL}};
+
+int luaopen_remote(lua_State *L)
+{
+    luaL_register(L, "remote", remote_funcs);
+    return 1;
+}
@@ -0,0 +1,21 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdbool.h>
+
+#include "lua.h"
+#include "remoteformat.h"
+
+#define REMOTE_BATCH_MAX 1024                 /* Requests run by one main-thread job */
+#define REMOTE_BATCH_BYTES (32 * 1024 * 1024) /* Read bytes one job may queue up */
+#define REMOTE_RECV_SIZE 65536                /* Free space kept for each socket or pipe read */
+#define REMOTE_PIPE_BUFFER 65536
+#define REMOTE_WAIT_SLICE_MS 100 /* Waits on the main thread check for remote.stop this often */
+#define REMOTE_BUSY_RETRY_MS 1   /* Pause before retrying an eval while the console runs Lua */
+#define REMOTE_RETRY_MS 1000     /* Pause after a failed accept */
+#define REMOTE_STOP_MS 2000
+
+bool remote_shutdown(void);
+int  luaopen_remote(lua_State *L);
+
+#endif // REMOTE_H
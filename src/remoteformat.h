@@ -0,0 +1,106 @@
+/* remoteformat.h: Wire format of the remote control endpoint, for external tooling */
+
+#ifndef REMOTEFORMAT_H
+#define REMOTEFORMAT_H
+
+#include <stdint.h>
+
+/*
+ * Both directions carry frames: a remote_header followed by `length`
+ * payload bytes, little endian. Clients pick request ids; every response
+ * frame repeats the id and op of its request. Requests may be pipelined
+ * without waiting, and responses come back in request order.
+ *
+ * A response is one final frame, optionally preceded by frames flagged
+ * REMOTE_FLAG_MORE that stream the earlier part of its payload. A final
+ * frame with a status other than REMOTE_OK carries an error message
+ * instead, which also ends a stream early.
+ *
+ *   REMOTE_HELLO  sent by the server on connect, id 0:
+ *                 payload = uint32 REMOTE_VERSION
+ *   REMOTE_PING   payload echoed back; answered by the server thread
+ *   REMOTE_EVAL   payload = Lua source, run on the main thread;
+ *                 response = the chunk's results as remote values
+ *   REMOTE_CALL   payload = remote_call, then nwords uint32 stack words;
+ *                 response = 8 bytes, the integer (EDX:EAX) or double result
+ *   REMOTE_READ   payload = remote_read; response = the bytes, streamed
+ *                 in REMOTE_STREAM_CHUNK frames
+ *   REMOTE_SCAN   payload = remote_scan, then the pattern text as for
+ *                 mem.scan; response = uint32 hit addresses, streamed
+ *
+ * A remote value is one type byte followed by its data: nothing for nil,
+ * one byte for a boolean, a double for a number, and a uint32 length plus
+ * the bytes for a string. Any other Lua value is sent as REMOTE_VALUE_OTHER
+ * with a "type: address" description in the same form as a string.
+ */
+
+#define REMOTE_VERSION      1
+#define REMOTE_PIPE_DEFAULT "europa1400-lua"         /* Named \\.\pipe\europa1400-lua */
+#define REMOTE_MAX_PAYLOAD  (16u * 1024u * 1024u)    /* Larger frames drop the connection */
+#define REMOTE_MAX_READ     (16u * 1024u * 1024u)    /* Longest REMOTE_READ */
+#define REMOTE_STREAM_CHUNK 65536u                   /* Payload bytes per streamed frame */
+
+enum
+{
+    REMOTE_HELLO = 0,
+    REMOTE_PING = 1,
+    REMOTE_EVAL = 2,
+    REMOTE_CALL = 3,
+    REMOTE_READ = 4,
+    REMOTE_SCAN = 5
+};
+
+enum
+{
+    REMOTE_OK = 0,
+    REMOTE_ERROR = 1,       /* The request ran and failed: Lua error, fault, ... */
+    REMOTE_BAD_REQUEST = 2, /* Malformed payload */
+    REMOTE_UNKNOWN_OP = 3
+};
+
+#define REMOTE_FLAG_MORE 0x01 /* More frames of this response follow */
+
+enum
+{
+    REMOTE_VALUE_NIL = 0,
+    REMOTE_VALUE_BOOLEAN = 1,
+    REMOTE_VALUE_NUMBER = 2,
+    REMOTE_VALUE_STRING = 3,
+    REMOTE_VALUE_OTHER = 4
+};
+
+typedef struct
+{
+    uint32_t length; /* Payload bytes that follow */
+    uint32_t id;
+    uint8_t  op;
+    uint8_t  flags;
+    uint16_t status; /* Responses only; 0 in requests */
+} remote_header;
+
+typedef struct
+{
+    uint32_t address;
+    uint8_t  conv;     /* dispatch_conv: 0 cdecl, 1 stdcall, 2 fastcall, 3 thiscall */
+    char     ret_kind; /* A return kind of dispatch.call; the result is not masked */
+    uint8_t  nwords;   /* Stack words that follow, at most 32 */
+    uint8_t  reserved;
+    uint32_t ecx;
+    uint32_t edx;
+} remote_call;
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t length;
+} remote_read;
+
+typedef struct
+{
+    uint32_t start; /* 0 = from the lowest address mem.scan covers */
+    uint32_t stop;  /* 0 = to the top of user space */
+    uint32_t limit; /* Max hits, 0 = no limit */
+    uint32_t align; /* Only hits at multiples of this, 0 or 1 = any */
+} remote_scan;
+
+#endif // REMOTEFORMAT_H
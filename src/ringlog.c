@@ -0,0 +1,601 @@
+/*
+ * ringlog.c: Fixed-capacity binary ring buffers for call and memory logs.
+ *
+ * Writers claim a slot with one atomic increment and fill a compact
+ * record in place; the oldest record is overwritten once the ring is
+ * full, so logging a hot function costs the same on the millionth call
+ * as on the first. Nothing is formatted until a reader asks for records,
+ * and rings can be dumped to disk as-is.
+ *
+ * Names (function names, mostly) are interned once into small integer
+ * ids that records carry instead of strings.
+ *
+ * Dump format (little endian):
+ *   ringlog_file_header
+ *   name_count x { uint16 length, bytes }    ids are 1-based indices
+ *   count x ringlog_record                   oldest first
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "logging.h"
+#include "ringlog.h"
+
+#define RINGLOG_MT "luaapi.ringlog"
+#define RINGLOG_DEFAULT_CAPACITY 1024
+#define RINGLOG_MAX_CAPACITY (1u << 24)
+#define RINGLOG_DEFAULT_RECORDS 10000
+
+struct ringlog
+{
+    ringlog_record *items;
+    uint32_t        mask; /* Capacity - 1, capacity is a power of two */
+    volatile LONG   next; /* Total records ever claimed */
+    volatile LONG   start; /* Records before this were cleared */
+};
+
+typedef struct
+{
+    char     magic[8]; /* "RINGLOG1" */
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t name_count;
+    uint64_t qpc_frequency;
+    uint64_t qpc_base;      /* QueryPerformanceCounter at ... */
+    uint64_t filetime_base; /* ... this wall clock time */
+} ringlog_file_header;
+
+typedef struct
+{
+    ringlog *ring;
+} ringlog_box;
+
+static SRWLOCK   g_namesLock = SRWLOCK_INIT;
+static char    **g_names = NULL; /* g_names[id - 1] */
+static uint32_t  g_nameCount = 0;
+static uint32_t  g_nameCapacity = 0;
+static uint32_t *g_nameSlots = NULL; /* Open addressing over ids, 0 = empty */
+static uint32_t  g_slotCapacity = 0; /* Power of two */
+
+static LARGE_INTEGER g_qpcFrequency = {0};
+static LARGE_INTEGER g_qpcBase = {0};
+static uint64_t      g_filetimeBase = 0;
+static INIT_ONCE     g_clockOnce = INIT_ONCE_STATIC_INIT;
+
+//============================================================================
+// RING
+//============================================================================
+
+ringlog *ringlog_create(uint32_t capacity)
+{
+    uint32_t size = 16;
+    while (size < capacity && size < RINGLOG_MAX_CAPACITY)
+    {
+        size <<= 1;
+    }
+
+    ringlog *ring = calloc(1, sizeof(ringlog));
+    if (!ring)
+    {
+        return NULL;
+    }
+
+    ring->items = calloc(size, sizeof(ringlog_record));
+    if (!ring->items)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    return ring;
+}
+
+void ringlog_destroy(ringlog *ring)
+{
+    if (ring)
+    {
+        free(ring->items);
+        free(ring);
+    }
+}
+
+// Appends a copy of record, stamping the time if the caller left it 0.
+// Safe from any thread; never blocks or allocates.
+void ringlog_push(ringlog *ring, ringlog_record *record)
+{
+    if (!record->time)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        record->time = (uint64_t)now.QuadPart;
+    }
+
+    LONG            index = InterlockedIncrement(&ring->next) - 1;
+    ringlog_record *slot = &ring->items[(uint32_t)index & ring->mask];
+
+    // Readers skip the slot until the new sequence number lands
+    InterlockedExchange((volatile LONG *)&slot->seq, 0);
+    record->seq = 0;
+    memcpy(slot, record, sizeof(*slot));
+    InterlockedExchange((volatile LONG *)&slot->seq, index + 1);
+}
+
+void ringlog_clear(ringlog *ring)
+{
+    InterlockedExchange(&ring->start, ring->next);
+}
+
+// Copies up to max of the newest complete records, oldest first
+static uint32_t collect(const ringlog *ring, uint32_t max, ringlog_record *out)
+{
+    uint32_t next = (uint32_t)ring->next;
+    uint32_t capacity = ring->mask + 1;
+    uint32_t first = next > capacity ? next - capacity : 0;
+    uint32_t start = (uint32_t)ring->start;
+    uint32_t count = 0;
+
+    if (start > first)
+    {
+        first = start;
+    }
+    if (next - first > max)
+    {
+        first = next - max;
+    }
+
+    for (uint32_t index = first; index != next; index++)
+    {
+        const ringlog_record *slot = &ring->items[index & ring->mask];
+        uint32_t              seq = slot->seq;
+        if (seq != index + 1)
+        {
+            continue; /* Being written, or already lapped */
+        }
+
+        out[count] = *slot;
+        MemoryBarrier();
+        if (slot->seq == seq)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static uint32_t complete_count(const ringlog *ring)
+{
+    uint32_t next = (uint32_t)ring->next;
+    uint32_t capacity = ring->mask + 1;
+    uint32_t first = next > capacity ? next - capacity : 0;
+    uint32_t start = (uint32_t)ring->start;
+    return next - (start > first ? start : first);
+}
+
+//============================================================================
+// NAMES
+//============================================================================
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return hash;
+}
+
+// Slot holding name or the empty slot where it belongs; caller holds the lock
+static uint32_t *find_name_slot(uint32_t *slots, uint32_t capacity, const char *name, uint32_t hash)
+{
+    for (uint32_t i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1))
+    {
+        if (slots[i] == 0 || strcmp(g_names[slots[i] - 1], name) == 0)
+        {
+            return &slots[i];
+        }
+    }
+}
+
+static bool grow_names(void)
+{
+    if (g_nameCount == g_nameCapacity)
+    {
+        uint32_t capacity = g_nameCapacity ? g_nameCapacity * 2 : 256;
+        char   **grown = realloc(g_names, capacity * sizeof(char *));
+        if (!grown)
+        {
+            return false;
+        }
+        g_names = grown;
+        g_nameCapacity = capacity;
+    }
+
+    // Keep the slot table at most half full
+    if ((g_nameCount + 1) * 2 > g_slotCapacity)
+    {
+        uint32_t  capacity = g_slotCapacity ? g_slotCapacity * 2 : 512;
+        uint32_t *slots = calloc(capacity, sizeof(uint32_t));
+        if (!slots)
+        {
+            return false;
+        }
+        for (uint32_t id = 1; id <= g_nameCount; id++)
+        {
+            *find_name_slot(slots, capacity, g_names[id - 1], hash_name(g_names[id - 1])) = id;
+        }
+        free(g_nameSlots);
+        g_nameSlots = slots;
+        g_slotCapacity = capacity;
+    }
+    return true;
+}
+
+// Stable id for name, 0 if out of memory
+uint32_t ringlog_intern(const char *name)
+{
+    uint32_t hash = hash_name(name);
+    uint32_t id = 0;
+
+    AcquireSRWLockShared(&g_namesLock);
+    if (g_slotCapacity)
+    {
+        id = *find_name_slot(g_nameSlots, g_slotCapacity, name, hash);
+    }
+    ReleaseSRWLockShared(&g_namesLock);
+    if (id)
+    {
+        return id;
+    }
+
+    AcquireSRWLockExclusive(&g_namesLock);
+    uint32_t *slot = g_slotCapacity ? find_name_slot(g_nameSlots, g_slotCapacity, name, hash) : NULL;
+    if (slot && *slot)
+    {
+        id = *slot; /* Interned by another thread meanwhile */
+    }
+    else if (grow_names())
+    {
+        char *copy = _strdup(name);
+        if (copy)
+        {
+            g_names[g_nameCount++] = copy;
+            id = g_nameCount;
+            *find_name_slot(g_nameSlots, g_slotCapacity, name, hash) = id;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_namesLock);
+    return id;
+}
+
+// Interned name for id, or NULL
+const char *ringlog_name(uint32_t id)
+{
+    const char *name = NULL;
+    AcquireSRWLockShared(&g_namesLock);
+    if (id > 0 && id <= g_nameCount)
+    {
+        name = g_names[id - 1];
+    }
+    ReleaseSRWLockShared(&g_namesLock);
+    return name;
+}
+
+//============================================================================
+// DUMP
+//============================================================================
+
+static bool write_all(HANDLE file, const void *data, DWORD size)
+{
+    DWORD written = 0;
+    return WriteFile(file, data, size, &written, NULL) && written == size;
+}
+
+static bool dump(const ringlog *ring, const char *path, uint32_t *written)
+{
+    uint32_t        capacity = ring->mask + 1;
+    ringlog_record *records = malloc(capacity * sizeof(ringlog_record));
+    if (!records)
+    {
+        return false;
+    }
+    uint32_t count = collect(ring, capacity, records);
+
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        free(records);
+        return false;
+    }
+
+    ringlog_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "RINGLOG1", 8);
+    header.version = 1;
+    header.record_size = sizeof(ringlog_record);
+    header.count = count;
+    header.qpc_frequency = (uint64_t)g_qpcFrequency.QuadPart;
+    header.qpc_base = (uint64_t)g_qpcBase.QuadPart;
+    header.filetime_base = g_filetimeBase;
+
+    AcquireSRWLockShared(&g_namesLock);
+    header.name_count = g_nameCount;
+    bool ok = write_all(file, &header, sizeof(header));
+    for (uint32_t i = 0; ok && i < g_nameCount; i++)
+    {
+        size_t   length = strlen(g_names[i]);
+        uint16_t prefix = (uint16_t)(length < 0xFFFF ? length : 0xFFFF);
+        ok = write_all(file, &prefix, sizeof(prefix)) && write_all(file, g_names[i], prefix);
+    }
+    ReleaseSRWLockShared(&g_namesLock);
+
+    ok = ok && write_all(file, records, count * sizeof(ringlog_record));
+    CloseHandle(file);
+    free(records);
+
+    *written = count;
+    return ok;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static const char *const g_kindNames[] = {"", "call", "main", "read", "write"};
+
+static ringlog *check_ring(lua_State *L)
+{
+    ringlog_box *box = (ringlog_box *)luaL_checkudata(L, 1, RINGLOG_MT);
+    if (!box->ring)
+    {
+        luaL_error(L, "ring log has been freed");
+    }
+    return box->ring;
+}
+
+// Wall clock seconds since the Unix epoch for a record time
+static double record_epoch(uint64_t time)
+{
+    double base = (double)g_filetimeBase / 1e7 - 11644473600.0;
+    return base + (double)((int64_t)(time - (uint64_t)g_qpcBase.QuadPart)) / (double)g_qpcFrequency.QuadPart;
+}
+
+// ringlog.new([capacity]) -> ring
+static int l_ringlog_new(lua_State *L)
+{
+    uint32_t     capacity = (uint32_t)luaL_optnumber(L, 1, RINGLOG_DEFAULT_CAPACITY);
+    ringlog_box *box = (ringlog_box *)lua_newuserdata(L, sizeof(ringlog_box));
+
+    box->ring = ringlog_create(capacity);
+    if (!box->ring)
+    {
+        return luaL_error(L, "out of memory");
+    }
+    luaL_getmetatable(L, RINGLOG_MT);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int l_ringlog_intern(lua_State *L)
+{
+    lua_pushnumber(L, ringlog_intern(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+static int l_ringlog_name(lua_State *L)
+{
+    const char *name = ringlog_name((uint32_t)luaL_checknumber(L, 1));
+    if (name)
+        lua_pushstring(L, name);
+    else
+        lua_pushnil(L);
+    return 1;
+}
+
+// ring:push(kind, id, address, size, flags, duration_ms, result, ...)
+static int l_ring_push(lua_State *L)
+{
+    ringlog       *ring = check_ring(L);
+    ringlog_record record;
+    int            argc = lua_gettop(L) - 8;
+
+    memset(&record, 0, sizeof(record));
+    record.kind = (uint8_t)luaL_checkinteger(L, 2);
+    record.id = (uint32_t)luaL_optnumber(L, 3, 0);
+    record.address = (uint32_t)(int64_t)luaL_optnumber(L, 4, 0);
+    record.size = (uint32_t)luaL_optnumber(L, 5, 0);
+    record.flags = (uint8_t)luaL_optinteger(L, 6, 0);
+
+    double duration = luaL_optnumber(L, 7, 0) * 1000.0;
+    record.duration = duration <= 0 ? 0 : duration >= 4294967295.0 ? 0xFFFFFFFFu : (uint32_t)duration;
+
+    if (lua_isnumber(L, 8))
+    {
+        record.result = lua_tonumber(L, 8);
+        record.flags |= RINGLOG_HAS_RESULT;
+    }
+    else if (lua_isboolean(L, 8))
+    {
+        record.result = lua_toboolean(L, 8);
+        record.flags |= RINGLOG_HAS_RESULT;
+    }
+
+    record.argc = (uint8_t)(argc > 0 ? (argc < 255 ? argc : 255) : 0);
+    for (int i = 0; i < argc && i < RINGLOG_ARGS; i++)
+    {
+        record.args[i] = lua_isboolean(L, 9 + i) ? lua_toboolean(L, 9 + i) : lua_tonumber(L, 9 + i);
+    }
+
+    ringlog_push(ring, &record);
+    return 0;
+}
+
+// ring:records([max]) -> { {time, kind, name, address, ...}, ... } oldest first
+static int l_ring_records(lua_State *L)
+{
+    ringlog *ring = check_ring(L);
+    uint32_t max = (uint32_t)luaL_optnumber(L, 2, RINGLOG_DEFAULT_RECORDS);
+    uint32_t capacity = ring->mask + 1;
+
+    if (max > capacity)
+    {
+        max = capacity;
+    }
+
+    ringlog_record *records = malloc((max ? max : 1) * sizeof(ringlog_record));
+    if (!records)
+    {
+        return luaL_error(L, "out of memory");
+    }
+    uint32_t count = collect(ring, max, records);
+
+    lua_createtable(L, (int)count, 0);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const ringlog_record *r = &records[i];
+        const char           *name = ringlog_name(r->id);
+
+        lua_createtable(L, 0, 10);
+        lua_pushnumber(L, record_epoch(r->time));
+        lua_setfield(L, -2, "time");
+        lua_pushstring(L, r->kind < sizeof(g_kindNames) / sizeof(g_kindNames[0]) ? g_kindNames[r->kind] : "");
+        lua_setfield(L, -2, "kind");
+        if (name)
+        {
+            lua_pushstring(L, name);
+            lua_setfield(L, -2, "name");
+        }
+        lua_pushnumber(L, r->address);
+        lua_setfield(L, -2, "address");
+        lua_pushnumber(L, r->size);
+        lua_setfield(L, -2, "size");
+        lua_pushnumber(L, r->duration / 1000.0);
+        lua_setfield(L, -2, "duration_ms");
+        lua_pushboolean(L, (r->flags & RINGLOG_OK) != 0);
+        lua_setfield(L, -2, "ok");
+        if (r->flags & RINGLOG_HAS_RESULT)
+        {
+            lua_pushnumber(L, r->result);
+            lua_setfield(L, -2, "result");
+        }
+        lua_pushnumber(L, r->argc);
+        lua_setfield(L, -2, "argc");
+
+        int kept = r->argc < RINGLOG_ARGS ? r->argc : RINGLOG_ARGS;
+        lua_createtable(L, kept, 0);
+        for (int a = 0; a < kept; a++)
+        {
+            lua_pushnumber(L, r->args[a]);
+            lua_rawseti(L, -2, a + 1);
+        }
+        lua_setfield(L, -2, "args");
+
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+
+    free(records);
+    return 1;
+}
+
+static int l_ring_count(lua_State *L)
+{
+    lua_pushnumber(L, complete_count(check_ring(L)));
+    return 1;
+}
+
+static int l_ring_capacity(lua_State *L)
+{
+    lua_pushnumber(L, check_ring(L)->mask + 1);
+    return 1;
+}
+
+static int l_ring_clear(lua_State *L)
+{
+    ringlog_clear(check_ring(L));
+    return 0;
+}
+
+// ring:dump(path) -> records written, or nil, err
+static int l_ring_dump(lua_State *L)
+{
+    ringlog    *ring = check_ring(L);
+    const char *path = luaL_checkstring(L, 2);
+    uint32_t    written = 0;
+
+    if (!dump(ring, path, &written))
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "cannot write %s (error %d)", path, (int)GetLastError());
+        return 2;
+    }
+
+    logf("[RINGLOG] Dumped %u records to %s", written, path);
+    lua_pushnumber(L, written);
+    return 1;
+}
+
+static int l_ring_gc(lua_State *L)
+{
+    ringlog_box *box = (ringlog_box *)luaL_checkudata(L, 1, RINGLOG_MT);
+    ringlog_destroy(box->ring);
+    box->ring = NULL;
+    return 0;
+}
+
+static const luaL_Reg ring_methods[] = {{"push", l_ring_push},     {"records", l_ring_records},
+                                        {"count", l_ring_count},   {"capacity", l_ring_capacity},
+                                        {"clear", l_ring_clear},   {"dump", l_ring_dump},
+                                        {NULL, NULL}};
+
+static const luaL_Reg ringlog_funcs[] = {
+    {"new", l_ringlog_new}, {"intern", l_ringlog_intern}, {"name", l_ringlog_name}, {NULL, NULL}};
+
+// Timestamps of every state's rings share one base, set by the first open
+static BOOL WINAPI init_clock(PINIT_ONCE once, void *param, void **context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    FILETIME now;
+    QueryPerformanceFrequency(&g_qpcFrequency);
+    QueryPerformanceCounter(&g_qpcBase);
+    GetSystemTimeAsFileTime(&now);
+    g_filetimeBase = ((uint64_t)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    return TRUE;
+}
+
+int luaopen_ringlog(lua_State *L)
+{
+    InitOnceExecuteOnce(&g_clockOnce, init_clock, NULL, NULL);
+
+    luaL_newmetatable(L, RINGLOG_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, ring_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_ring_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, l_ring_count);
+    lua_setfield(L, -2, "__len");
+    lua_pop(L, 1);
+
+    luaL_register(L, "ringlog", ringlog_funcs);
+    lua_pushnumber(L, RINGLOG_CALL);
+    lua_setfield(L, -2, "CALL");
+    lua_pushnumber(L, RINGLOG_CALL_MAIN);
+    lua_setfield(L, -2, "CALL_MAIN");
+    lua_pushnumber(L, RINGLOG_READ);
+    lua_setfield(L, -2, "READ");
+    lua_pushnumber(L, RINGLOG_WRITE);
+    lua_setfield(L, -2, "WRITE");
+    lua_pushnumber(L, RINGLOG_OK);
+    lua_setfield(L, -2, "OK");
+    return 1;
+}
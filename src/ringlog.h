@@ -0,0 +1,48 @@
+#ifndef RINGLOG_H
+#define RINGLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+#define RINGLOG_ARGS 4
+
+enum
+{
+    RINGLOG_CALL = 1,      /* Console thread call */
+    RINGLOG_CALL_MAIN = 2, /* Call run on the game's main thread */
+    RINGLOG_READ = 3,
+    RINGLOG_WRITE = 4
+};
+
+#define RINGLOG_OK 0x01         /* Call or memory operation succeeded */
+#define RINGLOG_HAS_RESULT 0x02 /* result holds a value */
+
+typedef struct
+{
+    uint64_t time;     /* QueryPerformanceCounter ticks */
+    uint32_t seq;      /* Write index + 1 once the record is complete */
+    uint32_t id;       /* Interned name, 0 for none */
+    uint32_t address;
+    uint32_t size;     /* Memory operations: byte count */
+    uint32_t duration; /* Microseconds */
+    uint8_t  kind;
+    uint8_t  flags;
+    uint8_t  argc;     /* Arguments passed; the first RINGLOG_ARGS are kept */
+    uint8_t  reserved;
+    double   result;
+    double   args[RINGLOG_ARGS];
+} ringlog_record;
+
+typedef struct ringlog ringlog;
+
+ringlog    *ringlog_create(uint32_t capacity);
+void        ringlog_destroy(ringlog *ring);
+void        ringlog_push(ringlog *ring, ringlog_record *record);
+void        ringlog_clear(ringlog *ring);
+uint32_t    ringlog_intern(const char *name);
+const char *ringlog_name(uint32_t id);
+int         luaopen_ringlog(lua_State *L);
+
+#endif // RINGLOG_H
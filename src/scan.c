@@ -0,0 +1,668 @@
+/*
+ * scan.c: Parallel byte-signature scanner behind mem.scan().
+ *
+ * Committed, readable regions are cut into chunks that the worker pool
+ * copies out and searches independently. The kernels filter candidate
+ * positions on the first and last fixed byte of the pattern, 16 or 32
+ * positions per compare with SSE2/AVX2, and only fully verify the
+ * survivors. Chunks overlap by the pattern length so no match is lost at
+ * a boundary, and each chunk keeps its own hits, which makes the merged
+ * result sorted without a final sort.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "cpu.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "pool.h"
+#include "regions.h"
+#include "scan.h"
+
+#define SCAN_CHUNK_SIZE 0x100000u /* Bytes per work item */
+#define SCAN_MIN_ADDRESS 0x10000u
+
+typedef bool (*scan_kernel)(const scan_pattern *p, const uint8_t *data, size_t starts, uint32_t base,
+                            scan_hits *out, size_t limit);
+
+typedef struct
+{
+    uint32_t  base;
+    uint32_t  owned;  /* Start positions that belong to this chunk */
+    uint32_t  length; /* Bytes to read, owned plus overlap into the next chunk */
+    uint32_t  read;
+    bool      done;
+    scan_hits hits;
+} scan_chunk;
+
+typedef struct
+{
+    const scan_pattern *pattern;
+    scan_chunk         *chunks;
+    uint8_t            *scratch; /* One SCAN_CHUNK_SIZE + SCAN_MAX_PATTERN buffer per worker */
+    size_t              limit;
+    volatile LONG       found;
+    volatile LONG       cutoff; /* Chunks above this one cannot hold any of the first limit hits */
+    SRWLOCK             lock;   /* Guards the done prefix */
+    int                 prefix; /* Chunks below this are done */
+    size_t              prefix_hits;
+} scan_job;
+
+static scan_kernel g_kernel = NULL;
+static const char *g_kernelName = "scalar";
+
+//============================================================================
+// PATTERNS
+//============================================================================
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Picks the filter bytes and stores the pattern inverted, so the copy the
+// scanner holds in memory is never reported as a match of itself.
+static const char *finish_pattern(scan_pattern *p)
+{
+    p->anchor_first = -1;
+    p->anchor_last = -1;
+    for (int i = 0; i < p->length; i++)
+    {
+        if (p->mask[i])
+        {
+            if (p->anchor_first < 0)
+                p->anchor_first = i;
+            p->anchor_last = i;
+        }
+        p->bytes[i] = (uint8_t)~(p->bytes[i] & p->mask[i]);
+    }
+
+    if (p->length == 0)
+    {
+        return "empty pattern";
+    }
+    if (p->anchor_first < 0)
+    {
+        return "pattern has no fixed bytes";
+    }
+    return NULL;
+}
+
+// "8B 0D ?? ?? ?? ?? 85 C9" or the same without spaces; "?" also works
+// as a wildcard. Returns an error message or NULL.
+const char *scan_parse_pattern(scan_pattern *p, const char *text)
+{
+    memset(p, 0, sizeof(*p));
+
+    for (const char *c = text; *c;)
+    {
+        if (*c == ' ' || *c == '\t' || *c == ',')
+        {
+            c++;
+            continue;
+        }
+
+        if (p->length == SCAN_MAX_PATTERN)
+        {
+            return "pattern too long";
+        }
+
+        if (*c == '?')
+        {
+            c += c[1] == '?' ? 2 : 1;
+            p->mask[p->length++] = 0x00;
+            continue;
+        }
+
+        int high = hex_value(c[0]);
+        int low = high >= 0 ? hex_value(c[1]) : -1;
+        if (low < 0)
+        {
+            return "pattern must be hex byte pairs or ?? wildcards";
+        }
+
+        p->bytes[p->length] = (uint8_t)(high << 4 | low);
+        p->mask[p->length++] = 0xFF;
+        c += 2;
+    }
+
+    return finish_pattern(p);
+}
+
+// Raw bytes plus a code-style mask ("xx????xx"; x = match, ? = wildcard)
+const char *scan_parse_code(scan_pattern *p, const uint8_t *bytes, size_t length, const char *mask)
+{
+    memset(p, 0, sizeof(*p));
+
+    if (length > SCAN_MAX_PATTERN)
+    {
+        return "pattern too long";
+    }
+    if (mask && strlen(mask) != length)
+    {
+        return "mask length must equal pattern length";
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        p->bytes[i] = bytes[i];
+        p->mask[i] = !mask || mask[i] == 'x' ? 0xFF : 0x00;
+    }
+    p->length = (int)length;
+
+    return finish_pattern(p);
+}
+
+//============================================================================
+// KERNELS
+//============================================================================
+
+static bool verify(const scan_pattern *p, const uint8_t *at)
+{
+    for (int i = 0; i < p->length; i++)
+    {
+        if ((at[i] ^ (uint8_t)~p->bytes[i]) & p->mask[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends a hit; returns true once the limit is reached
+static bool emit(const scan_pattern *p, uint32_t address, scan_hits *out, size_t limit)
+{
+    if (p->align > 1 && address % p->align)
+    {
+        return false;
+    }
+
+    if (out->count == out->capacity)
+    {
+        size_t    capacity = out->capacity ? out->capacity * 2 : 16;
+        uint32_t *grown = realloc(out->items, capacity * sizeof(uint32_t));
+        if (!grown)
+        {
+            return true;
+        }
+        out->items = grown;
+        out->capacity = capacity;
+    }
+
+    out->items[out->count++] = address;
+    return out->count >= limit;
+}
+
+// Candidate starts are [from, starts); data holds starts + length - 1 bytes
+static bool scan_scalar_from(const scan_pattern *p, const uint8_t *data, size_t from, size_t starts, uint32_t base,
+                             scan_hits *out, size_t limit)
+{
+    uint8_t first = (uint8_t)~p->bytes[p->anchor_first];
+    uint8_t last = (uint8_t)~p->bytes[p->anchor_last];
+
+    for (size_t i = from; i < starts; i++)
+    {
+        if (data[i + p->anchor_first] == first && data[i + p->anchor_last] == last && verify(p, data + i) &&
+            emit(p, base + (uint32_t)i, out, limit))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool scan_scalar(const scan_pattern *p, const uint8_t *data, size_t starts, uint32_t base, scan_hits *out,
+                        size_t limit)
+{
+    return scan_scalar_from(p, data, 0, starts, base, out, limit);
+}
+
+__attribute__((target("sse2"))) static bool scan_sse2(const scan_pattern *p, const uint8_t *data, size_t starts,
+                                                      uint32_t base, scan_hits *out, size_t limit)
+{
+    const __m128i first = _mm_set1_epi8((char)~p->bytes[p->anchor_first]);
+    const __m128i last = _mm_set1_epi8((char)~p->bytes[p->anchor_last]);
+    size_t        i = 0;
+
+    for (; i + 16 <= starts; i += 16)
+    {
+        __m128i  a = _mm_loadu_si128((const __m128i *)(data + i + p->anchor_first));
+        __m128i  b = _mm_loadu_si128((const __m128i *)(data + i + p->anchor_last));
+        unsigned bits = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+
+        while (bits)
+        {
+            size_t at = i + (size_t)__builtin_ctz(bits);
+            if (verify(p, data + at) && emit(p, base + (uint32_t)at, out, limit))
+            {
+                return true;
+            }
+            bits &= bits - 1;
+        }
+    }
+
+    return scan_scalar_from(p, data, i, starts, base, out, limit);
+}
+
+__attribute__((target("avx2"))) static bool scan_avx2(const scan_pattern *p, const uint8_t *data, size_t starts,
+                                                      uint32_t base, scan_hits *out, size_t limit)
+{
+    const __m256i first = _mm256_set1_epi8((char)~p->bytes[p->anchor_first]);
+    const __m256i last = _mm256_set1_epi8((char)~p->bytes[p->anchor_last]);
+    size_t        i = 0;
+
+    for (; i + 32 <= starts; i += 32)
+    {
+        __m256i  a = _mm256_loadu_si256((const __m256i *)(data + i + p->anchor_first));
+        __m256i  b = _mm256_loadu_si256((const __m256i *)(data + i + p->anchor_last));
+        unsigned bits =
+            (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+
+        while (bits)
+        {
+            size_t at = i + (size_t)__builtin_ctz(bits);
+            if (verify(p, data + at) && emit(p, base + (uint32_t)at, out, limit))
+            {
+                return true;
+            }
+            bits &= bits - 1;
+        }
+    }
+
+    return scan_scalar_from(p, data, i, starts, base, out, limit);
+}
+
+static void select_kernel(void)
+{
+    uint32_t features = cpu_features();
+
+    if (features & CPU_AVX2)
+    {
+        g_kernel = scan_avx2;
+        g_kernelName = "avx2";
+    }
+    else if (features & CPU_SSE2)
+    {
+        g_kernel = scan_sse2;
+        g_kernelName = "sse2";
+    }
+    else
+    {
+        g_kernel = scan_scalar;
+        g_kernelName = "scalar";
+    }
+}
+
+const char *scan_kernel_name(void)
+{
+    if (!g_kernel)
+    {
+        select_kernel();
+    }
+    return g_kernelName;
+}
+
+// Searches starts candidate positions of data, which must hold at least
+// starts + p->length - 1 bytes. Hits are appended as base + offset.
+void scan_buffer(const scan_pattern *p, const uint8_t *data, size_t length, size_t starts, uint32_t base,
+                 scan_hits *out, size_t limit)
+{
+    if (!g_kernel)
+    {
+        select_kernel();
+    }
+
+    if (length < (size_t)p->length)
+    {
+        return;
+    }
+    if (starts > length - p->length + 1)
+    {
+        starts = length - p->length + 1;
+    }
+
+    g_kernel(p, data, starts, base, out, limit);
+}
+
+//============================================================================
+// REGIONS
+//============================================================================
+
+// Cuts every matching region into chunks. Returns the chunk count.
+static int build_chunks(const scan_range *filter, const void *skip, int overlap, scan_chunk **out)
+{
+    scan_chunk *chunks = NULL;
+    int         count = 0;
+    int         capacity = 0;
+
+    regions_entry *regions;
+    int            region_count = regions_copy(filter->start, filter->stop, &regions);
+    if (region_count < 0)
+    {
+        *out = NULL;
+        return -1;
+    }
+
+    for (int r = 0; r < region_count; r++)
+    {
+        const regions_entry *region = &regions[r];
+        bool wanted = regions_readable(region->protect) && region->alloc_base != (uint32_t)(uintptr_t)skip &&
+                      (!filter->exec_only || regions_executable(region->protect)) &&
+                      (!filter->writable_only || regions_writable(region->protect));
+
+        if (wanted)
+        {
+            uint32_t from = region->base;
+            uint32_t to = region->end;
+
+            // 64-bit, or stepping past a region that ends near 4 GB
+            // (large address aware under WoW64) wraps and never stops
+            for (uint64_t next = from; next < to; next += SCAN_CHUNK_SIZE)
+            {
+                uint32_t base = (uint32_t)next;
+                if (count == capacity)
+                {
+                    capacity = capacity ? capacity * 2 : 256;
+                    scan_chunk *grown = realloc(chunks, capacity * sizeof(scan_chunk));
+                    if (!grown)
+                    {
+                        free(chunks);
+                        free(regions);
+                        *out = NULL;
+                        return -1;
+                    }
+                    chunks = grown;
+                }
+
+                uint32_t owned = to - base < SCAN_CHUNK_SIZE ? to - base : SCAN_CHUNK_SIZE;
+                uint32_t readable = to - base;
+                uint32_t length = owned + (uint32_t)overlap;
+
+                scan_chunk *chunk = &chunks[count++];
+                memset(chunk, 0, sizeof(*chunk));
+                chunk->base = base;
+                chunk->owned = owned;
+                chunk->length = length < readable ? length : readable;
+            }
+        }
+    }
+    free(regions);
+
+    *out = chunks;
+    return count;
+}
+
+//============================================================================
+// PARALLEL SCAN
+//============================================================================
+
+// Pool tasks run in any order, so a limit is only reached once every chunk
+// below has been counted too; the hits kept are then the first in address
+// order rather than whichever chunks happened to finish first
+static void finish_chunk(scan_job *job, scan_chunk *chunk)
+{
+    AcquireSRWLockExclusive(&job->lock);
+    chunk->done = true;
+    while (job->prefix < job->cutoff && job->chunks[job->prefix].done)
+    {
+        job->prefix_hits += job->chunks[job->prefix].hits.count;
+        if (job->prefix_hits >= job->limit)
+        {
+            InterlockedExchange(&job->cutoff, job->prefix);
+        }
+        job->prefix++;
+    }
+    ReleaseSRWLockExclusive(&job->lock);
+}
+
+static void scan_chunk_task(void *ctx, int index, int worker)
+{
+    scan_job   *job = (scan_job *)ctx;
+    scan_chunk *chunk = &job->chunks[index];
+    uint8_t    *buffer = job->scratch + (size_t)worker * (SCAN_CHUNK_SIZE + SCAN_MAX_PATTERN);
+
+    if (index > job->cutoff)
+    {
+        return;
+    }
+
+    // A region freed mid-scan turns into a short read rather than a fault
+    SIZE_T read = 0;
+    if (ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)chunk->base, buffer, chunk->length, &read) ||
+        read != 0)
+    {
+        chunk->read = (uint32_t)read;
+        scan_buffer(job->pattern, buffer, read, chunk->owned, chunk->base, &chunk->hits, job->limit);
+        if (chunk->hits.count)
+        {
+            InterlockedExchangeAdd(&job->found, (LONG)chunk->hits.count);
+        }
+    }
+    finish_chunk(job, chunk);
+}
+
+// Image range of a loaded module; NULL names the game executable
+bool scan_module_range(const char *name, scan_range *range)
+{
+    HMODULE module = GetModuleHandleA(name);
+    if (!module)
+    {
+        return false;
+    }
+
+    const IMAGE_DOS_HEADER *dos = (const IMAGE_DOS_HEADER *)module;
+    const IMAGE_NT_HEADERS *nt = (const IMAGE_NT_HEADERS *)((const uint8_t *)module + dos->e_lfanew);
+    range->start = (uint32_t)(uintptr_t)module;
+    range->stop = range->start + nt->OptionalHeader.SizeOfImage;
+    return true;
+}
+
+// Everything a scan can see: user space minus the first 64K
+void scan_full_range(scan_range *range)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    memset(range, 0, sizeof(*range));
+    range->start = SCAN_MIN_ADDRESS;
+    range->stop = (uint32_t)(uintptr_t)info.lpMaximumApplicationAddress;
+}
+
+// Searches range with the worker pool. Hits are appended to out in
+// address order; stats is optional.
+bool scan_memory(const scan_pattern *p, const scan_range *range, size_t limit, scan_hits *out, scan_stats *stats)
+{
+    DWORD started = GetTickCount();
+
+    // Scratch lives in its own allocation so the scan can skip it
+    int      workers = pool_size();
+    SIZE_T   scratch_size = (SIZE_T)workers * (SCAN_CHUNK_SIZE + SCAN_MAX_PATTERN);
+    uint8_t *scratch = VirtualAlloc(NULL, scratch_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!scratch)
+    {
+        return false;
+    }
+
+    scan_chunk *chunks;
+    int         count = build_chunks(range, scratch, p->length - 1, &chunks);
+    if (count < 0)
+    {
+        VirtualFree(scratch, 0, MEM_RELEASE);
+        return false;
+    }
+
+    scan_job job = {p, chunks, scratch, limit, 0, count, SRWLOCK_INIT, 0, 0};
+    pool_for(count, scan_chunk_task, &job);
+    VirtualFree(scratch, 0, MEM_RELEASE);
+
+    // Chunks are in address order, so concatenating keeps hits sorted; the
+    // last chunk kept may take the total past the limit
+    bool   ok = true;
+    double bytes = 0;
+    size_t found = job.found > 0 ? (size_t)job.found : 0;
+    size_t needed = out->count + (found < limit ? found : limit);
+    size_t stop = needed;
+    if (needed > out->capacity)
+    {
+        uint32_t *grown = realloc(out->items, needed * sizeof(uint32_t));
+        if (grown)
+        {
+            out->items = grown;
+            out->capacity = needed;
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        bytes += chunks[i].read;
+        for (size_t h = 0; ok && h < chunks[i].hits.count && out->count < stop; h++)
+        {
+            out->items[out->count++] = chunks[i].hits.items[h];
+        }
+        free(chunks[i].hits.items);
+    }
+    free(chunks);
+
+    if (stats)
+    {
+        stats->chunks = count;
+        stats->bytes = bytes;
+        stats->ms = GetTickCount() - started;
+        stats->workers = workers;
+    }
+    return ok;
+}
+
+static uint32_t opt_address(lua_State *L, int opts, const char *field, uint32_t fallback)
+{
+    lua_getfield(L, opts, field);
+    uint32_t value = lua_isnil(L, -1) ? fallback : (uint32_t)(int64_t)luaL_checknumber(L, -1);
+    lua_pop(L, 1);
+    return value;
+}
+
+static bool opt_bool(lua_State *L, int opts, const char *field)
+{
+    lua_getfield(L, opts, field);
+    bool value = lua_toboolean(L, -1) != 0;
+    lua_pop(L, 1);
+    return value;
+}
+
+// mem.scan(pattern [, opts]) -> { addr, ... }, info
+// opts: module, start, stop, exec, writable, align, limit,
+//       mask (pattern is then raw bytes with an "xx??x" mask)
+static int l_mem_scan(lua_State *L)
+{
+    size_t       pattern_length;
+    const char  *pattern_text = luaL_checklstring(L, 1, &pattern_length);
+    bool         has_opts = lua_istable(L, 2);
+    scan_pattern pattern;
+    scan_range   range;
+    size_t       limit = (size_t)-1;
+    const char  *error;
+
+    scan_full_range(&range);
+
+    const char *mask = NULL;
+    if (has_opts)
+    {
+        lua_getfield(L, 2, "mask");
+        mask = lua_tostring(L, -1);
+        lua_pop(L, 1);
+    }
+
+    if (mask)
+        error = scan_parse_code(&pattern, (const uint8_t *)pattern_text, pattern_length, mask);
+    else
+        error = scan_parse_pattern(&pattern, pattern_text);
+    if (error)
+    {
+        return luaL_argerror(L, 1, error);
+    }
+
+    if (has_opts)
+    {
+        lua_getfield(L, 2, "module");
+        const char *module = lua_tostring(L, -1);
+        if (module && !scan_module_range(module, &range))
+        {
+            return luaL_error(L, "module '%s' is not loaded", module);
+        }
+        lua_pop(L, 1);
+
+        range.start = opt_address(L, 2, "start", range.start);
+        range.stop = opt_address(L, 2, "stop", range.stop);
+        range.exec_only = opt_bool(L, 2, "exec");
+        range.writable_only = opt_bool(L, 2, "writable");
+        pattern.align = opt_address(L, 2, "align", 1);
+        limit = opt_address(L, 2, "limit", 0);
+        if (limit == 0)
+        {
+            limit = (size_t)-1;
+        }
+    }
+
+    scan_hits  hits = {0};
+    scan_stats stats;
+    if (!scan_memory(&pattern, &range, limit, &hits, &stats))
+    {
+        free(hits.items);
+        return luaL_error(L, "out of memory");
+    }
+
+    // The raw pattern string itself is not a hit
+    uintptr_t source = (uintptr_t)pattern_text;
+    size_t    total = 0;
+    lua_createtable(L, (int)hits.count, 0);
+    for (size_t i = 0; i < hits.count && total < limit; i++)
+    {
+        if (hits.items[i] >= source && hits.items[i] < source + pattern_length)
+        {
+            continue;
+        }
+        lua_pushnumber(L, hits.items[i]);
+        lua_rawseti(L, -2, (int)++total);
+    }
+    free(hits.items);
+
+    lua_createtable(L, 0, 5);
+    lua_pushnumber(L, (lua_Number)total);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, stats.chunks);
+    lua_setfield(L, -2, "chunks");
+    lua_pushnumber(L, stats.bytes);
+    lua_setfield(L, -2, "bytes");
+    lua_pushnumber(L, stats.ms);
+    lua_setfield(L, -2, "ms");
+    lua_pushstring(L, scan_kernel_name());
+    lua_setfield(L, -2, "kernel");
+
+    logf("[SCAN] %u hits in %d chunks (%u MB) in %lu ms using %s x%d", (unsigned)total, stats.chunks,
+         (unsigned)(stats.bytes / (1 << 20)), (unsigned long)stats.ms, scan_kernel_name(), stats.workers);
+    return 2;
+}
+
+static const luaL_Reg scan_funcs[] = {{"scan", l_mem_scan}, {NULL, NULL}};
+
+int luaopen_scan(lua_State *L)
+{
+    luaL_register(L, "mem", scan_funcs);
+    return 1;
+}
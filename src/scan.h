@@ -0,0 +1,56 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+#define SCAN_MAX_PATTERN 256
+
+typedef struct
+{
+    uint8_t bytes[SCAN_MAX_PATTERN];
+    uint8_t mask[SCAN_MAX_PATTERN]; /* 0xFF = must match, 0x00 = wildcard */
+    int     length;
+    int     anchor_first; /* Fixed bytes the SIMD kernels filter on */
+    int     anchor_last;
+    uint32_t align;       /* Only report hits at multiples of this */
+} scan_pattern;
+
+typedef struct
+{
+    uint32_t *items;
+    size_t    count;
+    size_t    capacity;
+} scan_hits;
+
+typedef struct
+{
+    uint32_t start;
+    uint32_t stop;
+    bool     exec_only;
+    bool     writable_only;
+} scan_range;
+
+typedef struct
+{
+    int      chunks;
+    int      workers;
+    double   bytes;
+    uint32_t ms;
+} scan_stats;
+
+const char *scan_parse_pattern(scan_pattern *p, const char *text);
+const char *scan_parse_code(scan_pattern *p, const uint8_t *bytes, size_t length, const char *mask);
+void        scan_buffer(const scan_pattern *p, const uint8_t *data, size_t length, size_t starts, uint32_t base,
+                        scan_hits *out, size_t limit);
+bool        scan_memory(const scan_pattern *p, const scan_range *range, size_t limit, scan_hits *out,
+                        scan_stats *stats);
+bool        scan_module_range(const char *name, scan_range *range);
+void        scan_full_range(scan_range *range);
+const char *scan_kernel_name(void);
+int         luaopen_scan(lua_State *L);
+
+#endif // SCAN_H
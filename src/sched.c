@@ -0,0 +1,554 @@
+/*
+ * sched.c: Cooperative job scheduler for console commands.
+ *
+ * Every console line runs as a Lua coroutine. A job that finishes without
+ * yielding behaves exactly like a plain command; one that calls sleep(),
+ * await() or yield() is parked and resumed by the console loop between
+ * input lines, so several long-running jobs can share the console thread
+ * while the prompt stays usable. Waiting jobs cost nothing: the loop
+ * sleeps until the next timer expires, a line arrives or the dispatcher
+ * reports finished main-thread calls.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "dispatch.h"
+#include "lauxlib.h"
+#include "luastate.h"
+#include "output.h"
+#include "sched.h"
+
+#define SCHED_LABEL_SIZE 64
+
+typedef enum
+{
+    JOB_READY,    /* Runs on the next pass */
+    JOB_SLEEPING, /* Waits for wake_at */
+    JOB_AWAITING, /* Waits for a dispatch future */
+    JOB_DONE
+} job_state;
+
+static const char *const g_stateNames[] = {"ready", "sleeping", "awaiting", "done"};
+
+typedef struct
+{
+    int           id;
+    int           ref; /* Registry reference to the coroutine */
+    lua_State    *co;
+    job_state     state;
+    bool          background; /* Outlived its first slice; reports completion */
+    bool          killed;
+    DWORD         started;
+    DWORD         wake_at;  /* GetTickCount deadline for sleep/await */
+    bool          has_deadline;
+    dispatch_job *awaited;
+    int           awaited_ref; /* Keeps the future alive while parked */
+    DWORD         run_ms;
+    uint32_t      resumes;
+    char          label[SCHED_LABEL_SIZE];
+} sched_job;
+
+// Pointers, so jobs spawned while others run don't move them
+static sched_job **g_jobs = NULL;
+static int         g_jobCount = 0;
+static int         g_jobCapacity = 0;
+static int         g_nextJobId = 1;
+static sched_job  *g_current = NULL;
+static HANDLE      g_wakeEvent = NULL;
+
+//============================================================================
+// JOB LIST
+//============================================================================
+
+static bool due(DWORD deadline, DWORD now)
+{
+    return (LONG)(deadline - now) <= 0;
+}
+
+// Pops the function on top of L into a new parked job
+static sched_job *new_job(lua_State *L, const char *label)
+{
+    if (g_jobCount == g_jobCapacity)
+    {
+        int         capacity = g_jobCapacity ? g_jobCapacity * 2 : 16;
+        sched_job **grown = realloc(g_jobs, capacity * sizeof(sched_job *));
+        if (!grown)
+        {
+            return NULL;
+        }
+        g_jobs = grown;
+        g_jobCapacity = capacity;
+    }
+
+    sched_job *job = calloc(1, sizeof(sched_job));
+    if (!job)
+    {
+        return NULL;
+    }
+
+    job->co = lua_newthread(L);
+    lua_insert(L, -2);
+    lua_xmove(L, job->co, 1);
+    job->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    job->awaited_ref = LUA_NOREF;
+    job->id = g_nextJobId++;
+    job->state = JOB_READY;
+    job->started = GetTickCount();
+
+    // Multi-line commands are listed by their first line
+    snprintf(job->label, sizeof(job->label), "%s", label ? label : "?");
+    job->label[strcspn(job->label, "\r\n")] = '\0';
+
+    g_jobs[g_jobCount++] = job;
+    return job;
+}
+
+static void release_await(lua_State *L, sched_job *job)
+{
+    luaL_unref(L, LUA_REGISTRYINDEX, job->awaited_ref);
+    job->awaited_ref = LUA_NOREF;
+    job->awaited = NULL;
+}
+
+// Frees finished and killed jobs. Never runs while a job is being resumed.
+static void reap_jobs(lua_State *L)
+{
+    int count = 0;
+    for (int i = 0; i < g_jobCount; i++)
+    {
+        sched_job *job = g_jobs[i];
+        if (job->state == JOB_DONE || job->killed)
+        {
+            release_await(L, job);
+            luaL_unref(L, LUA_REGISTRYINDEX, job->ref);
+            free(job);
+            continue;
+        }
+        g_jobs[count++] = job;
+    }
+    g_jobCount = count;
+}
+
+static sched_job *find_job(int id)
+{
+    for (int i = 0; i < g_jobCount; i++)
+    {
+        if (g_jobs[i]->id == id && !g_jobs[i]->killed)
+        {
+            return g_jobs[i];
+        }
+    }
+    return NULL;
+}
+
+//============================================================================
+// RESUMPTION
+//============================================================================
+
+// Runs a job until it yields or ends. The error of a foreground job is left
+// on its coroutine for the caller; background jobs report their own.
+static int resume_job(sched_job *job, int nargs)
+{
+    sched_job *previous = g_current;
+    g_current = job;
+
+    // A bare coroutine.yield() counts as yield()
+    job->state = JOB_READY;
+    job->resumes++;
+
+    DWORD start = GetTickCount();
+    int   status = lua_resume(job->co, nargs);
+    job->run_ms += GetTickCount() - start;
+
+    g_current = previous;
+
+    if (status == LUA_YIELD)
+    {
+        // Anything passed to coroutine.yield() is meaningless here
+        lua_settop(job->co, 0);
+        return status;
+    }
+
+    job->state = JOB_DONE;
+    if (!job->background)
+    {
+        return status;
+    }
+
+    if (status != 0)
+    {
+        const char *error = lua_tostring(job->co, -1);
+        output_printf("\n[job %d] failed: %s\n", job->id, error ? error : "(unknown error)");
+    }
+    else if (!job->killed)
+    {
+        output_printf("\n[job %d] finished after %.1fs: %s\n", job->id, (GetTickCount() - job->started) / 1000.0,
+                      job->label);
+    }
+    return status;
+}
+
+// Resumes an awaiting job with the same values future:wait() returns
+static void resume_await(lua_State *L, sched_job *job, bool completed)
+{
+    int nargs;
+    if (completed)
+    {
+        lua_pushboolean(job->co, 1);
+        nargs = 1 + dispatch_push_result(job->co, job->awaited);
+    }
+    else
+    {
+        lua_pushboolean(job->co, 0);
+        lua_pushliteral(job->co, "timeout");
+        nargs = 2;
+    }
+
+    release_await(L, job);
+    resume_job(job, nargs);
+}
+
+// Compiled chunk on top of L becomes a job and gets its first slice.
+// Returns the id if it is still running, 0 if it finished, or -1 with the
+// error message pushed onto L.
+int sched_spawn(lua_State *L, const char *label)
+{
+    sched_job *job = new_job(L, label);
+    if (!job)
+    {
+        lua_pop(L, 1);
+        lua_pushliteral(L, "not enough memory to start job");
+        return -1;
+    }
+
+    int status = resume_job(job, 0);
+    if (job->state != JOB_DONE)
+    {
+        job->background = true;
+        return job->id;
+    }
+
+    if (status != 0)
+    {
+        lua_xmove(job->co, L, 1);
+    }
+    reap_jobs(L);
+    return status != 0 ? -1 : 0;
+}
+
+// One pass over all jobs. Returns how long the console loop may sleep
+// before the next job is due, INFINITE if only events can wake one.
+DWORD sched_run(void)
+{
+    lua_State *L = luastate_acquire();
+    if (!L)
+    {
+        return INFINITE;
+    }
+
+    int count = g_jobCount;
+    for (int i = 0; i < count; i++)
+    {
+        sched_job *job = g_jobs[i];
+        DWORD      now = GetTickCount();
+        if (job->killed)
+        {
+            continue;
+        }
+
+        switch (job->state)
+        {
+        case JOB_READY:
+            resume_job(job, 0);
+            break;
+        case JOB_SLEEPING:
+            if (due(job->wake_at, now))
+            {
+                resume_job(job, 0);
+            }
+            break;
+        case JOB_AWAITING:
+            if (job->awaited->state == DISPATCH_DONE)
+            {
+                resume_await(L, job, true);
+            }
+            else if (job->has_deadline && due(job->wake_at, now))
+            {
+                resume_await(L, job, false);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    reap_jobs(L);
+
+    DWORD timeout = INFINITE;
+    DWORD now = GetTickCount();
+    for (int i = 0; i < g_jobCount; i++)
+    {
+        sched_job *job = g_jobs[i];
+        DWORD      wait = INFINITE;
+
+        if (job->state == JOB_READY)
+        {
+            wait = 0;
+        }
+        else if (job->state == JOB_SLEEPING || (job->state == JOB_AWAITING && job->has_deadline))
+        {
+            wait = due(job->wake_at, now) ? 0 : job->wake_at - now;
+        }
+
+        if (wait < timeout)
+        {
+            timeout = wait;
+        }
+    }
+
+    luastate_release();
+    return timeout;
+}
+
+HANDLE sched_wake_event(void)
+{
+    return g_wakeEvent;
+}
+
+// Removes a job. Called from inside a job, the removal happens after the
+// current pass, and a job killing itself stops at its next yield.
+bool sched_kill(int id)
+{
+    lua_State *L = luastate_acquire();
+    if (!L)
+    {
+        return false;
+    }
+
+    sched_job *job = find_job(id);
+    if (job)
+    {
+        job->killed = true;
+        if (!g_current)
+        {
+            reap_jobs(L);
+        }
+    }
+
+    luastate_release();
+    return job != NULL;
+}
+
+void sched_print_jobs(void)
+{
+    lua_State *L = luastate_acquire();
+    if (!L)
+    {
+        return;
+    }
+
+    if (g_jobCount == 0)
+    {
+        output_printf("No background jobs\n");
+    }
+    else
+    {
+        output_printf("  ID  STATE       ELAPSED   CPU MS  COMMAND\n");
+        DWORD now = GetTickCount();
+        for (int i = 0; i < g_jobCount; i++)
+        {
+            sched_job *job = g_jobs[i];
+            output_printf("%4d  %-10s %7.1fs %8lu  %s\n", job->id, g_stateNames[job->state],
+                          (now - job->started) / 1000.0, (unsigned long)job->run_ms, job->label);
+        }
+    }
+
+    luastate_release();
+}
+
+bool sched_init(void)
+{
+    g_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (!g_wakeEvent)
+    {
+        return false;
+    }
+
+    dispatch_set_notify_event(g_wakeEvent);
+    return true;
+}
+
+void sched_shutdown(void)
+{
+    dispatch_set_notify_event(NULL);
+
+    lua_State *L = luastate_acquire();
+    if (L)
+    {
+        for (int i = 0; i < g_jobCount; i++)
+        {
+            g_jobs[i]->killed = true;
+        }
+        reap_jobs(L);
+        luastate_release();
+    }
+
+    free(g_jobs);
+    g_jobs = NULL;
+    g_jobCapacity = 0;
+
+    if (g_wakeEvent)
+    {
+        CloseHandle(g_wakeEvent);
+        g_wakeEvent = NULL;
+    }
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+// The job whose coroutine is L, or NULL outside the scheduler (init.lua,
+// frame callbacks, user coroutines), where the blocking fallbacks apply.
+static sched_job *current_job(lua_State *L)
+{
+    return g_current && g_current->co == L ? g_current : NULL;
+}
+
+// sleep(ms) yields the job; elsewhere it blocks the calling thread
+static int l_sleep(lua_State *L)
+{
+    lua_Number ms = luaL_optnumber(L, 1, 0);
+    DWORD      wait = ms > 0 ? (DWORD)ms : 0;
+
+    sched_job *job = current_job(L);
+    if (!job)
+    {
+        Sleep(wait);
+        return 0;
+    }
+
+    job->state = JOB_SLEEPING;
+    job->wake_at = GetTickCount() + wait;
+    return lua_yield(L, 0);
+}
+
+// await(future [, timeout_ms]) -> true, result | false, "timeout"
+static int l_await(lua_State *L)
+{
+    dispatch_job *awaited = dispatch_to_job(L, 1);
+    luaL_argcheck(L, awaited != NULL, 1, "future expected");
+
+    bool  has_deadline = !lua_isnoneornil(L, 2);
+    DWORD timeout = has_deadline ? (DWORD)luaL_checknumber(L, 2) : INFINITE;
+
+    sched_job *job = current_job(L);
+    if (!job || awaited->state == DISPATCH_DONE)
+    {
+        bool completed = dispatch_wait(awaited, timeout);
+        lua_pushboolean(L, completed);
+        if (!completed)
+        {
+            lua_pushliteral(L, "timeout");
+            return 2;
+        }
+        return 1 + dispatch_push_result(L, awaited);
+    }
+
+    lua_pushvalue(L, 1);
+    job->awaited_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    job->awaited = awaited;
+    job->has_deadline = has_deadline;
+    job->wake_at = GetTickCount() + timeout;
+    job->state = JOB_AWAITING;
+    return lua_yield(L, 0);
+}
+
+// yield() lets other jobs and console input run, then continues
+static int l_yield(lua_State *L)
+{
+    if (!current_job(L))
+    {
+        return 0;
+    }
+    return lua_yield(L, 0);
+}
+
+// sched.spawn(fn [, label]) -> id, starts on the next scheduler pass
+static int l_sched_spawn(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    const char *label = luaL_optstring(L, 2, "sched.spawn");
+
+    lua_pushvalue(L, 1);
+    sched_job *job = new_job(L, label);
+    if (!job)
+    {
+        return luaL_error(L, "not enough memory to start job");
+    }
+
+    job->background = true;
+    SetEvent(g_wakeEvent);
+    lua_pushinteger(L, job->id);
+    return 1;
+}
+
+static int l_sched_kill(lua_State *L)
+{
+    lua_pushboolean(L, sched_kill(luaL_checkint(L, 1)));
+    return 1;
+}
+
+static int l_sched_current(lua_State *L)
+{
+    sched_job *job = current_job(L);
+    if (!job)
+    {
+        return 0;
+    }
+    lua_pushinteger(L, job->id);
+    return 1;
+}
+
+static int l_sched_list(lua_State *L)
+{
+    DWORD now = GetTickCount();
+    lua_createtable(L, g_jobCount, 0);
+    for (int i = 0; i < g_jobCount; i++)
+    {
+        sched_job *job = g_jobs[i];
+        lua_createtable(L, 0, 5);
+        lua_pushinteger(L, job->id);
+        lua_setfield(L, -2, "id");
+        lua_pushstring(L, g_stateNames[job->state]);
+        lua_setfield(L, -2, "state");
+        lua_pushstring(L, job->label);
+        lua_setfield(L, -2, "label");
+        lua_pushnumber(L, now - job->started);
+        lua_setfield(L, -2, "elapsed_ms");
+        lua_pushnumber(L, job->run_ms);
+        lua_setfield(L, -2, "run_ms");
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 1;
+}
+
+static const luaL_Reg sched_funcs[] = {{"spawn", l_sched_spawn},     {"kill", l_sched_kill},
+                                       {"current", l_sched_current}, {"list", l_sched_list},
+                                       {NULL, NULL}};
+
+int luaopen_sched(lua_State *L)
+{
+    lua_register(L, "sleep", l_sleep);
+    lua_register(L, "await", l_await);
+    lua_register(L, "yield", l_yield);
+
+    luaL_register(L, "sched", sched_funcs);
+    return 1;
+}
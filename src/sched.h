@@ -0,0 +1,18 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdbool.h>
+#include <windows.h>
+
+#include "lua.h"
+
+bool   sched_init(void);
+void   sched_shutdown(void);
+int    sched_spawn(lua_State *L, const char *label);
+DWORD  sched_run(void);
+HANDLE sched_wake_event(void);
+bool   sched_kill(int id);
+void   sched_print_jobs(void);
+int    luaopen_sched(lua_State *L);
+
+#endif // SCHED_H
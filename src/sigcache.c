@@ -0,0 +1,472 @@
+/*
+ * sigcache.c: Persistent signature -> RVA cache behind mem.resolve().
+ *
+ * The cache file is tied to one build of the game executable through its
+ * PE timestamp, checksum and image size; a different build discards it.
+ * A cached RVA is trusted only after the pattern is re-checked at that
+ * address, so warm lookups cost one small read each and only signatures
+ * that miss or fail validation pay for a scan of the executable image.
+ *
+ * File format (text, one entry per line):
+ *   # comment
+ *   build <timestamp> <checksum> <image size>
+ *   <rva> <normalized pattern>
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "logging.h"
+#include "scan.h"
+#include "sigcache.h"
+
+#define SIGCACHE_KEY_SIZE (SCAN_MAX_PATTERN * 3)
+#define SIGCACHE_LINE_SIZE (SIGCACHE_KEY_SIZE + 32)
+
+typedef struct
+{
+    char    *key; /* Normalized pattern, NULL for an empty slot */
+    uint32_t hash;
+    uint32_t rva;
+    bool     validated; /* Checked against the running image this session */
+} sigcache_entry;
+
+typedef struct
+{
+    uint32_t timestamp;
+    uint32_t checksum;
+    uint32_t image_size;
+} sigcache_build;
+
+typedef struct
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t stale; /* Cached RVA no longer matched */
+    uint32_t scans;
+    double   load_ms;
+} sigcache_stats;
+
+static sigcache_entry *g_entries = NULL;
+static uint32_t        g_capacity = 0; /* Power of two */
+static uint32_t        g_count = 0;
+static bool            g_dirty = false;
+static char            g_path[MAX_PATH] = "";
+static sigcache_build  g_build = {0};
+static scan_range      g_image = {0};
+static sigcache_stats  g_stats = {0};
+
+//============================================================================
+// HASH TABLE
+//============================================================================
+
+static uint32_t hash_key(const char *key)
+{
+    uint32_t hash = 2166136261u;
+    for (; *key; key++)
+    {
+        hash = (hash ^ (uint8_t)*key) * 16777619u;
+    }
+    return hash;
+}
+
+static sigcache_entry *find_slot(sigcache_entry *entries, uint32_t capacity, const char *key, uint32_t hash)
+{
+    uint32_t index = hash & (capacity - 1);
+    while (entries[index].key && (entries[index].hash != hash || strcmp(entries[index].key, key) != 0))
+    {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+static bool grow(void)
+{
+    uint32_t        capacity = g_capacity ? g_capacity * 2 : 256;
+    sigcache_entry *entries = calloc(capacity, sizeof(sigcache_entry));
+    if (!entries)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < g_capacity; i++)
+    {
+        if (g_entries[i].key)
+        {
+            *find_slot(entries, capacity, g_entries[i].key, g_entries[i].hash) = g_entries[i];
+        }
+    }
+
+    free(g_entries);
+    g_entries = entries;
+    g_capacity = capacity;
+    return true;
+}
+
+static sigcache_entry *lookup(const char *key)
+{
+    if (!g_capacity)
+    {
+        return NULL;
+    }
+    sigcache_entry *slot = find_slot(g_entries, g_capacity, key, hash_key(key));
+    return slot->key ? slot : NULL;
+}
+
+static void store(const char *key, uint32_t rva)
+{
+    uint32_t hash = hash_key(key);
+
+    // Keep the load factor under 3/4
+    if ((g_count + 1) * 4 > g_capacity * 3 && !grow())
+    {
+        return;
+    }
+
+    sigcache_entry *slot = find_slot(g_entries, g_capacity, key, hash);
+    if (!slot->key)
+    {
+        slot->key = _strdup(key);
+        if (!slot->key)
+        {
+            return;
+        }
+        slot->hash = hash;
+        g_count++;
+    }
+
+    slot->rva = rva;
+    slot->validated = true;
+    g_dirty = true;
+}
+
+static void clear_entries(void)
+{
+    for (uint32_t i = 0; i < g_capacity; i++)
+    {
+        free(g_entries[i].key);
+    }
+    free(g_entries);
+    g_entries = NULL;
+    g_capacity = 0;
+    g_count = 0;
+}
+
+//============================================================================
+// IMAGE IDENTITY
+//============================================================================
+
+static bool read_build(void)
+{
+    HMODULE exe = GetModuleHandleA(NULL);
+    if (!exe || !scan_module_range(NULL, &g_image))
+    {
+        return false;
+    }
+
+    const IMAGE_DOS_HEADER *dos = (const IMAGE_DOS_HEADER *)exe;
+    const IMAGE_NT_HEADERS *nt = (const IMAGE_NT_HEADERS *)((const uint8_t *)exe + dos->e_lfanew);
+    g_build.timestamp = nt->FileHeader.TimeDateStamp;
+    g_build.checksum = nt->OptionalHeader.CheckSum;
+    g_build.image_size = nt->OptionalHeader.SizeOfImage;
+    return true;
+}
+
+// Canonical spelling, so spacing and case don't split cache entries
+static void normalize(const scan_pattern *p, char *out)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char             *c = out;
+
+    for (int i = 0; i < p->length; i++)
+    {
+        if (i > 0)
+        {
+            *c++ = ' ';
+        }
+        if (p->mask[i])
+        {
+            uint8_t byte = (uint8_t)~p->bytes[i];
+            *c++ = hex[byte >> 4];
+            *c++ = hex[byte & 15];
+        }
+        else
+        {
+            *c++ = '?';
+            *c++ = '?';
+        }
+    }
+    *c = '\0';
+}
+
+// Re-checks a cached RVA against the running image
+static bool validate(const scan_pattern *p, uint32_t rva)
+{
+    uint8_t buffer[SCAN_MAX_PATTERN];
+    SIZE_T  read = 0;
+
+    if (rva + (uint32_t)p->length > g_build.image_size || rva + (uint32_t)p->length < rva)
+    {
+        return false;
+    }
+
+    if (!ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)(g_image.start + rva), buffer, p->length,
+                           &read) ||
+        read != (SIZE_T)p->length)
+    {
+        return false;
+    }
+
+    scan_hits hits = {0};
+    scan_buffer(p, buffer, read, 1, 0, &hits, 1);
+    bool matched = hits.count == 1;
+    free(hits.items);
+    return matched;
+}
+
+//============================================================================
+// PERSISTENCE
+//============================================================================
+
+// Loads the cache for the running build. A missing file or an entry for
+// another build leaves an empty cache that is written out on the next save.
+bool sigcache_load(const char *path)
+{
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    snprintf(g_path, sizeof(g_path), "%s", path);
+    clear_entries();
+    g_dirty = false;
+
+    if (!read_build())
+    {
+        logf("[SIGCACHE] Cannot read the game executable's PE header");
+        return false;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        logf("[SIGCACHE] No cache at %s, signatures will be scanned", path);
+        return true;
+    }
+
+    char line[SIGCACHE_LINE_SIZE];
+    bool build_ok = false;
+    while (fgets(line, sizeof(line), file))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '#' || line[0] == '\0')
+        {
+            continue;
+        }
+
+        unsigned timestamp, checksum, image_size, rva;
+        int      consumed = 0;
+        if (sscanf(line, "build %x %x %x", &timestamp, &checksum, &image_size) == 3)
+        {
+            build_ok = timestamp == g_build.timestamp && checksum == g_build.checksum &&
+                       image_size == g_build.image_size;
+            if (!build_ok)
+            {
+                logf("[SIGCACHE] Cache is for build %08X, game is %08X; discarding", timestamp, g_build.timestamp);
+                break;
+            }
+        }
+        else if (build_ok && sscanf(line, "%x %n", &rva, &consumed) == 1 && consumed > 0)
+        {
+            store(line + consumed, rva);
+        }
+    }
+    fclose(file);
+
+    // Entries still need validating against this session's image
+    for (uint32_t i = 0; i < g_capacity; i++)
+    {
+        g_entries[i].validated = false;
+    }
+    g_dirty = !build_ok;
+
+    QueryPerformanceCounter(&end);
+    g_stats.load_ms = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+    logf("[SIGCACHE] Loaded %u signatures from %s in %.2f ms", g_count, path, g_stats.load_ms);
+    return true;
+}
+
+// Writes the cache if it changed, through a temporary file so a crash
+// mid-write never leaves a truncated cache behind
+bool sigcache_save(void)
+{
+    if (!g_dirty || g_path[0] == '\0')
+    {
+        return true;
+    }
+
+    char temp[MAX_PATH + 8];
+    snprintf(temp, sizeof(temp), "%s.tmp", g_path);
+
+    FILE *file = fopen(temp, "w");
+    if (!file)
+    {
+        logf("[SIGCACHE] Cannot write %s", temp);
+        return false;
+    }
+
+    fprintf(file, "# Signature cache, regenerated automatically\n");
+    fprintf(file, "build %08X %08X %08X\n", g_build.timestamp, g_build.checksum, g_build.image_size);
+    for (uint32_t i = 0; i < g_capacity; i++)
+    {
+        if (g_entries[i].key)
+        {
+            fprintf(file, "%08X %s\n", g_entries[i].rva, g_entries[i].key);
+        }
+    }
+
+    bool ok = fclose(file) == 0 && MoveFileExA(temp, g_path, MOVEFILE_REPLACE_EXISTING);
+    if (ok)
+    {
+        g_dirty = false;
+        logf("[SIGCACHE] Saved %u signatures to %s", g_count, g_path);
+    }
+    return ok;
+}
+
+void sigcache_shutdown(void)
+{
+    sigcache_save();
+    clear_entries();
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+// mem.resolve(pattern [, opts]) -> address | nil, error
+// Finds a signature in the game executable, through the cache when the
+// cached location still matches. opts.offset is added to the match.
+static int l_mem_resolve(lua_State *L)
+{
+    const char  *text = luaL_checkstring(L, 1);
+    int32_t      offset = 0;
+    scan_pattern pattern;
+    char         key[SIGCACHE_KEY_SIZE];
+
+    if (lua_istable(L, 2))
+    {
+        lua_getfield(L, 2, "offset");
+        offset = (int32_t)luaL_optnumber(L, -1, 0);
+        lua_pop(L, 1);
+    }
+
+    const char *error = scan_parse_pattern(&pattern, text);
+    if (error)
+    {
+        return luaL_argerror(L, 1, error);
+    }
+    if (!g_image.start && !read_build())
+    {
+        return luaL_error(L, "cannot locate the game executable");
+    }
+
+    normalize(&pattern, key);
+    sigcache_entry *entry = lookup(key);
+    if (entry && (entry->validated || validate(&pattern, entry->rva)))
+    {
+        entry->validated = true;
+        g_stats.hits++;
+        lua_pushnumber(L, (uint32_t)(g_image.start + entry->rva + offset));
+        return 1;
+    }
+
+    if (entry)
+    {
+        g_stats.stale++;
+    }
+    g_stats.misses++;
+    g_stats.scans++;
+
+    // Two hits are enough to tell a unique signature from an ambiguous one
+    scan_hits hits = {0};
+    if (!scan_memory(&pattern, &g_image, 2, &hits, NULL))
+    {
+        free(hits.items);
+        return luaL_error(L, "out of memory");
+    }
+
+    if (hits.count == 0)
+    {
+        free(hits.items);
+        lua_pushnil(L);
+        lua_pushfstring(L, "signature not found: %s", key);
+        return 2;
+    }
+
+    if (hits.count > 1)
+    {
+        logf("[SIGCACHE] Signature is not unique, using first match at %08X: %s", hits.items[0], key);
+    }
+
+    uint32_t rva = hits.items[0] - g_image.start;
+    free(hits.items);
+    store(key, rva);
+
+    lua_pushnumber(L, (uint32_t)(g_image.start + rva + offset));
+    return 1;
+}
+
+static int l_mem_sigcache_save(lua_State *L)
+{
+    lua_pushboolean(L, sigcache_save());
+    return 1;
+}
+
+static int l_mem_sigcache_clear(lua_State *L)
+{
+    clear_entries();
+    g_dirty = true;
+    return 0;
+}
+
+static int l_mem_sigcache_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 8);
+    lua_pushnumber(L, g_count);
+    lua_setfield(L, -2, "entries");
+    lua_pushnumber(L, g_stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, g_stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, g_stats.stale);
+    lua_setfield(L, -2, "stale");
+    lua_pushnumber(L, g_stats.load_ms);
+    lua_setfield(L, -2, "load_ms");
+    char build[16];
+    snprintf(build, sizeof(build), "%08X", g_build.timestamp);
+    lua_pushstring(L, build);
+    lua_setfield(L, -2, "build");
+    lua_pushboolean(L, g_dirty);
+    lua_setfield(L, -2, "dirty");
+    lua_pushstring(L, g_path);
+    lua_setfield(L, -2, "path");
+    return 1;
+}
+
+static const luaL_Reg sigcache_funcs[] = {{"resolve", l_mem_resolve},
+                                          {"sigcache_save", l_mem_sigcache_save},
+                                          {"sigcache_clear", l_mem_sigcache_clear},
+                                          {"sigcache_stats", l_mem_sigcache_stats},
+                                          {NULL, NULL}};
+
+int luaopen_sigcache(lua_State *L)
+{
+    luaL_register(L, "mem", sigcache_funcs);
+    return 1;
+}
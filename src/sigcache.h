@@ -0,0 +1,14 @@
+#ifndef SIGCACHE_H
+#define SIGCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+bool sigcache_load(const char *path);
+bool sigcache_save(void);
+void sigcache_shutdown(void);
+int  luaopen_sigcache(lua_State *L);
+
+#endif // SIGCACHE_H
@@ -0,0 +1,1080 @@
+/*
+ * snapshot.c: Incremental memory snapshots for "find the changed value".
+ *
+ * mem.snapshot() copies every writable region once. Candidates start out
+ * implicit (every aligned slot) and become a bitset per region on the
+ * first filter; once few enough survive they move to a sorted address
+ * array with their last values. Each pass re-reads only pages that still
+ * hold candidates, compares 32 slots at a time with SSE2 where the type
+ * allows, and keeps the freshly read values as the baseline for the next
+ * pass, so refining costs work proportional to the survivors.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <emmintrin.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "cpu.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "pool.h"
+#include "regions.h"
+#include "scan.h"
+#include "snapshot.h"
+
+#define SNAP_MT "luaapi.snapshot"
+#define SNAP_PAGE 0x1000u
+#define SNAP_RUN_SIZE 0x10000u      /* Most bytes re-read per call */
+#define SNAP_REGION_MAX 0x1000000u  /* Larger regions are split for balancing */
+#define SNAP_SPARSE_BLOCK 4096u     /* Candidates per parallel work item */
+#define SNAP_DEFAULT_RESULTS 10000
+
+typedef enum
+{
+    SNAP_INT8,
+    SNAP_UINT8,
+    SNAP_INT16,
+    SNAP_UINT16,
+    SNAP_INT32,
+    SNAP_UINT32,
+    SNAP_INT64,
+    SNAP_UINT64,
+    SNAP_FLOAT,
+    SNAP_DOUBLE
+} snap_type;
+
+static const struct
+{
+    const char *name;
+    int         width;
+} g_types[] = {{"int8", 1},  {"uint8", 1},  {"int16", 2}, {"uint16", 2}, {"int32", 4},
+               {"uint32", 4}, {"int64", 8}, {"uint64", 8}, {"float", 4},  {"double", 8}};
+
+typedef enum
+{
+    OP_EQ,
+    OP_CHANGED,
+    OP_UNCHANGED,
+    OP_INCREASED,
+    OP_DECREASED,
+    OP_REFRESH
+} snap_op;
+
+typedef struct
+{
+    uint32_t  base;
+    uint32_t  size;   /* Whole pages */
+    uint8_t  *values; /* As of the last pass */
+    uint32_t *bits;   /* NULL while every slot is still a candidate */
+    uint32_t  count;
+} snap_region;
+
+typedef struct
+{
+    snap_type type;
+    int       width;
+    bool      sparse;
+    uint32_t  passes;
+    size_t    count;
+
+    // Dense phase
+    snap_region *regions;
+    int          region_count;
+
+    // Sparse phase, sorted by address
+    uint32_t *addrs;
+    uint8_t  *values;
+} snapshot;
+
+typedef struct
+{
+    snapshot *snap;
+    snap_op   op;
+    snap_type type; /* Interpretation for this pass, same width as the snapshot's */
+    uint8_t   ref[8];
+    bool      simd;
+    uint8_t  *scratch; /* SNAP_RUN_SIZE per worker */
+
+    // Dense passes
+    volatile LONG failed; /* A region could not get its bitset and was left unfiltered */
+
+    // Sparse passes
+    uint8_t  *next_values;
+    uint32_t *keep;
+} snap_pass;
+
+//============================================================================
+// COMPARISON
+//============================================================================
+
+static bool is_signed_int(snap_type type)
+{
+    return type == SNAP_INT8 || type == SNAP_INT16 || type == SNAP_INT32 || type == SNAP_INT64;
+}
+
+static bool is_float(snap_type type)
+{
+    return type == SNAP_FLOAT || type == SNAP_DOUBLE;
+}
+
+static int64_t load_int(snap_type type, const uint8_t *p)
+{
+    switch (type)
+    {
+    case SNAP_INT8:
+        return *(const int8_t *)p;
+    case SNAP_UINT8:
+        return *p;
+    case SNAP_INT16: {
+        int16_t v;
+        memcpy(&v, p, 2);
+        return v;
+    }
+    case SNAP_UINT16: {
+        uint16_t v;
+        memcpy(&v, p, 2);
+        return v;
+    }
+    case SNAP_INT32: {
+        int32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    case SNAP_UINT32: {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    default: {
+        int64_t v;
+        memcpy(&v, p, 8);
+        return v;
+    }
+    }
+}
+
+static double load_float(snap_type type, const uint8_t *p)
+{
+    if (type == SNAP_FLOAT)
+    {
+        float v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+    double v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// -1, 0 or 1 comparing a against b in the given type
+static int compare_value(snap_type type, const uint8_t *a, const uint8_t *b)
+{
+    if (is_float(type))
+    {
+        double x = load_float(type, a), y = load_float(type, b);
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+    if (type == SNAP_UINT64)
+    {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        return x < y ? -1 : x > y ? 1 : 0;
+    }
+    int64_t x = load_int(type, a), y = load_int(type, b);
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static bool keep_slot(const snap_pass *pass, const uint8_t *old, const uint8_t *cur)
+{
+    int width = pass->snap->width;
+
+    switch (pass->op)
+    {
+    case OP_EQ:
+        // NaN never equals anything, matching the SSE2 path
+        return is_float(pass->type) ? load_float(pass->type, cur) == load_float(pass->type, pass->ref)
+                                    : memcmp(cur, pass->ref, width) == 0;
+    case OP_CHANGED:
+        return memcmp(cur, old, width) != 0;
+    case OP_UNCHANGED:
+        return memcmp(cur, old, width) == 0;
+    case OP_INCREASED:
+        return compare_value(pass->type, cur, old) > 0;
+    case OP_DECREASED:
+        return compare_value(pass->type, cur, old) < 0;
+    default:
+        return true;
+    }
+}
+
+static uint32_t compare_scalar(const snap_pass *pass, const uint8_t *old, const uint8_t *cur, int n)
+{
+    uint32_t mask = 0;
+    int      width = pass->snap->width;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (keep_slot(pass, old + i * width, cur + i * width))
+        {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+// One bit per lane of a compare result: 16, 8, 4 or 2 lanes per vector
+__attribute__((target("sse2"))) static uint32_t lane_bits(__m128i c, int width)
+{
+    switch (width)
+    {
+    case 1:
+        return (uint32_t)_mm_movemask_epi8(c);
+    case 2:
+        return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(c, _mm_setzero_si128())) & 0xFF;
+    case 4:
+        return (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(c));
+    default:
+        // 64-bit lanes are equal when both halves are
+        c = _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2, 3, 0, 1)));
+        return (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(c));
+    }
+}
+
+__attribute__((target("sse2"))) static __m128i equal_lanes(__m128i a, __m128i b, int width)
+{
+    switch (width)
+    {
+    case 1:
+        return _mm_cmpeq_epi8(a, b);
+    case 2:
+        return _mm_cmpeq_epi16(a, b);
+    default:
+        return _mm_cmpeq_epi32(a, b);
+    }
+}
+
+// a > b per lane; only called for types simd_supported() accepts
+__attribute__((target("sse2"))) static __m128i greater_lanes(__m128i a, __m128i b, snap_type type)
+{
+    switch (type)
+    {
+    case SNAP_INT8:
+        return _mm_cmpgt_epi8(a, b);
+    case SNAP_INT16:
+        return _mm_cmpgt_epi16(a, b);
+    case SNAP_INT32:
+        return _mm_cmpgt_epi32(a, b);
+    case SNAP_FLOAT:
+        return _mm_castps_si128(_mm_cmpgt_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b)));
+    default:
+        return _mm_castpd_si128(_mm_cmpgt_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b)));
+    }
+}
+
+static bool simd_supported(snap_op op, snap_type type)
+{
+    if (op == OP_INCREASED || op == OP_DECREASED)
+    {
+        return type == SNAP_INT8 || type == SNAP_INT16 || type == SNAP_INT32 || type == SNAP_FLOAT ||
+               type == SNAP_DOUBLE;
+    }
+    return op != OP_REFRESH;
+}
+
+// Keep mask for 32 consecutive slots
+__attribute__((target("sse2"))) static uint32_t compare32_sse2(const snap_pass *pass, const uint8_t *old,
+                                                                const uint8_t *cur)
+{
+    int      width = pass->snap->width;
+    int      lanes = 16 / width;
+    uint32_t mask = 0;
+    __m128i  ref;
+
+    if (pass->op == OP_EQ)
+    {
+        uint8_t pattern[16];
+        for (int i = 0; i < 16; i += width)
+        {
+            memcpy(pattern + i, pass->ref, width);
+        }
+        ref = _mm_loadu_si128((const __m128i *)pattern);
+    }
+
+    for (int v = 0; v < 2 * width; v++)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(cur + v * 16));
+        __m128i r;
+
+        switch (pass->op)
+        {
+        case OP_EQ:
+            if (pass->type == SNAP_FLOAT)
+                r = _mm_castps_si128(_mm_cmpeq_ps(_mm_castsi128_ps(c), _mm_castsi128_ps(ref)));
+            else if (pass->type == SNAP_DOUBLE)
+                r = _mm_castpd_si128(_mm_cmpeq_pd(_mm_castsi128_pd(c), _mm_castsi128_pd(ref)));
+            else
+                r = equal_lanes(c, ref, width);
+            break;
+        case OP_CHANGED:
+            r = _mm_xor_si128(equal_lanes(c, _mm_loadu_si128((const __m128i *)(old + v * 16)), width),
+                              _mm_set1_epi32(-1));
+            break;
+        case OP_UNCHANGED:
+            r = equal_lanes(c, _mm_loadu_si128((const __m128i *)(old + v * 16)), width);
+            break;
+        case OP_INCREASED:
+            r = greater_lanes(c, _mm_loadu_si128((const __m128i *)(old + v * 16)), pass->type);
+            break;
+        default:
+            r = greater_lanes(_mm_loadu_si128((const __m128i *)(old + v * 16)), c, pass->type);
+            break;
+        }
+
+        // CHANGED inverts per byte; for 64-bit lanes "any half differs"
+        if (pass->op == OP_CHANGED && width == 8)
+        {
+            r = _mm_or_si128(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(2, 3, 0, 1)));
+            mask |= (uint32_t)_mm_movemask_pd(_mm_castsi128_pd(r)) << (v * lanes);
+        }
+        else
+        {
+            mask |= lane_bits(r, width) << (v * lanes);
+        }
+    }
+    return mask;
+}
+
+static uint32_t compare_slots(const snap_pass *pass, const uint8_t *old, const uint8_t *cur, int n)
+{
+    if (pass->op == OP_REFRESH)
+    {
+        return n == 32 ? 0xFFFFFFFFu : (1u << n) - 1;
+    }
+    if (n == 32 && pass->simd)
+    {
+        return compare32_sse2(pass, old, cur);
+    }
+    return compare_scalar(pass, old, cur, n);
+}
+
+//============================================================================
+// DENSE PHASE
+//============================================================================
+
+static uint32_t popcount_words(const uint32_t *words, size_t count)
+{
+    uint32_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        total += (uint32_t)__builtin_popcount(words[i]);
+    }
+    return total;
+}
+
+static bool page_has_candidates(const snap_region *r, uint32_t page, uint32_t words_per_page)
+{
+    if (!r->bits)
+    {
+        return true;
+    }
+    const uint32_t *words = r->bits + page * words_per_page;
+    for (uint32_t i = 0; i < words_per_page; i++)
+    {
+        if (words[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void dense_task(void *ctx, int index, int worker)
+{
+    snap_pass   *pass = (snap_pass *)ctx;
+    snapshot    *snap = pass->snap;
+    snap_region *r = &snap->regions[index];
+    uint8_t     *scratch = pass->scratch + (size_t)worker * SNAP_RUN_SIZE;
+
+    if (r->count == 0)
+    {
+        return;
+    }
+
+    uint32_t slots = r->size / snap->width;
+    uint32_t words_per_page = SNAP_PAGE / snap->width / 32;
+    uint32_t pages = r->size / SNAP_PAGE;
+
+    if (!r->bits)
+    {
+        r->bits = malloc((slots / 32) * sizeof(uint32_t));
+        if (!r->bits)
+        {
+            InterlockedExchange(&pass->failed, 1);
+            return;
+        }
+        memset(r->bits, 0xFF, (slots / 32) * sizeof(uint32_t));
+    }
+
+    for (uint32_t page = 0; page < pages;)
+    {
+        if (!page_has_candidates(r, page, words_per_page))
+        {
+            page++;
+            continue;
+        }
+
+        // Contiguous candidate pages become one read
+        uint32_t end = page + 1;
+        while (end < pages && (end - page) * SNAP_PAGE < SNAP_RUN_SIZE && page_has_candidates(r, end, words_per_page))
+        {
+            end++;
+        }
+
+        uint32_t offset = page * SNAP_PAGE;
+        uint32_t length = (end - page) * SNAP_PAGE;
+        uint32_t *words = r->bits + page * words_per_page;
+        uint32_t  word_count = (end - page) * words_per_page;
+        SIZE_T    read = 0;
+
+        if (!ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)(r->base + offset), scratch, length, &read) ||
+            read != length)
+        {
+            // Freed or protected since the last pass: nothing here survives
+            memset(words, 0, word_count * sizeof(uint32_t));
+        }
+        else
+        {
+            for (uint32_t w = 0; w < word_count; w++)
+            {
+                if (words[w])
+                {
+                    uint32_t at = w * 32 * snap->width;
+                    words[w] &= compare_slots(pass, r->values + offset + at, scratch + at, 32);
+                }
+            }
+            memcpy(r->values + offset, scratch, length);
+        }
+
+        page = end;
+    }
+
+    r->count = popcount_words(r->bits, slots / 32);
+}
+
+static void free_dense(snapshot *snap)
+{
+    for (int i = 0; i < snap->region_count; i++)
+    {
+        if (snap->regions[i].values)
+        {
+            VirtualFree(snap->regions[i].values, 0, MEM_RELEASE);
+        }
+        free(snap->regions[i].bits);
+    }
+    free(snap->regions);
+    snap->regions = NULL;
+    snap->region_count = 0;
+}
+
+static size_t dense_bytes(const snapshot *snap)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < snap->region_count; i++)
+    {
+        const snap_region *r = &snap->regions[i];
+        bytes += r->size + (r->bits ? r->size / snap->width / 8 : 0);
+    }
+    return bytes;
+}
+
+// Moves the survivors into sorted arrays once that is the smaller form
+static void maybe_go_sparse(snapshot *snap)
+{
+    size_t per = sizeof(uint32_t) + snap->width;
+    if (snap->sparse || snap->count * per * 2 > dense_bytes(snap))
+    {
+        return;
+    }
+
+    uint32_t *addrs = malloc((snap->count ? snap->count : 1) * sizeof(uint32_t));
+    uint8_t  *values = malloc((snap->count ? snap->count : 1) * snap->width);
+    if (!addrs || !values)
+    {
+        free(addrs);
+        free(values);
+        return;
+    }
+
+    size_t n = 0;
+    for (int i = 0; i < snap->region_count; i++)
+    {
+        snap_region *r = &snap->regions[i];
+        uint32_t     words = r->size / snap->width / 32;
+        // A region without a bitset still has every slot as a candidate
+        for (uint32_t w = 0; r->count && w < words; w++)
+        {
+            for (uint32_t bits = r->bits ? r->bits[w] : 0xFFFFFFFFu; bits; bits &= bits - 1)
+            {
+                uint32_t slot = w * 32 + (uint32_t)__builtin_ctz(bits);
+                addrs[n] = r->base + slot * snap->width;
+                memcpy(values + n * snap->width, r->values + slot * snap->width, snap->width);
+                n++;
+            }
+        }
+    }
+
+    free_dense(snap);
+    snap->addrs = addrs;
+    snap->values = values;
+    snap->count = n;
+    snap->sparse = true;
+}
+
+//============================================================================
+// SPARSE PHASE
+//============================================================================
+
+static void sparse_task(void *ctx, int index, int worker)
+{
+    snap_pass *pass = (snap_pass *)ctx;
+    snapshot  *snap = pass->snap;
+    uint8_t   *scratch = pass->scratch + (size_t)worker * SNAP_RUN_SIZE;
+    int        width = snap->width;
+    size_t     first = (size_t)index * SNAP_SPARSE_BLOCK;
+    size_t     last = first + SNAP_SPARSE_BLOCK < snap->count ? first + SNAP_SPARSE_BLOCK : snap->count;
+    uint32_t  *keep = pass->keep + first / 32;
+
+    memset(keep, 0, ((last - first + 31) / 32) * sizeof(uint32_t));
+
+    // Candidates whose pages touch are fetched with one read
+    for (size_t i = first; i < last;)
+    {
+        uint32_t start = snap->addrs[i];
+        size_t   end = i + 1;
+        while (end < last && snap->addrs[end] - snap->addrs[end - 1] < SNAP_PAGE &&
+               snap->addrs[end] + width - start <= SNAP_RUN_SIZE)
+        {
+            end++;
+        }
+
+        uint32_t length = snap->addrs[end - 1] + width - start;
+        SIZE_T   read = 0;
+        bool     ok = ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)start, scratch, length, &read) &&
+                  read == length;
+
+        for (size_t k = i; k < end; k++)
+        {
+            uint8_t *dest = pass->next_values + k * width;
+            if (ok)
+            {
+                memcpy(dest, scratch + (snap->addrs[k] - start), width);
+            }
+            else if (!ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)snap->addrs[k], dest, width, &read) ||
+                     read != (SIZE_T)width)
+            {
+                // Unreadable now; mark with the old value and drop below
+                memcpy(dest, snap->values + k * width, width);
+                continue;
+            }
+            keep[(k - first) / 32] |= 1u << ((k - first) % 32);
+        }
+
+        i = end;
+    }
+
+    // Old and new values are both contiguous, so whole words compare at once
+    for (size_t k = first; k < last; k += 32)
+    {
+        int n = last - k < 32 ? (int)(last - k) : 32;
+        keep[(k - first) / 32] &= compare_slots(pass, snap->values + k * width, pass->next_values + k * width, n);
+    }
+}
+
+// Compacts survivors in order after a sparse pass
+static void sparse_compact(snapshot *snap, const snap_pass *pass)
+{
+    size_t n = 0;
+    int    width = snap->width;
+
+    for (size_t i = 0; i < snap->count; i++)
+    {
+        if (pass->keep[i / 32] & (1u << (i % 32)))
+        {
+            snap->addrs[n] = snap->addrs[i];
+            memcpy(snap->values + n * width, pass->next_values + i * width, width);
+            n++;
+        }
+    }
+    snap->count = n;
+}
+
+//============================================================================
+// PASSES
+//============================================================================
+
+static bool run_pass(snapshot *snap, snap_pass *pass)
+{
+    int workers = pool_size();
+
+    pass->snap = snap;
+    pass->simd = (cpu_features() & CPU_SSE2) && simd_supported(pass->op, pass->type);
+    pass->scratch = malloc((size_t)workers * SNAP_RUN_SIZE);
+    if (!pass->scratch)
+    {
+        return false;
+    }
+
+    if (!snap->sparse)
+    {
+        pool_for(snap->region_count, dense_task, pass);
+
+        snap->count = 0;
+        for (int i = 0; i < snap->region_count; i++)
+        {
+            snap->count += snap->regions[i].count;
+        }
+        free(pass->scratch);
+        if (pass->failed)
+        {
+            return false;
+        }
+        maybe_go_sparse(snap);
+    }
+    else if (snap->count > 0)
+    {
+        pass->next_values = malloc(snap->count * snap->width);
+        pass->keep = malloc(((snap->count + 31) / 32) * sizeof(uint32_t));
+        if (!pass->next_values || !pass->keep)
+        {
+            free(pass->next_values);
+            free(pass->keep);
+            free(pass->scratch);
+            return false;
+        }
+
+        int blocks = (int)((snap->count + SNAP_SPARSE_BLOCK - 1) / SNAP_SPARSE_BLOCK);
+        pool_for(blocks, sparse_task, pass);
+        sparse_compact(snap, pass);
+
+        free(pass->next_values);
+        free(pass->keep);
+        free(pass->scratch);
+    }
+    else
+    {
+        free(pass->scratch);
+    }
+
+    snap->passes++;
+    return true;
+}
+
+static void snapshot_free(snapshot *snap)
+{
+    free_dense(snap);
+    free(snap->addrs);
+    free(snap->values);
+    snap->addrs = NULL;
+    snap->values = NULL;
+    snap->count = 0;
+}
+
+//============================================================================
+// CAPTURE
+//============================================================================
+
+typedef struct
+{
+    snapshot     *snap;
+    volatile LONG failed;
+} capture_job;
+
+static void capture_task(void *ctx, int index, int worker)
+{
+    capture_job *job = (capture_job *)ctx;
+    snap_region *r = &job->snap->regions[index];
+    SIZE_T       read = 0;
+
+    r->values = VirtualAlloc(NULL, r->size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!r->values)
+    {
+        InterlockedIncrement(&job->failed);
+        r->count = 0;
+        return;
+    }
+
+    if (!ReadProcessMemory(GetCurrentProcess(), (LPCVOID)(uintptr_t)r->base, r->values, r->size, &read) ||
+        read != r->size)
+    {
+        VirtualFree(r->values, 0, MEM_RELEASE);
+        r->values = NULL;
+        r->count = 0;
+        return;
+    }
+
+    r->count = r->size / job->snap->width;
+}
+
+static bool add_region(snapshot *snap, int *capacity, uint32_t base, uint32_t size)
+{
+    if (snap->region_count == *capacity)
+    {
+        int          grown_capacity = *capacity ? *capacity * 2 : 256;
+        snap_region *grown = realloc(snap->regions, grown_capacity * sizeof(snap_region));
+        if (!grown)
+        {
+            return false;
+        }
+        snap->regions = grown;
+        *capacity = grown_capacity;
+    }
+
+    snap_region *r = &snap->regions[snap->region_count++];
+    memset(r, 0, sizeof(*r));
+    r->base = base;
+    r->size = size;
+    return true;
+}
+
+// Lists the regions to capture before allocating anything, so the
+// snapshot's own buffers are never part of it
+static bool collect_regions(snapshot *snap, const scan_range *range)
+{
+    int            capacity = 0;
+    regions_entry *regions;
+    int            count = regions_copy(range->start, range->stop, &regions);
+    if (count < 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const regions_entry *e = &regions[i];
+        if (!(range->writable_only ? regions_writable(e->protect) : regions_readable(e->protect)))
+        {
+            continue;
+        }
+
+        // Clipped ends stay inside their page-aligned region when rounded out
+        uint32_t from = e->base & ~(SNAP_PAGE - 1);
+        uint32_t to = (e->end + SNAP_PAGE - 1) & ~(SNAP_PAGE - 1);
+        for (uint32_t at = from; at < to; at += SNAP_REGION_MAX)
+        {
+            uint32_t size = to - at < SNAP_REGION_MAX ? to - at : SNAP_REGION_MAX;
+            if (!add_region(snap, &capacity, at, size))
+            {
+                free(regions);
+                return false;
+            }
+        }
+    }
+
+    free(regions);
+    return true;
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static snapshot *check_snapshot(lua_State *L)
+{
+    return (snapshot *)luaL_checkudata(L, 1, SNAP_MT);
+}
+
+static snap_type check_type(lua_State *L, int idx, const char *fallback)
+{
+    const char *name = luaL_optstring(L, idx, fallback);
+    for (size_t i = 0; i < sizeof(g_types) / sizeof(g_types[0]); i++)
+    {
+        if (strcmp(g_types[i].name, name) == 0)
+        {
+            return (snap_type)i;
+        }
+    }
+    luaL_argerror(L, idx, "unknown type (int8..uint64, float, double)");
+    return SNAP_INT32;
+}
+
+static void encode_value(lua_State *L, int idx, snap_type type, uint8_t *out)
+{
+    lua_Number value = luaL_checknumber(L, idx);
+    if (type == SNAP_FLOAT)
+    {
+        float f = (float)value;
+        memcpy(out, &f, 4);
+    }
+    else if (type == SNAP_DOUBLE)
+    {
+        memcpy(out, &value, 8);
+    }
+    else
+    {
+        int64_t i = value < 0 ? (int64_t)value : (int64_t)(uint64_t)value;
+        memcpy(out, &i, g_types[type].width); /* Little endian */
+    }
+}
+
+static void push_value(lua_State *L, snap_type type, const uint8_t *p)
+{
+    if (is_float(type))
+        lua_pushnumber(L, load_float(type, p));
+    else if (type == SNAP_UINT64)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        lua_pushnumber(L, (lua_Number)v);
+    }
+    else
+        lua_pushnumber(L, (lua_Number)load_int(type, p));
+}
+
+static int filter(lua_State *L, snap_op op)
+{
+    snapshot *snap = check_snapshot(L);
+    snap_pass pass;
+
+    memset(&pass, 0, sizeof(pass));
+    pass.op = op;
+    pass.type = snap->type;
+
+    if (op == OP_EQ)
+    {
+        pass.type = check_type(L, 3, g_types[snap->type].name);
+        if (g_types[pass.type].width != snap->width)
+        {
+            return luaL_error(L, "snapshot holds %s values, cannot compare as %s", g_types[snap->type].name,
+                              g_types[pass.type].name);
+        }
+        encode_value(L, 2, pass.type, pass.ref);
+    }
+
+    DWORD started = GetTickCount();
+    if (!run_pass(snap, &pass))
+    {
+        return luaL_error(L, "out of memory");
+    }
+
+    logf("[SNAPSHOT] Pass %u left %u candidates (%s) in %lu ms", snap->passes, (unsigned)snap->count,
+         snap->sparse ? "sparse" : "dense", GetTickCount() - started);
+    lua_pushnumber(L, (lua_Number)snap->count);
+    return 1;
+}
+
+// snap:filter_eq(value [, type]) keeps slots now holding value
+static int l_snap_filter_eq(lua_State *L)
+{
+    return filter(L, OP_EQ);
+}
+
+static int l_snap_filter_changed(lua_State *L)
+{
+    return filter(L, OP_CHANGED);
+}
+
+static int l_snap_filter_unchanged(lua_State *L)
+{
+    return filter(L, OP_UNCHANGED);
+}
+
+static int l_snap_filter_increased(lua_State *L)
+{
+    return filter(L, OP_INCREASED);
+}
+
+static int l_snap_filter_decreased(lua_State *L)
+{
+    return filter(L, OP_DECREASED);
+}
+
+// snap:next_scan() re-reads the survivors as the new baseline
+static int l_snap_next_scan(lua_State *L)
+{
+    return filter(L, OP_REFRESH);
+}
+
+static int l_snap_count(lua_State *L)
+{
+    lua_pushnumber(L, (lua_Number)check_snapshot(L)->count);
+    return 1;
+}
+
+// snap:results([max]) -> { addr, ... }, { value, ... }
+static int l_snap_results(lua_State *L)
+{
+    snapshot *snap = check_snapshot(L);
+    size_t    max = (size_t)luaL_optnumber(L, 2, SNAP_DEFAULT_RESULTS);
+    size_t    total = snap->count < max ? snap->count : max;
+    int       width = snap->width;
+
+    lua_createtable(L, (int)total, 0);
+    lua_createtable(L, (int)total, 0);
+
+    size_t n = 0;
+    if (snap->sparse)
+    {
+        for (; n < total; n++)
+        {
+            lua_pushnumber(L, snap->addrs[n]);
+            lua_rawseti(L, -3, (int)n + 1);
+            push_value(L, snap->type, snap->values + n * width);
+            lua_rawseti(L, -2, (int)n + 1);
+        }
+        return 2;
+    }
+
+    for (int i = 0; i < snap->region_count && n < total; i++)
+    {
+        snap_region *r = &snap->regions[i];
+        uint32_t     slots = r->size / width;
+        for (uint32_t slot = 0; r->count && slot < slots && n < total; slot++)
+        {
+            if (r->bits && !(r->bits[slot / 32] & (1u << (slot % 32))))
+            {
+                continue;
+            }
+            n++;
+            lua_pushnumber(L, r->base + slot * width);
+            lua_rawseti(L, -3, (int)n);
+            push_value(L, snap->type, r->values + slot * width);
+            lua_rawseti(L, -2, (int)n);
+        }
+    }
+    return 2;
+}
+
+static int l_snap_info(lua_State *L)
+{
+    snapshot *snap = check_snapshot(L);
+    lua_createtable(L, 0, 5);
+    lua_pushnumber(L, (lua_Number)snap->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, snap->passes);
+    lua_setfield(L, -2, "passes");
+    lua_pushstring(L, snap->sparse ? "sparse" : "dense");
+    lua_setfield(L, -2, "mode");
+    lua_pushstring(L, g_types[snap->type].name);
+    lua_setfield(L, -2, "type");
+    lua_pushnumber(L, snap->sparse ? (lua_Number)snap->count * (sizeof(uint32_t) + snap->width)
+                                   : (lua_Number)dense_bytes(snap));
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+static int l_snap_free(lua_State *L)
+{
+    snapshot_free(check_snapshot(L));
+    return 0;
+}
+
+static int l_snap_tostring(lua_State *L)
+{
+    snapshot *snap = check_snapshot(L);
+    lua_pushfstring(L, "snapshot: %s, %d candidates", g_types[snap->type].name, (int)snap->count);
+    return 1;
+}
+
+// mem.snapshot([opts]) -> snapshot of writable memory
+// opts: type (default "int32"), module, start, stop, all (include read-only)
+static int l_mem_snapshot(lua_State *L)
+{
+    bool       has_opts = lua_istable(L, 1);
+    scan_range range;
+    snap_type  type = SNAP_INT32;
+
+    scan_full_range(&range);
+    range.writable_only = true;
+
+    if (has_opts)
+    {
+        lua_getfield(L, 1, "type");
+        type = check_type(L, -1, "int32");
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "module");
+        const char *module = lua_tostring(L, -1);
+        if (module && !scan_module_range(module, &range))
+        {
+            return luaL_error(L, "module '%s' is not loaded", module);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 1, "start");
+        range.start = lua_isnil(L, -1) ? range.start : (uint32_t)(int64_t)lua_tonumber(L, -1);
+        lua_getfield(L, 1, "stop");
+        range.stop = lua_isnil(L, -1) ? range.stop : (uint32_t)(int64_t)lua_tonumber(L, -1);
+        lua_getfield(L, 1, "all");
+        range.writable_only = !lua_toboolean(L, -1);
+        lua_pop(L, 3);
+    }
+
+    snapshot *snap = (snapshot *)lua_newuserdata(L, sizeof(snapshot));
+    memset(snap, 0, sizeof(*snap));
+    snap->type = type;
+    snap->width = g_types[type].width;
+    luaL_getmetatable(L, SNAP_MT);
+    lua_setmetatable(L, -2);
+
+    DWORD started = GetTickCount();
+    if (!collect_regions(snap, &range))
+    {
+        return luaL_error(L, "out of memory");
+    }
+
+    capture_job job = {snap, 0};
+    pool_for(snap->region_count, capture_task, &job);
+    if (job.failed)
+    {
+        double mb = (double)dense_bytes(snap) / (1 << 20);
+        snapshot_free(snap);
+        return luaL_error(L, "not enough address space to copy %.0f MB; narrow the snapshot with module/start/stop",
+                          mb);
+    }
+
+    for (int i = 0; i < snap->region_count; i++)
+    {
+        snap->count += snap->regions[i].count;
+    }
+
+    logf("[SNAPSHOT] Captured %d regions, %u MB, %u %s slots in %lu ms", snap->region_count,
+         (unsigned)(dense_bytes(snap) >> 20), (unsigned)snap->count, g_types[type].name, GetTickCount() - started);
+    return 1;
+}
+
+static const luaL_Reg snapshot_methods[] = {{"filter_eq", l_snap_filter_eq},
+                                            {"filter_changed", l_snap_filter_changed},
+                                            {"filter_unchanged", l_snap_filter_unchanged},
+                                            {"filter_increased", l_snap_filter_increased},
+                                            {"filter_decreased", l_snap_filter_decreased},
+                                            {"next_scan", l_snap_next_scan},
+                                            {"count", l_snap_count},
+                                            {"results", l_snap_results},
+                                            {"info", l_snap_info},
+                                            {"free", l_snap_free},
+                                            {NULL, NULL}};
+
+static const luaL_Reg snapshot_funcs[] = {{"snapshot", l_mem_snapshot}, {NULL, NULL}};
+
+int luaopen_snapshot(lua_State *L)
+{
+    luaL_newmetatable(L, SNAP_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, snapshot_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_snap_free);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, l_snap_count);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, l_snap_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 1);
+
+    luaL_register(L, "mem", snapshot_funcs);
+    return 1;
+}
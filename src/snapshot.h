@@ -0,0 +1,8 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "lua.h"
+
+int luaopen_snapshot(lua_State *L);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,503 @@
+/*
+ * symbols.c: Address to symbol index for registered functions.
+ *
+ * Functions are kept in insertion order with a hash index on their names,
+ * which is what add and remove work on. Lookups by address go through a
+ * flat array of start addresses sorted once after any change, searched
+ * without branches on the comparisons; a second array gives the function
+ * for each position. A function with a known size only covers that many
+ * bytes; one without covers up to the next function.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "symbols.h"
+
+#define SYMBOLS_MIN_SLOTS 1024
+#define SYMBOLS_NAME_SIZE 256 /* Names are cut to this in Lua lookups */
+#define SYMBOLS_BATCH 64
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t size; /* 0 when not known */
+    uint32_t hash;
+    char    *name;
+} symbol;
+
+static SRWLOCK           g_lock = SRWLOCK_INIT;
+static symbol           *g_symbols;
+static uint32_t          g_count;
+static uint32_t          g_capacity;
+static uint32_t         *g_slots; /* Name hash index: symbol + 1, 0 for an empty slot */
+static uint32_t          g_slotCount;
+static uint32_t         *g_addresses; /* Sorted start addresses */
+static uint32_t         *g_order;     /* Symbol at each sorted position */
+static uint32_t          g_sorted;
+static bool              g_dirty;
+static uint64_t          g_rebuilds;
+static volatile LONGLONG g_lookups;
+
+static uint32_t hash_name(const char *name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return hash;
+}
+
+//============================================================================
+// NAME INDEX
+//============================================================================
+
+// Slot holding name, or the empty slot it would go in
+static uint32_t find_slot(const char *name, uint32_t hash)
+{
+    uint32_t mask = g_slotCount - 1;
+    uint32_t slot = hash & mask;
+    while (g_slots[slot] != 0)
+    {
+        const symbol *s = &g_symbols[g_slots[slot] - 1];
+        if (s->hash == hash && strcmp(s->name, name) == 0)
+        {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+// Keeps the name index under half full
+static bool reserve_slots(void)
+{
+    if ((g_count + 1) * 2 <= g_slotCount)
+    {
+        return true;
+    }
+
+    uint32_t  count = g_slotCount ? g_slotCount * 2 : SYMBOLS_MIN_SLOTS;
+    uint32_t *slots = calloc(count, sizeof(uint32_t));
+    if (!slots)
+    {
+        return false;
+    }
+    free(g_slots);
+    g_slots = slots;
+    g_slotCount = count;
+    for (uint32_t i = 0; i < g_count; i++)
+    {
+        g_slots[find_slot(g_symbols[i].name, g_symbols[i].hash)] = i + 1;
+    }
+    return true;
+}
+
+// Empties a slot, moving later entries of its probe run back so that
+// lookups never stop early
+static void clear_slot(uint32_t hole)
+{
+    uint32_t mask = g_slotCount - 1;
+    for (uint32_t i = (hole + 1) & mask; g_slots[i] != 0; i = (i + 1) & mask)
+    {
+        uint32_t home = g_symbols[g_slots[i] - 1].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            g_slots[hole] = g_slots[i];
+            hole = i;
+        }
+    }
+    g_slots[hole] = 0;
+}
+
+//============================================================================
+// ADDRESS INDEX
+//============================================================================
+
+static int compare_keys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorts the start addresses again; runs on the first lookup after a change
+static void rebuild(void)
+{
+    g_dirty = false;
+    g_sorted = 0;
+    g_rebuilds++;
+
+    free(g_addresses);
+    free(g_order);
+    g_addresses = malloc((g_count ? g_count : 1) * sizeof(uint32_t));
+    g_order = malloc((g_count ? g_count : 1) * sizeof(uint32_t));
+    uint64_t *keys = malloc((g_count ? g_count : 1) * sizeof(uint64_t));
+    if (!g_addresses || !g_order || !keys)
+    {
+        free(keys);
+        return; /* Lookups find nothing until the next change */
+    }
+
+    for (uint32_t i = 0; i < g_count; i++)
+    {
+        keys[i] = (uint64_t)g_symbols[i].address << 32 | i;
+    }
+    qsort(keys, g_count, sizeof(uint64_t), compare_keys);
+    for (uint32_t i = 0; i < g_count; i++)
+    {
+        g_addresses[i] = (uint32_t)(keys[i] >> 32);
+        g_order[i] = (uint32_t)keys[i];
+    }
+    g_sorted = g_count;
+    free(keys);
+}
+
+// Takes the shared lock with the address index up to date
+static void acquire_index(void)
+{
+    AcquireSRWLockShared(&g_lock);
+    while (g_dirty)
+    {
+        ReleaseSRWLockShared(&g_lock);
+        AcquireSRWLockExclusive(&g_lock);
+        if (g_dirty)
+        {
+            rebuild();
+        }
+        ReleaseSRWLockExclusive(&g_lock);
+        AcquireSRWLockShared(&g_lock);
+    }
+}
+
+// Function covering address, or NULL. The loop halves the range with a
+// conditional move rather than a branch the predictor has to guess.
+static const symbol *locate(uint32_t address)
+{
+    uint32_t n = g_sorted;
+    if (n == 0)
+    {
+        return NULL;
+    }
+
+    const uint32_t *base = g_addresses;
+    while (n > 1)
+    {
+        uint32_t half = n / 2;
+        base = base[half] <= address ? base + half : base;
+        n -= half;
+    }
+    if (*base > address)
+    {
+        return NULL;
+    }
+
+    const symbol *s = &g_symbols[g_order[base - g_addresses]];
+    return s->size && address - s->address >= s->size ? NULL : s;
+}
+
+//============================================================================
+// PUBLIC API
+//============================================================================
+
+// Adds a function, or moves one already known by that name
+bool symbols_add(const char *name, uint32_t address, uint32_t size)
+{
+    uint32_t hash = hash_name(name);
+    bool     ok = true;
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (!reserve_slots())
+    {
+        ok = false;
+    }
+    else
+    {
+        uint32_t slot = find_slot(name, hash);
+        if (g_slots[slot] != 0)
+        {
+            symbol *s = &g_symbols[g_slots[slot] - 1];
+            g_dirty = g_dirty || s->address != address;
+            s->address = address;
+            s->size = size;
+        }
+        else if (g_count == g_capacity)
+        {
+            uint32_t capacity = g_capacity ? g_capacity * 2 : SYMBOLS_MIN_SLOTS / 2;
+            symbol  *grown = realloc(g_symbols, capacity * sizeof(symbol));
+            ok = grown != NULL;
+            if (grown)
+            {
+                g_symbols = grown;
+                g_capacity = capacity;
+            }
+        }
+        if (ok && g_slots[slot] == 0)
+        {
+            char *copy = _strdup(name);
+            ok = copy != NULL;
+            if (copy)
+            {
+                symbol *s = &g_symbols[g_count];
+                s->address = address;
+                s->size = size;
+                s->hash = hash;
+                s->name = copy;
+                g_slots[slot] = ++g_count;
+                g_dirty = true;
+            }
+        }
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    return ok;
+}
+
+bool symbols_remove(const char *name)
+{
+    uint32_t hash = hash_name(name);
+    bool     found = false;
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (g_slotCount)
+    {
+        uint32_t slot = find_slot(name, hash);
+        if (g_slots[slot] != 0)
+        {
+            uint32_t index = g_slots[slot] - 1;
+            free(g_symbols[index].name);
+            clear_slot(slot);
+
+            // The last function takes the freed place
+            uint32_t last = --g_count;
+            if (index != last)
+            {
+                g_symbols[index] = g_symbols[last];
+                g_slots[find_slot(g_symbols[index].name, g_symbols[index].hash)] = index + 1;
+            }
+            g_dirty = true;
+            found = true;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    return found;
+}
+
+void symbols_clear(void)
+{
+    AcquireSRWLockExclusive(&g_lock);
+    for (uint32_t i = 0; i < g_count; i++)
+    {
+        free(g_symbols[i].name);
+    }
+    g_count = 0;
+    if (g_slots)
+    {
+        memset(g_slots, 0, g_slotCount * sizeof(uint32_t));
+    }
+    g_dirty = true;
+    ReleaseSRWLockExclusive(&g_lock);
+}
+
+// Copies the name of the function covering address, cut to size
+bool symbols_lookup(uint32_t address, char *name, size_t size, uint32_t *offset)
+{
+    acquire_index();
+    const symbol *s = locate(address);
+    if (s)
+    {
+        snprintf(name, size, "%s", s->name);
+        *offset = address - s->address;
+    }
+    InterlockedExchangeAdd64(&g_lookups, 1);
+    ReleaseSRWLockShared(&g_lock);
+    return s != NULL;
+}
+
+uint32_t symbols_count(void)
+{
+    AcquireSRWLockShared(&g_lock);
+    uint32_t count = g_count;
+    ReleaseSRWLockShared(&g_lock);
+    return count;
+}
+
+// Visits up to limit functions in address order, returning how many were
+// visited. Changes wait until the walk is over.
+uint32_t symbols_each(symbols_visit visit, void *context, uint32_t limit)
+{
+    acquire_index();
+    uint32_t visited = g_sorted < limit ? g_sorted : limit;
+    for (uint32_t i = 0; i < visited; i++)
+    {
+        const symbol *s = &g_symbols[g_order[i]];
+        visit(context, s->address, s->size, s->name);
+    }
+    ReleaseSRWLockShared(&g_lock);
+    return visited;
+}
+
+//============================================================================
+// LUA API
+//============================================================================
+
+static uint32_t check_address(lua_State *L, int index)
+{
+    lua_Number address = luaL_checknumber(L, index);
+    luaL_argcheck(L, address >= 0 && address <= 0xFFFFFFFF, index, "address out of range");
+    return (uint32_t)address;
+}
+
+// symbols.add(name, address [, size])
+static int l_symbols_add(lua_State *L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    uint32_t    address = check_address(L, 2);
+    uint32_t    size = (uint32_t)luaL_optnumber(L, 3, 0);
+    if (!symbols_add(name, address, size))
+    {
+        return luaL_error(L, "symbols.add: out of memory");
+    }
+    return 0;
+}
+
+// symbols.remove(name) -> true if it was known
+static int l_symbols_remove(lua_State *L)
+{
+    lua_pushboolean(L, symbols_remove(luaL_checkstring(L, 1)));
+    return 1;
+}
+
+static int l_symbols_clear(lua_State *L)
+{
+    (void)L;
+    symbols_clear();
+    return 0;
+}
+
+// symbols.lookup(address) -> name, offset | nil
+static int l_symbols_lookup(lua_State *L)
+{
+    uint32_t address = check_address(L, 1);
+    char     name[SYMBOLS_NAME_SIZE];
+    uint32_t offset;
+    if (!symbols_lookup(address, name, sizeof(name), &offset))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushstring(L, name);
+    lua_pushnumber(L, offset);
+    return 2;
+}
+
+// symbols.lookup_many(addresses) -> names, offsets
+// Both are arrays with one element per address, false where no function
+// covers it. Addresses are looked up a batch at a time, so the index is
+// never locked while Lua allocates.
+static int l_symbols_lookup_many(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int count = (int)lua_objlen(L, 1);
+    lua_createtable(L, count, 0);
+    lua_createtable(L, count, 0);
+
+    struct
+    {
+        uint32_t address;
+        uint32_t offset;
+        bool     found;
+        char     name[SYMBOLS_NAME_SIZE];
+    } batch[SYMBOLS_BATCH];
+
+    for (int first = 1; first <= count; first += SYMBOLS_BATCH)
+    {
+        int size = count - first + 1 < SYMBOLS_BATCH ? count - first + 1 : SYMBOLS_BATCH;
+        for (int i = 0; i < size; i++)
+        {
+            lua_rawgeti(L, 1, first + i);
+            lua_Number address = lua_tonumber(L, -1);
+            lua_pop(L, 1);
+            batch[i].address = address >= 0 && address <= 0xFFFFFFFF ? (uint32_t)address : 0;
+        }
+
+        acquire_index();
+        for (int i = 0; i < size; i++)
+        {
+            const symbol *s = locate(batch[i].address);
+            batch[i].found = s != NULL;
+            if (s)
+            {
+                snprintf(batch[i].name, sizeof(batch[i].name), "%s", s->name);
+                batch[i].offset = batch[i].address - s->address;
+            }
+        }
+        ReleaseSRWLockShared(&g_lock);
+        InterlockedExchangeAdd64(&g_lookups, size);
+
+        for (int i = 0; i < size; i++)
+        {
+            if (batch[i].found)
+            {
+                lua_pushstring(L, batch[i].name);
+                lua_pushnumber(L, batch[i].offset);
+            }
+            else
+            {
+                lua_pushboolean(L, 0);
+                lua_pushboolean(L, 0);
+            }
+            lua_rawseti(L, -3, first + i);
+            lua_rawseti(L, -3, first + i);
+        }
+    }
+    return 2;
+}
+
+static int l_symbols_count(lua_State *L)
+{
+    lua_pushnumber(L, symbols_count());
+    return 1;
+}
+
+static int l_symbols_stats(lua_State *L)
+{
+    AcquireSRWLockShared(&g_lock);
+    uint32_t count = g_count;
+    uint64_t rebuilds = g_rebuilds;
+    uint64_t lookups = g_lookups;
+    bool     dirty = g_dirty;
+    ReleaseSRWLockShared(&g_lock);
+
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number)lookups);
+    lua_setfield(L, -2, "lookups");
+    lua_pushnumber(L, (lua_Number)rebuilds);
+    lua_setfield(L, -2, "rebuilds");
+    lua_pushboolean(L, dirty);
+    lua_setfield(L, -2, "pending_rebuild");
+    return 1;
+}
+
+static const luaL_Reg symbols_funcs[] = {{"add", l_symbols_add},
+                                         {"remove", l_symbols_remove},
+                                         {"clear", l_symbols_clear},
+                                         {"lookup", l_symbols_lookup},
+                                         {"lookup_many", l_symbols_lookup_many},
+                                         {"count", l_symbols_count},
+                                         {"stats", l_symbols_stats},
+                                         {NULL, NULL}};
+
+int luaopen_symbols(lua_State *L)
+{
+    luaL_register(L, "symbols", symbols_funcs);
+    return 1;
+}
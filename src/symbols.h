@@ -0,0 +1,20 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+typedef void (*symbols_visit)(void *context, uint32_t address, uint32_t size, const char *name);
+
+bool     symbols_add(const char *name, uint32_t address, uint32_t size);
+bool     symbols_remove(const char *name);
+void     symbols_clear(void);
+bool     symbols_lookup(uint32_t address, char *name, size_t size, uint32_t *offset);
+uint32_t symbols_count(void);
+uint32_t symbols_each(symbols_visit visit, void *context, uint32_t limit);
+int      luaopen_symbols(lua_State *L);
+
+#endif // SYMBOLS_H
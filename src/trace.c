@@ -0,0 +1,375 @@
+/*
+ * trace.c: Binary structured trace of calls, memory operations and log lines.
+ *
+ * Producers encode an event (name id, kind, zigzag varint values) on their
+ * stack and stage it through the logging rings, so emitting one costs a
+ * few dozen bytes of memcpy and one interlocked store; nothing is
+ * formatted. The logging writer hands trace records, and every hook_log
+ * line, to the sink here in tick order. The sink writes fixed trace_event
+ * headers to the trace file and defines each name the first time an event
+ * refers to it. tools/traceconv.c turns a trace into text or Chrome trace
+ * JSON. See traceformat.h for the layout.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "logging.h"
+#include "ringlog.h"
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE  (64u * 1024u)
+#define TRACE_MAX_NAMES    65536u
+#define TRACE_DEFAULT_PATH "lua/trace.bin"
+
+volatile LONG   g_traceActive = 0;
+
+// Writer side, only touched under the logging drain lock
+static HANDLE   g_file = INVALID_HANDLE_VALUE;
+static uint8_t  g_buffer[TRACE_BUFFER_SIZE];
+static uint32_t g_bufferLength = 0;
+static uint8_t  g_namesWritten[TRACE_MAX_NAMES / 8];
+static uint64_t g_events = 0;
+static uint64_t g_bytes = 0;
+static char     g_path[MAX_PATH];
+
+//============================================================================
+// Writer side
+//============================================================================
+
+static void flush_buffer(void)
+{
+    uint32_t offset = 0;
+    while (offset < g_bufferLength)
+    {
+        DWORD written = 0;
+        if (!WriteFile(g_file, g_buffer + offset, g_bufferLength - offset, &written, NULL) || written == 0)
+        {
+            break;
+        }
+        offset += written;
+    }
+    g_bytes += offset;
+    g_bufferLength = 0;
+}
+
+static void write_event(uint8_t kind, uint16_t name, uint64_t tick, uint32_t thread, const void *payload,
+                        uint32_t length)
+{
+    if (length > TRACE_PAYLOAD_MAX)
+    {
+        length = TRACE_PAYLOAD_MAX;
+    }
+    if (g_bufferLength + sizeof(trace_event) + length > sizeof(g_buffer))
+    {
+        flush_buffer();
+    }
+
+    trace_event event;
+    event.tick = tick;
+    event.thread = thread;
+    event.name = name;
+    event.kind = kind;
+    event.length = (uint8_t)length;
+    memcpy(g_buffer + g_bufferLength, &event, sizeof(event));
+    memcpy(g_buffer + g_bufferLength + sizeof(event), payload, length);
+    g_bufferLength += (uint32_t)sizeof(event) + length;
+    g_events++;
+}
+
+// Defines a name in the file the first time an event uses it
+static void define_name(uint16_t name, uint64_t tick)
+{
+    if (name == 0 || (g_namesWritten[name >> 3] & (1u << (name & 7))))
+    {
+        return;
+    }
+    g_namesWritten[name >> 3] |= (uint8_t)(1u << (name & 7));
+
+    const char *text = ringlog_name(name);
+    if (text)
+    {
+        write_event(TRACE_NAME, name, tick, 0, text, (uint32_t)strlen(text));
+    }
+}
+
+// Staged trace records are { uint16 name, uint8 kind, payload }
+static void trace_sink(uint8_t type, uint64_t tick, uint32_t thread, const void *data, uint32_t length)
+{
+    if (!data)
+    {
+        flush_buffer();
+        return;
+    }
+
+    const uint8_t *bytes = (const uint8_t *)data;
+    if (type == LOG_RECORD_TEXT)
+    {
+        if (length > 0 && bytes[length - 1] == '\n')
+        {
+            length--;
+        }
+        write_event(TRACE_MESSAGE, 0, tick, thread, bytes, length);
+    }
+    else if (type == LOG_RECORD_TRACE && length >= 3)
+    {
+        uint16_t name;
+        memcpy(&name, bytes, sizeof(name));
+        define_name(name, tick);
+        write_event(bytes[2], name, tick, thread, bytes + 3, length - 3);
+    }
+}
+
+//============================================================================
+// Public API
+//============================================================================
+
+bool trace_start(const char *path)
+{
+    if (g_traceActive || !g_logctx.running)
+    {
+        return false;
+    }
+
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    trace_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.event_size = sizeof(trace_event);
+    header.qpc_frequency = g_logctx.qpc_frequency;
+    header.qpc_base = g_logctx.qpc_base;
+    header.filetime_base = g_logctx.filetime_base;
+
+    DWORD written = 0;
+    if (!WriteFile(file, &header, sizeof(header), &written, NULL) || written != sizeof(header))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // The sink is not installed yet, so nothing else touches these
+    g_file = file;
+    g_bufferLength = 0;
+    g_events = 0;
+    g_bytes = sizeof(header);
+    memset(g_namesWritten, 0, sizeof(g_namesWritten));
+    lstrcpynA(g_path, path, sizeof(g_path));
+
+    log_set_sink(trace_sink);
+    InterlockedExchange(&g_traceActive, 1);
+    return true;
+}
+
+// Stops tracing once everything staged so far is in the file; returns the
+// number of events written
+uint64_t trace_stop(void)
+{
+    if (!InterlockedExchange(&g_traceActive, 0))
+    {
+        return 0;
+    }
+
+    log_flush();
+    log_set_sink(NULL);
+
+    CloseHandle(g_file);
+    g_file = INVALID_HANDLE_VALUE;
+    return g_events;
+}
+
+// Stages one event; values are stored as zigzag varints, at most
+// TRACE_VALUES_MAX of them. Safe from any thread, never blocks.
+void trace_emit(uint8_t kind, uint32_t name, const int64_t *values, int count)
+{
+    if (!g_traceActive)
+    {
+        return;
+    }
+
+    uint8_t  record[3 + TRACE_VALUES_MAX * TRACE_VARINT_MAX];
+    uint16_t id = name < TRACE_MAX_NAMES ? (uint16_t)name : 0;
+    uint32_t length = 3;
+
+    memcpy(record, &id, sizeof(id));
+    record[2] = kind;
+    for (int i = 0; i < count && i < TRACE_VALUES_MAX; i++)
+    {
+        length += trace_put_varint(record + length, trace_zigzag(values[i]));
+    }
+
+    log_push(LOG_RECORD_TRACE, record, length);
+}
+
+//============================================================================
+// Lua bindings
+//============================================================================
+
+static int64_t to_value(lua_State *L, int index)
+{
+    if (lua_isboolean(L, index))
+    {
+        return lua_toboolean(L, index);
+    }
+    return (int64_t)lua_tonumber(L, index);
+}
+
+// Names may be given as strings or as ids from ringlog.intern
+static uint32_t check_name(lua_State *L, int index)
+{
+    if (lua_type(L, index) == LUA_TSTRING)
+    {
+        return ringlog_intern(lua_tostring(L, index));
+    }
+    return (uint32_t)luaL_optnumber(L, index, 0);
+}
+
+// Emits kind with the name at index 1 and the values from index first on
+static int emit_from(lua_State *L, uint8_t kind, int first)
+{
+    if (!g_traceActive)
+    {
+        return 0;
+    }
+
+    int64_t values[TRACE_VALUES_MAX];
+    int     count = 0;
+    int     top = lua_gettop(L);
+    for (int i = first; i <= top && count < TRACE_VALUES_MAX; i++)
+    {
+        values[count++] = to_value(L, i);
+    }
+    trace_emit(kind, check_name(L, 1), values, count);
+    return 0;
+}
+
+// trace.start([path]) -> true | nil, error
+static int l_trace_start(lua_State *L)
+{
+    const char *path = luaL_optstring(L, 1, TRACE_DEFAULT_PATH);
+    if (!trace_start(path))
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, g_traceActive ? "already tracing to %s" : "cannot open %s", g_traceActive ? g_path : path);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// trace.stop() -> events written
+static int l_trace_stop(lua_State *L)
+{
+    lua_pushnumber(L, (lua_Number)trace_stop());
+    return 1;
+}
+
+static int l_trace_active(lua_State *L)
+{
+    lua_pushboolean(L, g_traceActive != 0);
+    return 1;
+}
+
+// trace.call(name, duration_ms, flags, result, ...)
+static int l_trace_call(lua_State *L)
+{
+    if (!g_traceActive)
+    {
+        return 0;
+    }
+
+    int64_t values[TRACE_VALUES_MAX];
+    double  duration = luaL_optnumber(L, 2, 0) * 1000.0;
+    int     count = 0;
+    int     top = lua_gettop(L);
+
+    values[count++] = duration > 0 ? (int64_t)duration : 0;
+    values[count++] = (int64_t)luaL_optnumber(L, 3, 0);
+    values[count++] = to_value(L, 4);
+    for (int i = 5; i <= top && count < TRACE_VALUES_MAX; i++)
+    {
+        values[count++] = to_value(L, i);
+    }
+    trace_emit(TRACE_CALL, check_name(L, 1), values, count);
+    return 0;
+}
+
+// trace.begin(name, ...), trace.finish(name, ...), trace.instant(name, ...)
+static int l_trace_begin(lua_State *L)
+{
+    return emit_from(L, TRACE_BEGIN, 2);
+}
+
+static int l_trace_finish(lua_State *L)
+{
+    return emit_from(L, TRACE_END, 2);
+}
+
+static int l_trace_instant(lua_State *L)
+{
+    return emit_from(L, TRACE_INSTANT, 2);
+}
+
+// trace.counter(name, value)
+static int l_trace_counter(lua_State *L)
+{
+    return emit_from(L, TRACE_COUNTER, 2);
+}
+
+// trace.memory(write, address, size, ok)
+static int l_trace_memory(lua_State *L)
+{
+    if (!g_traceActive)
+    {
+        return 0;
+    }
+
+    int64_t values[3];
+    values[0] = (int64_t)luaL_checknumber(L, 2);
+    values[1] = (int64_t)luaL_optnumber(L, 3, 0);
+    values[2] = lua_toboolean(L, 4) ? TRACE_FLAG_OK : 0;
+    trace_emit(lua_toboolean(L, 1) ? TRACE_WRITE : TRACE_READ, 0, values, 3);
+    return 0;
+}
+
+// trace.stats() -> {active, path, events, bytes}
+static int l_trace_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 4);
+    lua_pushboolean(L, g_traceActive != 0);
+    lua_setfield(L, -2, "active");
+    lua_pushstring(L, g_path);
+    lua_setfield(L, -2, "path");
+    lua_pushnumber(L, (lua_Number)g_events);
+    lua_setfield(L, -2, "events");
+    lua_pushnumber(L, (lua_Number)(g_bytes + g_bufferLength));
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+static const luaL_Reg trace_funcs[] = {{"start", l_trace_start},     {"stop", l_trace_stop},
+                                       {"active", l_trace_active},   {"call", l_trace_call},
+                                       {"begin", l_trace_begin},     {"finish", l_trace_finish},
+                                       {"instant", l_trace_instant}, {"counter", l_trace_counter},
+                                       {"memory", l_trace_memory},   {"stats", l_trace_stats},
+                                       {NULL, NULL}};
+
+int luaopen_trace(lua_State *L)
+{
+    luaL_register(L, "trace", trace_funcs);
+    lua_pushnumber(L, TRACE_FLAG_OK);
+    lua_setfield(L, -2, "OK");
+    lua_pushnumber(L, TRACE_FLAG_MAIN);
+    lua_setfield(L, -2, "MAIN");
+    return 1;
+}
@@ -0,0 +1,24 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <windows.h>
+
+#include "lua.h"
+#include "traceformat.h"
+
+extern volatile LONG g_traceActive;
+
+bool     trace_start(const char *path);
+uint64_t trace_stop(void);
+void     trace_emit(uint8_t kind, uint32_t name, const int64_t *values, int count);
+int      luaopen_trace(lua_State *L);
+
+// Cheap enough to test before building an event's values
+static inline bool trace_active(void)
+{
+    return g_traceActive != 0;
+}
+
+#endif // TRACE_H
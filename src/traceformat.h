@@ -0,0 +1,110 @@
+/* traceformat.h: On-disk layout of binary trace files, shared with tools/traceconv.c */
+
+#ifndef TRACEFORMAT_H
+#define TRACEFORMAT_H
+
+#include <stdint.h>
+
+/*
+ * A trace file is a trace_file_header followed by events, each a fixed
+ * trace_event header and `length` payload bytes (little endian). Payloads
+ * are zigzag varints unless noted:
+ *
+ *   TRACE_NAME     name = id being defined, payload = the name's bytes;
+ *                  written before the first event that uses the id
+ *   TRACE_MESSAGE  payload = text of a hook_log.txt line, no newline
+ *   TRACE_CALL     duration_us, flags (TRACE_FLAG_*), result, args...;
+ *                  tick is when the call returned
+ *   TRACE_BEGIN    values...  (open a span on this thread)
+ *   TRACE_END      values...  (close the innermost span)
+ *   TRACE_INSTANT  values...
+ *   TRACE_COUNTER  value
+ *   TRACE_READ     address, size, flags
+ *   TRACE_WRITE    address, size, flags
+ *
+ * Name id 0 means unnamed. Ticks are QueryPerformanceCounter values; the
+ * header maps them to local wall-clock time.
+ */
+
+#define TRACE_MAGIC       "E14TRACE"
+#define TRACE_VERSION     1
+#define TRACE_PAYLOAD_MAX 255
+#define TRACE_VALUES_MAX  16
+#define TRACE_VARINT_MAX  10
+
+enum
+{
+    TRACE_NAME = 0,
+    TRACE_MESSAGE = 1,
+    TRACE_CALL = 2,
+    TRACE_BEGIN = 3,
+    TRACE_END = 4,
+    TRACE_INSTANT = 5,
+    TRACE_COUNTER = 6,
+    TRACE_READ = 7,
+    TRACE_WRITE = 8
+};
+
+#define TRACE_FLAG_OK   0x01 /* Call or memory operation succeeded */
+#define TRACE_FLAG_MAIN 0x02 /* Call ran on the game's main thread */
+
+typedef struct
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t event_size;    /* sizeof(trace_event) */
+    int64_t  qpc_frequency;
+    uint64_t qpc_base;      /* QueryPerformanceCounter at ... */
+    uint64_t filetime_base; /* ... this local FILETIME */
+} trace_file_header;
+
+typedef struct
+{
+    uint64_t tick;
+    uint32_t thread;
+    uint16_t name;
+    uint8_t  kind;
+    uint8_t  length; /* Payload bytes that follow */
+} trace_event;
+
+static inline uint64_t trace_zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t trace_unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Writes value as a LEB128 varint; returns the bytes used (at most 10)
+static inline uint32_t trace_put_varint(uint8_t *out, uint64_t value)
+{
+    uint32_t length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+// Reads one varint from at most size bytes; returns the bytes used, 0 if
+// the input ends mid-value
+static inline uint32_t trace_get_varint(const uint8_t *in, uint32_t size, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < size && i < TRACE_VARINT_MAX; i++)
+    {
+        result |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+        if (!(in[i] & 0x80))
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+#endif // TRACEFORMAT_H
@@ -0,0 +1,550 @@
+/*
+ * walker.c: Native walks over game object graphs into column buffers.
+ *
+ * A walker is made once from a node layout: the node size, the pointer
+ * fields that lead to more nodes (single pointers such as "next" or
+ * "parent", arrays of node pointers, arrays of nodes) and the fields to
+ * keep. w:walk() then visits every node reachable from the roots breadth
+ * first, each once, and writes one element per node into every column of
+ * a buffer the caller allocated up front, so a refresh allocates nothing.
+ * The output's address column doubles as the work queue, which lets the
+ * walk prefetch nodes a few places ahead of the one it is copying.
+ * Pointers are checked against the region map before they are queued and
+ * each node is copied under the memview fault guard.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "memview.h"
+#include "regions.h"
+#include "walker.h"
+
+#define WALKER_MT "luaapi.walker"
+
+typedef enum
+{
+    LINK_POINTER,  /* Pointer to one node */
+    LINK_POINTERS, /* Pointer to an array of node pointers */
+    LINK_STRUCTS   /* Pointer to an array of nodes */
+} link_kind;
+
+static const char *const g_linkKinds[] = {"pointer", "pointers", "structs", NULL};
+
+typedef struct
+{
+    link_kind kind;
+    uint32_t  offset;       /* Of the pointer in the node */
+    uint32_t  count_offset; /* Of the element count, for arrays */
+    uint32_t  count_size;   /* 1, 2 or 4 bytes; 0 for a fixed count */
+    uint32_t  count;        /* Fixed element count, or the cap on a read one */
+} walker_link;
+
+typedef struct
+{
+    uint32_t source; /* Offset in the node */
+    uint32_t dest;   /* Offset of the column array in the output */
+    uint32_t size;
+} walker_column;
+
+typedef struct
+{
+    uint32_t      node_size;
+    uint32_t      capacity;
+    uint32_t      bytes;          /* Output size the layout needs */
+    uint32_t      address_column; /* uint32_t[capacity] */
+    uint32_t      parent_column;  /* int32_t[capacity], -1 for roots */
+    int           link_count;
+    walker_link   links[WALKER_MAX_LINKS];
+    int           column_count;
+    walker_column columns[WALKER_MAX_COLUMNS];
+
+    uint8_t  *node;       /* Copy of the node being visited */
+    uint32_t *seen;       /* Addresses queued this walk, open addressing */
+    uint32_t *seen_marks; /* Walk number each seen slot was written in */
+    uint32_t  seen_mask;
+    uint32_t  mark;
+
+    // Last readable region found, so most pointers skip the region lookup
+    uint32_t cached_base;
+    uint32_t cached_end;
+    uint32_t cached_generation;
+
+    // Totals
+    uint32_t walks;
+    uint64_t nodes;
+    double   last_ms;
+} walker;
+
+typedef struct
+{
+    walker        *w;
+    uint8_t       *out;
+    walker_header *header;
+    uint32_t      *addresses;
+    int32_t       *parents;
+} walk_state;
+
+//============================================================================
+// TRAVERSAL
+//============================================================================
+
+static bool readable(walker *w, uint32_t address, uint32_t size)
+{
+    uint32_t end = address + size;
+    if (end < address)
+    {
+        return false;
+    }
+
+    uint32_t generation = regions_generation();
+    if (address >= w->cached_base && end <= w->cached_end && generation == w->cached_generation)
+    {
+        return true;
+    }
+    if (!regions_check(address, size, false))
+    {
+        return false;
+    }
+
+    regions_entry region;
+    if (regions_find(address, &region) && regions_readable(region.protect))
+    {
+        w->cached_base = region.base;
+        w->cached_end = region.end;
+        w->cached_generation = generation;
+    }
+    return true;
+}
+
+// Adds a node to the end of the queue unless it was seen this walk
+static void enqueue(walk_state *s, uint32_t address, int32_t parent)
+{
+    walker        *w = s->w;
+    walker_header *header = s->header;
+    if (address == 0)
+    {
+        return;
+    }
+
+    uint32_t slot = (address * 2654435761u) & w->seen_mask;
+    while (w->seen_marks[slot] == w->mark)
+    {
+        if (w->seen[slot] == address)
+        {
+            return;
+        }
+        slot = (slot + 1) & w->seen_mask;
+    }
+
+    if (header->count == w->capacity)
+    {
+        header->truncated = 1;
+        return;
+    }
+    if (!readable(w, address, w->node_size))
+    {
+        header->unreadable++;
+        return;
+    }
+
+    w->seen[slot] = address;
+    w->seen_marks[slot] = w->mark;
+    __builtin_prefetch((const void *)(uintptr_t)address);
+    s->addresses[header->count] = address;
+    s->parents[header->count] = parent;
+    header->count++;
+}
+
+static uint32_t read_count(const walker_link *link, const uint8_t *node)
+{
+    if (link->count_size == 0)
+    {
+        return link->count;
+    }
+
+    uint32_t count = 0;
+    memcpy(&count, node + link->count_offset, link->count_size); /* Little endian */
+    return count < link->count ? count : link->count;
+}
+
+// Queues the nodes an array link points at
+static void follow_array(walk_state *s, const walker_link *link, uint32_t base, uint32_t count, int32_t parent)
+{
+    walker *w = s->w;
+    if (link->kind == LINK_STRUCTS)
+    {
+        for (uint32_t i = 0; i < count && !s->header->truncated; i++)
+        {
+            enqueue(s, base + i * w->node_size, parent);
+        }
+        return;
+    }
+
+    uint32_t pointers[WALKER_ARRAY_BATCH];
+    for (uint32_t first = 0; first < count && !s->header->truncated; first += WALKER_ARRAY_BATCH)
+    {
+        uint32_t batch = count - first < WALKER_ARRAY_BATCH ? count - first : WALKER_ARRAY_BATCH;
+        uint32_t address = base + first * sizeof(uint32_t);
+        if (!readable(w, address, batch * sizeof(uint32_t)) ||
+            !memview_copy(pointers, (const void *)(uintptr_t)address, batch * sizeof(uint32_t), NULL))
+        {
+            s->header->unreadable++;
+            return;
+        }
+        for (uint32_t i = 0; i < batch; i++)
+        {
+            enqueue(s, pointers[i], parent);
+        }
+    }
+}
+
+static void visit(walk_state *s, uint32_t index)
+{
+    walker  *w = s->w;
+    uint8_t *node = w->node;
+    uint32_t fault = 0;
+    bool     copied = memview_copy(node, (const void *)(uintptr_t)s->addresses[index], w->node_size, &fault);
+    if (!copied)
+    {
+        regions_invalidate(fault, 1);
+        memset(node, 0, w->node_size);
+        s->header->faults++;
+    }
+
+    for (int i = 0; i < w->column_count; i++)
+    {
+        const walker_column *column = &w->columns[i];
+        memcpy(s->out + column->dest + (size_t)index * column->size, node + column->source, column->size);
+    }
+    if (!copied)
+    {
+        return;
+    }
+
+    for (int i = 0; i < w->link_count; i++)
+    {
+        const walker_link *link = &w->links[i];
+        uint32_t           pointer;
+        memcpy(&pointer, node + link->offset, sizeof(pointer));
+        if (link->kind == LINK_POINTER)
+        {
+            enqueue(s, pointer, (int32_t)index);
+        }
+        else if (pointer)
+        {
+            follow_array(s, link, pointer, read_count(link, node), (int32_t)index);
+        }
+    }
+}
+
+//============================================================================
+// LUA BINDINGS
+//============================================================================
+
+static walker *check_walker(lua_State *L)
+{
+    walker *w = (walker *)luaL_checkudata(L, 1, WALKER_MT);
+    if (!w->node)
+    {
+        luaL_error(L, "walker is freed");
+    }
+    return w;
+}
+
+static uint32_t field_uint(lua_State *L, int table, const char *key, bool required, uint32_t fallback)
+{
+    lua_getfield(L, table, key);
+    if (lua_isnil(L, -1) && !required)
+    {
+        lua_pop(L, 1);
+        return fallback;
+    }
+    if (!lua_isnumber(L, -1))
+    {
+        luaL_error(L, "mem.walker: '%s' must be a number", key);
+    }
+    lua_Number value = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    if (value < 0 || value > 0xFFFFFFFF)
+    {
+        luaL_error(L, "mem.walker: '%s' out of range", key);
+    }
+    return (uint32_t)value;
+}
+
+// Column arrays must sit inside the output and clear of its header
+static void check_column(lua_State *L, const walker *w, uint32_t dest, uint32_t size)
+{
+    if (dest < sizeof(walker_header) || (uint64_t)dest + (uint64_t)size * w->capacity > w->bytes)
+    {
+        luaL_error(L, "mem.walker: column at %d does not fit the output", (int)dest);
+    }
+}
+
+static void read_links(lua_State *L, walker *w)
+{
+    lua_getfield(L, 1, "links");
+    int count = lua_istable(L, -1) ? (int)lua_objlen(L, -1) : 0;
+    if (count > WALKER_MAX_LINKS)
+    {
+        luaL_error(L, "mem.walker: more than %d links", WALKER_MAX_LINKS);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        lua_rawgeti(L, -1, i + 1);
+        int table = lua_gettop(L);
+        luaL_checktype(L, table, LUA_TTABLE);
+
+        walker_link *link = &w->links[w->link_count++];
+        lua_getfield(L, table, "kind");
+        link->kind = (link_kind)luaL_checkoption(L, -1, "pointer", g_linkKinds);
+        lua_pop(L, 1);
+        link->offset = field_uint(L, table, "offset", true, 0);
+        link->count_offset = field_uint(L, table, "count_offset", false, 0);
+        link->count_size = field_uint(L, table, "count_size", false, 0);
+        link->count = field_uint(L, table, "count", false, 0);
+
+        // Arrays need a count field or a fixed count; a count field's value
+        // is capped at `count`, or at the capacity
+        bool counted = link->kind == LINK_POINTER ||
+                       (link->count_size == 0 ? link->count > 0
+                                              : link->count_size <= 4 && link->count_size != 3 &&
+                                                    link->count_offset + link->count_size <= w->node_size);
+        if (link->count_size && !link->count)
+        {
+            link->count = w->capacity;
+        }
+        if (link->offset + sizeof(uint32_t) > w->node_size || !counted)
+        {
+            luaL_error(L, "mem.walker: link %d does not fit the node", i + 1);
+        }
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+static void read_columns(lua_State *L, walker *w)
+{
+    lua_getfield(L, 1, "columns");
+    int count = lua_istable(L, -1) ? (int)lua_objlen(L, -1) : 0;
+    if (count > WALKER_MAX_COLUMNS)
+    {
+        luaL_error(L, "mem.walker: more than %d columns", WALKER_MAX_COLUMNS);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        lua_rawgeti(L, -1, i + 1);
+        int table = lua_gettop(L);
+        luaL_checktype(L, table, LUA_TTABLE);
+
+        walker_column *column = &w->columns[w->column_count++];
+        column->source = field_uint(L, table, "source", true, 0);
+        column->dest = field_uint(L, table, "dest", true, 0);
+        column->size = field_uint(L, table, "size", true, 0);
+        if (column->size == 0 || column->source + column->size > w->node_size)
+        {
+            luaL_error(L, "mem.walker: column %d does not fit the node", i + 1);
+        }
+        check_column(L, w, column->dest, column->size);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+static void free_walker(walker *w)
+{
+    free(w->node);
+    free(w->seen);
+    free(w->seen_marks);
+    w->node = NULL;
+    w->seen = NULL;
+    w->seen_marks = NULL;
+}
+
+// mem.walker(layout) -> walker
+// layout: size (node bytes), capacity (nodes), bytes (output size),
+// address / parent (column offsets), links = {{kind, offset [, count_offset,
+// count_size] [, count]}}, columns = {{source, dest, size}}
+static int l_mem_walker(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+
+    walker *w = (walker *)lua_newuserdata(L, sizeof(walker));
+    memset(w, 0, sizeof(*w));
+    luaL_getmetatable(L, WALKER_MT);
+    lua_setmetatable(L, -2);
+
+    w->node_size = field_uint(L, 1, "size", true, 0);
+    w->capacity = field_uint(L, 1, "capacity", true, 0);
+    w->bytes = field_uint(L, 1, "bytes", true, 0);
+    w->address_column = field_uint(L, 1, "address", true, 0);
+    w->parent_column = field_uint(L, 1, "parent", true, 0);
+    if (w->node_size < sizeof(uint32_t) || w->node_size > WALKER_MAX_NODE || w->capacity == 0 ||
+        w->capacity > 0x1000000)
+    {
+        return luaL_error(L, "mem.walker: node size or capacity out of range");
+    }
+    if (w->address_column % 4 || w->parent_column % 4)
+    {
+        return luaL_error(L, "mem.walker: address and parent columns must be 4-byte aligned");
+    }
+    check_column(L, w, w->address_column, sizeof(uint32_t));
+    check_column(L, w, w->parent_column, sizeof(int32_t));
+    read_links(L, w);
+    read_columns(L, w);
+
+    uint32_t slots = 16;
+    while (slots < w->capacity * 2)
+    {
+        slots *= 2;
+    }
+    w->node = malloc(w->node_size);
+    w->seen = malloc(slots * sizeof(uint32_t));
+    w->seen_marks = calloc(slots, sizeof(uint32_t));
+    w->seen_mask = slots - 1;
+    if (!w->node || !w->seen || !w->seen_marks)
+    {
+        free_walker(w);
+        return luaL_error(L, "mem.walker: out of memory");
+    }
+    return 1;
+}
+
+// Queues one root: a node address, or {kind = "pointers"|"structs", address, count}
+static void add_root(lua_State *L, walk_state *s, int index)
+{
+    if (lua_isnumber(L, index))
+    {
+        enqueue(s, (uint32_t)(int64_t)lua_tonumber(L, index), -1);
+        return;
+    }
+    luaL_checktype(L, index, LUA_TTABLE);
+
+    walker_link link = {0};
+    lua_getfield(L, index, "kind");
+    link.kind = (link_kind)luaL_checkoption(L, -1, "pointers", g_linkKinds);
+    lua_pop(L, 1);
+    uint32_t address = field_uint(L, index, "address", true, 0);
+    uint32_t count = field_uint(L, index, "count", link.kind != LINK_POINTER, 1);
+    if (link.kind == LINK_POINTER)
+    {
+        enqueue(s, address, -1);
+    }
+    else
+    {
+        follow_array(s, &link, address, count, -1);
+    }
+}
+
+// w:walk(out, roots) -> count
+// out: address of an output buffer of at least layout.bytes; roots: one
+// root or an array of them
+static int l_walker_walk(lua_State *L)
+{
+    walker  *w = check_walker(L);
+    uint32_t out = (uint32_t)(int64_t)luaL_checknumber(L, 2);
+    luaL_argcheck(L, out != 0, 2, "output buffer address expected");
+
+    LARGE_INTEGER frequency, start, end;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&start);
+
+    walk_state s;
+    s.w = w;
+    s.out = (uint8_t *)(uintptr_t)out;
+    s.header = (walker_header *)s.out;
+    s.addresses = (uint32_t *)(s.out + w->address_column);
+    s.parents = (int32_t *)(s.out + w->parent_column);
+    memset(s.header, 0, sizeof(walker_header));
+
+    // A new mark empties the seen set without touching it
+    if (++w->mark == 0)
+    {
+        memset(w->seen_marks, 0, (w->seen_mask + 1) * sizeof(uint32_t));
+        w->mark = 1;
+    }
+
+    if (lua_istable(L, 3) && lua_objlen(L, 3) > 0)
+    {
+        int roots = (int)lua_objlen(L, 3);
+        for (int i = 1; i <= roots; i++)
+        {
+            lua_rawgeti(L, 3, i);
+            add_root(L, &s, lua_gettop(L));
+            lua_pop(L, 1);
+        }
+    }
+    else
+    {
+        add_root(L, &s, 3);
+    }
+
+    for (uint32_t i = 0; i < s.header->count; i++)
+    {
+        if (i + WALKER_PREFETCH_AHEAD < s.header->count)
+        {
+            __builtin_prefetch((const void *)(uintptr_t)s.addresses[i + WALKER_PREFETCH_AHEAD]);
+        }
+        visit(&s, i);
+    }
+
+    QueryPerformanceCounter(&end);
+    w->walks++;
+    w->nodes += s.header->count;
+    w->last_ms = (double)(end.QuadPart - start.QuadPart) * 1000.0 / (double)frequency.QuadPart;
+
+    lua_pushnumber(L, s.header->count);
+    return 1;
+}
+
+static int l_walker_stats(lua_State *L)
+{
+    walker *w = check_walker(L);
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, w->walks);
+    lua_setfield(L, -2, "walks");
+    lua_pushnumber(L, (lua_Number)w->nodes);
+    lua_setfield(L, -2, "nodes");
+    lua_pushnumber(L, w->last_ms);
+    lua_setfield(L, -2, "last_ms");
+    lua_pushnumber(L, w->capacity);
+    lua_setfield(L, -2, "capacity");
+    lua_pushnumber(L, w->node_size);
+    lua_setfield(L, -2, "node_size");
+    lua_pushnumber(L, w->bytes);
+    lua_setfield(L, -2, "bytes");
+    return 1;
+}
+
+static int l_walker_free(lua_State *L)
+{
+    free_walker((walker *)luaL_checkudata(L, 1, WALKER_MT));
+    return 0;
+}
+
+static const luaL_Reg walker_methods[] = {
+    {"walk", l_walker_walk}, {"stats", l_walker_stats}, {"free", l_walker_free}, {NULL, NULL}};
+
+static const luaL_Reg walker_funcs[] = {{"walker", l_mem_walker}, {NULL, NULL}};
+
+int luaopen_walker(lua_State *L)
+{
+    luaL_newmetatable(L, WALKER_MT);
+    lua_newtable(L);
+    luaL_register(L, NULL, walker_methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, l_walker_free);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    luaL_register(L, "mem", walker_funcs);
+    return 1;
+}
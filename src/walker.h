@@ -0,0 +1,26 @@
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <stdint.h>
+
+#include "lua.h"
+
+#define WALKER_MAX_LINKS 16
+#define WALKER_MAX_COLUMNS 64
+#define WALKER_MAX_NODE 0x10000  /* Largest node copied per visit */
+#define WALKER_ARRAY_BATCH 256   /* Node pointers read from an array at a time */
+#define WALKER_PREFETCH_AHEAD 8  /* Queued nodes prefetched ahead of the one being read */
+
+// Start of every output buffer; the column arrays follow at the offsets
+// the walker was created with. Mirrored by the cdef in gamecalls.lua.
+typedef struct
+{
+    uint32_t count;      /* Nodes written */
+    uint32_t truncated;  /* Non-zero if the capacity ran out */
+    uint32_t faults;     /* Nodes that faulted while being read; their fields are zero */
+    uint32_t unreadable; /* Pointers skipped as not pointing at readable memory */
+} walker_header;
+
+int luaopen_walker(lua_State *L);
+
+#endif // WALKER_H
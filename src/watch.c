@@ -0,0 +1,1022 @@
+/*
+ * watch.c: Memory watchpoints on the hardware debug registers, with guard
+ * pages as the fallback.
+ *
+ * Up to four aligned 1, 2 or 4 byte ranges go into DR0-DR3 of every thread
+ * in the process. Other threads are suspended one at a time and given the
+ * registers with SetThreadContext; the calling thread sets its own from
+ * inside the exception handler, and threads started later pick them up at
+ * the next sync (at most every WATCH_SYNC_MS, from the callback tick or
+ * mem.watch_poll).
+ * The CPU traps after a matching write, so the EIP recorded is that of the
+ * instruction following the writer.
+ *
+ * Anything else is watched by putting PAGE_GUARD on its pages. The first
+ * access to such a page raises a guard page exception and the system drops
+ * the guard; the handler notes the access, single-steps the thread over
+ * the instruction and puts the guard back. The EIP recorded is the writer
+ * itself, but every access to the page costs two exceptions, and guarded
+ * pages count as unreadable to the other mem.* functions.
+ *
+ * The handler never blocks or allocates: it claims a slot in a fixed ring
+ * of events with one atomic increment. Lua drains the ring with
+ * mem.watch_poll, and while any watch has a callback a frame tick drains
+ * it on the main thread and calls them there.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tlhelp32.h>
+#include <windows.h>
+
+#include "lauxlib.h"
+#include "logging.h"
+#include "memview.h"
+#include "output.h"
+#include "watch.h"
+
+#define WATCH_SYNC_EXCEPTION 0xE0574154u /* Raised to load this thread's own debug registers */
+#define WATCH_TRAP_FLAG      0x100u
+#define WATCH_RESUME_FLAG    0x10000u
+#define WATCH_DR6_HITS       0xFu
+#define WATCH_DR7_OWNED      0xFFFF00FFu /* Enable, type and length bits of DR0-DR3 */
+#define WATCH_MAX_THREADS    1024
+#define WATCH_PAGE           0x1000u
+
+enum
+{
+    WATCH_WRITE,
+    WATCH_ACCESS,
+    WATCH_EXECUTE
+};
+
+// Access codes as in EXCEPTION_RECORD, plus one for "read or write"
+enum
+{
+    ACCESS_READ = 0,
+    ACCESS_WRITE = 1,
+    ACCESS_ANY = 2,
+    ACCESS_EXECUTE = 8
+};
+
+typedef struct
+{
+    volatile LONG active;
+    uint32_t      id;
+    uint32_t      address;
+    uint32_t      size;
+    uint8_t       mode;
+    int8_t        slot; /* Debug register, -1 for guard pages */
+    int           ref;  /* Lua callback, LUA_NOREF for none */
+    volatile LONG hits;
+} watch_entry;
+
+typedef struct
+{
+    uint64_t      time; /* QueryPerformanceCounter ticks */
+    volatile LONG seq;  /* Write index + 1 once the event is complete */
+    uint32_t      watch;
+    uint32_t      thread;
+    uint32_t      eip;
+    uint32_t      address;
+    uint32_t      size; /* Bytes of value read */
+    uint32_t      access;
+    uint64_t      value; /* Bytes at address after the access */
+} watch_event;
+
+// A thread being stepped over an access to a guarded page
+typedef struct
+{
+    volatile LONG thread; /* Owner, 0 when free */
+    uint32_t      fault;
+    uint32_t      access;
+    uint32_t      eip;
+} watch_pending;
+
+typedef struct
+{
+    DWORD dr[WATCH_HARDWARE_SLOTS];
+    DWORD dr7;
+} debug_state;
+
+static watch_entry   g_watches[WATCH_MAX];
+static volatile LONG g_slots[WATCH_HARDWARE_SLOTS]; /* Watch index + 1, 0 when free */
+static watch_event   g_events[WATCH_RING];
+static volatile LONG g_eventNext = 0;
+static uint32_t      g_eventRead = 0;
+static watch_pending g_pending[WATCH_PENDING];
+static volatile LONG g_dropped = 0; /* Events overwritten before being drained */
+static volatile LONG g_lost = 0;    /* Guarded accesses that could not be stepped over */
+static volatile LONG g_rearm = 0;   /* Guard pages to restore at the next drain */
+static debug_state   g_debug;       /* Registers every thread should have */
+static DWORD         g_synced[WATCH_MAX_THREADS];
+static int           g_syncedCount = 0;
+static DWORD         g_lastSync = 0;
+static uint32_t      g_nextId = 1;
+static void         *g_handler = NULL;
+static DWORD         g_busySlot = TLS_OUT_OF_INDEXES; /* Set while this thread runs the handler */
+static int           g_tickId = 0;
+static int           g_backlogRef = LUA_NOREF; /* Events of watches without a callback */
+static int           g_backlogCount = 0;
+static bool          g_draining = false;
+static int64_t       g_qpcFrequency = 1;
+
+//============================================================================
+// EXCEPTION HANDLER
+//============================================================================
+
+static DWORD debug_address(const CONTEXT *ctx, int slot)
+{
+    return slot == 0 ? ctx->Dr0 : slot == 1 ? ctx->Dr1 : slot == 2 ? ctx->Dr2 : ctx->Dr3;
+}
+
+static void load_debug_registers(CONTEXT *ctx)
+{
+    ctx->Dr0 = g_debug.dr[0];
+    ctx->Dr1 = g_debug.dr[1];
+    ctx->Dr2 = g_debug.dr[2];
+    ctx->Dr3 = g_debug.dr[3];
+    ctx->Dr7 = (ctx->Dr7 & ~WATCH_DR7_OWNED) | g_debug.dr7;
+    ctx->ContextFlags |= CONTEXT_DEBUG_REGISTERS;
+}
+
+static void push_event(watch_entry *w, uint32_t eip, uint32_t address, uint32_t access)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    LONG         index = InterlockedIncrement(&g_eventNext) - 1;
+    watch_event *e = &g_events[(uint32_t)index & (WATCH_RING - 1)];
+
+    // The drain skips the slot until the new sequence number lands
+    InterlockedExchange(&e->seq, 0);
+    e->time = (uint64_t)now.QuadPart;
+    e->watch = w->id;
+    e->thread = GetCurrentThreadId();
+    e->eip = eip;
+    e->address = address;
+    e->access = access;
+    e->value = 0;
+    e->size = 0;
+    if (w->mode != WATCH_EXECUTE)
+    {
+        // Up to 8 bytes, kept within the watch and the page just accessed
+        uint32_t size = w->address + w->size - address;
+        uint32_t page_left = WATCH_PAGE - (address & (WATCH_PAGE - 1));
+        size = size < page_left ? size : page_left;
+        size = size < sizeof(e->value) ? size : sizeof(e->value);
+        if (memview_copy(&e->value, (const void *)(uintptr_t)address, size, NULL))
+        {
+            e->size = size;
+        }
+    }
+    InterlockedIncrement(&w->hits);
+    InterlockedExchange(&e->seq, index + 1);
+}
+
+static bool guards_page(const watch_entry *w, uint32_t page)
+{
+    uint32_t first = w->address & ~(WATCH_PAGE - 1);
+    uint32_t last = (w->address + w->size - 1) & ~(WATCH_PAGE - 1);
+    return w->active && w->slot < 0 && page >= first && page <= last;
+}
+
+static bool page_guarded(uint32_t page, const watch_entry *except)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        if (&g_watches[i] != except && guards_page(&g_watches[i], page))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool set_guard(uint32_t page, bool guard)
+{
+    MEMORY_BASIC_INFORMATION mbi;
+    if (!VirtualQuery((void *)(uintptr_t)page, &mbi, sizeof(mbi)) || mbi.State != MEM_COMMIT)
+    {
+        return false;
+    }
+
+    DWORD protect = guard ? mbi.Protect | PAGE_GUARD : mbi.Protect & ~PAGE_GUARD;
+    DWORD old;
+    return protect == mbi.Protect || VirtualProtect((void *)(uintptr_t)page, WATCH_PAGE, protect, &old);
+}
+
+// Two passes: a nested guard fault on a thread that is already being
+// stepped cannot be tracked, and is left for the next drain to re-arm
+static watch_pending *claim_pending(DWORD thread)
+{
+    for (int i = 0; i < WATCH_PENDING; i++)
+    {
+        if (g_pending[i].thread == (LONG)thread)
+        {
+            return NULL;
+        }
+    }
+    for (int i = 0; i < WATCH_PENDING; i++)
+    {
+        int slot = (int)((thread + (DWORD)i) % WATCH_PENDING);
+        if (InterlockedCompareExchange(&g_pending[slot].thread, (LONG)thread, 0) == 0)
+        {
+            return &g_pending[slot];
+        }
+    }
+    return NULL;
+}
+
+static watch_pending *find_pending(DWORD thread)
+{
+    for (int i = 0; i < WATCH_PENDING; i++)
+    {
+        int slot = (int)((thread + (DWORD)i) % WATCH_PENDING);
+        if (g_pending[slot].thread == (LONG)thread)
+        {
+            return &g_pending[slot];
+        }
+    }
+    return NULL;
+}
+
+static LONG on_guard(EXCEPTION_RECORD *record, CONTEXT *ctx)
+{
+    uint32_t access = (uint32_t)record->ExceptionInformation[0];
+    uint32_t fault = (uint32_t)record->ExceptionInformation[1];
+    if (!page_guarded(fault & ~(WATCH_PAGE - 1), NULL))
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    // The system already dropped the guard, so the access can still go ahead
+    watch_pending *pending = claim_pending(GetCurrentThreadId());
+    if (!pending)
+    {
+        InterlockedIncrement(&g_lost);
+        InterlockedExchange(&g_rearm, 1);
+        return EXCEPTION_CONTINUE_EXECUTION;
+    }
+
+    pending->fault = fault;
+    pending->access = access;
+    pending->eip = ctx->Eip;
+    ctx->EFlags |= WATCH_TRAP_FLAG;
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+static LONG on_single_step(CONTEXT *ctx)
+{
+    bool handled = false;
+
+    // Nothing else in the process uses DR0-DR3, so every hit is ours, even
+    // one on a slot freed since (or never synced into) this thread
+    DWORD hits = ctx->Dr6 & WATCH_DR6_HITS;
+    for (int slot = 0; slot < WATCH_HARDWARE_SLOTS; slot++)
+    {
+        if (!(hits & (1u << slot)))
+        {
+            continue;
+        }
+
+        // Instruction breakpoints fault before executing; RF lets it run once
+        if (((ctx->Dr7 >> (16 + slot * 4)) & 3) == 0)
+        {
+            ctx->EFlags |= WATCH_RESUME_FLAG;
+        }
+        handled = true;
+
+        LONG         index = g_slots[slot];
+        watch_entry *w = index ? &g_watches[index - 1] : NULL;
+        if (!w || !w->active || debug_address(ctx, slot) != w->address)
+        {
+            continue;
+        }
+        if (w->mode == WATCH_EXECUTE)
+        {
+            push_event(w, ctx->Eip, w->address, ACCESS_EXECUTE);
+        }
+        else
+        {
+            push_event(w, ctx->Eip, w->address, w->mode == WATCH_WRITE ? ACCESS_WRITE : ACCESS_ANY);
+        }
+    }
+
+    // Stale registers are replaced with the current set
+    if (hits)
+    {
+        load_debug_registers(ctx);
+    }
+
+    // Stepped over an access to a guarded page: record it, then re-arm
+    watch_pending *pending = find_pending(GetCurrentThreadId());
+    if (pending)
+    {
+        uint32_t page = pending->fault & ~(WATCH_PAGE - 1);
+        for (int i = 0; i < WATCH_MAX; i++)
+        {
+            watch_entry *w = &g_watches[i];
+            if (guards_page(w, page) && pending->fault >= w->address && pending->fault - w->address < w->size &&
+                (w->mode == WATCH_ACCESS || pending->access == ACCESS_WRITE))
+            {
+                push_event(w, pending->eip, pending->fault, pending->access);
+            }
+        }
+        if (page_guarded(page, NULL))
+        {
+            set_guard(page, true);
+        }
+        ctx->EFlags &= ~WATCH_TRAP_FLAG;
+        InterlockedExchange(&pending->thread, 0);
+        handled = true;
+    }
+
+    if (!handled)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+    ctx->Dr6 = 0;
+    return EXCEPTION_CONTINUE_EXECUTION;
+}
+
+static LONG CALLBACK watch_handler(EXCEPTION_POINTERS *info)
+{
+    DWORD code = info->ExceptionRecord->ExceptionCode;
+    if (code != WATCH_SYNC_EXCEPTION && code != STATUS_GUARD_PAGE_VIOLATION && code != EXCEPTION_SINGLE_STEP)
+    {
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    // The game's own exceptions must look untouched, last error included
+    DWORD error = GetLastError();
+    LONG  result = EXCEPTION_CONTINUE_EXECUTION;
+    if (TlsGetValue(g_busySlot))
+    {
+        // Reading the value of an "access" watch hit it again
+        CONTEXT *ctx = info->ContextRecord;
+        bool     hit = code == EXCEPTION_SINGLE_STEP && (ctx->Dr6 & WATCH_DR6_HITS);
+        result = hit ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH;
+        if (hit)
+        {
+            load_debug_registers(ctx);
+        }
+        ctx->Dr6 &= ~WATCH_DR6_HITS;
+        SetLastError(error);
+        return result;
+    }
+
+    TlsSetValue(g_busySlot, (void *)1);
+    if (code == WATCH_SYNC_EXCEPTION)
+    {
+        load_debug_registers(info->ContextRecord);
+    }
+    else if (code == STATUS_GUARD_PAGE_VIOLATION)
+    {
+        result = on_guard(info->ExceptionRecord, info->ContextRecord);
+    }
+    else
+    {
+        result = on_single_step(info->ContextRecord);
+    }
+    TlsSetValue(g_busySlot, NULL);
+    SetLastError(error);
+    return result;
+}
+
+static bool ensure_handler(void)
+{
+    if (g_busySlot == TLS_OUT_OF_INDEXES)
+    {
+        g_busySlot = TlsAlloc();
+    }
+    if (!g_handler && g_busySlot != TLS_OUT_OF_INDEXES)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        g_qpcFrequency = frequency.QuadPart;
+        g_handler = AddVectoredExceptionHandler(1, watch_handler);
+    }
+    return g_handler != NULL;
+}
+
+//============================================================================
+// DEBUG REGISTERS
+//============================================================================
+
+static void compute_debug_state(void)
+{
+    debug_state state;
+    memset(&state, 0, sizeof(state));
+
+    for (int slot = 0; slot < WATCH_HARDWARE_SLOTS; slot++)
+    {
+        LONG index = g_slots[slot];
+        if (!index)
+        {
+            continue;
+        }
+
+        const watch_entry *w = &g_watches[index - 1];
+        DWORD              rw = w->mode == WATCH_EXECUTE ? 0 : w->mode == WATCH_WRITE ? 1 : 3;
+        DWORD              len = w->mode == WATCH_EXECUTE || w->size == 1 ? 0 : w->size == 2 ? 1 : 3;
+        state.dr[slot] = w->address;
+        state.dr7 |= (1u << (slot * 2)) | (rw << (16 + slot * 4)) | (len << (18 + slot * 4));
+    }
+    g_debug = state;
+}
+
+static bool hardware_active(void)
+{
+    for (int slot = 0; slot < WATCH_HARDWARE_SLOTS; slot++)
+    {
+        if (g_slots[slot])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Nothing is allocated or locked while the thread is suspended
+static void load_thread(DWORD id)
+{
+    HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_SET_CONTEXT, FALSE, id);
+    if (!thread)
+    {
+        return;
+    }
+
+    if (SuspendThread(thread) != (DWORD)-1)
+    {
+        CONTEXT ctx;
+        memset(&ctx, 0, sizeof(ctx));
+        ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+        if (GetThreadContext(thread, &ctx))
+        {
+            load_debug_registers(&ctx);
+            ctx.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+            SetThreadContext(thread, &ctx);
+        }
+        ResumeThread(thread);
+    }
+    CloseHandle(thread);
+}
+
+static bool synced(DWORD id)
+{
+    for (int i = 0; i < g_syncedCount; i++)
+    {
+        if (g_synced[i] == id)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Loads g_debug into every thread, or with only_new into threads that did
+// not exist at the last sync
+static void sync_threads(bool only_new)
+{
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    DWORD         pid = GetCurrentProcessId();
+    DWORD         self = GetCurrentThreadId();
+    DWORD         seen[WATCH_MAX_THREADS];
+    int           count = 0;
+    THREADENTRY32 te;
+    te.dwSize = sizeof(te);
+
+    for (BOOL ok = Thread32First(snapshot, &te); ok; ok = Thread32Next(snapshot, &te))
+    {
+        if (te.th32OwnerProcessID != pid)
+        {
+            continue;
+        }
+        if (te.th32ThreadID != self && !(only_new && synced(te.th32ThreadID)))
+        {
+            load_thread(te.th32ThreadID);
+        }
+        if (count < WATCH_MAX_THREADS)
+        {
+            seen[count++] = te.th32ThreadID;
+        }
+    }
+    CloseHandle(snapshot);
+
+    memcpy(g_synced, seen, count * sizeof(DWORD));
+    g_syncedCount = count;
+    g_lastSync = GetTickCount();
+    if (!only_new)
+    {
+        RaiseException(WATCH_SYNC_EXCEPTION, 0, 0, NULL);
+    }
+}
+
+static int free_slot(void)
+{
+    for (int slot = 0; slot < WATCH_HARDWARE_SLOTS; slot++)
+    {
+        if (!g_slots[slot])
+        {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+//============================================================================
+// GUARD PAGES
+//============================================================================
+
+static bool committed(uint32_t address, uint32_t size)
+{
+    for (uint32_t page = address & ~(WATCH_PAGE - 1); page < address + size; page += WATCH_PAGE)
+    {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (!VirtualQuery((void *)(uintptr_t)page, &mbi, sizeof(mbi)) || mbi.State != MEM_COMMIT ||
+            (mbi.Protect & PAGE_NOACCESS))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void arm_guard(const watch_entry *w)
+{
+    for (uint32_t page = w->address & ~(WATCH_PAGE - 1); page < w->address + w->size; page += WATCH_PAGE)
+    {
+        set_guard(page, true);
+    }
+}
+
+// Pages still covered by another watch keep their guard
+static void disarm_guard(const watch_entry *w)
+{
+    for (uint32_t page = w->address & ~(WATCH_PAGE - 1); page < w->address + w->size; page += WATCH_PAGE)
+    {
+        if (!page_guarded(page, w))
+        {
+            set_guard(page, false);
+        }
+    }
+}
+
+static void rearm_all(void)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        if (g_watches[i].active && g_watches[i].slot < 0)
+        {
+            arm_guard(&g_watches[i]);
+        }
+    }
+}
+
+//============================================================================
+// DRAINING
+//============================================================================
+
+static const char *const g_modeNames[] = {"write", "access", "execute", NULL};
+
+static const char *access_name(uint32_t access)
+{
+    switch (access)
+    {
+    case ACCESS_READ:
+        return "read";
+    case ACCESS_WRITE:
+        return "write";
+    case ACCESS_EXECUTE:
+        return "execute";
+    default:
+        return "access";
+    }
+}
+
+static watch_entry *find_watch(uint32_t id)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        if (g_watches[i].active && g_watches[i].id == id)
+        {
+            return &g_watches[i];
+        }
+    }
+    return NULL;
+}
+
+static void push_event_table(lua_State *L, const watch_event *e)
+{
+    lua_createtable(L, 0, 8);
+    lua_pushnumber(L, e->watch);
+    lua_setfield(L, -2, "watch");
+    lua_pushnumber(L, e->address);
+    lua_setfield(L, -2, "address");
+    lua_pushnumber(L, (lua_Number)e->value);
+    lua_setfield(L, -2, "value");
+    lua_pushnumber(L, e->size);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, e->eip);
+    lua_setfield(L, -2, "eip");
+    lua_pushnumber(L, e->thread);
+    lua_setfield(L, -2, "thread");
+    lua_pushstring(L, access_name(e->access));
+    lua_setfield(L, -2, "access");
+    lua_pushnumber(L, (double)e->time / (double)g_qpcFrequency);
+    lua_setfield(L, -2, "time");
+}
+
+static void push_backlog(lua_State *L)
+{
+    if (g_backlogRef == LUA_NOREF)
+    {
+        lua_newtable(L);
+        g_backlogRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        g_backlogCount = 0;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, g_backlogRef);
+}
+
+static void run_callback(lua_State *L, watch_entry *w, const watch_event *e)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, w->ref);
+    push_event_table(L, e);
+    if (lua_pcall(L, 1, 0, 0) != 0)
+    {
+        const char *error = lua_tostring(L, -1);
+        output_printf("[watch] Callback for watch %u failed and was removed: %s\n", (unsigned)w->id,
+                      error ? error : "(unknown error)");
+        lua_pop(L, 1);
+        if (w->ref != LUA_NOREF)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, w->ref);
+            w->ref = LUA_NOREF;
+        }
+    }
+}
+
+// Moves complete events out of the ring: watches with a callback get it
+// called, the rest are appended to the backlog mem.watch_poll returns
+static void drain(lua_State *L)
+{
+    if (g_draining)
+    {
+        return;
+    }
+    g_draining = true;
+    if (g_rearm && InterlockedExchange(&g_rearm, 0))
+    {
+        rearm_all();
+    }
+
+    uint32_t next = (uint32_t)g_eventNext;
+    if (next - g_eventRead > WATCH_RING)
+    {
+        InterlockedExchangeAdd(&g_dropped, (LONG)(next - WATCH_RING - g_eventRead));
+        g_eventRead = next - WATCH_RING;
+    }
+
+    push_backlog(L);
+    int backlog = lua_gettop(L);
+    while (g_eventRead != next)
+    {
+        const watch_event *slot = &g_events[g_eventRead & (WATCH_RING - 1)];
+        uint32_t           seq = (uint32_t)slot->seq;
+        if (seq != g_eventRead + 1)
+        {
+            if (seq == 0 || (int32_t)(seq - (g_eventRead + 1)) < 0)
+            {
+                break; /* Still being written */
+            }
+            InterlockedIncrement(&g_dropped); /* Lapped by a newer event */
+            g_eventRead++;
+            continue;
+        }
+
+        watch_event e = *slot;
+        MemoryBarrier();
+        g_eventRead++;
+        if ((uint32_t)slot->seq != seq)
+        {
+            InterlockedIncrement(&g_dropped);
+            continue;
+        }
+
+        // Callbacks may unwatch, so the watch is looked up per event
+        watch_entry *w = find_watch(e.watch);
+        if (w && w->ref != LUA_NOREF)
+        {
+            run_callback(L, w, &e);
+        }
+        else if (g_backlogCount < WATCH_RING)
+        {
+            push_event_table(L, &e);
+            lua_rawseti(L, backlog, ++g_backlogCount);
+        }
+        else
+        {
+            InterlockedIncrement(&g_dropped);
+        }
+    }
+    lua_pop(L, 1);
+    g_draining = false;
+}
+
+static bool callbacks_active(void)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        if (g_watches[i].active && g_watches[i].ref != LUA_NOREF)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Gives threads started since the last sync the debug registers
+static void sync_new_threads(void)
+{
+    if (hardware_active() && GetTickCount() - g_lastSync >= WATCH_SYNC_MS)
+    {
+        sync_threads(true);
+    }
+}
+
+// Frame tick on the main thread; returning false unsubscribes it once no
+// watch has a callback left
+static int l_watch_tick(lua_State *L)
+{
+    drain(L);
+    sync_new_threads();
+    if (!callbacks_active())
+    {
+        g_tickId = 0;
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    return 0;
+}
+
+static void start_tick(lua_State *L)
+{
+    if (g_tickId)
+    {
+        return;
+    }
+
+    lua_getglobal(L, "frame");
+    if (lua_istable(L, -1))
+    {
+        lua_getfield(L, -1, "on_tick");
+        lua_pushnumber(L, WATCH_POLL_MS);
+        lua_pushcfunction(L, l_watch_tick);
+        lua_call(L, 2, 1);
+        g_tickId = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+}
+
+//============================================================================
+// LUA API
+//============================================================================
+
+static void remove_watch(lua_State *L, watch_entry *w)
+{
+    InterlockedExchange(&w->active, 0);
+    if (w->slot >= 0)
+    {
+        InterlockedExchange(&g_slots[w->slot], 0);
+        compute_debug_state();
+        sync_threads(false);
+    }
+    else
+    {
+        disarm_guard(w);
+    }
+    if (L && w->ref != LUA_NOREF)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, w->ref);
+    }
+    w->ref = LUA_NOREF;
+}
+
+// mem.watch(addr, size, mode [, fn] [, opts]) -> id, method | nil, err
+// mode: "write", "access" or "execute"; opts.guard forces guard pages
+static int l_mem_watch(lua_State *L)
+{
+    uint32_t   address = (uint32_t)(int64_t)luaL_checknumber(L, 1);
+    lua_Number size_arg = luaL_checknumber(L, 2);
+    int        mode = luaL_checkoption(L, 3, "write", g_modeNames);
+    bool       has_callback = !lua_isnoneornil(L, 4);
+    bool       force_guard = false;
+    luaL_argcheck(L, size_arg >= 1 && size_arg <= WATCH_MAX_GUARD_BYTES, 2, "size out of range");
+    if (has_callback)
+    {
+        luaL_checktype(L, 4, LUA_TFUNCTION);
+    }
+    if (lua_istable(L, 5))
+    {
+        lua_getfield(L, 5, "guard");
+        force_guard = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+
+    uint32_t size = mode == WATCH_EXECUTE ? 1 : (uint32_t)size_arg;
+    if (address + size < address)
+    {
+        return luaL_argerror(L, 2, "range wraps the address space");
+    }
+
+    int index = 0;
+    while (index < WATCH_MAX && g_watches[index].active)
+    {
+        index++;
+    }
+    if (index == WATCH_MAX)
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "at most %d watches", WATCH_MAX);
+        return 2;
+    }
+    if (!ensure_handler())
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "could not install the exception handler");
+        return 2;
+    }
+
+    // Debug registers take 1, 2 or 4 bytes aligned to their size
+    bool fits = mode == WATCH_EXECUTE || ((size == 1 || size == 2 || size == 4) && address % size == 0);
+    int  slot = fits && !force_guard ? free_slot() : -1;
+    if (slot < 0 && mode == WATCH_EXECUTE)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, "no free debug register");
+        return 2;
+    }
+    if (slot < 0 && !committed(address, size))
+    {
+        lua_pushnil(L);
+        lua_pushfstring(L, "0x%08X is not committed memory", (unsigned)address);
+        return 2;
+    }
+
+    watch_entry *w = &g_watches[index];
+    w->id = g_nextId++;
+    w->address = address;
+    w->size = size;
+    w->mode = (uint8_t)mode;
+    w->slot = (int8_t)slot;
+    w->hits = 0;
+    w->ref = LUA_NOREF;
+    if (has_callback)
+    {
+        lua_pushvalue(L, 4);
+        w->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    // Active before arming, or the first hit would not be recognised
+    InterlockedExchange(&w->active, 1);
+    if (slot >= 0)
+    {
+        InterlockedExchange(&g_slots[slot], index + 1);
+        compute_debug_state();
+        sync_threads(false);
+    }
+    else
+    {
+        arm_guard(w);
+    }
+    if (has_callback)
+    {
+        start_tick(L);
+    }
+
+    lua_pushnumber(L, w->id);
+    lua_pushstring(L, slot >= 0 ? "hardware" : "guard");
+    return 2;
+}
+
+// mem.unwatch(id) -> true if the watch existed
+static int l_mem_unwatch(lua_State *L)
+{
+    watch_entry *w = find_watch((uint32_t)luaL_checknumber(L, 1));
+    if (w)
+    {
+        remove_watch(L, w);
+    }
+    lua_pushboolean(L, w != NULL);
+    return 1;
+}
+
+// mem.watch_poll() -> events of watches without a callback since the last poll
+static int l_mem_watch_poll(lua_State *L)
+{
+    drain(L);
+    sync_new_threads();
+    push_backlog(L);
+    luaL_unref(L, LUA_REGISTRYINDEX, g_backlogRef);
+    g_backlogRef = LUA_NOREF;
+    g_backlogCount = 0;
+    return 1;
+}
+
+static int l_mem_watches(lua_State *L)
+{
+    lua_newtable(L);
+    int count = 0;
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        const watch_entry *w = &g_watches[i];
+        if (!w->active)
+        {
+            continue;
+        }
+
+        lua_createtable(L, 0, 7);
+        lua_pushnumber(L, w->id);
+        lua_setfield(L, -2, "id");
+        lua_pushnumber(L, w->address);
+        lua_setfield(L, -2, "address");
+        lua_pushnumber(L, w->size);
+        lua_setfield(L, -2, "size");
+        lua_pushstring(L, g_modeNames[w->mode]);
+        lua_setfield(L, -2, "mode");
+        lua_pushstring(L, w->slot >= 0 ? "hardware" : "guard");
+        lua_setfield(L, -2, "method");
+        lua_pushnumber(L, (uint32_t)w->hits);
+        lua_setfield(L, -2, "hits");
+        lua_pushboolean(L, w->ref != LUA_NOREF);
+        lua_setfield(L, -2, "callback");
+        lua_rawseti(L, -2, ++count);
+    }
+    return 1;
+}
+
+static int l_mem_watch_stats(lua_State *L)
+{
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, (uint32_t)g_eventNext);
+    lua_setfield(L, -2, "events");
+    lua_pushnumber(L, (uint32_t)g_eventNext - g_eventRead);
+    lua_setfield(L, -2, "queued");
+    lua_pushnumber(L, g_backlogCount);
+    lua_setfield(L, -2, "backlog");
+    lua_pushnumber(L, (uint32_t)g_dropped);
+    lua_setfield(L, -2, "dropped");
+    lua_pushnumber(L, (uint32_t)g_lost);
+    lua_setfield(L, -2, "lost");
+    lua_pushnumber(L, g_syncedCount);
+    lua_setfield(L, -2, "threads");
+    return 1;
+}
+
+//============================================================================
+// LIFECYCLE
+//============================================================================
+
+// Clears the debug registers and guard pages before the module unloads;
+// the Lua state is about to close, so callbacks are not released here
+void watch_shutdown(void)
+{
+    for (int i = 0; i < WATCH_MAX; i++)
+    {
+        if (g_watches[i].active)
+        {
+            remove_watch(NULL, &g_watches[i]);
+        }
+    }
+    if (g_handler)
+    {
+        RemoveVectoredExceptionHandler(g_handler);
+        g_handler = NULL;
+    }
+    if (g_busySlot != TLS_OUT_OF_INDEXES)
+    {
+        TlsFree(g_busySlot);
+        g_busySlot = TLS_OUT_OF_INDEXES;
+    }
+}
+
+static const luaL_Reg watch_funcs[] = {{"watch", l_mem_watch},           {"unwatch", l_mem_unwatch},
+                                       {"watch_poll", l_mem_watch_poll}, {"watches", l_mem_watches},
+                                       {"watch_stats", l_mem_watch_stats}, {NULL, NULL}};
+
+int luaopen_watch(lua_State *L)
+{
+    luaL_register(L, "mem", watch_funcs);
+    return 1;
+}
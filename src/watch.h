@@ -0,0 +1,19 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+
+#include "lua.h"
+
+#define WATCH_MAX 32
+#define WATCH_HARDWARE_SLOTS 4        /* DR0-DR3 */
+#define WATCH_RING 4096               /* Events kept until Lua drains them; power of two */
+#define WATCH_PENDING 64              /* Threads stepping over a guarded access at once */
+#define WATCH_MAX_GUARD_BYTES 0x100000
+#define WATCH_POLL_MS 16              /* Drain interval for callbacks on the main thread */
+#define WATCH_SYNC_MS 1000            /* How often new threads get the debug registers */
+
+void watch_shutdown(void);
+int  luaopen_watch(lua_State *L);
+
+#endif // WATCH_H
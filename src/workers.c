@@ -0,0 +1,1292 @@
+/*
+ * workers.c: Extra Lua states on their own threads, and channels between
+ * them.
+ *
+ * workers.spawn starts a thread with a fresh LuaJIT state. It opens the
+ * same native modules as the console, except those whose callbacks run on
+ * the console's state (frame, hook, sched and the like, which are left as
+ * tables of stubs that raise), runs lua/init.lua for the same bindings,
+ * then the script. States share nothing: values cross between them as
+ * messages, serialized into a flat buffer when sent and rebuilt in the
+ * receiving state. Channels and shared buffers are reference counted and
+ * travel by reference, so a large result can be written into a buffer by
+ * a worker and read in place through the FFI by the console.
+ *
+ * Blocking waits (recv, send on a full channel, join, sleep) run in
+ * WORKERS_WAIT_SLICE_MS slices and give up once their worker is cancelled;
+ * running Lua code is stopped by a count hook installed from the
+ * cancelling thread.
+ */
+
+#define WIN32_LEAN_AND_MEAN
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "dispatch.h"
+#include "ghidra.h"
+#include "latency.h"
+#include "lauxlib.h"
+#include "logging.h"
+#include "lualib.h"
+#include "memview.h"
+#include "output.h"
+#include "regfile.h"
+#include "regions.h"
+#include "ringlog.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "symbols.h"
+#include "trace.h"
+#include "walker.h"
+#include "workers.h"
+
+#define WORKER_MT "luaapi.worker"
+#define CHANNEL_MT "luaapi.channel"
+#define BUFFER_MT "luaapi.buffer"
+#define WORKER_SELF "luaapi.worker_self" /* Registry key of the running worker */
+#define WORKERS_INIT_SCRIPT "lua/init.lua" /* Same script as the console */
+#define WORKERS_NAME_SIZE 64
+
+enum
+{
+    TAG_NIL,
+    TAG_FALSE,
+    TAG_TRUE,
+    TAG_NUMBER,
+    TAG_STRING,
+    TAG_TABLE,
+    TAG_END,
+    TAG_OBJECT
+};
+
+typedef enum
+{
+    SHARED_CHANNEL,
+    SHARED_BUFFER
+} shared_kind;
+
+typedef struct
+{
+    volatile LONG refs;
+    shared_kind   kind;
+} shared_object;
+
+// Serialized values; objects holds one reference per TAG_OBJECT
+typedef struct
+{
+    char           *data;
+    uint32_t        size;
+    uint32_t        value_count;
+    shared_object **objects;
+    uint32_t        object_count;
+} message;
+
+typedef struct
+{
+    shared_object      header;
+    SRWLOCK            lock;
+    CONDITION_VARIABLE readable;
+    CONDITION_VARIABLE writable;
+    message          **items;
+    uint32_t           capacity;
+    uint32_t           head;
+    uint32_t           count;
+    bool               closed;
+    uint32_t           sent;
+    uint32_t           received;
+} channel;
+
+typedef struct
+{
+    shared_object header;
+    uint32_t      size;
+    uint8_t      *data; /* Page aligned, zeroed */
+} buffer;
+
+typedef struct
+{
+    shared_object *object;
+} shared_box;
+
+typedef enum
+{
+    WORKER_STARTING,
+    WORKER_RUNNING,
+    WORKER_DONE,
+    WORKER_FAILED,
+    WORKER_CANCELLED
+} worker_state;
+
+static const char *const g_stateNames[] = {"starting", "running", "done", "failed", "cancelled"};
+
+typedef struct
+{
+    volatile LONG refs;  /* Handles plus the thread while it runs */
+    uint32_t      id;
+    HANDLE        thread;
+    lua_State    *L;     /* Set while the state is open, under g_lock */
+    volatile LONG state;
+    volatile LONG cancel;
+    char         *source;
+    size_t        source_length;
+    char          name[WORKERS_NAME_SIZE];
+    message      *args;
+    message      *results;
+    char         *error;
+    int64_t       start_tick;
+    int64_t       stop_tick;
+} worker;
+
+typedef struct
+{
+    worker *w;
+} worker_box;
+
+static SRWLOCK       g_lock = SRWLOCK_INIT;
+static worker       *g_running[WORKERS_MAX];
+static int           g_runningCount = 0;
+static volatile LONG g_nextId = 0;
+static int64_t       g_qpcFrequency = 1;
+
+// Modules whose callbacks or state belong to the console's Lua state
+static const char *const g_consoleOnly[] = {"frame", "frametime", "hook", "profiler", "sched", "chunk", "remote", NULL};
+
+static int64_t qpc_now(void)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+}
+
+//============================================================================
+// SHARED OBJECTS
+//============================================================================
+
+static void message_free(message *m);
+
+static void shared_retain(shared_object *object)
+{
+    InterlockedIncrement(&object->refs);
+}
+
+static void shared_release(shared_object *object)
+{
+    if (InterlockedDecrement(&object->refs) != 0)
+    {
+        return;
+    }
+
+    if (object->kind == SHARED_CHANNEL)
+    {
+        channel *c = (channel *)object;
+        for (uint32_t i = 0; i < c->count; i++)
+        {
+            message_free(c->items[(c->head + i) % c->capacity]);
+        }
+        free(c->items);
+    }
+    else
+    {
+        VirtualFree(((buffer *)object)->data, 0, MEM_RELEASE);
+    }
+    free(object);
+}
+
+static channel *channel_new(uint32_t capacity)
+{
+    channel *c = calloc(1, sizeof(channel));
+    if (!c)
+    {
+        return NULL;
+    }
+
+    c->items = calloc(capacity, sizeof(message *));
+    if (!c->items)
+    {
+        free(c);
+        return NULL;
+    }
+    c->header.refs = 1;
+    c->header.kind = SHARED_CHANNEL;
+    c->capacity = capacity;
+    InitializeSRWLock(&c->lock);
+    InitializeConditionVariable(&c->readable);
+    InitializeConditionVariable(&c->writable);
+    return c;
+}
+
+static buffer *buffer_new(uint32_t size)
+{
+    buffer *b = calloc(1, sizeof(buffer));
+    if (!b)
+    {
+        return NULL;
+    }
+
+    b->data = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!b->data)
+    {
+        free(b);
+        return NULL;
+    }
+    b->header.refs = 1;
+    b->header.kind = SHARED_BUFFER;
+    b->size = size;
+    return b;
+}
+
+// Takes over one reference
+static void push_shared(lua_State *L, shared_object *object)
+{
+    shared_box *box = (shared_box *)lua_newuserdata(L, sizeof(shared_box));
+    box->object = object;
+    luaL_getmetatable(L, object->kind == SHARED_CHANNEL ? CHANNEL_MT : BUFFER_MT);
+    lua_setmetatable(L, -2);
+}
+
+static shared_object *to_shared(lua_State *L, int index)
+{
+    shared_box *box = (shared_box *)lua_touserdata(L, index);
+    if (!box || !lua_getmetatable(L, index))
+    {
+        return NULL;
+    }
+
+    luaL_getmetatable(L, CHANNEL_MT);
+    luaL_getmetatable(L, BUFFER_MT);
+    bool known = lua_rawequal(L, -3, -2) || lua_rawequal(L, -3, -1);
+    lua_pop(L, 3);
+    return known ? box->object : NULL;
+}
+
+static channel *check_channel(lua_State *L)
+{
+    return (channel *)((shared_box *)luaL_checkudata(L, 1, CHANNEL_MT))->object;
+}
+
+static buffer *check_buffer(lua_State *L)
+{
+    return (buffer *)((shared_box *)luaL_checkudata(L, 1, BUFFER_MT))->object;
+}
+
+static int l_shared_gc(lua_State *L)
+{
+    shared_box *box = (shared_box *)lua_touserdata(L, 1);
+    if (box->object)
+    {
+        shared_release(box->object);
+        box->object = NULL;
+    }
+    return 0;
+}
+
+//============================================================================
+// MESSAGES
+//============================================================================
+
+typedef struct
+{
+    message    *m;
+    uint32_t    capacity;
+    uint32_t    object_capacity;
+    const char *error; /* Reason encoding stopped */
+} writer;
+
+static void message_free(message *m)
+{
+    if (!m)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < m->object_count; i++)
+    {
+        if (m->objects[i])
+        {
+            shared_release(m->objects[i]);
+        }
+    }
+    free(m->objects);
+    free(m->data);
+    free(m);
+}
+
+static bool put(writer *w, const void *data, uint32_t size)
+{
+    message *m = w->m;
+    if (m->size + size > w->capacity)
+    {
+        uint32_t capacity = w->capacity ? w->capacity : 256;
+        while (capacity < m->size + size)
+        {
+            capacity *= 2;
+        }
+        char *grown = realloc(m->data, capacity);
+        if (!grown)
+        {
+            w->error = "out of memory";
+            return false;
+        }
+        m->data = grown;
+        w->capacity = capacity;
+    }
+    memcpy(m->data + m->size, data, size);
+    m->size += size;
+    return true;
+}
+
+static bool put_tag(writer *w, uint8_t tag)
+{
+    return put(w, &tag, 1);
+}
+
+static bool put_object(writer *w, shared_object *object)
+{
+    message *m = w->m;
+    if (m->object_count == w->object_capacity)
+    {
+        uint32_t        capacity = w->object_capacity ? w->object_capacity * 2 : 4;
+        shared_object **grown = realloc(m->objects, capacity * sizeof(shared_object *));
+        if (!grown)
+        {
+            w->error = "out of memory";
+            return false;
+        }
+        m->objects = grown;
+        w->object_capacity = capacity;
+    }
+
+    uint32_t index = m->object_count;
+    if (!put_tag(w, TAG_OBJECT) || !put(w, &index, sizeof(index)))
+    {
+        return false;
+    }
+    shared_retain(object);
+    m->objects[m->object_count++] = object;
+    return true;
+}
+
+static bool encode(lua_State *L, writer *w, int index, int depth)
+{
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+        return put_tag(w, TAG_NIL);
+    case LUA_TBOOLEAN:
+        return put_tag(w, lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+    case LUA_TNUMBER:
+    {
+        double value = lua_tonumber(L, index);
+        return put_tag(w, TAG_NUMBER) && put(w, &value, sizeof(value));
+    }
+    case LUA_TSTRING:
+    {
+        size_t      length;
+        const char *text = lua_tolstring(L, index, &length);
+        uint32_t    size = (uint32_t)length;
+        return put_tag(w, TAG_STRING) && put(w, &size, sizeof(size)) && put(w, text, size);
+    }
+    case LUA_TTABLE:
+    {
+        if (depth >= WORKERS_MAX_DEPTH)
+        {
+            w->error = "tables nested too deeply (or a cycle)";
+            return false;
+        }
+        if (!put_tag(w, TAG_TABLE))
+        {
+            return false;
+        }
+
+        luaL_checkstack(L, 3, "message too deep");
+        lua_pushnil(L);
+        while (lua_next(L, index))
+        {
+            int top = lua_gettop(L);
+            if (lua_isnil(L, top - 1) || !encode(L, w, top - 1, depth + 1) || !encode(L, w, top, depth + 1))
+            {
+                lua_pop(L, 2);
+                return false;
+            }
+            lua_pop(L, 1);
+        }
+        return put_tag(w, TAG_END);
+    }
+    case LUA_TUSERDATA:
+    {
+        shared_object *object = to_shared(L, index);
+        if (object)
+        {
+            return put_object(w, object);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    w->error = lua_type(L, index) == LUA_TUSERDATA || lua_type(L, index) == 10 /* LuaJIT cdata */
+                   ? "only channels and buffers can be sent; copy cdata into workers.buffer"
+                   : "functions, threads and light userdata cannot be sent";
+    return false;
+}
+
+// Serializes count values starting at first. Raises on values that cannot
+// cross states.
+static message *encode_values(lua_State *L, int first, int count)
+{
+    writer w = {NULL, 0, 0, NULL};
+    w.m = calloc(1, sizeof(message));
+    if (!w.m)
+    {
+        luaL_error(L, "out of memory");
+    }
+
+    w.m->value_count = (uint32_t)count;
+    for (int i = 0; i < count; i++)
+    {
+        if (!encode(L, &w, first + i, 0))
+        {
+            message_free(w.m);
+            luaL_error(L, "cannot send value %d: %s", i + 1, w.error);
+        }
+    }
+    return w.m;
+}
+
+typedef struct
+{
+    message    *m;
+    uint32_t    pos;
+} reader;
+
+static bool take(reader *r, void *out, uint32_t size)
+{
+    if (r->pos + size > r->m->size)
+    {
+        return false;
+    }
+    memcpy(out, r->m->data + r->pos, size);
+    r->pos += size;
+    return true;
+}
+
+// Pushes one value; TAG_END is reported through *end for table walks
+static bool decode(lua_State *L, reader *r, bool *end)
+{
+    uint8_t tag;
+    *end = false;
+    if (!take(r, &tag, 1))
+    {
+        return false;
+    }
+
+    switch (tag)
+    {
+    case TAG_NIL:
+        lua_pushnil(L);
+        return true;
+    case TAG_FALSE:
+    case TAG_TRUE:
+        lua_pushboolean(L, tag == TAG_TRUE);
+        return true;
+    case TAG_NUMBER:
+    {
+        double value;
+        if (!take(r, &value, sizeof(value)))
+        {
+            return false;
+        }
+        lua_pushnumber(L, value);
+        return true;
+    }
+    case TAG_STRING:
+    {
+        uint32_t size;
+        if (!take(r, &size, sizeof(size)) || r->pos + size > r->m->size)
+        {
+            return false;
+        }
+        lua_pushlstring(L, r->m->data + r->pos, size);
+        r->pos += size;
+        return true;
+    }
+    case TAG_TABLE:
+    {
+        luaL_checkstack(L, 4, "message too deep");
+        lua_newtable(L);
+        for (;;)
+        {
+            bool done;
+            if (!decode(L, r, &done))
+            {
+                return false;
+            }
+            if (done)
+            {
+                return true;
+            }
+            if (!decode(L, r, &done) || done)
+            {
+                return false;
+            }
+            lua_rawset(L, -3);
+        }
+    }
+    case TAG_END:
+        *end = true;
+        return true;
+    case TAG_OBJECT:
+    {
+        uint32_t index;
+        if (!take(r, &index, sizeof(index)) || index >= r->m->object_count || !r->m->objects[index])
+        {
+            return false;
+        }
+        push_shared(L, r->m->objects[index]);
+        r->m->objects[index] = NULL; /* The userdata owns the reference now */
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Pushes every value of m and frees it; returns the number pushed
+static int decode_values(lua_State *L, message *m)
+{
+    reader r = {m, 0};
+    int    base = lua_gettop(L);
+    luaL_checkstack(L, (int)m->value_count + 4, "too many values");
+
+    for (uint32_t i = 0; i < m->value_count; i++)
+    {
+        bool end;
+        if (!decode(L, &r, &end) || end)
+        {
+            lua_settop(L, base);
+            message_free(m);
+            return luaL_error(L, "corrupt message");
+        }
+    }
+    message_free(m);
+    return lua_gettop(L) - base;
+}
+
+//============================================================================
+// WAITING
+//============================================================================
+
+static worker *current_worker(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, WORKER_SELF);
+    worker *w = (worker *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return w;
+}
+
+static bool cancelled(lua_State *L)
+{
+    worker *w = current_worker(L);
+    return w && w->cancel;
+}
+
+// Milliseconds left before deadline, or WORKERS_WAIT_SLICE_MS for
+// INFINITE; 0 once it passed
+static DWORD wait_slice(DWORD deadline, bool forever)
+{
+    if (forever)
+    {
+        return WORKERS_WAIT_SLICE_MS;
+    }
+    LONG left = (LONG)(deadline - GetTickCount());
+    if (left <= 0)
+    {
+        return 0;
+    }
+    return left < WORKERS_WAIT_SLICE_MS ? (DWORD)left : WORKERS_WAIT_SLICE_MS;
+}
+
+static void read_timeout(lua_State *L, int index, DWORD *deadline, bool *forever)
+{
+    *forever = lua_isnoneornil(L, index);
+    *deadline = GetTickCount() + (*forever ? 0 : (DWORD)luaL_checknumber(L, index));
+}
+
+//============================================================================
+// CHANNELS
+//============================================================================
+
+// workers.channel([capacity]) -> channel
+static int l_workers_channel(lua_State *L)
+{
+    lua_Number capacity = luaL_optnumber(L, 1, WORKERS_CHANNEL_CAPACITY);
+    luaL_argcheck(L, capacity >= 1 && capacity <= (1 << 20), 1, "capacity out of range");
+
+    channel *c = channel_new((uint32_t)capacity);
+    if (!c)
+    {
+        return luaL_error(L, "out of memory");
+    }
+    push_shared(L, &c->header);
+    return 1;
+}
+
+// chan:send(value [, timeout_ms]) -> true | false, "full"/"closed"/"cancelled"
+static int l_channel_send(lua_State *L)
+{
+    channel *c = check_channel(L);
+    luaL_argcheck(L, !lua_isnoneornil(L, 2), 2, "nil cannot be sent");
+    DWORD deadline;
+    bool  forever;
+    read_timeout(L, 3, &deadline, &forever);
+
+    message    *m = encode_values(L, 2, 1);
+    const char *failure = NULL;
+    AcquireSRWLockExclusive(&c->lock);
+    while (!c->closed && c->count == c->capacity)
+    {
+        DWORD slice = wait_slice(deadline, forever);
+        if (!slice || cancelled(L))
+        {
+            failure = slice ? "cancelled" : "full";
+            break;
+        }
+        SleepConditionVariableSRW(&c->writable, &c->lock, slice, 0);
+    }
+    if (!failure && c->closed)
+    {
+        failure = "closed";
+    }
+    if (!failure)
+    {
+        c->items[(c->head + c->count) % c->capacity] = m;
+        c->count++;
+        c->sent++;
+        WakeConditionVariable(&c->readable);
+    }
+    ReleaseSRWLockExclusive(&c->lock);
+
+    if (failure)
+    {
+        message_free(m);
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, failure);
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+// chan:recv([timeout_ms]) -> value | nil, "timeout"/"closed"/"cancelled"
+static int l_channel_recv(lua_State *L)
+{
+    channel *c = check_channel(L);
+    DWORD    deadline;
+    bool     forever;
+    read_timeout(L, 2, &deadline, &forever);
+
+    message    *m = NULL;
+    const char *failure = NULL;
+    AcquireSRWLockExclusive(&c->lock);
+    while (c->count == 0)
+    {
+        DWORD slice = c->closed ? 0 : wait_slice(deadline, forever);
+        if (!slice || cancelled(L))
+        {
+            failure = c->closed ? "closed" : slice ? "cancelled" : "timeout";
+            break;
+        }
+        SleepConditionVariableSRW(&c->readable, &c->lock, slice, 0);
+    }
+    if (!failure)
+    {
+        m = c->items[c->head];
+        c->head = (c->head + 1) % c->capacity;
+        c->count--;
+        c->received++;
+        WakeConditionVariable(&c->writable);
+    }
+    ReleaseSRWLockExclusive(&c->lock);
+
+    if (failure)
+    {
+        lua_pushnil(L);
+        lua_pushstring(L, failure);
+        return 2;
+    }
+    return decode_values(L, m);
+}
+
+// Queued messages stay readable; senders fail and waiting receivers wake
+static int l_channel_close(lua_State *L)
+{
+    channel *c = check_channel(L);
+    AcquireSRWLockExclusive(&c->lock);
+    c->closed = true;
+    WakeAllConditionVariable(&c->readable);
+    WakeAllConditionVariable(&c->writable);
+    ReleaseSRWLockExclusive(&c->lock);
+    return 0;
+}
+
+static int l_channel_count(lua_State *L)
+{
+    channel *c = check_channel(L);
+    AcquireSRWLockShared(&c->lock);
+    uint32_t count = c->count;
+    ReleaseSRWLockShared(&c->lock);
+    lua_pushnumber(L, count);
+    return 1;
+}
+
+static int l_channel_stats(lua_State *L)
+{
+    channel *c = check_channel(L);
+    AcquireSRWLockShared(&c->lock);
+    lua_createtable(L, 0, 5);
+    lua_pushnumber(L, c->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, c->capacity);
+    lua_setfield(L, -2, "capacity");
+    lua_pushnumber(L, c->sent);
+    lua_setfield(L, -2, "sent");
+    lua_pushnumber(L, c->received);
+    lua_setfield(L, -2, "received");
+    lua_pushboolean(L, c->closed);
+    lua_setfield(L, -2, "closed");
+    ReleaseSRWLockShared(&c->lock);
+    return 1;
+}
+
+//============================================================================
+// BUFFERS
+//============================================================================
+
+// workers.buffer(size) -> buffer of zeroed bytes shared by every holder
+static int l_workers_buffer(lua_State *L)
+{
+    lua_Number size = luaL_checknumber(L, 1);
+    luaL_argcheck(L, size >= 1 && size <= 0x40000000, 1, "size out of range");
+
+    buffer *b = buffer_new((uint32_t)size);
+    if (!b)
+    {
+        return luaL_error(L, "out of memory");
+    }
+    push_shared(L, &b->header);
+    return 1;
+}
+
+// buf:ptr() -> light userdata for ffi.cast; valid while any holder keeps buf
+static int l_buffer_ptr(lua_State *L)
+{
+    lua_pushlightuserdata(L, check_buffer(L)->data);
+    return 1;
+}
+
+static int l_buffer_address(lua_State *L)
+{
+    lua_pushnumber(L, (uint32_t)(uintptr_t)check_buffer(L)->data);
+    return 1;
+}
+
+static int l_buffer_size(lua_State *L)
+{
+    lua_pushnumber(L, check_buffer(L)->size);
+    return 1;
+}
+
+//============================================================================
+// WORKER THREADS
+//============================================================================
+
+static void worker_release(worker *w)
+{
+    if (InterlockedDecrement(&w->refs) != 0)
+    {
+        return;
+    }
+    if (w->thread)
+    {
+        CloseHandle(w->thread);
+    }
+    message_free(w->args);
+    message_free(w->results);
+    free(w->source);
+    free(w->error);
+    free(w);
+}
+
+static void cancel_hook(lua_State *L, lua_Debug *ar)
+{
+    (void)ar;
+    luaL_error(L, "worker cancelled");
+}
+
+static int l_console_only(lua_State *L)
+{
+    return luaL_error(L, "%s is only available in the console's Lua state", lua_tostring(L, lua_upvalueindex(1)));
+}
+
+// __index of a console-only module: every field is a function that raises
+static int l_console_only_index(lua_State *L)
+{
+    lua_pushfstring(L, "%s.%s", lua_tostring(L, lua_upvalueindex(1)), luaL_optstring(L, 2, "?"));
+    lua_pushcclosure(L, l_console_only, 1);
+    return 1;
+}
+
+// sleep(ms) for workers; returns early with false once cancelled
+static int l_worker_sleep(lua_State *L)
+{
+    DWORD deadline = GetTickCount() + (DWORD)luaL_optnumber(L, 1, 0);
+    DWORD slice;
+    while ((slice = wait_slice(deadline, false)) != 0)
+    {
+        if (cancelled(L))
+        {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+        Sleep(slice);
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+static void open_worker_libs(lua_State *L, worker *w)
+{
+    luaL_openlibs(L);
+    luaopen_dispatch(L);
+    lua_pop(L, 1);
+    luaopen_scan(L);
+    lua_pop(L, 1);
+    luaopen_snapshot(L);
+    lua_pop(L, 1);
+    luaopen_memview(L);
+    lua_pop(L, 1);
+    luaopen_regions(L);
+    lua_pop(L, 1);
+    luaopen_ringlog(L);
+    lua_pop(L, 1);
+    luaopen_latency(L);
+    lua_pop(L, 1);
+    luaopen_logging(L);
+    lua_pop(L, 1);
+    luaopen_trace(L);
+    lua_pop(L, 1);
+    luaopen_output(L);
+    lua_pop(L, 1);
+    luaopen_regfile(L);
+    lua_pop(L, 1);
+    luaopen_ghidra(L);
+    lua_pop(L, 1);
+    luaopen_symbols(L);
+    lua_pop(L, 1);
+    luaopen_walker(L);
+    lua_pop(L, 1);
+    luaopen_workers(L);
+    lua_pushnumber(L, w->id);
+    lua_setfield(L, -2, "id");
+    lua_pop(L, 1);
+
+    for (int i = 0; g_consoleOnly[i]; i++)
+    {
+        lua_newtable(L);
+        lua_createtable(L, 0, 1);
+        lua_pushstring(L, g_consoleOnly[i]);
+        lua_pushcclosure(L, l_console_only_index, 1);
+        lua_setfield(L, -2, "__index");
+        lua_setmetatable(L, -2);
+        lua_setglobal(L, g_consoleOnly[i]);
+    }
+    lua_register(L, "sleep", l_worker_sleep);
+
+    lua_pushlightuserdata(L, w);
+    lua_setfield(L, LUA_REGISTRYINDEX, WORKER_SELF);
+}
+
+// Protected body of a worker: bindings, init.lua, then the script, whose
+// results are kept for join
+static int worker_body(lua_State *L)
+{
+    worker *w = (worker *)lua_touserdata(L, 1);
+    open_worker_libs(L, w);
+
+    if (luaL_loadfile(L, WORKERS_INIT_SCRIPT) != 0)
+    {
+        return lua_error(L);
+    }
+    lua_call(L, 0, 0);
+
+    int status = w->source[0] == '@' ? luaL_loadfile(L, w->source + 1)
+                                     : luaL_loadbuffer(L, w->source, w->source_length, w->name);
+    if (status != 0)
+    {
+        return lua_error(L);
+    }
+
+    int      func = lua_gettop(L);
+    message *args = w->args;
+    w->args = NULL;
+    decode_values(L, args);
+    lua_call(L, lua_gettop(L) - func, LUA_MULTRET);
+    w->results = encode_values(L, func, lua_gettop(L) - func + 1);
+    return 0;
+}
+
+static DWORD WINAPI worker_main(LPVOID param)
+{
+    worker    *w = (worker *)param;
+    lua_State *L = luaL_newstate();
+    bool       ok = false;
+
+    if (L)
+    {
+        AcquireSRWLockExclusive(&g_lock);
+        w->L = L;
+        if (w->cancel)
+        {
+            lua_sethook(L, cancel_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+        }
+        ReleaseSRWLockExclusive(&g_lock);
+        InterlockedExchange(&w->state, WORKER_RUNNING);
+
+        ok = lua_cpcall(L, worker_body, w) == 0;
+        if (!ok)
+        {
+            const char *error = lua_tostring(L, -1);
+            w->error = _strdup(error ? error : "(unknown error)");
+        }
+
+        // Finalizers run by lua_close must not trip the cancel hook
+        AcquireSRWLockExclusive(&g_lock);
+        w->L = NULL;
+        ReleaseSRWLockExclusive(&g_lock);
+        lua_sethook(L, NULL, 0, 0);
+        // Main-thread calls still queued point into this state's strings
+        dispatch_settle(L);
+        lua_close(L);
+    }
+    else
+    {
+        w->error = _strdup("could not create a Lua state");
+    }
+
+    w->stop_tick = qpc_now();
+    InterlockedExchange(&w->state, ok ? WORKER_DONE : w->cancel ? WORKER_CANCELLED : WORKER_FAILED);
+    if (!ok && !w->cancel)
+    {
+        output_printf("[worker %u] %s\n", (unsigned)w->id, w->error ? w->error : "failed");
+    }
+
+    AcquireSRWLockExclusive(&g_lock);
+    for (int i = 0; i < g_runningCount; i++)
+    {
+        if (g_running[i] == w)
+        {
+            g_running[i] = g_running[--g_runningCount];
+            break;
+        }
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    worker_release(w);
+    return 0;
+}
+
+// Callers hold g_lock, so the state cannot close underneath lua_sethook,
+// which may be called from another thread; compiled traces stop at their
+// next exit to the interpreter
+static void cancel_locked(worker *w)
+{
+    InterlockedExchange(&w->cancel, 1);
+    if (w->L)
+    {
+        lua_sethook(w->L, cancel_hook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+    }
+}
+
+//============================================================================
+// LUA API
+//============================================================================
+
+static worker *check_worker(lua_State *L)
+{
+    return ((worker_box *)luaL_checkudata(L, 1, WORKER_MT))->w;
+}
+
+// workers.spawn(script, ...) -> worker | nil, err
+// script is Lua source, or "@path" for a file; the extra arguments become
+// the script's "..."
+static int l_workers_spawn(lua_State *L)
+{
+    size_t      length;
+    const char *source = luaL_checklstring(L, 1, &length);
+    luaL_argcheck(L, length > 0, 1, "empty script");
+
+    message *args = encode_values(L, 2, lua_gettop(L) - 1);
+    worker  *w = calloc(1, sizeof(worker));
+    char    *copy = malloc(length + 1);
+    if (!w || !copy)
+    {
+        free(w);
+        free(copy);
+        message_free(args);
+        return luaL_error(L, "out of memory");
+    }
+    memcpy(copy, source, length + 1);
+
+    w->refs = 2; /* The handle and the thread */
+    w->id = (uint32_t)InterlockedIncrement(&g_nextId);
+    w->source = copy;
+    w->source_length = length;
+    w->args = args;
+    w->state = WORKER_STARTING;
+    w->start_tick = qpc_now();
+    if (source[0] == '@')
+    {
+        snprintf(w->name, sizeof(w->name), "%s", source);
+    }
+    else
+    {
+        snprintf(w->name, sizeof(w->name), "=worker %u", (unsigned)w->id);
+    }
+
+    worker_box *box = (worker_box *)lua_newuserdata(L, sizeof(worker_box));
+    box->w = NULL;
+    luaL_getmetatable(L, WORKER_MT);
+    lua_setmetatable(L, -2);
+
+    AcquireSRWLockExclusive(&g_lock);
+    if (g_runningCount == WORKERS_MAX)
+    {
+        ReleaseSRWLockExclusive(&g_lock);
+        w->refs = 1;
+        worker_release(w);
+        lua_pushnil(L);
+        lua_pushfstring(L, "at most %d workers can run at once", WORKERS_MAX);
+        return 2;
+    }
+    g_running[g_runningCount++] = w;
+    box->w = w;
+
+    // Suspended until published, so the thread never runs ahead of g_running
+    w->thread = CreateThread(NULL, 0, worker_main, w, CREATE_SUSPENDED, NULL);
+    if (!w->thread)
+    {
+        g_running[--g_runningCount] = NULL;
+        ReleaseSRWLockExclusive(&g_lock);
+        box->w = NULL;
+        w->refs = 1;
+        worker_release(w);
+        lua_pushnil(L);
+        lua_pushstring(L, "could not create the worker thread");
+        return 2;
+    }
+    ReleaseSRWLockExclusive(&g_lock);
+    SetThreadPriority(w->thread, THREAD_PRIORITY_BELOW_NORMAL);
+    ResumeThread(w->thread);
+    return 1;
+}
+
+// w:join([timeout_ms]) -> true, results... | false, err | nil, "timeout"
+static int l_worker_join(lua_State *L)
+{
+    worker *w = check_worker(L);
+    DWORD   deadline;
+    bool    forever;
+    read_timeout(L, 2, &deadline, &forever);
+
+    for (;;)
+    {
+        DWORD slice = wait_slice(deadline, forever);
+        if (WaitForSingleObject(w->thread, slice) == WAIT_OBJECT_0)
+        {
+            break;
+        }
+        if (!wait_slice(deadline, forever) || cancelled(L))
+        {
+            lua_pushnil(L);
+            lua_pushstring(L, cancelled(L) ? "cancelled" : "timeout");
+            return 2;
+        }
+    }
+
+    if (w->state != WORKER_DONE)
+    {
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, w->error ? w->error : g_stateNames[w->state]);
+        return 2;
+    }
+
+    lua_pushboolean(L, 1);
+    if (!w->results)
+    {
+        return 1;
+    }
+    message *results = w->results;
+    w->results = NULL;
+    return 1 + decode_values(L, results);
+}
+
+static int l_worker_cancel(lua_State *L)
+{
+    worker *w = check_worker(L);
+    bool    running = w->state == WORKER_STARTING || w->state == WORKER_RUNNING;
+    if (running)
+    {
+        AcquireSRWLockShared(&g_lock);
+        cancel_locked(w);
+        ReleaseSRWLockShared(&g_lock);
+    }
+    lua_pushboolean(L, running);
+    return 1;
+}
+
+static int l_worker_status(lua_State *L)
+{
+    lua_pushstring(L, g_stateNames[check_worker(L)->state]);
+    return 1;
+}
+
+static int l_worker_id(lua_State *L)
+{
+    lua_pushnumber(L, check_worker(L)->id);
+    return 1;
+}
+
+static void push_worker_info(lua_State *L, const worker *w)
+{
+    int64_t stop = w->state >= WORKER_DONE ? w->stop_tick : qpc_now();
+    lua_createtable(L, 0, 4);
+    lua_pushnumber(L, w->id);
+    lua_setfield(L, -2, "id");
+    lua_pushstring(L, g_stateNames[w->state]);
+    lua_setfield(L, -2, "status");
+    lua_pushstring(L, w->name[0] == '=' || w->name[0] == '@' ? w->name + 1 : w->name);
+    lua_setfield(L, -2, "name");
+    lua_pushnumber(L, (double)(stop - w->start_tick) * 1000.0 / (double)g_qpcFrequency);
+    lua_setfield(L, -2, "ms");
+}
+
+static int l_worker_info(lua_State *L)
+{
+    push_worker_info(L, check_worker(L));
+    return 1;
+}
+
+static int l_worker_gc(lua_State *L)
+{
+    worker_box *box = (worker_box *)lua_touserdata(L, 1);
+    if (box->w)
+    {
+        worker_release(box->w);
+        box->w = NULL;
+    }
+    return 0;
+}
+
+// workers.list() -> info of every running worker
+static int l_workers_list(lua_State *L)
+{
+    lua_newtable(L);
+    AcquireSRWLockShared(&g_lock);
+    for (int i = 0; i < g_runningCount; i++)
+    {
+        push_worker_info(L, g_running[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    ReleaseSRWLockShared(&g_lock);
+    return 1;
+}
+
+static int l_workers_cores(lua_State *L)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    lua_pushnumber(L, info.dwNumberOfProcessors);
+    return 1;
+}
+
+//============================================================================
+// LIFECYCLE
+//============================================================================
+
+// Cancels every worker and waits for them before the console goes away.
+// False if one is still running: a loop compiled into a trace never runs
+// the cancel hook, and the module must then stay loaded under it.
+bool workers_shutdown(void)
+{
+    HANDLE threads[WORKERS_MAX];
+    int    count = 0;
+
+    AcquireSRWLockShared(&g_lock);
+    for (int i = 0; i < g_runningCount; i++)
+    {
+        cancel_locked(g_running[i]);
+        if (DuplicateHandle(GetCurrentProcess(), g_running[i]->thread, GetCurrentProcess(), &threads[count], SYNCHRONIZE,
+                            FALSE, 0))
+        {
+            count++;
+        }
+    }
+    ReleaseSRWLockShared(&g_lock);
+
+    bool stopped = true;
+    if (count && WaitForMultipleObjects(count, threads, TRUE, WORKERS_SHUTDOWN_MS) == WAIT_TIMEOUT)
+    {
+        logf("[WORKERS] Workers still running at shutdown");
+        stopped = false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        CloseHandle(threads[i]);
+    }
+    return stopped;
+}
+
+static const luaL_Reg worker_methods[] = {{"join", l_worker_join},   {"cancel", l_worker_cancel},
+                                          {"status", l_worker_status}, {"id", l_worker_id},
+                                          {"info", l_worker_info},   {NULL, NULL}};
+
+static const luaL_Reg channel_methods[] = {{"send", l_channel_send},   {"recv", l_channel_recv},
+                                           {"close", l_channel_close}, {"count", l_channel_count},
+                                           {"stats", l_channel_stats}, {NULL, NULL}};
+
+static const luaL_Reg buffer_methods[] = {
+    {"ptr", l_buffer_ptr}, {"address", l_buffer_address}, {"size", l_buffer_size}, {NULL, NULL}};
+
+static const luaL_Reg workers_funcs[] = {{"spawn", l_workers_spawn},   {"channel", l_workers_channel},
+                                         {"buffer", l_workers_buffer}, {"list", l_workers_list},
+                                         {"cores", l_workers_cores},   {NULL, NULL}};
+
+static void new_metatable(lua_State *L, const char *name, const luaL_Reg *methods, lua_CFunction gc)
+{
+    luaL_newmetatable(L, name);
+    lua_newtable(L);
+    luaL_register(L, NULL, methods);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+}
+
+int luaopen_workers(lua_State *L)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    g_qpcFrequency = frequency.QuadPart;
+
+    new_metatable(L, WORKER_MT, worker_methods, l_worker_gc);
+    new_metatable(L, CHANNEL_MT, channel_methods, l_shared_gc);
+    new_metatable(L, BUFFER_MT, buffer_methods, l_shared_gc);
+
+    luaL_register(L, "workers", workers_funcs);
+    lua_pushnumber(L, 0);
+    lua_setfield(L, -2, "id");
+    return 1;
+}
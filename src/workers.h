@@ -0,0 +1,17 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+
+#include "lua.h"
+
+#define WORKERS_MAX 64                /* Workers running at once */
+#define WORKERS_CHANNEL_CAPACITY 1024 /* Default messages a channel holds */
+#define WORKERS_MAX_DEPTH 32          /* Table nesting in one message */
+#define WORKERS_WAIT_SLICE_MS 50      /* Blocking waits check for cancellation this often */
+#define WORKERS_SHUTDOWN_MS 2000
+
+bool workers_shutdown(void);
+int  luaopen_workers(lua_State *L);
+
+#endif // WORKERS_H
@@ -0,0 +1,353 @@
+/*
+ * traceconv.c: Converts binary trace files (see src/traceformat.h) to text
+ * or Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ *   traceconv [-json] trace.bin [output]
+ *
+ * Output goes to stdout unless a file is given. Builds with any C99
+ * compiler for the host; it does not depend on Windows or Lua.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "traceformat.h"
+
+#define MAX_NAMES 65536
+
+typedef struct
+{
+    const trace_file_header *header;
+    char                    *names[MAX_NAMES];
+    FILE                    *out;
+    bool                     json;
+    bool                     first;
+} converter;
+
+static const char *kind_name(uint8_t kind)
+{
+    switch (kind)
+    {
+    case TRACE_MESSAGE:
+        return "log";
+    case TRACE_CALL:
+        return "call";
+    case TRACE_BEGIN:
+        return "begin";
+    case TRACE_END:
+        return "end";
+    case TRACE_INSTANT:
+        return "instant";
+    case TRACE_COUNTER:
+        return "counter";
+    case TRACE_READ:
+        return "read";
+    case TRACE_WRITE:
+        return "write";
+    default:
+        return "unknown";
+    }
+}
+
+static int decode_values(const uint8_t *payload, uint32_t length, int64_t *values)
+{
+    int      count = 0;
+    uint32_t offset = 0;
+    while (offset < length && count < TRACE_VALUES_MAX)
+    {
+        uint64_t raw;
+        uint32_t used = trace_get_varint(payload + offset, length - offset, &raw);
+        if (!used)
+        {
+            break;
+        }
+        values[count++] = trace_unzigzag(raw);
+        offset += used;
+    }
+    return count;
+}
+
+// Microseconds since the trace's clock base
+static double tick_us(const converter *conv, uint64_t tick)
+{
+    int64_t delta = (int64_t)(tick - conv->header->qpc_base);
+    return (double)delta * 1e6 / (double)conv->header->qpc_frequency;
+}
+
+static void format_time(const converter *conv, uint64_t tick, char *out, size_t size)
+{
+    int64_t  delta = (int64_t)(tick - conv->header->qpc_base);
+    int64_t  frequency = conv->header->qpc_frequency;
+    int64_t  units = (delta / frequency) * 10000000 + (delta % frequency) * 10000000 / frequency;
+    uint64_t filetime = conv->header->filetime_base + (uint64_t)units;
+
+    // The base is already local time, so treat it as UTC when splitting
+    time_t     seconds = (time_t)(filetime / 10000000u - 11644473600ull);
+    struct tm *parts = gmtime(&seconds);
+    size_t     length = parts ? strftime(out, size, "%Y-%m-%d %H:%M:%S", parts) : 0;
+    snprintf(out + length, size - length, ".%03u", (unsigned)((filetime / 10000u) % 1000u));
+}
+
+static void json_string(FILE *out, const char *text, uint32_t length)
+{
+    fputc('"', out);
+    for (uint32_t i = 0; i < length; i++)
+    {
+        unsigned char c = (unsigned char)text[i];
+        if (c == '"' || c == '\\')
+        {
+            fprintf(out, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(out, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void json_values(FILE *out, const int64_t *values, int count)
+{
+    fputc('[', out);
+    for (int i = 0; i < count; i++)
+    {
+        fprintf(out, "%s%" PRId64, i ? "," : "", values[i]);
+    }
+    fputc(']', out);
+}
+
+static void write_json(converter *conv, const trace_event *event, const uint8_t *payload)
+{
+    FILE       *out = conv->out;
+    const char *name = conv->names[event->name] ? conv->names[event->name] : kind_name(event->kind);
+    int64_t     values[TRACE_VALUES_MAX];
+    int         count = event->kind == TRACE_MESSAGE ? 0 : decode_values(payload, event->length, values);
+    double      ts = tick_us(conv, event->tick);
+
+    fprintf(out, "%s\n{\"name\":", conv->first ? "" : ",");
+    conv->first = false;
+    json_string(out, name, (uint32_t)strlen(name));
+    fprintf(out, ",\"cat\":\"%s\",\"pid\":1,\"tid\":%" PRIu32, kind_name(event->kind), event->thread);
+
+    switch (event->kind)
+    {
+    case TRACE_MESSAGE:
+        fprintf(out, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"args\":{\"text\":", ts);
+        json_string(out, (const char *)payload, event->length);
+        fputc('}', out);
+        break;
+    case TRACE_CALL: {
+        int64_t duration = count > 0 ? values[0] : 0;
+        int64_t flags = count > 1 ? values[1] : 0;
+        fprintf(out, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%" PRId64 ",\"args\":{\"ok\":%s,\"main\":%s", ts - duration,
+                duration, (flags & TRACE_FLAG_OK) ? "true" : "false", (flags & TRACE_FLAG_MAIN) ? "true" : "false");
+        if (count > 2)
+        {
+            fprintf(out, ",\"result\":%" PRId64 ",\"args\":", values[2]);
+            json_values(out, values + 3, count - 3);
+        }
+        fputc('}', out);
+        break;
+    }
+    case TRACE_COUNTER:
+        fprintf(out, ",\"ph\":\"C\",\"ts\":%.3f,\"args\":{\"value\":%" PRId64 "}", ts, count ? values[0] : 0);
+        break;
+    case TRACE_READ:
+    case TRACE_WRITE:
+        fprintf(out,
+                ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"args\":{\"address\":\"0x%08" PRIX64 "\",\"size\":%" PRId64
+                ",\"ok\":%s}",
+                ts, count > 0 ? (uint64_t)values[0] : 0, count > 1 ? values[1] : 0,
+                count > 2 && (values[2] & TRACE_FLAG_OK) ? "true" : "false");
+        break;
+    default:
+        fprintf(out, ",\"ph\":\"%s\",\"ts\":%.3f",
+                event->kind == TRACE_BEGIN ? "B" : event->kind == TRACE_END ? "E" : "i", ts);
+        if (event->kind == TRACE_INSTANT)
+        {
+            fputs(",\"s\":\"t\"", out);
+        }
+        fputs(",\"args\":{\"values\":", out);
+        json_values(out, values, count);
+        fputc('}', out);
+        break;
+    }
+    fputc('}', out);
+}
+
+static void write_text(converter *conv, const trace_event *event, const uint8_t *payload)
+{
+    FILE       *out = conv->out;
+    const char *name = conv->names[event->name] ? conv->names[event->name] : "";
+    int64_t     values[TRACE_VALUES_MAX];
+    char        stamp[48];
+
+    format_time(conv, event->tick, stamp, sizeof(stamp));
+    fprintf(out, "[%s] %5" PRIu32 " %-7s ", stamp, event->thread, kind_name(event->kind));
+
+    if (event->kind == TRACE_MESSAGE)
+    {
+        fprintf(out, "%.*s\n", (int)event->length, (const char *)payload);
+        return;
+    }
+
+    int count = decode_values(payload, event->length, values);
+    switch (event->kind)
+    {
+    case TRACE_CALL:
+        fprintf(out, "%s %" PRId64 "us%s%s", name, count > 0 ? values[0] : 0,
+                count > 1 && (values[1] & TRACE_FLAG_OK) ? "" : " FAILED",
+                count > 1 && (values[1] & TRACE_FLAG_MAIN) ? " main" : "");
+        if (count > 2)
+        {
+            fprintf(out, " -> %" PRId64, values[2]);
+        }
+        for (int i = 3; i < count; i++)
+        {
+            fprintf(out, "%s%" PRId64, i == 3 ? " (" : ", ", values[i]);
+        }
+        fputs(count > 3 ? ")\n" : "\n", out);
+        break;
+    case TRACE_READ:
+    case TRACE_WRITE:
+        fprintf(out, "0x%08" PRIX64 " %" PRId64 " bytes%s\n", count > 0 ? (uint64_t)values[0] : 0,
+                count > 1 ? values[1] : 0, count > 2 && (values[2] & TRACE_FLAG_OK) ? "" : " FAILED");
+        break;
+    default:
+        fputs(name, out);
+        for (int i = 0; i < count; i++)
+        {
+            fprintf(out, " %" PRId64, values[i]);
+        }
+        fputc('\n', out);
+        break;
+    }
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = length > 0 ? malloc((size_t)length) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+int main(int argc, char **argv)
+{
+    static converter conv;
+    int              arg = 1;
+
+    if (arg < argc && strcmp(argv[arg], "-json") == 0)
+    {
+        conv.json = true;
+        arg++;
+    }
+    if (arg >= argc)
+    {
+        fprintf(stderr, "usage: %s [-json] trace.bin [output]\n", argv[0]);
+        return 2;
+    }
+
+    size_t   size;
+    uint8_t *data = read_file(argv[arg], &size);
+    if (!data || size < sizeof(trace_file_header))
+    {
+        fprintf(stderr, "%s: cannot read trace\n", argv[arg]);
+        return 1;
+    }
+
+    conv.header = (const trace_file_header *)data;
+    if (memcmp(conv.header->magic, TRACE_MAGIC, sizeof(conv.header->magic)) != 0 ||
+        conv.header->version != TRACE_VERSION || conv.header->event_size != sizeof(trace_event) ||
+        conv.header->qpc_frequency <= 0)
+    {
+        fprintf(stderr, "%s: not a version %d trace file\n", argv[arg], TRACE_VERSION);
+        return 1;
+    }
+
+    conv.out = stdout;
+    if (arg + 1 < argc && !(conv.out = fopen(argv[arg + 1], "w")))
+    {
+        fprintf(stderr, "%s: cannot create\n", argv[arg + 1]);
+        return 1;
+    }
+
+    if (conv.json)
+    {
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", conv.out);
+        conv.first = true;
+    }
+
+    size_t offset = sizeof(trace_file_header);
+    size_t events = 0;
+    while (offset + sizeof(trace_event) <= size)
+    {
+        trace_event event;
+        memcpy(&event, data + offset, sizeof(event));
+        const uint8_t *payload = data + offset + sizeof(event);
+        if (offset + sizeof(event) + event.length > size)
+        {
+            break; // Truncated by a crash mid-write
+        }
+        offset += sizeof(event) + event.length;
+
+        if (event.kind == TRACE_NAME)
+        {
+            free(conv.names[event.name]);
+            conv.names[event.name] = malloc((size_t)event.length + 1);
+            if (conv.names[event.name])
+            {
+                memcpy(conv.names[event.name], payload, event.length);
+                conv.names[event.name][event.length] = '\0';
+            }
+            continue;
+        }
+
+        if (conv.json)
+        {
+            write_json(&conv, &event, payload);
+        }
+        else
+        {
+            write_text(&conv, &event, payload);
+        }
+        events++;
+    }
+
+    if (conv.json)
+    {
+        fputs("\n]}\n", conv.out);
+    }
+    if (conv.out != stdout)
+    {
+        fclose(conv.out);
+    }
+
+    fprintf(stderr, "%zu events%s\n", events, offset < size ? ", trailing bytes ignored" : "");
+    free(data);
+    return 0;
+}